@@ -0,0 +1,228 @@
+#include "animation.h"
+#include "app.h"
+#include "memory.h"
+#include <math.h>
+
+// Clip of logAnimationBenchmark, keys at 30 Hz sampled at 60 Hz
+#define ANIMATION_BENCHMARK_KEYS 120
+#define ANIMATION_BENCHMARK_FRAMES 600
+
+void initAnimation(Animation *animation, int numChannels, int numKeys) {
+  *animation = (Animation){0};
+  animation->numChannels = numChannels;
+  animation->channels = MMALLOC_ARRAY_ZEROES(AnimationChannel, numChannels);
+  animation->numKeys = numKeys;
+  animation->keyTimes = MMALLOC_ARRAY(float, numKeys);
+  animation->keyValues = MMALLOC_ARRAY(Float4, numKeys);
+  animation->cursors = MMALLOC_ARRAY_ZEROES(int, numChannels);
+  animation->values = MMALLOC_ARRAY_ZEROES(Float4, numChannels);
+}
+
+void destroyAnimation(Animation *animation) {
+  MFREE(animation->values);
+  MFREE(animation->cursors);
+  MFREE(animation->keyValues);
+  MFREE(animation->keyTimes);
+  MFREE(animation->channels);
+  *animation = (Animation){0};
+}
+
+// Returns the key that starts the segment containing time. Starts from the
+// previous result and only rewinds when playback went backwards or looped.
+static int advanceAnimationCursor(const float *times, int numKeys, int cursor,
+                                  float time) {
+  if (cursor >= numKeys - 1 || times[cursor] > time) {
+    cursor = 0;
+  }
+  while (cursor + 2 < numKeys && times[cursor + 1] <= time) {
+    ++cursor;
+  }
+  return cursor;
+}
+
+void sampleAnimation(Animation *animation, float time) {
+  for (int first = 0; first < animation->numChannels; first += 4) {
+    int numLanes = MIN(animation->numChannels - first, 4);
+
+    // Gather the two keys around time for each lane, then evaluate the four
+    // channels together with one lane per channel
+    Float4 a[4] = {0};
+    Float4 b[4] = {0};
+    Float4 t = 0;
+    Float4 rotationMask = 0;
+    for (int lane = 0; lane < numLanes; ++lane) {
+      int channelIndex = first + lane;
+      const AnimationChannel *channel = &animation->channels[channelIndex];
+      const float *times = &animation->keyTimes[channel->keyOffset];
+      const Float4 *values = &animation->keyValues[channel->keyOffset];
+
+      int k0 = advanceAnimationCursor(times, channel->numKeys,
+                                      animation->cursors[channelIndex], time);
+      int k1 = MIN(k0 + 1, channel->numKeys - 1);
+      animation->cursors[channelIndex] = k0;
+
+      float span = times[k1] - times[k0];
+      float s = span > 0 ? (time - times[k0]) / span : 0;
+      s = fminf(fmaxf(s, 0), 1);
+      if (channel->interpolation == AnimationInterpolation_Step) {
+        s = s >= 1 ? 1 : 0;
+      }
+
+      a[lane] = values[k0];
+      b[lane] = values[k1];
+      t[lane] = s;
+      rotationMask[lane] = channel->path == AnimationPath_Rotation ? 1 : 0;
+    }
+
+    Float4 ax = {a[0].x, a[1].x, a[2].x, a[3].x};
+    Float4 ay = {a[0].y, a[1].y, a[2].y, a[3].y};
+    Float4 az = {a[0].z, a[1].z, a[2].z, a[3].z};
+    Float4 aw = {a[0].w, a[1].w, a[2].w, a[3].w};
+    Float4 bx = {b[0].x, b[1].x, b[2].x, b[3].x};
+    Float4 by = {b[0].y, b[1].y, b[2].y, b[3].y};
+    Float4 bz = {b[0].z, b[1].z, b[2].z, b[3].z};
+    Float4 bw = {b[0].w, b[1].w, b[2].w, b[3].w};
+
+    // Take the shortest arc between the two rotations
+    Float4 dot = ax * bx + ay * by + az * bz + aw * bw;
+    Float4 negative = -__builtin_convertvector(dot < 0, Float4);
+    Float4 sign = 1 - 2 * negative * rotationMask;
+
+    Float4 rx = ax + (bx * sign - ax) * t;
+    Float4 ry = ay + (by * sign - ay) * t;
+    Float4 rz = az + (bz * sign - az) * t;
+    Float4 rw = aw + (bw * sign - aw) * t;
+
+    // nlerp: renormalize the rotation lanes and leave the others untouched
+    Float4 lengthSq = rx * rx + ry * ry + rz * rz + rw * rw;
+    Float4 length = {
+        sqrtf(fmaxf(lengthSq.x, 1e-12f)),
+        sqrtf(fmaxf(lengthSq.y, 1e-12f)),
+        sqrtf(fmaxf(lengthSq.z, 1e-12f)),
+        sqrtf(fmaxf(lengthSq.w, 1e-12f)),
+    };
+    Float4 scale = rotationMask / length + (1 - rotationMask);
+    rx *= scale;
+    ry *= scale;
+    rz *= scale;
+    rw *= scale;
+
+    for (int lane = 0; lane < numLanes; ++lane) {
+      animation->values[first + lane] =
+          (Float4){rx[lane], ry[lane], rz[lane], rw[lane]};
+    }
+  }
+}
+
+// sampleAnimation one channel at a time, with a binary search for the keys
+static Float4 sampleAnimationChannel(const Animation *animation,
+                                     int channelIndex, float time) {
+  const AnimationChannel *channel = &animation->channels[channelIndex];
+  const float *times = &animation->keyTimes[channel->keyOffset];
+  const Float4 *values = &animation->keyValues[channel->keyOffset];
+
+  int low = 0;
+  int high = MAX(channel->numKeys - 2, 0);
+  while (low < high) {
+    int middle = (low + high + 1) / 2;
+    if (times[middle] <= time) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  int k0 = low;
+  int k1 = MIN(k0 + 1, channel->numKeys - 1);
+
+  float span = times[k1] - times[k0];
+  float s = span > 0 ? (time - times[k0]) / span : 0;
+  s = fminf(fmaxf(s, 0), 1);
+  if (channel->interpolation == AnimationInterpolation_Step) {
+    s = s >= 1 ? 1 : 0;
+  }
+
+  Float4 a = values[k0];
+  Float4 b = values[k1];
+  if (channel->path != AnimationPath_Rotation) {
+    return a + (b - a) * s;
+  }
+  if (float4Dot(a, b) < 0) {
+    b = -b;
+  }
+  Float4 result = a + (b - a) * s;
+  return result / sqrtf(fmaxf(float4Dot(result, result), 1e-12f));
+}
+
+static float nextBenchmarkRandom(uint32_t *state) {
+  *state = *state * 1664525u + 1013904223u;
+  return (float)(*state >> 8) / (float)(1u << 24) * 2.f - 1.f;
+}
+
+void logAnimationBenchmark(int numNodes) {
+  numNodes = MAX(numNodes, 1);
+  int numChannels = numNodes * AnimationPath_Count;
+  Animation animation;
+  initAnimation(&animation, numChannels,
+                numChannels * ANIMATION_BENCHMARK_KEYS);
+  animation.duration = (ANIMATION_BENCHMARK_KEYS - 1) / 30.f;
+
+  uint32_t state = 1;
+  for (int c = 0; c < numChannels; ++c) {
+    AnimationChannel *channel = &animation.channels[c];
+    *channel = (AnimationChannel){
+        .node = c / AnimationPath_Count,
+        .path = (AnimationPath)(c % AnimationPath_Count),
+        .interpolation = AnimationInterpolation_Linear,
+        .keyOffset = c * ANIMATION_BENCHMARK_KEYS,
+        .numKeys = ANIMATION_BENCHMARK_KEYS,
+    };
+    for (int k = 0; k < ANIMATION_BENCHMARK_KEYS; ++k) {
+      Float4 value;
+      for (int i = 0; i < 4; ++i) {
+        value[i] = nextBenchmarkRandom(&state);
+      }
+      if (channel->path == AnimationPath_Rotation) {
+        value /= sqrtf(fmaxf(float4Dot(value, value), 1e-12f));
+      }
+      animation.keyTimes[channel->keyOffset + k] = k / 30.f;
+      animation.keyValues[channel->keyOffset + k] = value;
+    }
+  }
+
+  // Playback loops, so the cursors also rewind
+  Float4 *reference = MMALLOC_ARRAY(Float4, numChannels);
+  double sampleTime = 0;
+  double referenceTime = 0;
+  float maxDifference = 0;
+  for (int frame = 0; frame < ANIMATION_BENCHMARK_FRAMES; ++frame) {
+    float time = fmodf(frame / 60.f, animation.duration);
+
+    double startTime = getTime();
+    sampleAnimation(&animation, time);
+    sampleTime += getTime() - startTime;
+
+    startTime = getTime();
+    for (int c = 0; c < numChannels; ++c) {
+      reference[c] = sampleAnimationChannel(&animation, c, time);
+    }
+    referenceTime += getTime() - startTime;
+
+    for (int c = 0; c < numChannels; ++c) {
+      Float4 difference = animation.values[c] - reference[c];
+      for (int i = 0; i < 4; ++i) {
+        maxDifference = fmaxf(maxDifference, fabsf(difference[i]));
+      }
+    }
+  }
+  MFREE(reference);
+  destroyAnimation(&animation);
+
+  LOG("Animation benchmark: %d nodes, %d channels of %d keys, %d frames",
+      numNodes, numChannels, ANIMATION_BENCHMARK_KEYS,
+      ANIMATION_BENCHMARK_FRAMES);
+  LOG("  sampleAnimation %.3f ms per frame, binary search per channel %.3f "
+      "ms, largest difference %g",
+      sampleTime * 1000.0 / ANIMATION_BENCHMARK_FRAMES,
+      referenceTime * 1000.0 / ANIMATION_BENCHMARK_FRAMES,
+      (double)maxDifference);
+}
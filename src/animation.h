@@ -0,0 +1,68 @@
+#pragma once
+#include "util.h"
+#include "vmath.h"
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+typedef enum _AnimationPath {
+  AnimationPath_Translation = 0,
+  AnimationPath_Rotation,
+  AnimationPath_Scale,
+
+  AnimationPath_Count
+} AnimationPath;
+
+typedef enum _AnimationInterpolation {
+  AnimationInterpolation_Step = 0,
+  AnimationInterpolation_Linear,
+
+  AnimationInterpolation_Count
+} AnimationInterpolation;
+
+typedef struct _AnimationChannel {
+  int node;
+  AnimationPath path;
+  AnimationInterpolation interpolation;
+  // Range in keyTimes/keyValues
+  int keyOffset;
+  int numKeys;
+} AnimationChannel;
+
+// Keys of every channel are packed back to back. Times and values live in
+// separate arrays so the cursor search only touches the times.
+typedef struct _Animation {
+  float duration;
+
+  int numChannels;
+  AnimationChannel *channels;
+
+  int numKeys;
+  float *keyTimes;
+  // Translation and scale only use xyz
+  Float4 *keyValues;
+
+  // Per channel key index of the last sample, so monotonic playback finds the
+  // next key in O(1) amortized
+  int *cursors;
+  // Per channel result of the last sampleAnimation call
+  Float4 *values;
+} Animation;
+
+// Allocates channels, keys, cursors and values. The caller fills channels and
+// keys.
+void initAnimation(Animation *animation, int numChannels, int numKeys);
+void destroyAnimation(Animation *animation);
+
+// Samples all channels at time (seconds, clamped to the key range of each
+// channel) into animation->values. Channels are evaluated four at a time.
+// Rotations are nlerped along the shortest arc.
+void sampleAnimation(Animation *animation, float time);
+
+// Samples a synthetic clip with translation, rotation and scale channels for
+// numNodes nodes over a few seconds of frames, and logs the time per frame of
+// sampleAnimation against a channel at a time binary search, and the largest
+// difference between the two
+void logAnimationBenchmark(int numNodes);
+
+C_INTERFACE_END
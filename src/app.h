@@ -18,6 +18,18 @@ typedef struct _App {
 #endif
 } App;
 
+typedef enum _AppEventType {
+  AppEventType_Resize = 0,
+  AppEventType_Quit,
+} AppEventType;
+
+// From the platform side of the app to the thread that runs update
+typedef struct _AppEvent {
+  AppEventType type;
+  int width;
+  int height;
+} AppEvent;
+
 typedef void (*OnInit)(void);
 typedef void (*OnUpdate)(float dt);
 typedef void (*OnCleanup)(void);
@@ -27,9 +39,19 @@ int runMain(int argc, char **argv, const char *title, int width, int height,
 
 App *getApp(void);
 
+// Seconds elapsed on a monotonic high resolution clock
+double getTime(void);
+
+#ifdef RENDERER_GL33
+// For GL entry points outside of the core loader, such as extensions
+void *getGLProcAddress(const char *name);
+#endif
+
 typedef enum _ResourceType {
   ResourceType_Common = 0,
   ResourceType_Shader,
+  // Files the app writes for later runs, like program binaries
+  ResourceType_Cache,
 
   ResourceType_Count
 } ResourceType;
@@ -38,3 +60,6 @@ String createResourcePath(ResourceType type, const char *relPath);
 
 void *readFileData(const String *path, bool nullTerminate, int *outFileSize);
 void destroyFileData(void *data);
+bool fileExists(const String *path);
+// Returns false when the file can't be written, caches can do without it
+bool writeFileData(const String *path, const void *data, int size);
@@ -0,0 +1,203 @@
+#include "../app.h"
+#include "../util.h"
+#include "../renderer.h"
+#include "../memory.h"
+#include "../thread.h"
+#include "../updatethread.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Runs a fixed number of frames with a fixed time step and no window, so runs
+// are repeatable. Pass --frames N to change how many. With the software
+// renderer, --capture <path> writes the last frame as a binary PPM.
+// --resize N switches between the full and a smaller size every N frames, like
+// a window being resized. Renderers that record snapshots run update on a
+// thread of its own.
+#define HEADLESS_DEFAULT_NUM_FRAMES 600
+#define HEADLESS_TIME_STEP (1 / 60.f)
+
+static App gApp;
+App *getApp(void) { return &gApp; }
+
+#ifdef RENDERER_SOFT
+static void writeCapture(const char *path) {
+  int width, height;
+  const uint8_t *pixels = getSoftFramebuffer(&width, &height);
+
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    LOG("Can't open %s for writing", path);
+    return;
+  }
+  fprintf(file, "P6\n%d %d\n255\n", width, height);
+  for (int i = 0; i < width * height; ++i) {
+    fwrite(&pixels[i * 4], 1, 3, file);
+  }
+  fclose(file);
+  LOG("Wrote %s", path);
+}
+#endif
+
+double getTime(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+int runMain(int argc, char **argv, const char *title, int width, int height,
+            OnInit init, OnUpdate update, OnCleanup cleanup) {
+  ASSERT(width > 0 && height > 0 && init && update && cleanup);
+  LOG("Hello headless!");
+
+  copyStringFromCStr(&gApp.title, title);
+  gApp.width = width;
+  gApp.height = height;
+
+  int numFrames = HEADLESS_DEFAULT_NUM_FRAMES;
+  int resizeFrames = 0;
+  UNUSED const char *capturePath = NULL;
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (strcmp(argv[i], "--frames") == 0) {
+      numFrames = MAX(atoi(argv[i + 1]), 1);
+    } else if (strcmp(argv[i], "--capture") == 0) {
+      capturePath = argv[i + 1];
+    } else if (strcmp(argv[i], "--resize") == 0) {
+      resizeFrames = MAX(atoi(argv[i + 1]), 0);
+    }
+  }
+
+  initRenderer();
+
+  if (init) {
+    init();
+  }
+
+  double startTime = getTime();
+#ifdef RENDERER_SNAPSHOTS
+  startUpdateThread(update, setRecordedSnapshot, numFrames,
+                    HEADLESS_TIME_STEP);
+  bool isFullSize = true;
+  for (int frame = 0; frame < numFrames; ++frame) {
+    // The next frame is updated while this one renders, so its resize has to
+    // be pushed before this one is picked up
+    int next = frame + 1;
+    if (resizeFrames > 0 && next < numFrames && next % resizeFrames == 0) {
+      isFullSize = !isFullSize;
+      AppEvent event = {
+          .type = AppEventType_Resize,
+          .width = isFullSize ? width : width * 3 / 4,
+          .height = isFullSize ? height : height * 3 / 4,
+      };
+      pushAppEvent(&event);
+    }
+    const UpdatedFrame *updated;
+    while (!(updated = acquireUpdatedFrame())) {
+      yieldThread();
+    }
+    setRenderedSnapshot(updated->slot);
+    render(updated->dt);
+  }
+  stopUpdateThread();
+#else
+  for (int frame = 0; frame < numFrames; ++frame) {
+    if (resizeFrames > 0 && frame > 0 && frame % resizeFrames == 0) {
+      bool isFullSize = gApp.width == width;
+      gApp.width = isFullSize ? width * 3 / 4 : width;
+      gApp.height = isFullSize ? height * 3 / 4 : height;
+    }
+    if (update) {
+      update(HEADLESS_TIME_STEP);
+    }
+    render(HEADLESS_TIME_STEP);
+  }
+#endif
+  double elapsed = getTime() - startTime;
+  LOG("%d frames in %.2f s, %.3f ms per frame", numFrames, elapsed,
+      elapsed * 1000.0 / numFrames);
+
+#ifdef RENDERER_SOFT
+  if (capturePath) {
+    writeCapture(capturePath);
+  }
+#endif
+
+  if (cleanup) {
+    cleanup();
+  }
+
+  destroyRenderer();
+
+  destroyString(&gApp.title);
+
+  return 0;
+}
+
+static const char *gResourceRootPaths[ResourceType_Count] = {
+    "../resources",
+    "../src/shaders/generated",
+    ".",
+};
+
+String createResourcePath(ResourceType type, const char *relPath) {
+  String path = {0};
+
+  static char tmp[4096];
+
+  ssize_t len = readlink("/proc/self/exe", tmp, sizeof(tmp) - 1);
+  ASSERT(len > 0);
+  tmp[len] = 0;
+  for (ssize_t i = len - 1; i >= 0; --i) {
+    if (tmp[i] == '/') {
+      tmp[i] = 0;
+      break;
+    }
+  }
+  copyStringFromCStr(&path, tmp);
+
+  appendPathCStr(&path, gResourceRootPaths[type]);
+  appendPathCStr(&path, relPath);
+
+  return path;
+}
+
+void *readFileData(const String *path, bool nullTerminate, int *outFileSize) {
+  FILE *file = fopen(path->buf, "rb");
+  ASSERT(file);
+  fseek(file, 0, SEEK_END);
+  long fileSize = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  uint8_t *data = MMALLOC_ARRAY(uint8_t, fileSize + (nullTerminate ? 1 : 0));
+
+  size_t bytesRead = fread(data, 1, fileSize, file);
+  ASSERT((long)bytesRead == fileSize);
+  if (nullTerminate) {
+    data[fileSize] = 0;
+  }
+
+  if (outFileSize) {
+    *outFileSize = (int)fileSize;
+  }
+
+  fclose(file);
+
+  return data;
+}
+
+void destroyFileData(void *data) { MFREE(data); }
+
+bool fileExists(const String *path) { return access(path->buf, F_OK) == 0; }
+
+bool writeFileData(const String *path, const void *data, int size) {
+  FILE *file = fopen(path->buf, "wb");
+  if (!file) {
+    return false;
+  }
+  size_t bytesWritten = fwrite(data, 1, size, file);
+  fclose(file);
+  return (int)bytesWritten == size;
+}
@@ -11,6 +11,15 @@
 static App gApp;
 App *getApp(void) { return &gApp; }
 
+double getTime(void) {
+  static mach_timebase_info_data_t timeBase;
+  if (timeBase.denom == 0) {
+    mach_timebase_info(&timeBase);
+  }
+  return (double)(mach_absolute_time() * timeBase.numer / timeBase.denom) *
+         1e-9;
+}
+
 @interface ViewDelegate : NSObject <MTKViewDelegate> {
   uint64_t lastTimeCounter;
   mach_timebase_info_data_t timeBase;
@@ -2,6 +2,8 @@
 #include "../util.h"
 #include "../renderer.h"
 #include "../memory.h"
+#include "../thread.h"
+#include "../updatethread.h"
 #include "../external/glad/wgl.h"
 #include <stdio.h>
 #include <stdint.h>
@@ -12,6 +14,16 @@
 static App gApp;
 App *getApp(void) { return &gApp; }
 
+double getTime(void) {
+  static LARGE_INTEGER freq;
+  if (freq.QuadPart == 0) {
+    QueryPerformanceFrequency(&freq);
+  }
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
 static LRESULT CALLBACK wndProc(HWND window, UINT msg, WPARAM wp, LPARAM lp);
 
 static struct Win32Internal {
@@ -40,6 +52,8 @@ static GLADapiproc loadGLProc(const char *name) {
   return (GLADapiproc)proc;
 }
 
+void *getGLProcAddress(const char *name) { return (void *)loadGLProc(name); }
+
 static void initGL(HWND window) {
   PIXELFORMATDESCRIPTOR dummyPFD = {
       .nSize = sizeof(PIXELFORMATDESCRIPTOR),
@@ -158,12 +172,6 @@ int runMain(UNUSED int argc, UNUSED char **argv, const char *title, int width,
   ShowWindow(window, SW_SHOW);
   UpdateWindow(window);
 
-  LARGE_INTEGER freq;
-  QueryPerformanceFrequency(&freq);
-  LARGE_INTEGER prevCounter;
-  QueryPerformanceCounter(&prevCounter);
-
-  float targetTimeStep = 1 / 60.f;
   MSG msg = {0};
 
 #ifdef RENDERER_GL33
@@ -174,6 +182,34 @@ int runMain(UNUSED int argc, UNUSED char **argv, const char *title, int width,
     init();
   }
 
+#ifdef RENDERER_SNAPSHOTS
+  // Update runs on a thread of its own and this one renders what it leaves
+  startUpdateThread(update, setRecordedSnapshot, 0, 0);
+  while (msg.message != WM_QUIT) {
+    if (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+      TranslateMessage(&msg);
+      DispatchMessage(&msg);
+      continue;
+    }
+
+    const UpdatedFrame *updated = acquireUpdatedFrame();
+    if (!updated) {
+      yieldThread();
+      continue;
+    }
+    SetWindowTextA(gApp.win32.window, updated->title.buf);
+    setRenderedSnapshot(updated->slot);
+    render(updated->dt);
+    SwapBuffers(dc);
+  }
+  stopUpdateThread();
+#else
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  LARGE_INTEGER prevCounter;
+  QueryPerformanceCounter(&prevCounter);
+
+  float targetTimeStep = 1 / 60.f;
   while (msg.message != WM_QUIT) {
 
     if (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
@@ -203,6 +239,7 @@ int runMain(UNUSED int argc, UNUSED char **argv, const char *title, int width,
 #endif
     }
   }
+#endif
 
   if (cleanup) {
     cleanup();
@@ -226,8 +263,18 @@ static LRESULT CALLBACK wndProc(HWND window, UINT msg, WPARAM wp, LPARAM lp) {
     EndPaint(window, &paintStruct);
   } break;
   case WM_SIZE: {
+#ifdef RENDERER_SNAPSHOTS
+    // The update thread owns the size
+    AppEvent event = {
+        .type = AppEventType_Resize,
+        .width = LOWORD(lp),
+        .height = HIWORD(lp),
+    };
+    pushAppEvent(&event);
+#else
     gApp.width = LOWORD(lp);
     gApp.height = HIWORD(lp);
+#endif
   } break;
   case WM_CLOSE:
     PostQuitMessage(0);
@@ -247,6 +294,7 @@ static const char *gResourceRootPaths[ResourceType_Count] = {
 #elif defined(RENDERER_DX11)
     "../src/shaders/generated/hlsl50",
 #endif
+    ".",
 };
 
 String createResourcePath(ResourceType type, const char *relPath) {
@@ -293,4 +341,20 @@ void *readFileData(const String *path, bool nullTerminate, int *outFileSize) {
   return data;
 }
 
-void destroyFileData(void *data) { MFREE(data); }
\ No newline at end of file
+void destroyFileData(void *data) { MFREE(data); }
+
+bool fileExists(const String *path) {
+  return GetFileAttributesA(path->buf) != INVALID_FILE_ATTRIBUTES;
+}
+
+bool writeFileData(const String *path, const void *data, int size) {
+  HANDLE file = CreateFileA(path->buf, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                            0, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  DWORD bytesWritten = 0;
+  BOOL result = WriteFile(file, data, (DWORD)size, &bytesWritten, NULL);
+  CloseHandle(file);
+  return result && (int)bytesWritten == size;
+}
\ No newline at end of file
@@ -0,0 +1,587 @@
+#include "bvh.h"
+#include "memory.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static Float4 minFloat4(Float4 a, Float4 b) {
+  return float4Select(a < b, a, b);
+}
+
+static Float4 maxFloat4(Float4 a, Float4 b) {
+  return float4Select(a > b, a, b);
+}
+
+static float halfArea(Float3 aabbMin, Float3 aabbMax) {
+  Float3 e = aabbMax - aabbMin;
+  return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+static void growBounds(Float3 *aabbMin, Float3 *aabbMax, Float3 otherMin,
+                       Float3 otherMax) {
+  for (int k = 0; k < 3; ++k) {
+    (*aabbMin)[k] = fminf((*aabbMin)[k], otherMin[k]);
+    (*aabbMax)[k] = fmaxf((*aabbMax)[k], otherMax[k]);
+  }
+}
+
+static void getItemRangeBounds(const Bvh *bvh, int begin, int end,
+                               Float3 *outMin, Float3 *outMax) {
+  *outMin = (Float3){INFINITY, INFINITY, INFINITY};
+  *outMax = (Float3){-INFINITY, -INFINITY, -INFINITY};
+  for (int i = begin; i < end; ++i) {
+    int item = bvh->items[i];
+    growBounds(outMin, outMax, bvh->itemMins[item], bvh->itemMaxs[item]);
+  }
+}
+
+static void setChildBounds(BvhNode *node, int child, Float3 aabbMin,
+                           Float3 aabbMax) {
+  node->minX[child] = aabbMin.x;
+  node->minY[child] = aabbMin.y;
+  node->minZ[child] = aabbMin.z;
+  node->maxX[child] = aabbMax.x;
+  node->maxY[child] = aabbMax.y;
+  node->maxZ[child] = aabbMax.z;
+}
+
+static float minLane(Float4 v) {
+  return fminf(fminf(v.x, v.y), fminf(v.z, v.w));
+}
+
+static float maxLane(Float4 v) {
+  return fmaxf(fmaxf(v.x, v.y), fmaxf(v.z, v.w));
+}
+
+static void getNodeBounds(const BvhNode *node, Float3 *outMin,
+                          Float3 *outMax) {
+  *outMin = (Float3){minLane(node->minX), minLane(node->minY),
+                     minLane(node->minZ)};
+  *outMax = (Float3){maxLane(node->maxX), maxLane(node->maxY),
+                     maxLane(node->maxZ)};
+}
+
+static Float3 getItemCentroid(const Bvh *bvh, int item) {
+  return (bvh->itemMins[item] + bvh->itemMaxs[item]) * 0.5f;
+}
+
+// Partitions items [begin, end) around their median centroid on axis
+static int splitItemRangeAtMedian(Bvh *bvh, int begin, int end, int axis) {
+  int mid = (begin + end) / 2;
+  int low = begin;
+  int high = end - 1;
+  while (low < high) {
+    float pivot = getItemCentroid(bvh, bvh->items[(low + high) / 2])[axis];
+    int i = low;
+    int j = high;
+    while (i <= j) {
+      while (getItemCentroid(bvh, bvh->items[i])[axis] < pivot) {
+        ++i;
+      }
+      while (getItemCentroid(bvh, bvh->items[j])[axis] > pivot) {
+        --j;
+      }
+      if (i <= j) {
+        int item = bvh->items[i];
+        bvh->items[i++] = bvh->items[j];
+        bvh->items[j--] = item;
+      }
+    }
+    if (mid <= j) {
+      high = j;
+    } else if (mid >= i) {
+      low = i;
+    } else {
+      break;
+    }
+  }
+  return mid;
+}
+
+// Partitions items [begin, end) and returns where the right side starts. The
+// SAH split is used unless median is set.
+static int splitItemRange(Bvh *bvh, int begin, int end, bool median) {
+  Float3 centroidMin = {INFINITY, INFINITY, INFINITY};
+  Float3 centroidMax = {-INFINITY, -INFINITY, -INFINITY};
+  for (int i = begin; i < end; ++i) {
+    Float3 c = getItemCentroid(bvh, bvh->items[i]);
+    growBounds(&centroidMin, &centroidMax, c, c);
+  }
+
+  Float3 extent = centroidMax - centroidMin;
+  int axis = 0;
+  if (extent.y > extent[axis]) {
+    axis = 1;
+  }
+  if (extent.z > extent[axis]) {
+    axis = 2;
+  }
+  if (!(extent[axis] > 0)) {
+    return (begin + end) / 2;
+  }
+  if (median) {
+    return splitItemRangeAtMedian(bvh, begin, end, axis);
+  }
+
+  int binCounts[BVH_SAH_BINS] = {0};
+  Float3 binMins[BVH_SAH_BINS];
+  Float3 binMaxs[BVH_SAH_BINS];
+  for (int b = 0; b < BVH_SAH_BINS; ++b) {
+    binMins[b] = (Float3){INFINITY, INFINITY, INFINITY};
+    binMaxs[b] = (Float3){-INFINITY, -INFINITY, -INFINITY};
+  }
+
+  float binScale = (float)BVH_SAH_BINS / extent[axis];
+  for (int i = begin; i < end; ++i) {
+    int item = bvh->items[i];
+    float c = getItemCentroid(bvh, item)[axis];
+    int b = MIN((int)((c - centroidMin[axis]) * binScale), BVH_SAH_BINS - 1);
+    ++binCounts[b];
+    growBounds(&binMins[b], &binMaxs[b], bvh->itemMins[item],
+               bvh->itemMaxs[item]);
+  }
+
+  // rightCosts[b] is the cost of bins [b, BVH_SAH_BINS)
+  float rightCosts[BVH_SAH_BINS];
+  Float3 sideMin = {INFINITY, INFINITY, INFINITY};
+  Float3 sideMax = {-INFINITY, -INFINITY, -INFINITY};
+  int sideCount = 0;
+  for (int b = BVH_SAH_BINS - 1; b > 0; --b) {
+    if (binCounts[b] > 0) {
+      growBounds(&sideMin, &sideMax, binMins[b], binMaxs[b]);
+      sideCount += binCounts[b];
+    }
+    rightCosts[b] = sideCount > 0 ? halfArea(sideMin, sideMax) * sideCount : 0;
+  }
+
+  int bestSplit = BVH_SAH_BINS / 2;
+  float bestCost = INFINITY;
+  sideMin = (Float3){INFINITY, INFINITY, INFINITY};
+  sideMax = (Float3){-INFINITY, -INFINITY, -INFINITY};
+  sideCount = 0;
+  for (int b = 1; b < BVH_SAH_BINS; ++b) {
+    if (binCounts[b - 1] > 0) {
+      growBounds(&sideMin, &sideMax, binMins[b - 1], binMaxs[b - 1]);
+      sideCount += binCounts[b - 1];
+    }
+    float leftCost = sideCount > 0 ? halfArea(sideMin, sideMax) * sideCount : 0;
+    if (leftCost + rightCosts[b] < bestCost) {
+      bestCost = leftCost + rightCosts[b];
+      bestSplit = b;
+    }
+  }
+
+  int mid = begin;
+  for (int i = begin; i < end; ++i) {
+    int item = bvh->items[i];
+    float c = getItemCentroid(bvh, item)[axis];
+    int b = MIN((int)((c - centroidMin[axis]) * binScale), BVH_SAH_BINS - 1);
+    if (b < bestSplit) {
+      bvh->items[i] = bvh->items[mid];
+      bvh->items[mid++] = item;
+    }
+  }
+  if (mid == begin || mid == end) {
+    mid = (begin + end) / 2;
+  }
+  return mid;
+}
+
+static void initBvhNode(BvhNode *node, int parent) {
+  Float4 inf = {INFINITY, INFINITY, INFINITY, INFINITY};
+  node->minX = inf;
+  node->minY = inf;
+  node->minZ = inf;
+  node->maxX = -inf;
+  node->maxY = -inf;
+  node->maxZ = -inf;
+  for (int i = 0; i < BVH_WIDTH; ++i) {
+    node->first[i] = -1;
+    node->numItems[i] = 0;
+  }
+  node->parent = parent;
+}
+
+// Splits the range in two until there are four children or every child fits
+// in a leaf, always splitting the largest child next. depth is 0 at the root.
+static int buildBvhNode(Bvh *bvh, int begin, int end, int parent,
+                        int depth) {
+  int nodeIndex = bvh->numNodes++;
+  initBvhNode(&bvh->nodes[nodeIndex], parent);
+  bvh->depth = MAX(bvh->depth, depth + 1);
+
+  int rangeBegins[BVH_WIDTH] = {begin};
+  int rangeEnds[BVH_WIDTH] = {end};
+  int numRanges = 1;
+  while (numRanges < BVH_WIDTH) {
+    int largest = -1;
+    for (int i = 0; i < numRanges; ++i) {
+      int count = rangeEnds[i] - rangeBegins[i];
+      if (count > BVH_MAX_LEAF_ITEMS &&
+          (largest < 0 ||
+           count > rangeEnds[largest] - rangeBegins[largest])) {
+        largest = i;
+      }
+    }
+    if (largest < 0) {
+      break;
+    }
+    int mid = splitItemRange(bvh, rangeBegins[largest], rangeEnds[largest],
+                             depth >= BVH_MAX_SAH_DEPTH);
+    rangeBegins[numRanges] = mid;
+    rangeEnds[numRanges] = rangeEnds[largest];
+    rangeEnds[largest] = mid;
+    ++numRanges;
+  }
+
+  for (int i = 0; i < numRanges; ++i) {
+    int count = rangeEnds[i] - rangeBegins[i];
+    if (count <= BVH_MAX_LEAF_ITEMS) {
+      bvh->nodes[nodeIndex].first[i] = rangeBegins[i];
+      bvh->nodes[nodeIndex].numItems[i] = count;
+      for (int j = rangeBegins[i]; j < rangeEnds[i]; ++j) {
+        bvh->itemNodes[bvh->items[j]] = nodeIndex;
+      }
+    } else {
+      bvh->nodes[nodeIndex].first[i] =
+          buildBvhNode(bvh, rangeBegins[i], rangeEnds[i], nodeIndex, depth + 1);
+    }
+
+    Float3 aabbMin, aabbMax;
+    getItemRangeBounds(bvh, rangeBegins[i], rangeEnds[i], &aabbMin, &aabbMax);
+    setChildBounds(&bvh->nodes[nodeIndex], i, aabbMin, aabbMax);
+  }
+
+  return nodeIndex;
+}
+
+void buildBvh(Bvh *bvh, const Float3 *aabbMins, const Float3 *aabbMaxs,
+              int numItems) {
+  *bvh = (Bvh){0};
+  if (numItems == 0) {
+    return;
+  }
+
+  bvh->numItems = numItems;
+  bvh->itemMins = MMALLOC_ARRAY(Float3, numItems);
+  bvh->itemMaxs = MMALLOC_ARRAY(Float3, numItems);
+  memcpy(bvh->itemMins, aabbMins, sizeof(Float3) * numItems);
+  memcpy(bvh->itemMaxs, aabbMaxs, sizeof(Float3) * numItems);
+  bvh->items = MMALLOC_ARRAY(int, numItems);
+  for (int i = 0; i < numItems; ++i) {
+    bvh->items[i] = i;
+  }
+  bvh->itemNodes = MMALLOC_ARRAY(int, numItems);
+
+  // Every inner node has at least two children and every leaf at least one
+  // item, so there are fewer nodes than items
+  bvh->nodes = MMALLOC_ARRAY(BvhNode, numItems);
+  buildBvhNode(bvh, 0, numItems, -1, 0);
+  // Every level leaves at most BVH_WIDTH - 1 siblings on the query stacks
+  ASSERT(bvh->depth * (BVH_WIDTH - 1) + 1 <= BVH_MAX_STACK_SIZE);
+
+  bvh->dirtyNodes = MMALLOC_ARRAY(int, bvh->numNodes);
+  bvh->isNodeDirty = MMALLOC_ARRAY_ZEROES(bool, bvh->numNodes);
+}
+
+void destroyBvh(Bvh *bvh) {
+  MFREE(bvh->isNodeDirty);
+  MFREE(bvh->dirtyNodes);
+  MFREE(bvh->nodes);
+  MFREE(bvh->itemNodes);
+  MFREE(bvh->items);
+  MFREE(bvh->itemMaxs);
+  MFREE(bvh->itemMins);
+  *bvh = (Bvh){0};
+}
+
+void updateBvhItem(Bvh *bvh, int item, Float3 aabbMin, Float3 aabbMax) {
+  ASSERT(item >= 0 && item < bvh->numItems);
+  bvh->itemMins[item] = aabbMin;
+  bvh->itemMaxs[item] = aabbMax;
+
+  for (int node = bvh->itemNodes[item]; node >= 0 && !bvh->isNodeDirty[node];
+       node = bvh->nodes[node].parent) {
+    bvh->isNodeDirty[node] = true;
+    bvh->dirtyNodes[bvh->numDirtyNodes++] = node;
+  }
+}
+
+static int compareNodesDescending(const void *a, const void *b) {
+  return *(const int *)b - *(const int *)a;
+}
+
+void refitBvh(Bvh *bvh) {
+  if (bvh->numDirtyNodes == 0) {
+    return;
+  }
+
+  // Children come after their parent, so going from the highest index down
+  // refits every child before the nodes that contain it
+  qsort(bvh->dirtyNodes, bvh->numDirtyNodes, sizeof(int),
+        compareNodesDescending);
+
+  for (int i = 0; i < bvh->numDirtyNodes; ++i) {
+    int nodeIndex = bvh->dirtyNodes[i];
+    BvhNode *node = &bvh->nodes[nodeIndex];
+    for (int child = 0; child < BVH_WIDTH; ++child) {
+      if (node->first[child] < 0) {
+        continue;
+      }
+      Float3 aabbMin, aabbMax;
+      if (node->numItems[child] > 0) {
+        getItemRangeBounds(bvh, node->first[child],
+                           node->first[child] + node->numItems[child],
+                           &aabbMin, &aabbMax);
+      } else {
+        getNodeBounds(&bvh->nodes[node->first[child]], &aabbMin, &aabbMax);
+      }
+      setChildBounds(node, child, aabbMin, aabbMax);
+    }
+    bvh->isNodeDirty[nodeIndex] = false;
+  }
+  bvh->numDirtyNodes = 0;
+}
+
+typedef enum _BvhQueryType {
+  BvhQueryType_Frustum = 0,
+  BvhQueryType_Sphere,
+  BvhQueryType_AABB,
+
+  BvhQueryType_Count
+} BvhQueryType;
+
+typedef struct _BvhQuery {
+  BvhQueryType type;
+  const Frustum *frustum;
+  Float3 center;
+  float radius;
+  Float3 aabbMin;
+  Float3 aabbMax;
+} BvhQuery;
+
+// Unused children have empty bounds and fail every test
+static Int4 overlapChildren(const BvhQuery *query, const BvhNode *node) {
+  Int4 mask = {-1, -1, -1, -1};
+  switch (query->type) {
+  case BvhQueryType_Frustum:
+    for (int i = 0; i < 6; ++i) {
+      Float4 plane = query->frustum->planes[i];
+      Float4 x = plane.x >= 0 ? node->maxX : node->minX;
+      Float4 y = plane.y >= 0 ? node->maxY : node->minY;
+      Float4 z = plane.z >= 0 ? node->maxZ : node->minZ;
+      mask &= x * plane.x + y * plane.y + z * plane.z + plane.w >= 0;
+    }
+    break;
+  case BvhQueryType_Sphere: {
+    Float4 zero = {0};
+    Float4 dx = maxFloat4(node->minX - query->center.x, zero) +
+                maxFloat4(query->center.x - node->maxX, zero);
+    Float4 dy = maxFloat4(node->minY - query->center.y, zero) +
+                maxFloat4(query->center.y - node->maxY, zero);
+    Float4 dz = maxFloat4(node->minZ - query->center.z, zero) +
+                maxFloat4(query->center.z - node->maxZ, zero);
+    mask = dx * dx + dy * dy + dz * dz <= query->radius * query->radius;
+    break;
+  }
+  default:
+    mask = (node->minX <= query->aabbMax.x) & (node->maxX >= query->aabbMin.x) &
+           (node->minY <= query->aabbMax.y) & (node->maxY >= query->aabbMin.y) &
+           (node->minZ <= query->aabbMax.z) & (node->maxZ >= query->aabbMin.z);
+    break;
+  }
+  return mask;
+}
+
+static bool overlapItem(const BvhQuery *query, Float3 aabbMin,
+                        Float3 aabbMax) {
+  switch (query->type) {
+  case BvhQueryType_Frustum:
+    return frustumIntersectsAABB(query->frustum, aabbMin, aabbMax);
+  case BvhQueryType_Sphere: {
+    float distanceSq = 0;
+    for (int k = 0; k < 3; ++k) {
+      float d = fmaxf(fmaxf(aabbMin[k] - query->center[k], 0),
+                      query->center[k] - aabbMax[k]);
+      distanceSq += d * d;
+    }
+    return distanceSq <= query->radius * query->radius;
+  }
+  default:
+    for (int k = 0; k < 3; ++k) {
+      if (aabbMin[k] > query->aabbMax[k] || aabbMax[k] < query->aabbMin[k]) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+static int queryBvh(const Bvh *bvh, const BvhQuery *query, int *outItems) {
+  if (bvh->numNodes == 0) {
+    return 0;
+  }
+
+  int numOutItems = 0;
+  int stack[BVH_MAX_STACK_SIZE];
+  int stackSize = 0;
+  stack[stackSize++] = 0;
+  while (stackSize > 0) {
+    const BvhNode *node = &bvh->nodes[stack[--stackSize]];
+    Int4 mask = overlapChildren(query, node);
+    for (int child = 0; child < BVH_WIDTH; ++child) {
+      if (!mask[child]) {
+        continue;
+      }
+      if (node->numItems[child] == 0) {
+        ASSERT(stackSize < BVH_MAX_STACK_SIZE);
+        stack[stackSize++] = node->first[child];
+        continue;
+      }
+      for (int i = node->first[child];
+           i < node->first[child] + node->numItems[child]; ++i) {
+        int item = bvh->items[i];
+        if (overlapItem(query, bvh->itemMins[item], bvh->itemMaxs[item])) {
+          outItems[numOutItems++] = item;
+        }
+      }
+    }
+  }
+  return numOutItems;
+}
+
+int queryBvhFrustum(const Bvh *bvh, const Frustum *frustum, int *outItems) {
+  BvhQuery query = {.type = BvhQueryType_Frustum, .frustum = frustum};
+  return queryBvh(bvh, &query, outItems);
+}
+
+int queryBvhSphere(const Bvh *bvh, Float3 center, float radius,
+                   int *outItems) {
+  BvhQuery query = {
+      .type = BvhQueryType_Sphere, .center = center, .radius = radius};
+  return queryBvh(bvh, &query, outItems);
+}
+
+int queryBvhAABB(const Bvh *bvh, Float3 aabbMin, Float3 aabbMax,
+                 int *outItems) {
+  BvhQuery query = {
+      .type = BvhQueryType_AABB, .aabbMin = aabbMin, .aabbMax = aabbMax};
+  return queryBvh(bvh, &query, outItems);
+}
+
+// Axes the ray doesn't move along get a huge inverse instead of infinity, so
+// slabs it starts on don't produce NaNs
+static Float3 getInverseDirection(Float3 direction) {
+  Float3 inverse;
+  for (int k = 0; k < 3; ++k) {
+    inverse[k] = direction[k] != 0 ? 1.f / direction[k] : FLT_MAX;
+  }
+  return inverse;
+}
+
+static float raycastAABB(Float3 origin, Float3 inverseDirection,
+                         Float3 aabbMin, Float3 aabbMax) {
+  float tNear = 0;
+  float tFar = INFINITY;
+  for (int k = 0; k < 3; ++k) {
+    float t0 = (aabbMin[k] - origin[k]) * inverseDirection[k];
+    float t1 = (aabbMax[k] - origin[k]) * inverseDirection[k];
+    tNear = fmaxf(tNear, fminf(t0, t1));
+    tFar = fminf(tFar, fmaxf(t0, t1));
+  }
+  return tNear <= tFar ? tNear : -1.f;
+}
+
+typedef struct _BvhRayStackEntry {
+  int node;
+  // -1 for the node itself, otherwise the leaf child of node
+  int child;
+  float distance;
+} BvhRayStackEntry;
+
+int raycastBvh(const Bvh *bvh, Float3 origin, Float3 direction,
+               float maxDistance, BvhRayItemFunc itemFunc, void *data,
+               float *outDistance) {
+  if (bvh->numNodes == 0) {
+    return -1;
+  }
+
+  Float3 inverseDirection = getInverseDirection(direction);
+  int nearestItem = -1;
+  float nearestDistance = maxDistance;
+
+  BvhRayStackEntry stack[BVH_MAX_STACK_SIZE];
+  int stackSize = 0;
+  stack[stackSize++] = (BvhRayStackEntry){0, -1, 0};
+  while (stackSize > 0) {
+    BvhRayStackEntry entry = stack[--stackSize];
+    if (entry.distance > nearestDistance) {
+      continue;
+    }
+    const BvhNode *node = &bvh->nodes[entry.node];
+
+    if (entry.child >= 0) {
+      for (int i = node->first[entry.child];
+           i < node->first[entry.child] + node->numItems[entry.child]; ++i) {
+        int item = bvh->items[i];
+        float distance =
+            itemFunc ? itemFunc(data, item, origin, direction)
+                     : raycastAABB(origin, inverseDirection,
+                                   bvh->itemMins[item], bvh->itemMaxs[item]);
+        if (distance >= 0 && distance < nearestDistance) {
+          nearestDistance = distance;
+          nearestItem = item;
+        }
+      }
+      continue;
+    }
+
+    Float4 t0 = (node->minX - origin.x) * inverseDirection.x;
+    Float4 t1 = (node->maxX - origin.x) * inverseDirection.x;
+    Float4 tNear = minFloat4(t0, t1);
+    Float4 tFar = maxFloat4(t0, t1);
+    t0 = (node->minY - origin.y) * inverseDirection.y;
+    t1 = (node->maxY - origin.y) * inverseDirection.y;
+    tNear = maxFloat4(tNear, minFloat4(t0, t1));
+    tFar = minFloat4(tFar, maxFloat4(t0, t1));
+    t0 = (node->minZ - origin.z) * inverseDirection.z;
+    t1 = (node->maxZ - origin.z) * inverseDirection.z;
+    tNear = maxFloat4(tNear, minFloat4(t0, t1));
+    tFar = minFloat4(tFar, maxFloat4(t0, t1));
+    Float4 zero = {0};
+    tNear = maxFloat4(tNear, zero);
+    tFar = minFloat4(tFar, zero + nearestDistance);
+    // Empty bounds would pass every slab, so unused children are masked out
+    Int4 hit = (tNear <= tFar) & (node->minX <= node->maxX);
+
+    // Push the farthest hit first so the nearest one is visited next
+    int order[BVH_WIDTH];
+    int numHits = 0;
+    for (int child = 0; child < BVH_WIDTH; ++child) {
+      if (!hit[child]) {
+        continue;
+      }
+      int j = numHits++;
+      while (j > 0 && tNear[order[j - 1]] < tNear[child]) {
+        order[j] = order[j - 1];
+        --j;
+      }
+      order[j] = child;
+    }
+    for (int i = 0; i < numHits; ++i) {
+      int child = order[i];
+      ASSERT(stackSize < BVH_MAX_STACK_SIZE);
+      stack[stackSize++] = (BvhRayStackEntry){
+          .node = node->numItems[child] > 0 ? entry.node : node->first[child],
+          .child = node->numItems[child] > 0 ? child : -1,
+          .distance = tNear[child],
+      };
+    }
+  }
+
+  if (nearestItem >= 0 && outDistance) {
+    *outDistance = nearestDistance;
+  }
+  return nearestItem;
+}
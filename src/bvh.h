@@ -0,0 +1,86 @@
+#pragma once
+#include "util.h"
+#include "vmath.h"
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+#define BVH_WIDTH 4
+#define BVH_MAX_LEAF_ITEMS 4
+#define BVH_SAH_BINS 12
+// From this depth on ranges are split at the object median, which halves
+// the largest child of every node. Trees stay under 32 + 31 levels for any int
+// item count, however lopsided the SAH splits above are, so the query stacks
+// never hold more than 63 * (BVH_WIDTH - 1) + 1 entries.
+#define BVH_MAX_SAH_DEPTH 32
+#define BVH_MAX_STACK_SIZE 256
+
+// Bounds of the four children are stored a component at a time, so one node
+// is tested against a frustum plane, box or ray with a handful of Float4 ops.
+// A child with numItems > 0 is a leaf holding Bvh.items[first, first +
+// numItems), one with first >= 0 and numItems == 0 is an inner node and
+// first == -1 marks an unused slot, whose bounds are empty.
+typedef struct _BvhNode {
+  Float4 minX;
+  Float4 minY;
+  Float4 minZ;
+  Float4 maxX;
+  Float4 maxY;
+  Float4 maxZ;
+  int32_t first[BVH_WIDTH];
+  int32_t numItems[BVH_WIDTH];
+  int parent;
+} BvhNode;
+
+// Bounding volume hierarchy over item AABBs. Items are identified by their
+// index in the arrays handed to buildBvh. Children are always stored after
+// their parent.
+typedef struct _Bvh {
+  int numItems;
+  Float3 *itemMins;
+  Float3 *itemMaxs;
+  // Item indices in leaf order
+  int *items;
+  // Node holding each item
+  int *itemNodes;
+
+  int numNodes;
+  BvhNode *nodes;
+  // Nodes on the longest path from the root
+  int depth;
+
+  // Nodes whose bounds are stale since the last refitBvh
+  int numDirtyNodes;
+  int *dirtyNodes;
+  bool *isNodeDirty;
+} Bvh;
+
+// Splits with the surface area heuristic over BVH_SAH_BINS centroid bins
+void buildBvh(Bvh *bvh, const Float3 *aabbMins, const Float3 *aabbMaxs,
+              int numItems);
+void destroyBvh(Bvh *bvh);
+
+// Changes the bounds of an item. The tree keeps its shape and only the nodes
+// above changed items are recomputed by the next refitBvh.
+void updateBvhItem(Bvh *bvh, int item, Float3 aabbMin, Float3 aabbMax);
+void refitBvh(Bvh *bvh);
+
+// The queries write the items they find to outItems, which needs room for
+// bvh->numItems entries, and return their count
+int queryBvhFrustum(const Bvh *bvh, const Frustum *frustum, int *outItems);
+int queryBvhSphere(const Bvh *bvh, Float3 center, float radius, int *outItems);
+int queryBvhAABB(const Bvh *bvh, Float3 aabbMin, Float3 aabbMax,
+                 int *outItems);
+
+// Returns the distance along direction to item, or a negative value on a miss
+typedef float (*BvhRayItemFunc)(void *data, int item, Float3 origin,
+                                Float3 direction);
+
+// Nearest item hit by the ray within maxDistance, or -1. Items are tested
+// against their AABB, or with itemFunc when given. Children are visited
+// closest first and skipped once they start beyond the nearest hit.
+int raycastBvh(const Bvh *bvh, Float3 origin, Float3 direction,
+               float maxDistance, BvhRayItemFunc itemFunc, void *data,
+               float *outDistance);
+
+C_INTERFACE_END
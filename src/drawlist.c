@@ -0,0 +1,541 @@
+#include "drawlist.h"
+#include "memory.h"
+#include "thread.h"
+#include <math.h>
+#include <string.h>
+
+#define DRAW_KEY_FIELD(value, bits) ((uint64_t)(value) & ((1ull << (bits)) - 1))
+
+uint64_t makeDrawSortKey(DrawPass pass, int pipeline, int material,
+                         int mesh, int subMesh, float depth) {
+  depth = depth < 0 ? 0 : (depth > 1 ? 1 : depth);
+  uint32_t quantizedDepth =
+      (uint32_t)(depth * (float)((1u << DRAW_KEY_DEPTH_BITS) - 1));
+
+  uint64_t key = DRAW_KEY_FIELD(pass, DRAW_KEY_PASS_BITS);
+  key = (key << DRAW_KEY_PIPELINE_BITS) |
+        DRAW_KEY_FIELD(pipeline, DRAW_KEY_PIPELINE_BITS);
+  key = (key << DRAW_KEY_MATERIAL_BITS) |
+        DRAW_KEY_FIELD(material, DRAW_KEY_MATERIAL_BITS);
+  key = (key << DRAW_KEY_MESH_BITS) | DRAW_KEY_FIELD(mesh, DRAW_KEY_MESH_BITS);
+  key = (key << DRAW_KEY_SUBMESH_BITS) |
+        DRAW_KEY_FIELD(subMesh, DRAW_KEY_SUBMESH_BITS);
+  key = (key << DRAW_KEY_DEPTH_BITS) |
+        DRAW_KEY_FIELD(quantizedDepth, DRAW_KEY_DEPTH_BITS);
+  return key;
+}
+
+void destroyDrawList(DrawList *list) {
+  for (int i = 0; i < list->jobCapacity; ++i) {
+    destroyDrawList(&list->jobLists[i]);
+  }
+  MFREE(list->jobOcclusionStats);
+  MFREE(list->jobLists);
+  MFREE(list->visibleNodes);
+  MFREE(list->drawUniforms);
+  MFREE(list->ranges);
+  MFREE(list->sortScratch);
+  MFREE(list->sortItems);
+  MFREE(list->packets);
+  *list = (DrawList){0};
+}
+
+void resetDrawList(DrawList *list) {
+  list->numPackets = 0;
+  list->numRanges = 0;
+  list->numDrawUniforms = 0;
+}
+
+static void *growDrawListArray(void *array, int count, int *capacity,
+                               int required, int elementSize, int alignment) {
+  if (*capacity >= required) {
+    return array;
+  }
+
+  int newCapacity = MAX(required, MAX(*capacity * 2, 64));
+  void *newArray = allocate(elementSize * newCapacity, alignment);
+  if (array) {
+    memcpy(newArray, array, elementSize * count);
+    MFREE(array);
+  }
+  *capacity = newCapacity;
+  return newArray;
+}
+
+int pushDrawUniforms(DrawList *list, const DrawUniforms *uniforms) {
+  list->drawUniforms = growDrawListArray(
+      list->drawUniforms, list->numDrawUniforms, &list->drawUniformCapacity,
+      list->numDrawUniforms + 1, sizeof(DrawUniforms), _Alignof(DrawUniforms));
+  list->drawUniforms[list->numDrawUniforms] = *uniforms;
+  return list->numDrawUniforms++;
+}
+
+IndexRange *reserveDrawRanges(DrawList *list, int count) {
+  list->ranges = growDrawListArray(list->ranges, list->numRanges,
+                                   &list->rangeCapacity,
+                                   list->numRanges + count, sizeof(IndexRange),
+                                   _Alignof(IndexRange));
+  return &list->ranges[list->numRanges];
+}
+
+int commitDrawRanges(DrawList *list, int count) {
+  ASSERT(list->numRanges + count <= list->rangeCapacity);
+  int firstRange = list->numRanges;
+  list->numRanges += count;
+  return firstRange;
+}
+
+void pushDrawPacket(DrawList *list, uint64_t sortKey,
+                    const DrawPacket *packet) {
+  if (list->numPackets == list->packetCapacity) {
+    int capacity = list->packetCapacity;
+    list->packets = growDrawListArray(list->packets, list->numPackets,
+                                      &capacity, list->numPackets + 1,
+                                      sizeof(DrawPacket), _Alignof(DrawPacket));
+    capacity = list->packetCapacity;
+    list->sortItems = growDrawListArray(list->sortItems, list->numPackets,
+                                        &capacity, list->numPackets + 1,
+                                        sizeof(SortItem), _Alignof(SortItem));
+    MFREE(list->sortScratch);
+    list->packetCapacity = capacity;
+    list->sortScratch = MMALLOC_ARRAY(SortItem, capacity);
+  }
+
+  list->packets[list->numPackets] = *packet;
+  list->sortItems[list->numPackets] = (SortItem){
+      .key = sortKey,
+      .index = (uint32_t)list->numPackets,
+  };
+  ++list->numPackets;
+}
+
+void sortDrawList(DrawList *list) {
+  radixSortItems(list->sortItems, list->sortScratch, list->numPackets);
+}
+
+int getDrawBatchSize(const DrawList *list, int first) {
+  const DrawPacket *packet = &list->packets[list->sortItems[first].index];
+  if (packet->numRanges != 1) {
+    return 1;
+  }
+  const IndexRange *range = &list->ranges[packet->firstRange];
+
+  int count = 1;
+  while (first + count < list->numPackets) {
+    const DrawPacket *other =
+        &list->packets[list->sortItems[first + count].index];
+    const IndexRange *otherRange = &list->ranges[other->firstRange];
+    if (other->subMesh != packet->subMesh || other->model != packet->model ||
+        other->pipeline != packet->pipeline ||
+        other->material != packet->material || other->numRanges != 1 ||
+        otherRange->offset != range->offset ||
+        otherRange->count != range->count) {
+      break;
+    }
+    ++count;
+  }
+  return count;
+}
+
+static void recordMeshDraws(DrawList *list, const Model *model,
+                            const Mesh *mesh, SceneNode *node,
+                            int drawUniforms, Mat4 modelMat,
+                            const DrawView *view, DrawPass pass,
+                            int pipeline, OcclusionStats *occlusionStats) {
+  // Cull in mesh space so the meshlet bounds can be used as they are
+  Mat4 mvp = mat4Multiply(view->viewProj, modelMat);
+  Frustum frustum = frustumFromMatrix(mvp);
+  Float4 eyeWorld = {view->eye.x, view->eye.y, view->eye.z, 1};
+  Float3 eye = mat4MultiplyFloat4(mat4Inverse(modelMat), eyeWorld).xyz;
+
+  for (int subMeshIndex = 0; subMeshIndex < mesh->numSubMeshes;
+       ++subMeshIndex) {
+    SubMesh *subMesh = &mesh->subMeshes[subMeshIndex];
+
+    int lod = selectSubMeshLod(subMesh, node->subMeshLods[subMeshIndex],
+                               modelMat, view->eye, view->pixelsPerUnit);
+    node->subMeshLods[subMeshIndex] = lod;
+
+    // Skinned bounds are those of the bind pose, so they can't be trusted
+    if (view->occlusion && !subMesh->skinVertices) {
+      float radius = subMesh->boundsRadius;
+      Float3 extent = {radius, radius, radius};
+      if (isBoxOccluded(view->occlusion, mvp, subMesh->boundsCenter - extent,
+                        subMesh->boundsCenter + extent, occlusionStats)) {
+        continue;
+      }
+    }
+
+    // Meshlet culling gives every node its own ranges, which would keep the
+    // nodes sharing the mesh from being drawn as instances
+    int numRanges = 0;
+    if (lod == 0 && subMesh->numMeshlets > 0 && mesh->numInstances <= 1) {
+      IndexRange *ranges = reserveDrawRanges(list, subMesh->numMeshlets);
+      numRanges = cullMeshlets(subMesh->meshlets, subMesh->numMeshlets,
+                               &frustum, eye, ranges);
+      if (numRanges == 0) {
+        continue;
+      }
+    } else {
+      if (!subMesh->skinVertices &&
+          !frustumIntersectsSphere(&frustum, subMesh->boundsCenter,
+                                   subMesh->boundsRadius)) {
+        continue;
+      }
+      IndexRange *range = reserveDrawRanges(list, 1);
+      range->offset = subMesh->lods[lod].indexOffset;
+      range->count = subMesh->lods[lod].numIndices;
+      numRanges = 1;
+    }
+
+    Float4 center = {subMesh->boundsCenter.x, subMesh->boundsCenter.y,
+                     subMesh->boundsCenter.z, 1};
+    float distance =
+        float3Length(mat4MultiplyFloat4(modelMat, center).xyz - view->eye);
+    uint64_t sortKey =
+        makeDrawSortKey(pass, pipeline, subMesh->material, mesh - model->meshes,
+                        subMeshIndex, distance / view->farZ);
+
+    DrawPacket packet = {
+        .model = model,
+        .subMesh = subMesh,
+        .material = subMesh->material,
+        .pipeline = pipeline,
+        .drawUniforms = drawUniforms,
+        .firstRange = commitDrawRanges(list, numRanges),
+        .numRanges = numRanges,
+    };
+    pushDrawPacket(list, sortKey, &packet);
+  }
+}
+
+// Large sub-meshes go into the occlusion buffer at their coarsest LOD
+static void rasterizeMeshOccluders(OcclusionBuffer *occlusion,
+                                   const Mesh *mesh, Mat4 modelMat,
+                                   const DrawView *view) {
+  Mat4 mvp = mat4Multiply(view->viewProj, modelMat);
+  Frustum frustum = frustumFromMatrix(mvp);
+  float scale = sqrtf(MAX(float3LengthSq(modelMat.cols[0].xyz),
+                          MAX(float3LengthSq(modelMat.cols[1].xyz),
+                              float3LengthSq(modelMat.cols[2].xyz))));
+
+  for (int subMeshIndex = 0; subMeshIndex < mesh->numSubMeshes;
+       ++subMeshIndex) {
+    const SubMesh *subMesh = &mesh->subMeshes[subMeshIndex];
+    if (subMesh->skinVertices ||
+        !frustumIntersectsSphere(&frustum, subMesh->boundsCenter,
+                                 subMesh->boundsRadius)) {
+      continue;
+    }
+
+    Float4 center = {subMesh->boundsCenter.x, subMesh->boundsCenter.y,
+                     subMesh->boundsCenter.z, 1};
+    float distance =
+        float3Length(mat4MultiplyFloat4(modelMat, center).xyz - view->eye);
+    float radius = subMesh->boundsRadius * scale;
+    if (distance > radius &&
+        radius * view->pixelsPerUnit / distance < OCCLUDER_MIN_PIXEL_RADIUS) {
+      continue;
+    }
+
+    const SubMeshLod *lod = &subMesh->lods[subMesh->numLods - 1];
+    rasterizeOccluder(occlusion, mvp, &subMesh->indices[lod->indexOffset],
+                      lod->numIndices,
+                      (const float *)&subMesh->vertices[0].position,
+                      sizeof(Vertex));
+  }
+}
+
+// Nodes of model whose world bounds intersect the view, as node indices.
+// Skinned nodes are always included.
+static int cullModelNodes(DrawList *list, const Model *model, Mat4 transform,
+                          const DrawView *view) {
+  int capacity = model->bvh.numItems + model->numUnboundedNodes;
+  list->visibleNodes =
+      growDrawListArray(list->visibleNodes, 0, &list->visibleNodeCapacity,
+                        capacity, sizeof(int), _Alignof(int));
+
+  // The BVH is in the space of the node world transforms
+  Frustum frustum = frustumFromMatrix(mat4Multiply(view->viewProj, transform));
+  int numNodes = queryBvhFrustum(&model->bvh, &frustum, list->visibleNodes);
+  for (int i = 0; i < numNodes; ++i) {
+    list->visibleNodes[i] = model->bvhNodes[list->visibleNodes[i]];
+  }
+  for (int i = 0; i < model->numUnboundedNodes; ++i) {
+    list->visibleNodes[numNodes++] = model->unboundedNodes[i];
+  }
+  return numNodes;
+}
+
+// Appends the packets of src, which was recorded on its own, after those of
+// dst
+static void appendDrawList(DrawList *dst, const DrawList *src) {
+  int firstDrawUniforms = dst->numDrawUniforms;
+  dst->drawUniforms = growDrawListArray(
+      dst->drawUniforms, dst->numDrawUniforms, &dst->drawUniformCapacity,
+      dst->numDrawUniforms + src->numDrawUniforms, sizeof(DrawUniforms),
+      _Alignof(DrawUniforms));
+  memcpy(&dst->drawUniforms[firstDrawUniforms], src->drawUniforms,
+         sizeof(DrawUniforms) * src->numDrawUniforms);
+  dst->numDrawUniforms += src->numDrawUniforms;
+
+  IndexRange *ranges = reserveDrawRanges(dst, src->numRanges);
+  memcpy(ranges, src->ranges, sizeof(IndexRange) * src->numRanges);
+  int firstRange = commitDrawRanges(dst, src->numRanges);
+
+  for (int i = 0; i < src->numPackets; ++i) {
+    DrawPacket packet = src->packets[i];
+    packet.drawUniforms += firstDrawUniforms;
+    packet.firstRange += firstRange;
+    pushDrawPacket(dst, src->sortItems[i].key, &packet);
+  }
+}
+
+typedef struct _DrawRecordJob {
+  DrawList *list;
+  DrawList *jobLists;
+  OcclusionStats *jobOcclusionStats;
+  const int *nodes;
+  int numNodes;
+  Model *model;
+  Mat4 transform;
+  // Inverse transpose of transform
+  Mat4 normalTransform;
+  const DrawView *view;
+  DrawPass pass;
+  int pipeline;
+} DrawRecordJob;
+
+// Records nodes [begin, end) into the list of the job. The first job writes
+// straight into the target list, since nothing is appended before it.
+static void recordNodeRange(const DrawRecordJob *job, int jobIndex, int begin,
+                            int end) {
+  DrawList *list = jobIndex == 0 ? job->list : &job->jobLists[jobIndex];
+  OcclusionStats *occlusionStats = &job->jobOcclusionStats[jobIndex];
+
+  const SceneGraph *graph = &job->model->sceneGraph;
+  for (int i = begin; i < end; ++i) {
+    int nodeIndex = job->nodes[i];
+    SceneNode *node = &job->model->nodes[nodeIndex];
+    DrawUniforms uniform;
+    uniform.modelMat =
+        mat4Multiply(job->transform, graph->worldMatrices[nodeIndex]);
+    uniform.normalMat =
+        mat4Multiply(job->normalTransform, graph->normalMatrices[nodeIndex]);
+    int drawUniforms = pushDrawUniforms(list, &uniform);
+
+    Mesh *mesh = &job->model->meshes[node->mesh];
+    recordMeshDraws(list, job->model, mesh, node, drawUniforms,
+                    uniform.modelMat, job->view, job->pass, job->pipeline,
+                    occlusionStats);
+  }
+}
+
+// Runs jobs [begin, end), each over the next DRAW_RECORD_GRAIN_SIZE nodes, so
+// which nodes a job records doesn't depend on how parallelFor splits the range
+static void recordNodeJobs(void *data, int begin, int end) {
+  const DrawRecordJob *job = (const DrawRecordJob *)data;
+  for (int jobIndex = begin; jobIndex < end; ++jobIndex) {
+    int first = jobIndex * DRAW_RECORD_GRAIN_SIZE;
+    recordNodeRange(job, jobIndex, first,
+                    MIN(first + DRAW_RECORD_GRAIN_SIZE, job->numNodes));
+  }
+}
+
+static void reserveDrawRecordJobs(DrawList *list, int numJobs) {
+  if (list->jobCapacity >= numJobs) {
+    return;
+  }
+
+  int capacity = MAX(numJobs, list->jobCapacity * 2);
+  DrawList *jobLists = MMALLOC_ARRAY_ZEROES(DrawList, capacity);
+  if (list->jobLists) {
+    memcpy(jobLists, list->jobLists, sizeof(DrawList) * list->jobCapacity);
+    MFREE(list->jobLists);
+  }
+  list->jobLists = jobLists;
+  MFREE(list->jobOcclusionStats);
+  list->jobOcclusionStats = MMALLOC_ARRAY(OcclusionStats, capacity);
+  list->jobCapacity = capacity;
+}
+
+void recordModelDraws(DrawList *list, Model *model, Mat4 transform,
+                      const DrawView *view, DrawPass pass, int pipeline) {
+  int numNodes = cullModelNodes(list, model, transform, view);
+
+  if (view->occlusion) {
+    for (int i = 0; i < numNodes; ++i) {
+      int nodeIndex = list->visibleNodes[i];
+      const SceneNode *node = &model->nodes[nodeIndex];
+      Mat4 modelMat =
+          mat4Multiply(transform, model->sceneGraph.worldMatrices[nodeIndex]);
+      rasterizeMeshOccluders(view->occlusion, &model->meshes[node->mesh],
+                             modelMat, view);
+    }
+    buildOcclusionPyramid(view->occlusion);
+  }
+
+  int numJobs =
+      (numNodes + DRAW_RECORD_GRAIN_SIZE - 1) / DRAW_RECORD_GRAIN_SIZE;
+  reserveDrawRecordJobs(list, numJobs);
+  for (int i = 0; i < numJobs; ++i) {
+    resetDrawList(&list->jobLists[i]);
+    list->jobOcclusionStats[i] = (OcclusionStats){0};
+  }
+
+  DrawRecordJob job = {
+      .list = list,
+      .jobLists = list->jobLists,
+      .jobOcclusionStats = list->jobOcclusionStats,
+      .nodes = list->visibleNodes,
+      .numNodes = numNodes,
+      .model = model,
+      .transform = transform,
+      .normalTransform = mat4Transpose(mat4Inverse(transform)),
+      .view = view,
+      .pass = pass,
+      .pipeline = pipeline,
+  };
+  parallelFor(numJobs, 1, recordNodeJobs, &job);
+
+  // Job order is node order, so the result doesn't depend on which thread
+  // ran which job
+  for (int i = 1; i < numJobs; ++i) {
+    appendDrawList(list, &list->jobLists[i]);
+  }
+  if (view->occlusion) {
+    OcclusionStats *stats = &view->occlusion->stats;
+    for (int i = 0; i < numJobs; ++i) {
+      stats->numTested += list->jobOcclusionStats[i].numTested;
+      stats->numCulled += list->jobOcclusionStats[i].numCulled;
+      stats->timeMs += list->jobOcclusionStats[i].timeMs;
+    }
+  }
+}
+
+void requestDrawTextureLevels(TextureStreamer *streamer, const DrawList *list,
+                              int firstPacket, const DrawView *view) {
+  for (int i = firstPacket; i < list->numPackets; ++i) {
+    const DrawPacket *packet = &list->packets[i];
+    const Model *model = packet->model;
+    const SubMesh *subMesh = packet->subMesh;
+    // Base color is the only texture materials are loaded with so far
+    int textureIndex = model->materials[packet->material].baseColorTexture;
+    if (!model->textureStreams || textureIndex < 0 ||
+        model->textureStreams[textureIndex] < 0 || subMesh->uvDensity <= 0) {
+      continue;
+    }
+    int texture = model->textureStreams[textureIndex];
+    const StreamedTexture *t = &streamer->textures[texture];
+
+    Mat4 modelMat = list->drawUniforms[packet->drawUniforms].modelMat;
+    float scale = sqrtf(MAX(float3LengthSq(modelMat.cols[0].xyz),
+                            MAX(float3LengthSq(modelMat.cols[1].xyz),
+                                float3LengthSq(modelMat.cols[2].xyz))));
+    Float4 center = {subMesh->boundsCenter.x, subMesh->boundsCenter.y,
+                     subMesh->boundsCenter.z, 1};
+    float distance =
+        float3Length(mat4MultiplyFloat4(modelMat, center).xyz - view->eye) -
+        subMesh->boundsRadius * scale;
+
+    // Every level halves the texels per pixel
+    int level = 0;
+    if (distance > 0) {
+      float size = (float)MAX(t->width, t->height);
+      float texelsPerPixel = subMesh->uvDensity * size * distance /
+                             (scale * view->pixelsPerUnit);
+      level = texelsPerPixel > 1 ? (int)log2f(texelsPerPixel) : 0;
+    }
+    requestTextureLevel(streamer, texture, level);
+  }
+}
+
+// A packet of the list checkDrawList batches
+typedef struct _DrawListCheckPacket {
+  int subMesh;
+  int material;
+  int rangeOffset;
+  int numRanges;
+  float depth;
+} DrawListCheckPacket;
+
+bool checkDrawList(void) {
+  bool passed = true;
+
+  int subMeshShift = DRAW_KEY_DEPTH_BITS;
+  int meshShift = subMeshShift + DRAW_KEY_SUBMESH_BITS;
+  int materialShift = meshShift + DRAW_KEY_MESH_BITS;
+  int pipelineShift = materialShift + DRAW_KEY_MATERIAL_BITS;
+  int passShift = pipelineShift + DRAW_KEY_PIPELINE_BITS;
+  CHECK(passed, passShift + DRAW_KEY_PASS_BITS == 64);
+  uint64_t maxDepth = (1ull << DRAW_KEY_DEPTH_BITS) - 1;
+  CHECK(passed, makeDrawSortKey(DrawPass_GBuffer, 2, 3, 4, 5, 1.f) ==
+                    (2ull << pipelineShift | 3ull << materialShift |
+                     4ull << meshShift | 5ull << subMeshShift | maxDepth));
+  CHECK(passed, makeDrawSortKey(1, 0, 0, 0, 0, 0) == 1ull << passShift);
+
+  // Depth is clamped and fields past their bits wrap instead of spilling
+  // into the next one
+  uint64_t zero = makeDrawSortKey(DrawPass_GBuffer, 0, 0, 0, 0, 0);
+  CHECK(passed, makeDrawSortKey(DrawPass_GBuffer, 0, 0, 0, 0, -1.f) == zero);
+  CHECK(passed, makeDrawSortKey(DrawPass_GBuffer, 0, 0, 0, 0, 2.f) ==
+                    makeDrawSortKey(DrawPass_GBuffer, 0, 0, 0, 0, 1.f));
+  CHECK(passed, makeDrawSortKey(DrawPass_GBuffer, 0,
+                                1 << DRAW_KEY_MATERIAL_BITS, 0, 0, 0) == zero);
+
+  // State before depth, and nearer first within the same state
+  CHECK(passed, makeDrawSortKey(DrawPass_GBuffer, 0, 0, 0, 0, 0.2f) <
+                    makeDrawSortKey(DrawPass_GBuffer, 0, 0, 0, 0, 0.8f));
+  CHECK(passed, makeDrawSortKey(DrawPass_GBuffer, 0, 0, 0, 1, 0) >
+                    makeDrawSortKey(DrawPass_GBuffer, 0, 0, 0, 0, 1.f));
+  CHECK(passed, makeDrawSortKey(DrawPass_GBuffer, 1, 0, 0, 0, 0) >
+                    makeDrawSortKey(DrawPass_GBuffer, 0, 4095, 4095, 255, 1.f));
+
+  // In sort order: two instances, one at another LOD range in between, one
+  // more instance, two packets with several ranges, and two instances of
+  // another material
+  static const DrawListCheckPacket packets[] = {
+      {1, 1, 0, 1, 0.6f},  {1, 0, 0, 2, 0.2f}, {0, 0, 0, 1, 0.3f},
+      {0, 0, 6, 1, 0.25f}, {1, 1, 0, 1, 0.5f}, {0, 0, 0, 1, 0.1f},
+      {1, 0, 0, 2, 0.1f},  {0, 0, 0, 1, 0.2f},
+  };
+  static const int expectedBatches[] = {2, 1, 1, 1, 1, 2};
+
+  Model model = {0};
+  SubMesh subMeshes[2] = {0};
+  DrawList list = {0};
+  for (int i = 0; i < (int)ARRAY_COUNT(packets); ++i) {
+    const DrawListCheckPacket *check = &packets[i];
+    IndexRange *ranges = reserveDrawRanges(&list, check->numRanges);
+    for (int r = 0; r < check->numRanges; ++r) {
+      ranges[r] = (IndexRange){.offset = check->rangeOffset + r * 3,
+                               .count = 3};
+    }
+    DrawPacket packet = {
+        .model = &model,
+        .subMesh = &subMeshes[check->subMesh],
+        .material = check->material,
+        .drawUniforms = pushDrawUniforms(&list, &(DrawUniforms){0}),
+        .firstRange = commitDrawRanges(&list, check->numRanges),
+        .numRanges = check->numRanges,
+    };
+    uint64_t key = makeDrawSortKey(DrawPass_GBuffer, 0, check->material, 0,
+                                   check->subMesh, check->depth);
+    pushDrawPacket(&list, key, &packet);
+  }
+  sortDrawList(&list);
+
+  int numBatches = 0;
+  int batchSize;
+  for (int i = 0; i < list.numPackets; i += batchSize) {
+    batchSize = getDrawBatchSize(&list, i);
+    CHECK(passed, numBatches < (int)ARRAY_COUNT(expectedBatches) &&
+                      batchSize == expectedBatches[numBatches]);
+    ++numBatches;
+  }
+  CHECK(passed, numBatches == (int)ARRAY_COUNT(expectedBatches));
+  destroyDrawList(&list);
+
+  LOG("Draw list: checks %s", passed ? "passed" : "failed");
+  return passed;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "renderer.h"
+#include "occlusion.h"
+#include "sort.h"
+#include "texturestream.h"
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+// Sort key layout, most significant first:
+// pass(4) | pipeline(8) | material(12) | mesh(12) | subMesh(8) | depth(20)
+// Packets of the same sub-mesh end up next to each other so that they can be
+// drawn as instances of one draw.
+#define DRAW_KEY_PASS_BITS 4
+#define DRAW_KEY_PIPELINE_BITS 8
+#define DRAW_KEY_MATERIAL_BITS 12
+#define DRAW_KEY_MESH_BITS 12
+#define DRAW_KEY_SUBMESH_BITS 8
+#define DRAW_KEY_DEPTH_BITS 20
+
+// Scene nodes recorded per job by recordModelDraws
+#define DRAW_RECORD_GRAIN_SIZE 128
+
+typedef enum _DrawPass {
+  DrawPass_GBuffer = 0,
+
+  DrawPass_Count
+} DrawPass;
+
+typedef struct _DrawPacket {
+  const Model *model;
+  const SubMesh *subMesh;
+  int material;
+  int pipeline;
+  // Index into DrawList.drawUniforms, which is the instance data of the packet
+  int drawUniforms;
+  // Index ranges to draw, stored in DrawList.ranges
+  int firstRange;
+  int numRanges;
+} DrawPacket;
+
+// Recorded by scene traversal in any order and submitted by the backend in
+// sort key order. Storage is kept between frames.
+typedef struct _DrawList {
+  int numPackets;
+  int packetCapacity;
+  DrawPacket *packets;
+  SortItem *sortItems;
+  SortItem *sortScratch;
+
+  int numRanges;
+  int rangeCapacity;
+  IndexRange *ranges;
+
+  int numDrawUniforms;
+  int drawUniformCapacity;
+  DrawUniforms *drawUniforms;
+
+  // Scratch for the nodes that pass culling in recordModelDraws
+  int visibleNodeCapacity;
+  int *visibleNodes;
+
+  // What the jobs of recordModelDraws record on their own, before it is
+  // appended to this list in job order
+  int jobCapacity;
+  struct _DrawList *jobLists;
+  OcclusionStats *jobOcclusionStats;
+} DrawList;
+
+// depth is the view distance normalized to [0, 1], so opaque draws within the
+// same state go front to back
+uint64_t makeDrawSortKey(DrawPass pass, int pipeline, int material,
+                         int mesh, int subMesh, float depth);
+
+void destroyDrawList(DrawList *list);
+void resetDrawList(DrawList *list);
+
+int pushDrawUniforms(DrawList *list, const DrawUniforms *uniforms);
+
+// Returns room for count ranges at the end of the list. Only the first n of
+// them are kept once commitDrawRanges(list, n) is called, which returns the
+// index of the first one.
+IndexRange *reserveDrawRanges(DrawList *list, int count);
+int commitDrawRanges(DrawList *list, int count);
+
+void pushDrawPacket(DrawList *list, uint64_t sortKey, const DrawPacket *packet);
+
+// Afterwards list->sortItems[i].index is the packet to submit i-th
+void sortDrawList(DrawList *list);
+
+// What recordModelDraws needs to know about the view being drawn
+typedef struct _DrawView {
+  Mat4 viewProj;
+  Float3 eye;
+  float farZ;
+  // Projected height in pixels of one unit at distance one
+  float pixelsPerUnit;
+  // Optional, begun for this view by the backend
+  OcclusionBuffer *occlusion;
+} DrawView;
+
+// Culls the mesh nodes of model against the view with its BVH, then culls
+// their sub-meshes, picks their LOD and records a packet for each visible one.
+// transform is applied on top of the node world transforms. Nodes are recorded
+// by jobs on the thread pool and the result is the same for any number of
+// threads. With an occlusion
+// buffer, the large sub-meshes of model are first drawn into it and every
+// sub-mesh is then also tested against it.
+void recordModelDraws(DrawList *list, Model *model, Mat4 transform,
+                      const DrawView *view, DrawPass pass, int pipeline);
+
+// Asks streamer for the level the material textures of the packets of list
+// from firstPacket on need to have about a texel per pixel, from the on-screen
+// size of their sub-meshes
+void requestDrawTextureLevels(TextureStreamer *streamer, const DrawList *list,
+                              int firstPacket, const DrawView *view);
+
+// Number of sorted packets starting at first that only differ in their
+// instance data and can go out as one instanced draw. Packets with more than
+// one index range are never batched.
+int getDrawBatchSize(const DrawList *list, int first);
+
+// Checks where makeDrawSortKey puts its fields and how it orders them, then
+// sorts a small list and checks where getDrawBatchSize splits it. Logs every
+// check that fails.
+bool checkDrawList(void);
+
+C_INTERFACE_END
@@ -0,0 +1,61 @@
+#include "dynamicresolution.h"
+#include <math.h>
+
+void initDynamicResolution(DynamicResolution *res, float targetFrameTime) {
+  ASSERT(targetFrameTime >= 0);
+  *res = (DynamicResolution){
+      .targetFrameTime = targetFrameTime,
+      .stats =
+          {
+              .scale = DYNAMIC_RESOLUTION_MAX_SCALE,
+              .targetFrameTime = targetFrameTime,
+          },
+  };
+}
+
+void updateDynamicResolution(DynamicResolution *res, float frameTime) {
+  DynamicResolutionStats *stats = &res->stats;
+  stats->frameTime = frameTime;
+  stats->smoothedFrameTime =
+      stats->numFrames == 0
+          ? frameTime
+          : stats->smoothedFrameTime +
+                (frameTime - stats->smoothedFrameTime) *
+                    DYNAMIC_RESOLUTION_SMOOTHING;
+  ++stats->numFrames;
+  if (res->targetFrameTime <= 0) {
+    return;
+  }
+
+  float aimedFrameTime = res->targetFrameTime * DYNAMIC_RESOLUTION_HEADROOM;
+  float error = fminf(fmaxf(1 - stats->smoothedFrameTime / aimedFrameTime, -1),
+                      1);
+  stats->derivative = error - stats->error;
+  stats->error = error;
+
+  // The integral holds the scale at rest. It stops growing while the scale is
+  // clamped and the error pushes it further out, so it doesn't wind up.
+  float integral = stats->integral + error;
+  float scale = DYNAMIC_RESOLUTION_MAX_SCALE + DYNAMIC_RESOLUTION_KP * error +
+                DYNAMIC_RESOLUTION_KI * integral +
+                DYNAMIC_RESOLUTION_KD * stats->derivative;
+  bool saturated = (scale > DYNAMIC_RESOLUTION_MAX_SCALE && error > 0) ||
+                   (scale < DYNAMIC_RESOLUTION_MIN_SCALE && error < 0);
+  if (!saturated) {
+    stats->integral = integral;
+  }
+  scale = DYNAMIC_RESOLUTION_MAX_SCALE + DYNAMIC_RESOLUTION_KP * error +
+          DYNAMIC_RESOLUTION_KI * stats->integral +
+          DYNAMIC_RESOLUTION_KD * stats->derivative;
+  stats->scale = fminf(
+      fmaxf(scale, DYNAMIC_RESOLUTION_MIN_SCALE), DYNAMIC_RESOLUTION_MAX_SCALE);
+}
+
+void setDynamicResolutionTargetSize(DynamicResolution *res, int maxWidth,
+                                    int maxHeight) {
+  DynamicResolutionStats *stats = &res->stats;
+  stats->width =
+      MIN(MAX((int)ceilf((float)maxWidth * stats->scale), 1), maxWidth);
+  stats->height =
+      MIN(MAX((int)ceilf((float)maxHeight * stats->scale), 1), maxHeight);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+
+C_INTERFACE_BEGIN
+
+// Fractions of the width and height of the targets the scale stays within
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.5f
+#define DYNAMIC_RESOLUTION_MAX_SCALE 1.f
+// Frame time the controller aims for, as a fraction of the target, so that
+// the noise of the measurements mostly stays below the target
+#define DYNAMIC_RESOLUTION_HEADROOM 0.9f
+// Weight of a new measurement in the smoothed frame time
+#define DYNAMIC_RESOLUTION_SMOOTHING 0.3f
+// Gains on the error relative to the aimed frame time
+#define DYNAMIC_RESOLUTION_KP 0.2f
+#define DYNAMIC_RESOLUTION_KI 0.05f
+#define DYNAMIC_RESOLUTION_KD 0.1f
+
+// 60 Hz
+#define DYNAMIC_RESOLUTION_DEFAULT_TARGET (1 / 60.f)
+
+typedef struct _DynamicResolutionStats {
+  float scale;
+  // Size rendered at, from the origin of the targets
+  int width;
+  int height;
+  // Seconds
+  float targetFrameTime;
+  float frameTime;
+  float smoothedFrameTime;
+  // Relative error of the smoothed frame time, positive while there's time
+  // to spare, and the controller terms derived from it
+  float error;
+  float integral;
+  float derivative;
+  int numFrames;
+} DynamicResolutionStats;
+
+// PID controller of the render scale, fed with the measured time of the
+// scaled part of each frame. Passes render into a viewport of the full size
+// targets, so changing the scale never reallocates them.
+typedef struct _DynamicResolution {
+  // 0 keeps the scale at DYNAMIC_RESOLUTION_MAX_SCALE
+  float targetFrameTime;
+  DynamicResolutionStats stats;
+} DynamicResolution;
+
+void initDynamicResolution(DynamicResolution *res, float targetFrameTime);
+
+// Measurements can lag a few frames behind, like GPU timer queries do
+void updateDynamicResolution(DynamicResolution *res, float frameTime);
+
+// Picks the size to render at this frame for targets of maxWidth x maxHeight
+void setDynamicResolutionTargetSize(DynamicResolution *res, int maxWidth,
+                                    int maxHeight);
+
+C_INTERFACE_END
@@ -0,0 +1,314 @@
+#include "framegraph.h"
+#include "memory.h"
+#include "profiler.h"
+#include <string.h>
+
+static const int gRenderTargetFormatSizes[RenderTargetFormat_Count] = {
+    [RenderTargetFormat_RGBA8] = 4,
+    [RenderTargetFormat_RGBA16F] = 8,
+    [RenderTargetFormat_Depth32F] = 4,
+};
+
+int64_t getRenderTargetSize(const RenderTargetDesc *desc) {
+  return (int64_t)desc->width * desc->height *
+         gRenderTargetFormatSizes[desc->format];
+}
+
+static bool isSameRenderTargetDesc(const RenderTargetDesc *a,
+                                   const RenderTargetDesc *b) {
+  return a->width == b->width && a->height == b->height &&
+         a->format == b->format;
+}
+
+void initFrameGraph(FrameGraph *graph, CreateRenderTarget createRenderTarget,
+                    DestroyRenderTarget destroyRenderTarget) {
+  *graph = (FrameGraph){
+      .createRenderTarget = createRenderTarget,
+      .destroyRenderTarget = destroyRenderTarget,
+  };
+}
+
+void destroyFrameGraph(FrameGraph *graph) {
+  for (int i = 0; i < graph->numPooledTargets; ++i) {
+    graph->destroyRenderTarget(graph->pool[i].handle);
+  }
+  MFREE(graph->pool);
+  *graph = (FrameGraph){0};
+}
+
+void resetFrameGraph(FrameGraph *graph) {
+  graph->numPasses = 0;
+  graph->numResources = 0;
+  graph->compiled = false;
+}
+
+static FrameGraphResource addFrameGraphResource(FrameGraph *graph,
+                                                const char *name,
+                                                RenderTargetDesc desc) {
+  ASSERT(graph->numResources < FRAME_GRAPH_MAX_RESOURCES);
+  ASSERT(desc.width > 0 && desc.height > 0);
+  FrameGraphResource resource = graph->numResources++;
+  graph->resources[resource] = (FrameGraphResourceNode){
+      .name = name,
+      .desc = desc,
+      .producer = -1,
+      .firstPass = -1,
+      .lastPass = -1,
+      .target = -1,
+  };
+  return resource;
+}
+
+FrameGraphResource createFrameGraphTexture(FrameGraph *graph, const char *name,
+                                           RenderTargetDesc desc) {
+  return addFrameGraphResource(graph, name, desc);
+}
+
+FrameGraphResource importFrameGraphTexture(FrameGraph *graph, const char *name,
+                                           RenderTargetDesc desc,
+                                           RenderTargetHandle handle) {
+  FrameGraphResource resource = addFrameGraphResource(graph, name, desc);
+  graph->resources[resource].imported = true;
+  graph->resources[resource].handle = handle;
+  return resource;
+}
+
+int addFrameGraphPass(FrameGraph *graph, const char *name,
+                      FrameGraphExecute execute, void *data) {
+  ASSERT(graph->numPasses < FRAME_GRAPH_MAX_PASSES);
+  int pass = graph->numPasses++;
+  graph->passes[pass] = (FrameGraphPass){
+      .name = name,
+      .execute = execute,
+      .data = data,
+  };
+  return pass;
+}
+
+void readFrameGraphResource(FrameGraph *graph, int pass,
+                            FrameGraphResource resource) {
+  ASSERT(pass >= 0 && pass < graph->numPasses);
+  ASSERT(resource >= 0 && resource < graph->numResources);
+  FrameGraphPass *node = &graph->passes[pass];
+  ASSERT(node->numReads < FRAME_GRAPH_MAX_PASS_RESOURCES);
+  // Passes run in the order they were added
+  ASSERT(graph->resources[resource].imported ||
+         (graph->resources[resource].producer >= 0 &&
+          graph->resources[resource].producer < pass));
+  node->reads[node->numReads++] = resource;
+}
+
+void writeFrameGraphResource(FrameGraph *graph, int pass,
+                             FrameGraphResource resource) {
+  ASSERT(pass >= 0 && pass < graph->numPasses);
+  ASSERT(resource >= 0 && resource < graph->numResources);
+  FrameGraphPass *node = &graph->passes[pass];
+  ASSERT(node->numWrites < FRAME_GRAPH_MAX_PASS_RESOURCES);
+  ASSERT(graph->resources[resource].producer < 0);
+  graph->resources[resource].producer = pass;
+  node->writes[node->numWrites++] = resource;
+}
+
+// Walks back from the resources nobody reads: a pass whose writes all end up
+// unread is culled, which in turn drops the reads of its own inputs
+static void cullFrameGraphPasses(FrameGraph *graph) {
+  for (int i = 0; i < graph->numResources; ++i) {
+    graph->resources[i].refCount = 0;
+  }
+  for (int i = 0; i < graph->numPasses; ++i) {
+    FrameGraphPass *pass = &graph->passes[i];
+    pass->refCount = pass->numWrites;
+    pass->culled = false;
+    for (int r = 0; r < pass->numReads; ++r) {
+      ++graph->resources[pass->reads[r]].refCount;
+    }
+  }
+
+  int numUnread = 0;
+  FrameGraphResource unread[FRAME_GRAPH_MAX_RESOURCES];
+  for (int i = 0; i < graph->numResources; ++i) {
+    const FrameGraphResourceNode *resource = &graph->resources[i];
+    if (resource->refCount == 0 && !resource->imported) {
+      unread[numUnread++] = i;
+    }
+  }
+
+  while (numUnread > 0) {
+    const FrameGraphResourceNode *resource =
+        &graph->resources[unread[--numUnread]];
+    if (resource->producer < 0) {
+      continue;
+    }
+    FrameGraphPass *producer = &graph->passes[resource->producer];
+    if (--producer->refCount > 0) {
+      continue;
+    }
+    producer->culled = true;
+    for (int r = 0; r < producer->numReads; ++r) {
+      FrameGraphResourceNode *input = &graph->resources[producer->reads[r]];
+      if (--input->refCount == 0 && !input->imported) {
+        unread[numUnread++] = producer->reads[r];
+      }
+    }
+  }
+}
+
+static int acquirePooledTarget(FrameGraph *graph,
+                               const RenderTargetDesc *desc) {
+  for (int i = 0; i < graph->numPooledTargets; ++i) {
+    PooledRenderTarget *target = &graph->pool[i];
+    if (!target->inUse && isSameRenderTargetDesc(&target->desc, desc)) {
+      if (target->lastUsedFrame != graph->frameIndex) {
+        ++graph->stats.numTargetsUsed;
+      }
+      target->inUse = true;
+      target->lastUsedFrame = graph->frameIndex;
+      return i;
+    }
+  }
+
+  if (graph->numPooledTargets == graph->pooledTargetCapacity) {
+    int capacity = MAX(graph->pooledTargetCapacity * 2, 8);
+    PooledRenderTarget *pool = MMALLOC_ARRAY(PooledRenderTarget, capacity);
+    if (graph->pool) {
+      memcpy(pool, graph->pool,
+             sizeof(PooledRenderTarget) * graph->numPooledTargets);
+      MFREE(graph->pool);
+    }
+    graph->pool = pool;
+    graph->pooledTargetCapacity = capacity;
+  }
+
+  int index = graph->numPooledTargets++;
+  graph->pool[index] = (PooledRenderTarget){
+      .desc = *desc,
+      .handle = graph->createRenderTarget(desc),
+      .inUse = true,
+      .lastUsedFrame = graph->frameIndex,
+  };
+  ++graph->stats.numTargetsCreated;
+  ++graph->stats.numTargetsUsed;
+  return index;
+}
+
+static void destroyPooledTarget(FrameGraph *graph, int index) {
+  graph->destroyRenderTarget(graph->pool[index].handle);
+  graph->pool[index] = graph->pool[--graph->numPooledTargets];
+  ++graph->stats.numTargetsDestroyed;
+}
+
+// Destroys the targets that have been unused for too long, or sooner, oldest
+// first, while the pool is much bigger than what the frame needed
+static void retirePooledTargets(FrameGraph *graph) {
+  int64_t pooledBytes = 0;
+  for (int i = 0; i < graph->numPooledTargets; ++i) {
+    // Every target is released by the end of the frame
+    ASSERT(!graph->pool[i].inUse);
+    pooledBytes += getRenderTargetSize(&graph->pool[i].desc);
+  }
+
+  if (graph->frameIndex % FRAME_GRAPH_RETIRE_FRAMES == 0) {
+    graph->windowPeakLiveBytes[1] = graph->windowPeakLiveBytes[0];
+    graph->windowPeakLiveBytes[0] = 0;
+  }
+  graph->windowPeakLiveBytes[0] =
+      MAX(graph->windowPeakLiveBytes[0], graph->stats.peakLiveBytes);
+  int64_t maxPooledBytes =
+      MAX(graph->windowPeakLiveBytes[0], graph->windowPeakLiveBytes[1]) *
+      FRAME_GRAPH_POOL_SLACK;
+  for (;;) {
+    int oldest = -1;
+    for (int i = 0; i < graph->numPooledTargets; ++i) {
+      int lastUsedFrame = graph->pool[i].lastUsedFrame;
+      if (lastUsedFrame != graph->frameIndex &&
+          (oldest < 0 || lastUsedFrame < graph->pool[oldest].lastUsedFrame)) {
+        oldest = i;
+      }
+    }
+    if (oldest < 0) {
+      break;
+    }
+    int unusedFrames = graph->frameIndex - graph->pool[oldest].lastUsedFrame;
+    if (pooledBytes <= maxPooledBytes &&
+        unusedFrames <= FRAME_GRAPH_RETIRE_FRAMES) {
+      break;
+    }
+    pooledBytes -= getRenderTargetSize(&graph->pool[oldest].desc);
+    destroyPooledTarget(graph, oldest);
+  }
+  graph->stats.pooledBytes = pooledBytes;
+}
+
+void compileFrameGraph(FrameGraph *graph) {
+  ASSERT(!graph->compiled);
+  graph->stats = (FrameGraphStats){.numPasses = graph->numPasses};
+  ++graph->frameIndex;
+
+  cullFrameGraphPasses(graph);
+
+  for (int i = 0; i < graph->numPasses; ++i) {
+    const FrameGraphPass *pass = &graph->passes[i];
+    if (pass->culled) {
+      ++graph->stats.numCulledPasses;
+      continue;
+    }
+    for (int r = 0; r < pass->numReads + pass->numWrites; ++r) {
+      FrameGraphResource resource = r < pass->numReads
+                                        ? pass->reads[r]
+                                        : pass->writes[r - pass->numReads];
+      FrameGraphResourceNode *node = &graph->resources[resource];
+      if (node->firstPass < 0) {
+        node->firstPass = i;
+      }
+      node->lastPass = i;
+    }
+  }
+
+  // Resources take a target before their first pass and give it back after
+  // their last one, so that later resources with the same desc can reuse it
+  int64_t liveBytes = 0;
+  for (int i = 0; i < graph->numPasses; ++i) {
+    if (graph->passes[i].culled) {
+      continue;
+    }
+    for (int r = 0; r < graph->numResources; ++r) {
+      FrameGraphResourceNode *node = &graph->resources[r];
+      if (node->firstPass == i && !node->imported) {
+        node->target = acquirePooledTarget(graph, &node->desc);
+        node->handle = graph->pool[node->target].handle;
+        liveBytes += getRenderTargetSize(&node->desc);
+        ++graph->stats.numTransientResources;
+      }
+    }
+    graph->stats.peakLiveBytes = MAX(graph->stats.peakLiveBytes, liveBytes);
+    for (int r = 0; r < graph->numResources; ++r) {
+      const FrameGraphResourceNode *node = &graph->resources[r];
+      if (node->lastPass == i && node->target >= 0) {
+        graph->pool[node->target].inUse = false;
+        liveBytes -= getRenderTargetSize(&node->desc);
+      }
+    }
+  }
+
+  retirePooledTargets(graph);
+
+  graph->compiled = true;
+}
+
+void executeFrameGraph(FrameGraph *graph) {
+  ASSERT(graph->compiled);
+  for (int i = 0; i < graph->numPasses; ++i) {
+    const FrameGraphPass *pass = &graph->passes[i];
+    if (!pass->culled && pass->execute) {
+      PROFILE_SCOPE(pass->name);
+      pass->execute(graph, pass->data);
+    }
+  }
+}
+
+RenderTargetHandle getFrameGraphTarget(const FrameGraph *graph,
+                                       FrameGraphResource resource) {
+  ASSERT(graph->compiled);
+  ASSERT(resource >= 0 && resource < graph->numResources);
+  return graph->resources[resource].handle;
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+#define FRAME_GRAPH_MAX_PASSES 16
+#define FRAME_GRAPH_MAX_RESOURCES 32
+#define FRAME_GRAPH_MAX_PASS_RESOURCES 8
+// Pooled render targets that no pass used for this many frames are destroyed,
+// so going back and forth between window sizes doesn't reallocate every time
+#define FRAME_GRAPH_RETIRE_FRAMES 60
+// Unused targets are destroyed right away, oldest first, while the pool holds
+// more than this many times the most memory that was live at once over the
+// last FRAME_GRAPH_RETIRE_FRAMES frames or so
+#define FRAME_GRAPH_POOL_SLACK 2
+
+typedef enum _RenderTargetFormat {
+  RenderTargetFormat_RGBA8 = 0,
+  RenderTargetFormat_RGBA16F,
+  RenderTargetFormat_Depth32F,
+
+  RenderTargetFormat_Count
+} RenderTargetFormat;
+
+typedef struct _RenderTargetDesc {
+  int width;
+  int height;
+  RenderTargetFormat format;
+} RenderTargetDesc;
+
+// Backend object behind a render target, such as a GL texture name
+typedef uint32_t RenderTargetHandle;
+
+typedef RenderTargetHandle (*CreateRenderTarget)(const RenderTargetDesc *desc);
+typedef void (*DestroyRenderTarget)(RenderTargetHandle handle);
+
+struct _FrameGraph;
+typedef void (*FrameGraphExecute)(const struct _FrameGraph *graph,
+                                  void *data);
+
+// Index of a resource in FrameGraph.resources
+typedef int FrameGraphResource;
+
+typedef struct _FrameGraphResourceNode {
+  const char *name;
+  RenderTargetDesc desc;
+  // Imported resources, like the back buffer, live outside of the graph. They
+  // keep the passes that write them and aren't pooled.
+  bool imported;
+  RenderTargetHandle handle;
+  // Pass that writes the resource, -1 until one does
+  int producer;
+  // Passes that read it and haven't been culled
+  int refCount;
+  // First and last pass that uses it, only set for resources of live passes
+  int firstPass;
+  int lastPass;
+  // Index in FrameGraph.pool, -1 for imported and unused resources
+  int target;
+} FrameGraphResourceNode;
+
+typedef struct _FrameGraphPass {
+  const char *name;
+  FrameGraphExecute execute;
+  void *data;
+  int numReads;
+  FrameGraphResource reads[FRAME_GRAPH_MAX_PASS_RESOURCES];
+  int numWrites;
+  FrameGraphResource writes[FRAME_GRAPH_MAX_PASS_RESOURCES];
+  // Resources the pass writes that are still read by someone
+  int refCount;
+  bool culled;
+} FrameGraphPass;
+
+typedef struct _PooledRenderTarget {
+  RenderTargetDesc desc;
+  RenderTargetHandle handle;
+  // Taken by a resource whose lifetime hasn't ended yet in the current frame
+  bool inUse;
+  // FrameGraph.frameIndex of the last frame a resource was placed in it
+  int lastUsedFrame;
+} PooledRenderTarget;
+
+typedef struct _FrameGraphStats {
+  int numPasses;
+  int numCulledPasses;
+  // Resources of live passes that were placed in pooled targets
+  int numTransientResources;
+  // Pooled targets used by the frame, fewer than the transient resources when
+  // some of them alias
+  int numTargetsUsed;
+  int numTargetsCreated;
+  int numTargetsDestroyed;
+  // Most memory held by transient resources at the same time during the frame
+  int64_t peakLiveBytes;
+  // Memory of all pooled targets after the frame, used or not
+  int64_t pooledBytes;
+} FrameGraphStats;
+
+// Passes and resources are declared every frame, then compileFrameGraph culls
+// the passes whose results nobody reads and places the transient resources in
+// pooled render targets. Resources whose lifetimes don't overlap share a
+// target when their descs match. Passes execute in the order they were added.
+typedef struct _FrameGraph {
+  CreateRenderTarget createRenderTarget;
+  DestroyRenderTarget destroyRenderTarget;
+
+  int numPasses;
+  FrameGraphPass passes[FRAME_GRAPH_MAX_PASSES];
+  int numResources;
+  FrameGraphResourceNode resources[FRAME_GRAPH_MAX_RESOURCES];
+  bool compiled;
+  // Counts compiled frames
+  int frameIndex;
+  // Peaks of live memory in the current and the previous window of
+  // FRAME_GRAPH_RETIRE_FRAMES frames
+  int64_t windowPeakLiveBytes[2];
+
+  int numPooledTargets;
+  int pooledTargetCapacity;
+  PooledRenderTarget *pool;
+
+  FrameGraphStats stats;
+} FrameGraph;
+
+void initFrameGraph(FrameGraph *graph, CreateRenderTarget createRenderTarget,
+                    DestroyRenderTarget destroyRenderTarget);
+// Destroys every pooled render target
+void destroyFrameGraph(FrameGraph *graph);
+
+// Forgets the passes and resources of the last frame, keeping the pool
+void resetFrameGraph(FrameGraph *graph);
+
+FrameGraphResource createFrameGraphTexture(FrameGraph *graph, const char *name,
+                                           RenderTargetDesc desc);
+FrameGraphResource importFrameGraphTexture(FrameGraph *graph, const char *name,
+                                           RenderTargetDesc desc,
+                                           RenderTargetHandle handle);
+
+// Returns the index of the pass. Its reads have to be written by passes that
+// were added before it.
+int addFrameGraphPass(FrameGraph *graph, const char *name,
+                      FrameGraphExecute execute, void *data);
+void readFrameGraphResource(FrameGraph *graph, int pass,
+                            FrameGraphResource resource);
+// Every resource has a single writer
+void writeFrameGraphResource(FrameGraph *graph, int pass,
+                             FrameGraphResource resource);
+
+// Culls, computes lifetimes and places the transient resources in the pool.
+// Targets are created and retired here.
+void compileFrameGraph(FrameGraph *graph);
+// Runs the live passes of a compiled graph in order
+void executeFrameGraph(FrameGraph *graph);
+
+// Backend object of a resource, valid from compileFrameGraph until the next
+// reset
+RenderTargetHandle getFrameGraphTarget(const FrameGraph *graph,
+                                       FrameGraphResource resource);
+
+int64_t getRenderTargetSize(const RenderTargetDesc *desc);
+
+C_INTERFACE_END
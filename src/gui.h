@@ -1,6 +1,7 @@
 #pragma once
 #include "util.h"
 #include "vmath.h"
+#include "rendercounters.h"
 #import <Metal/Metal.h>
 #import <MetalKit/MetalKit.h>
 
@@ -27,6 +28,8 @@ void guiEndFrameAndRender(id<MTLCommandBuffer> commandBufer,
                           id<MTLRenderCommandEncoder> renderEncoder);
 
 void doGUI(bool *shouldLoadNewModel);
+// Overlay with the counters of a frame
+void doRenderCountersGUI(const RenderCounters *counters);
 bool isGUIHandlingMouseInput(void);
 
 void guiDemo(void);
@@ -1,4 +1,5 @@
 #include "gui.h"
+#include "profiler.h"
 #include "external/toml.h"
 #include "external/imgui/imgui_impl_osx.h"
 #include "external/imgui/imgui_impl_metal.h"
@@ -64,6 +65,7 @@ BOOL guiHandleOSXEvent(NSEvent *event, MTKView *view) {
 }
 
 void guiBeginFrame(MTKView *view) {
+  PROFILE_SCOPE("guiBeginFrame");
   ImGui_ImplMetal_NewFrame(view.currentRenderPassDescriptor);
   ImGui_ImplOSX_NewFrame(view);
   ImGui::NewFrame();
@@ -71,6 +73,7 @@ void guiBeginFrame(MTKView *view) {
 
 void guiEndFrameAndRender(id<MTLCommandBuffer> commandBufer,
                           id<MTLRenderCommandEncoder> renderEncoder) {
+  PROFILE_SCOPE("guiEndFrameAndRender");
   ImGui::Render();
   [renderEncoder pushDebugGroup:@"ImGui"];
   ImGui_ImplMetal_RenderDrawData(ImGui::GetDrawData(), commandBufer,
@@ -79,6 +82,7 @@ void guiEndFrameAndRender(id<MTLCommandBuffer> commandBufer,
 }
 
 void doGUI(bool *shouldLoadNewModel) {
+  PROFILE_SCOPE("doGUI");
   ImGui::Begin("Control Panel");
   ImGui::Checkbox("Render wireframe", &gGUI.wireframe);
   int newSelectedModel = gGUI.selectedModel;
@@ -93,6 +97,30 @@ void doGUI(bool *shouldLoadNewModel) {
   ImGui::End();
 }
 
+void doRenderCountersGUI(const RenderCounters *counters) {
+  ImGui::Begin("Render Counters");
+  ImGui::Text("Frame %d, %.2f ms", counters->frameIndex,
+              counters->frameTimeMs);
+  ImGui::Text("%d draws, %d instances, %lld triangles", counters->numDraws,
+              counters->numInstances, (long long)counters->numTriangles);
+  if (ImGui::CollapsingHeader("State changes",
+                              ImGuiTreeNodeFlags_DefaultOpen)) {
+    for (int i = 0; i < StateChangeType_Count; ++i) {
+      ImGui::Text("%s: %d", getStateChangeTypeName((StateChangeType)i),
+                  counters->stateChanges[i]);
+    }
+  }
+  if (ImGui::CollapsingHeader("Uploads", ImGuiTreeNodeFlags_DefaultOpen)) {
+    for (int i = 0; i < UploadType_Count; ++i) {
+      ImGui::Text("%s: %.1f KB", getUploadTypeName((UploadType)i),
+                  (double)counters->uploadedBytes[i] / 1024.0);
+    }
+  }
+  ImGui::Text("%d allocations of %.1f KB", counters->numAllocations,
+              (double)counters->allocatedBytes / 1024.0);
+  ImGui::End();
+}
+
 bool isGUIHandlingMouseInput(void) {
   bool result = ImGui::GetIO().WantCaptureMouse;
   return result;
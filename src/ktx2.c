@@ -0,0 +1,464 @@
+#include "ktx2.h"
+#include "memory.h"
+#include <string.h>
+
+// Vulkan format values used by KTX2 files
+#define KTX2_VK_FORMAT_R8G8B8A8_UNORM 37
+#define KTX2_VK_FORMAT_R8G8B8A8_SRGB 43
+#define KTX2_VK_FORMAT_BC1_RGB_UNORM_BLOCK 131
+#define KTX2_VK_FORMAT_BC1_RGB_SRGB_BLOCK 132
+#define KTX2_VK_FORMAT_BC1_RGBA_UNORM_BLOCK 133
+#define KTX2_VK_FORMAT_BC1_RGBA_SRGB_BLOCK 134
+#define KTX2_VK_FORMAT_BC3_UNORM_BLOCK 137
+#define KTX2_VK_FORMAT_BC3_SRGB_BLOCK 138
+#define KTX2_VK_FORMAT_BC4_UNORM_BLOCK 139
+#define KTX2_VK_FORMAT_BC5_UNORM_BLOCK 141
+#define KTX2_VK_FORMAT_BC7_UNORM_BLOCK 145
+#define KTX2_VK_FORMAT_BC7_SRGB_BLOCK 146
+
+// Color models of the data format descriptor
+#define KTX2_DF_MODEL_ETC1S 163
+#define KTX2_DF_MODEL_UASTC 166
+
+#define KTX2_SUPERCOMPRESSION_BASIS_LZ 1
+
+#define KTX2_DF_MODEL_BC1A 128
+
+#define KTX2_HEADER_SIZE 80
+// Total size word and a basic descriptor block with one sample
+#define KTX2_DFD_SIZE 44
+#define KTX2_LEVEL_INDEX_ENTRY_SIZE 24
+
+static const uint8_t gKtx2Identifier[12] = {0xab, 0x4b, 0x54, 0x58, 0x20, 0x32,
+                                            0x30, 0xbb, 0x0d, 0x0a, 0x1a, 0x0a};
+
+static uint32_t readKtx2U32(const uint8_t *data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint64_t readKtx2U64(const uint8_t *data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+bool isKtx2Data(const uint8_t *data, int size) {
+  bool result = size >= KTX2_HEADER_SIZE &&
+                memcmp(data, gKtx2Identifier, sizeof(gKtx2Identifier)) == 0;
+  return result;
+}
+
+bool isKtx2BasisData(const uint8_t *data, int size) {
+  if (!isKtx2Data(data, size) || readKtx2U32(data + 12) != 0) {
+    return false;
+  }
+  if (readKtx2U32(data + 44) == KTX2_SUPERCOMPRESSION_BASIS_LZ) {
+    return true;
+  }
+
+  // The color model sits in the first descriptor block, after the total size
+  // and two words of block header
+  uint32_t dfdOffset = readKtx2U32(data + 48);
+  if ((uint64_t)dfdOffset + 13 > (uint64_t)size) {
+    return false;
+  }
+  uint8_t colorModel = data[dfdOffset + 12];
+  return colorModel == KTX2_DF_MODEL_UASTC || colorModel == KTX2_DF_MODEL_ETC1S;
+}
+
+// sRGB variants are mapped to their UNORM counterparts, which matches how the
+// PNG/JPEG path uploads RGBA8 data.
+static Ktx2Format ktx2FormatFromVkFormat(uint32_t vkFormat) {
+  switch (vkFormat) {
+  case KTX2_VK_FORMAT_R8G8B8A8_UNORM:
+  case KTX2_VK_FORMAT_R8G8B8A8_SRGB:
+    return Ktx2Format_RGBA8;
+  case KTX2_VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+  case KTX2_VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+  case KTX2_VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+  case KTX2_VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    return Ktx2Format_BC1;
+  case KTX2_VK_FORMAT_BC3_UNORM_BLOCK:
+  case KTX2_VK_FORMAT_BC3_SRGB_BLOCK:
+    return Ktx2Format_BC3;
+  case KTX2_VK_FORMAT_BC4_UNORM_BLOCK:
+    return Ktx2Format_BC4;
+  case KTX2_VK_FORMAT_BC5_UNORM_BLOCK:
+    return Ktx2Format_BC5;
+  case KTX2_VK_FORMAT_BC7_UNORM_BLOCK:
+  case KTX2_VK_FORMAT_BC7_SRGB_BLOCK:
+    return Ktx2Format_BC7;
+  default:
+    return Ktx2Format_Unsupported;
+  }
+}
+
+static int ktx2LevelSize(Ktx2Format format, int width, int height) {
+  int blocksX = (width + 3) / 4;
+  int blocksY = (height + 3) / 4;
+  switch (format) {
+  case Ktx2Format_RGBA8:
+    return width * height * 4;
+  case Ktx2Format_BC1:
+  case Ktx2Format_BC4:
+    return blocksX * blocksY * 8;
+  case Ktx2Format_BC3:
+  case Ktx2Format_BC5:
+  case Ktx2Format_BC7:
+    return blocksX * blocksY * 16;
+  default:
+    return 0;
+  }
+}
+
+bool parseKtx2(Ktx2Image *image, const uint8_t *data, int size) {
+  *image = (Ktx2Image){0};
+
+  if (!isKtx2Data(data, size)) {
+    return false;
+  }
+
+  uint32_t vkFormat = readKtx2U32(data + 12);
+  uint32_t pixelWidth = readKtx2U32(data + 20);
+  uint32_t pixelHeight = readKtx2U32(data + 24);
+  uint32_t pixelDepth = readKtx2U32(data + 28);
+  uint32_t layerCount = readKtx2U32(data + 32);
+  uint32_t faceCount = readKtx2U32(data + 36);
+  uint32_t levelCount = readKtx2U32(data + 40);
+  uint32_t supercompressionScheme = readKtx2U32(data + 44);
+
+  if (supercompressionScheme != 0 || pixelDepth > 1 || layerCount > 1 ||
+      faceCount != 1 || pixelHeight == 0) {
+    return false;
+  }
+
+  image->format = ktx2FormatFromVkFormat(vkFormat);
+  if (image->format == Ktx2Format_Unsupported) {
+    return false;
+  }
+
+  // A level count of 0 asks the loader to generate the mip chain
+  int numLevels = levelCount > 0 ? (int)levelCount : 1;
+  if (numLevels > KTX2_MAX_LEVELS ||
+      KTX2_HEADER_SIZE + numLevels * KTX2_LEVEL_INDEX_ENTRY_SIZE > size) {
+    return false;
+  }
+
+  image->width = pixelWidth;
+  image->height = pixelHeight;
+  image->numLevels = numLevels;
+
+  for (int i = 0; i < numLevels; ++i) {
+    const uint8_t *entry =
+        data + KTX2_HEADER_SIZE + i * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+    uint64_t byteOffset = readKtx2U64(entry);
+    uint64_t byteLength = readKtx2U64(entry + 8);
+
+    Ktx2Level *level = &image->levels[i];
+    level->width = MAX(image->width >> i, 1);
+    level->height = MAX(image->height >> i, 1);
+    level->size = ktx2LevelSize(image->format, level->width, level->height);
+    if ((uint64_t)level->size > byteLength ||
+        byteOffset + byteLength > (uint64_t)size) {
+      return false;
+    }
+    level->data = data + byteOffset;
+  }
+
+  return true;
+}
+
+bool canDecodeKtx2Format(Ktx2Format format) {
+  bool result = format == Ktx2Format_RGBA8 || format == Ktx2Format_BC1 ||
+                format == Ktx2Format_BC3 || format == Ktx2Format_BC4 ||
+                format == Ktx2Format_BC5;
+  return result;
+}
+
+static void decodeBC1ColorBlock(const uint8_t *block, uint8_t outTexels[16][4],
+                                bool allowPunchThrough) {
+  uint16_t c0 = (uint16_t)(block[0] | (block[1] << 8));
+  uint16_t c1 = (uint16_t)(block[2] | (block[3] << 8));
+  uint32_t selectors = readKtx2U32(block + 4);
+
+  uint8_t palette[4][4];
+  uint16_t endpoints[2] = {c0, c1};
+  for (int i = 0; i < 2; ++i) {
+    uint16_t c = endpoints[i];
+    palette[i][0] = (uint8_t)(((c >> 11) & 31) * 255 / 31);
+    palette[i][1] = (uint8_t)(((c >> 5) & 63) * 255 / 63);
+    palette[i][2] = (uint8_t)((c & 31) * 255 / 31);
+    palette[i][3] = 255;
+  }
+
+  for (int k = 0; k < 3; ++k) {
+    if (c0 > c1 || !allowPunchThrough) {
+      palette[2][k] = (uint8_t)((2 * palette[0][k] + palette[1][k]) / 3);
+      palette[3][k] = (uint8_t)((palette[0][k] + 2 * palette[1][k]) / 3);
+    } else {
+      palette[2][k] = (uint8_t)((palette[0][k] + palette[1][k]) / 2);
+      palette[3][k] = 0;
+    }
+  }
+  palette[2][3] = 255;
+  palette[3][3] = (c0 > c1 || !allowPunchThrough) ? 255 : 0;
+
+  for (int i = 0; i < 16; ++i) {
+    memcpy(outTexels[i], palette[(selectors >> (i * 2)) & 3], 4);
+  }
+}
+
+static void decodeBC4Block(const uint8_t *block, uint8_t outTexels[16][4],
+                           int channel) {
+  uint8_t r0 = block[0];
+  uint8_t r1 = block[1];
+
+  uint8_t palette[8] = {r0, r1};
+  if (r0 > r1) {
+    for (int i = 1; i < 7; ++i) {
+      palette[i + 1] = (uint8_t)(((7 - i) * r0 + i * r1) / 7);
+    }
+  } else {
+    for (int i = 1; i < 5; ++i) {
+      palette[i + 1] = (uint8_t)(((5 - i) * r0 + i * r1) / 5);
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+
+  uint64_t selectors = 0;
+  for (int i = 0; i < 6; ++i) {
+    selectors |= (uint64_t)block[2 + i] << (i * 8);
+  }
+
+  for (int i = 0; i < 16; ++i) {
+    outTexels[i][channel] = palette[(selectors >> (i * 3)) & 7];
+  }
+}
+
+void decodeKtx2Level(const Ktx2Image *image, int level, uint8_t *outRGBA) {
+  const Ktx2Level *ktxLevel = &image->levels[level];
+  int width = ktxLevel->width;
+  int height = ktxLevel->height;
+
+  if (image->format == Ktx2Format_RGBA8) {
+    memcpy(outRGBA, ktxLevel->data, ktxLevel->size);
+    return;
+  }
+
+  int blockSize = (image->format == Ktx2Format_BC1 ||
+                   image->format == Ktx2Format_BC4)
+                      ? 8
+                      : 16;
+  int blocksX = (width + 3) / 4;
+  int blocksY = (height + 3) / 4;
+
+  for (int by = 0; by < blocksY; ++by) {
+    for (int bx = 0; bx < blocksX; ++bx) {
+      const uint8_t *block = ktxLevel->data + (by * blocksX + bx) * blockSize;
+      uint8_t texels[16][4];
+      memset(texels, 0, sizeof(texels));
+
+      switch (image->format) {
+      case Ktx2Format_BC1:
+        decodeBC1ColorBlock(block, texels, true);
+        break;
+      case Ktx2Format_BC3:
+        decodeBC1ColorBlock(block + 8, texels, false);
+        decodeBC4Block(block, texels, 3);
+        break;
+      case Ktx2Format_BC4:
+        decodeBC4Block(block, texels, 0);
+        for (int i = 0; i < 16; ++i) {
+          texels[i][3] = 255;
+        }
+        break;
+      case Ktx2Format_BC5:
+        decodeBC4Block(block, texels, 0);
+        decodeBC4Block(block + 8, texels, 1);
+        for (int i = 0; i < 16; ++i) {
+          texels[i][3] = 255;
+        }
+        break;
+      default:
+        ASSERT(false);
+        break;
+      }
+
+      for (int y = 0; y < 4 && by * 4 + y < height; ++y) {
+        for (int x = 0; x < 4 && bx * 4 + x < width; ++x) {
+          uint8_t *dst = outRGBA + ((by * 4 + y) * width + bx * 4 + x) * 4;
+          memcpy(dst, texels[y * 4 + x], 4);
+        }
+      }
+    }
+  }
+}
+
+static uint16_t packRgb565(const uint8_t *rgb) {
+  return (uint16_t)(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) |
+                    (rgb[2] >> 3));
+}
+
+// Texels past the edge repeat the last row and column
+static void encodeBC1Block(const uint8_t *rgba, int width, int height,
+                           int blockX, int blockY, uint8_t *outBlock) {
+  uint8_t texels[16][3];
+  uint8_t minColor[3] = {255, 255, 255};
+  uint8_t maxColor[3] = {0, 0, 0};
+  for (int i = 0; i < 16; ++i) {
+    int x = MIN(blockX * 4 + i % 4, width - 1);
+    int y = MIN(blockY * 4 + i / 4, height - 1);
+    for (int c = 0; c < 3; ++c) {
+      texels[i][c] = rgba[(y * width + x) * 4 + c];
+      minColor[c] = MIN(minColor[c], texels[i][c]);
+      maxColor[c] = MAX(maxColor[c], texels[i][c]);
+    }
+  }
+
+  // c0 > c1 picks the four color mode
+  uint16_t c0 = packRgb565(maxColor);
+  uint16_t c1 = packRgb565(minColor);
+  uint32_t selectors = 0;
+  if (c0 > c1) {
+    int axis[3];
+    int lengthSq = 0;
+    for (int c = 0; c < 3; ++c) {
+      axis[c] = maxColor[c] - minColor[c];
+      lengthSq += axis[c] * axis[c];
+    }
+    // Selectors 0, 2, 3, 1 go from c0 to c1
+    static const uint32_t steps[4] = {1, 3, 2, 0};
+    for (int i = 0; i < 16; ++i) {
+      int projection = 0;
+      for (int c = 0; c < 3; ++c) {
+        projection += (texels[i][c] - minColor[c]) * axis[c];
+      }
+      int step = MIN((projection * 3 + lengthSq / 2) / lengthSq, 3);
+      selectors |= steps[step] << (i * 2);
+    }
+  } else {
+    c1 = c0;
+  }
+
+  outBlock[0] = (uint8_t)c0;
+  outBlock[1] = (uint8_t)(c0 >> 8);
+  outBlock[2] = (uint8_t)c1;
+  outBlock[3] = (uint8_t)(c1 >> 8);
+  memcpy(outBlock + 4, &selectors, sizeof(selectors));
+}
+
+static void downsampleRgba8(const uint8_t *src, int srcWidth, int srcHeight,
+                            uint8_t *dst, int dstWidth, int dstHeight) {
+  for (int y = 0; y < dstHeight; ++y) {
+    int y0 = MIN(y * 2, srcHeight - 1);
+    int y1 = MIN(y * 2 + 1, srcHeight - 1);
+    for (int x = 0; x < dstWidth; ++x) {
+      int x0 = MIN(x * 2, srcWidth - 1);
+      int x1 = MIN(x * 2 + 1, srcWidth - 1);
+      for (int c = 0; c < 4; ++c) {
+        int sum = src[(y0 * srcWidth + x0) * 4 + c] +
+                  src[(y0 * srcWidth + x1) * 4 + c] +
+                  src[(y1 * srcWidth + x0) * 4 + c] +
+                  src[(y1 * srcWidth + x1) * 4 + c];
+        dst[(y * dstWidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+static void writeKtx2U32(uint8_t *data, uint32_t value) {
+  memcpy(data, &value, sizeof(value));
+}
+
+static void writeKtx2U64(uint8_t *data, uint64_t value) {
+  memcpy(data, &value, sizeof(value));
+}
+
+uint8_t *createKtx2BC1(const uint8_t *rgba, int width, int height,
+                       int *outSize) {
+  int numLevels = 1;
+  while (numLevels < KTX2_MAX_LEVELS &&
+         (width >> numLevels > 0 || height >> numLevels > 0)) {
+    ++numLevels;
+  }
+
+  // Levels are stored smallest first, each 8 byte aligned
+  int levelOffsets[KTX2_MAX_LEVELS];
+  int levelSizes[KTX2_MAX_LEVELS];
+  int dfdOffset = KTX2_HEADER_SIZE + numLevels * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+  int size = dfdOffset + KTX2_DFD_SIZE;
+  for (int level = numLevels - 1; level >= 0; --level) {
+    size = (size + 7) & ~7;
+    levelOffsets[level] = size;
+    levelSizes[level] = ktx2LevelSize(Ktx2Format_BC1, MAX(width >> level, 1),
+                                      MAX(height >> level, 1));
+    size += levelSizes[level];
+  }
+
+  uint8_t *data = MMALLOC_ARRAY_ZEROES(uint8_t, size);
+  memcpy(data, gKtx2Identifier, sizeof(gKtx2Identifier));
+  writeKtx2U32(data + 12, KTX2_VK_FORMAT_BC1_RGB_UNORM_BLOCK);
+  writeKtx2U32(data + 16, 1);
+  writeKtx2U32(data + 20, width);
+  writeKtx2U32(data + 24, height);
+  writeKtx2U32(data + 36, 1);
+  writeKtx2U32(data + 40, numLevels);
+  writeKtx2U32(data + 48, dfdOffset);
+  writeKtx2U32(data + 52, KTX2_DFD_SIZE);
+
+  uint8_t *dfd = data + dfdOffset;
+  writeKtx2U32(dfd, KTX2_DFD_SIZE);
+  writeKtx2U32(dfd + 8, 2 | (KTX2_DFD_SIZE - 4) << 16);
+  dfd[12] = KTX2_DF_MODEL_BC1A;
+  dfd[13] = 1;
+  dfd[14] = 1;
+  dfd[16] = 3;
+  dfd[17] = 3;
+  dfd[20] = 8;
+  writeKtx2U32(dfd + 28, 63 << 16);
+  writeKtx2U32(dfd + 40, UINT32_MAX);
+
+  const uint8_t *levelPixels = rgba;
+  uint8_t *scratch[2] = {NULL, NULL};
+  for (int level = 0; level < numLevels; ++level) {
+    int levelWidth = MAX(width >> level, 1);
+    int levelHeight = MAX(height >> level, 1);
+    if (level > 0) {
+      uint8_t **dst = &scratch[level % 2];
+      if (!*dst) {
+        *dst = MMALLOC_ARRAY(uint8_t, levelWidth * levelHeight * 4);
+      }
+      downsampleRgba8(levelPixels, MAX(width >> (level - 1), 1),
+                      MAX(height >> (level - 1), 1), *dst, levelWidth,
+                      levelHeight);
+      levelPixels = *dst;
+    }
+
+    uint8_t *entry =
+        data + KTX2_HEADER_SIZE + level * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+    writeKtx2U64(entry, levelOffsets[level]);
+    writeKtx2U64(entry + 8, levelSizes[level]);
+    writeKtx2U64(entry + 16, levelSizes[level]);
+
+    int blocksX = (levelWidth + 3) / 4;
+    int blocksY = (levelHeight + 3) / 4;
+    uint8_t *blocks = data + levelOffsets[level];
+    for (int blockY = 0; blockY < blocksY; ++blockY) {
+      for (int blockX = 0; blockX < blocksX; ++blockX) {
+        encodeBC1Block(levelPixels, levelWidth, levelHeight, blockX, blockY,
+                       blocks + (blockY * blocksX + blockX) * 8);
+      }
+    }
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (scratch[i]) {
+      MFREE(scratch[i]);
+    }
+  }
+
+  *outSize = size;
+  return data;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KTX2_MAX_LEVELS 16
+
+C_INTERFACE_BEGIN
+
+typedef enum _Ktx2Format {
+  Ktx2Format_Unsupported = 0,
+  Ktx2Format_RGBA8,
+  Ktx2Format_BC1,
+  Ktx2Format_BC3,
+  Ktx2Format_BC4,
+  Ktx2Format_BC5,
+  Ktx2Format_BC7,
+
+  Ktx2Format_Count
+} Ktx2Format;
+
+typedef struct _Ktx2Level {
+  const uint8_t *data;
+  int size;
+  int width;
+  int height;
+} Ktx2Level;
+
+// Level data points into the buffer handed to parseKtx2
+typedef struct _Ktx2Image {
+  Ktx2Format format;
+  int width;
+  int height;
+  int numLevels;
+  Ktx2Level levels[KTX2_MAX_LEVELS];
+} Ktx2Image;
+
+bool isKtx2Data(const uint8_t *data, int size);
+
+// Basis Universal payloads: BasisLZ supercompressed ETC1S or UASTC blocks.
+// There is no transcoder for them, so parseKtx2 rejects them.
+bool isKtx2BasisData(const uint8_t *data, int size);
+
+// Only 2D images without supercompression are accepted. Basis Universal
+// payloads, which is what KHR_texture_basisu assets normally carry, are
+// rejected so the caller can fall back to the glTF texture's PNG/JPEG source.
+bool parseKtx2(Ktx2Image *image, const uint8_t *data, int size);
+
+// Block formats that a backend cannot sample directly can be expanded to RGBA8
+// on the CPU. BC7 has no CPU decoder and returns false.
+bool canDecodeKtx2Format(Ktx2Format format);
+void decodeKtx2Level(const Ktx2Image *image, int level, uint8_t *outRGBA);
+
+// Writes a KTX2 file of BC1 blocks with a box filtered mip chain from RGBA8
+// pixels, with the endpoints of every block at the corners of its color
+// bounding box. Fast and rough, meant for benchmarks rather than assets.
+// Returns the file, which the caller frees with MFREE.
+uint8_t *createKtx2BC1(const uint8_t *rgba, int width, int height,
+                       int *outSize);
+
+C_INTERFACE_END
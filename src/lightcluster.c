@@ -0,0 +1,277 @@
+#include "lightcluster.h"
+#include "app.h"
+#include "memory.h"
+#include "thread.h"
+#include <math.h>
+#include <string.h>
+
+typedef struct _LightClusterJob {
+  LightClusters *clusters;
+  Mat4 viewMat;
+  const Light *lights;
+  int numLights;
+} LightClusterJob;
+
+static Float4 clusterDistanceOutside(Float4 minValue, Float4 maxValue,
+                                     float value) {
+  Float4 below = minValue - value;
+  Float4 above = value - maxValue;
+  return float4Select(below > 0, below,
+                      float4Select(above > 0, above, (Float4){0}));
+}
+
+static int getClusterTile(float ndc, int numTiles) {
+  int tile = (int)floorf((ndc * 0.5f + 0.5f) * (float)numTiles);
+  return MIN(MAX(tile, 0), numTiles - 1);
+}
+
+static int getClusterSlice(const LightClusters *clusters, float depth) {
+  int slice = (int)floorf(logf(depth / clusters->nearZ) * clusters->sliceScale);
+  return MIN(MAX(slice, 0), LIGHT_CLUSTERS_Z - 1);
+}
+
+void initLightClusters(LightClusters *clusters) {
+  *clusters = (LightClusters){0};
+  int numGroups = LIGHT_CLUSTER_COUNT / 4;
+  clusters->minX = MMALLOC_ARRAY(Float4, numGroups);
+  clusters->minY = MMALLOC_ARRAY(Float4, numGroups);
+  clusters->minZ = MMALLOC_ARRAY(Float4, numGroups);
+  clusters->maxX = MMALLOC_ARRAY(Float4, numGroups);
+  clusters->maxY = MMALLOC_ARRAY(Float4, numGroups);
+  clusters->maxZ = MMALLOC_ARRAY(Float4, numGroups);
+  clusters->ranges = MMALLOC_ARRAY_ZEROES(uint32_t, LIGHT_CLUSTER_COUNT * 2);
+  clusters->clusterCounts = MMALLOC_ARRAY(uint16_t, LIGHT_CLUSTER_COUNT);
+  clusters->clusterLights = MMALLOC_ARRAY(
+      uint32_t, LIGHT_CLUSTER_COUNT * LIGHT_CLUSTER_MAX_LIGHTS);
+}
+
+void destroyLightClusters(LightClusters *clusters) {
+  MFREE(clusters->clusterLights);
+  MFREE(clusters->clusterCounts);
+  MFREE(clusters->lightBounds);
+  MFREE(clusters->viewSpheres);
+  MFREE(clusters->lightIndices);
+  MFREE(clusters->ranges);
+  MFREE(clusters->maxZ);
+  MFREE(clusters->maxY);
+  MFREE(clusters->maxX);
+  MFREE(clusters->minZ);
+  MFREE(clusters->minY);
+  MFREE(clusters->minX);
+  *clusters = (LightClusters){0};
+}
+
+void setLightClusterProjection(LightClusters *clusters, Mat4 projMat,
+                               float nearZ, float farZ) {
+  float tanHalfX = 1.f / projMat.cols[0][0];
+  float tanHalfY = 1.f / projMat.cols[1][1];
+  if (clusters->nearZ == nearZ && clusters->farZ == farZ &&
+      clusters->tanHalfX == tanHalfX && clusters->tanHalfY == tanHalfY) {
+    return;
+  }
+  clusters->nearZ = nearZ;
+  clusters->farZ = farZ;
+  clusters->tanHalfX = tanHalfX;
+  clusters->tanHalfY = tanHalfY;
+  clusters->sliceScale = (float)LIGHT_CLUSTERS_Z / logf(farZ / nearZ);
+
+  // Tile edges move linearly with depth, so the corners at the two slice
+  // planes bound the frustum piece
+  for (int z = 0; z < LIGHT_CLUSTERS_Z; ++z) {
+    float nearDepth = nearZ * expf((float)z / clusters->sliceScale);
+    float farDepth = nearZ * expf((float)(z + 1) / clusters->sliceScale);
+    for (int y = 0; y < LIGHT_CLUSTERS_Y; ++y) {
+      float y0 = (-1.f + 2.f * (float)y / LIGHT_CLUSTERS_Y) * tanHalfY;
+      float y1 = (-1.f + 2.f * (float)(y + 1) / LIGHT_CLUSTERS_Y) * tanHalfY;
+      for (int x = 0; x < LIGHT_CLUSTERS_X; ++x) {
+        float x0 = (-1.f + 2.f * (float)x / LIGHT_CLUSTERS_X) * tanHalfX;
+        float x1 = (-1.f + 2.f * (float)(x + 1) / LIGHT_CLUSTERS_X) * tanHalfX;
+        int cluster = (z * LIGHT_CLUSTERS_Y + y) * LIGHT_CLUSTERS_X + x;
+        int group = cluster / 4;
+        int lane = cluster % 4;
+        clusters->minX[group][lane] = fminf(x0 * nearDepth, x0 * farDepth);
+        clusters->maxX[group][lane] = fmaxf(x1 * nearDepth, x1 * farDepth);
+        clusters->minY[group][lane] = fminf(y0 * nearDepth, y0 * farDepth);
+        clusters->maxY[group][lane] = fmaxf(y1 * nearDepth, y1 * farDepth);
+        clusters->minZ[group][lane] = -farDepth;
+        clusters->maxZ[group][lane] = -nearDepth;
+      }
+    }
+  }
+}
+
+// Empty bounds have a min slice past the max one
+static void boundLightRange(void *data, int begin, int end) {
+  const LightClusterJob *job = (const LightClusterJob *)data;
+  LightClusters *clusters = job->clusters;
+
+  for (int i = begin; i < end; ++i) {
+    const Light *light = &job->lights[i];
+    Float4 position = {light->position.x, light->position.y,
+                       light->position.z, 1};
+    Float3 center = mat4MultiplyFloat4(job->viewMat, position).xyz;
+    float radius = light->range;
+    clusters->viewSpheres[i] = (Float4){center.x, center.y, center.z, radius};
+
+    uint8_t *bounds = clusters->lightBounds[i];
+    bounds[4] = 1;
+    bounds[5] = 0;
+
+    float depth = -center.z;
+    if (depth + radius < clusters->nearZ || depth - radius > clusters->farZ) {
+      continue;
+    }
+    float nearDepth = fmaxf(depth - radius, clusters->nearZ);
+    float farDepth = fminf(depth + radius, clusters->farZ);
+
+    float minNdcX = fminf((center.x - radius) / nearDepth,
+                          (center.x - radius) / farDepth) /
+                    clusters->tanHalfX;
+    float maxNdcX = fmaxf((center.x + radius) / nearDepth,
+                          (center.x + radius) / farDepth) /
+                    clusters->tanHalfX;
+    float minNdcY = fminf((center.y - radius) / nearDepth,
+                          (center.y - radius) / farDepth) /
+                    clusters->tanHalfY;
+    float maxNdcY = fmaxf((center.y + radius) / nearDepth,
+                          (center.y + radius) / farDepth) /
+                    clusters->tanHalfY;
+    if (maxNdcX < -1 || minNdcX > 1 || maxNdcY < -1 || minNdcY > 1) {
+      continue;
+    }
+
+    bounds[0] = (uint8_t)getClusterTile(minNdcX, LIGHT_CLUSTERS_X);
+    bounds[1] = (uint8_t)getClusterTile(maxNdcX, LIGHT_CLUSTERS_X);
+    bounds[2] = (uint8_t)getClusterTile(minNdcY, LIGHT_CLUSTERS_Y);
+    bounds[3] = (uint8_t)getClusterTile(maxNdcY, LIGHT_CLUSTERS_Y);
+    bounds[4] = (uint8_t)getClusterSlice(clusters, nearDepth);
+    bounds[5] = (uint8_t)getClusterSlice(clusters, farDepth);
+  }
+}
+
+// Lights are visited in index order, so every cluster lists them sorted
+static void assignSliceLights(void *data, int begin, int end) {
+  const LightClusterJob *job = (const LightClusterJob *)data;
+  LightClusters *clusters = job->clusters;
+
+  for (int z = begin; z < end; ++z) {
+    int firstCluster = z * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_X;
+    memset(&clusters->clusterCounts[firstCluster], 0,
+           sizeof(uint16_t) * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_X);
+    int numDropped = 0;
+
+    for (int i = 0; i < job->numLights; ++i) {
+      const uint8_t *bounds = clusters->lightBounds[i];
+      if (z < bounds[4] || z > bounds[5]) {
+        continue;
+      }
+      Float4 sphere = clusters->viewSpheres[i];
+      float radiusSquared = sphere.w * sphere.w;
+
+      for (int y = bounds[2]; y <= bounds[3]; ++y) {
+        int row = firstCluster + y * LIGHT_CLUSTERS_X;
+        for (int x = bounds[0] & ~3; x <= bounds[1]; x += 4) {
+          int group = (row + x) / 4;
+          Float4 dx = clusterDistanceOutside(clusters->minX[group],
+                                             clusters->maxX[group], sphere.x);
+          Float4 dy = clusterDistanceOutside(clusters->minY[group],
+                                             clusters->maxY[group], sphere.y);
+          Float4 dz = clusterDistanceOutside(clusters->minZ[group],
+                                             clusters->maxZ[group], sphere.z);
+          Int4 hit = dx * dx + dy * dy + dz * dz <= radiusSquared;
+          if (!(hit[0] | hit[1] | hit[2] | hit[3])) {
+            continue;
+          }
+
+          for (int lane = 0; lane < 4; ++lane) {
+            int tile = x + lane;
+            if (!hit[lane] || tile < bounds[0] || tile > bounds[1]) {
+              continue;
+            }
+            int cluster = row + tile;
+            int count = clusters->clusterCounts[cluster];
+            if (count == LIGHT_CLUSTER_MAX_LIGHTS) {
+              ++numDropped;
+              continue;
+            }
+            clusters->clusterLights[cluster * LIGHT_CLUSTER_MAX_LIGHTS +
+                                    count] = (uint32_t)i;
+            clusters->clusterCounts[cluster] = (uint16_t)(count + 1);
+          }
+        }
+      }
+    }
+    clusters->sliceDroppedLights[z] = numDropped;
+  }
+}
+
+void assignLightClusters(LightClusters *clusters, Mat4 viewMat,
+                         const Light *lights, int numLights) {
+  double startTime = getTime();
+
+  if (clusters->lightCapacity < numLights) {
+    MFREE(clusters->lightBounds);
+    MFREE(clusters->viewSpheres);
+    clusters->lightCapacity = MAX(numLights, clusters->lightCapacity * 2);
+    clusters->viewSpheres = MMALLOC_ARRAY(Float4, clusters->lightCapacity);
+    clusters->lightBounds = (uint8_t(*)[6])MMALLOC_ARRAY(
+        uint8_t, clusters->lightCapacity * 6);
+  }
+
+  LightClusterJob job = {
+      .clusters = clusters,
+      .viewMat = viewMat,
+      .lights = lights,
+      .numLights = numLights,
+  };
+  parallelFor(numLights, LIGHT_CLUSTER_GRAIN_SIZE, boundLightRange, &job);
+  parallelFor(LIGHT_CLUSTERS_Z, 1, assignSliceLights, &job);
+
+  int numLightIndices = 0;
+  for (int i = 0; i < LIGHT_CLUSTER_COUNT; ++i) {
+    numLightIndices += clusters->clusterCounts[i];
+  }
+  if (clusters->lightIndexCapacity < numLightIndices) {
+    MFREE(clusters->lightIndices);
+    clusters->lightIndexCapacity =
+        MAX(numLightIndices, clusters->lightIndexCapacity * 2);
+    clusters->lightIndices =
+        MMALLOC_ARRAY(uint32_t, clusters->lightIndexCapacity);
+  }
+
+  LightClusterStats *stats = &clusters->stats;
+  *stats = (LightClusterStats){.numLights = numLights};
+  int offset = 0;
+  for (int i = 0; i < LIGHT_CLUSTER_COUNT; ++i) {
+    int count = clusters->clusterCounts[i];
+    memcpy(&clusters->lightIndices[offset],
+           &clusters->clusterLights[i * LIGHT_CLUSTER_MAX_LIGHTS],
+           sizeof(uint32_t) * count);
+    clusters->ranges[i * 2] = (uint32_t)offset;
+    clusters->ranges[i * 2 + 1] = (uint32_t)count;
+    offset += count;
+    stats->maxClusterLights = MAX(stats->maxClusterLights, count);
+  }
+  clusters->numLightIndices = numLightIndices;
+
+  for (int i = 0; i < numLights; ++i) {
+    if (clusters->lightBounds[i][4] <= clusters->lightBounds[i][5]) {
+      ++stats->numVisibleLights;
+    }
+  }
+  for (int z = 0; z < LIGHT_CLUSTERS_Z; ++z) {
+    stats->numDroppedLights += clusters->sliceDroppedLights[z];
+  }
+  stats->numLightIndices = numLightIndices;
+  stats->timeMs = (getTime() - startTime) * 1000.0;
+}
+
+int getLightCluster(const LightClusters *clusters, Float3 viewPosition) {
+  float depth = -viewPosition.z;
+  int x = getClusterTile(viewPosition.x / (depth * clusters->tanHalfX),
+                         LIGHT_CLUSTERS_X);
+  int y = getClusterTile(viewPosition.y / (depth * clusters->tanHalfY),
+                         LIGHT_CLUSTERS_Y);
+  int z = getClusterSlice(clusters, depth);
+  return (z * LIGHT_CLUSTERS_Y + y) * LIGHT_CLUSTERS_X + x;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "util.h"
+#include "vmath.h"
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+// Froxel grid of the view. X is split evenly in NDC and must be a multiple of
+// four, Z is split exponentially between the near and far planes.
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 8
+#define LIGHT_CLUSTERS_Z 24
+#define LIGHT_CLUSTER_COUNT                                                    \
+  (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
+
+// Lights past this many in one cluster are dropped and counted in the stats
+#define LIGHT_CLUSTER_MAX_LIGHTS 256
+
+// Lights without a range stop where their intensity falls below this
+#define LIGHT_MIN_INTENSITY 0.01f
+
+#define LIGHT_CLUSTER_GRAIN_SIZE 1024
+
+typedef enum _LightType {
+  LightType_Point = 0,
+  LightType_Spot,
+
+  LightType_Count
+} LightType;
+
+typedef struct _Light {
+  LightType type;
+  // World space. Spot lights shine along direction.
+  Float3 position;
+  Float3 direction;
+  // Linear color times intensity
+  Float3 color;
+  float range;
+  // Cosines of the spot cone half angles
+  float innerConeCos;
+  float outerConeCos;
+} Light;
+
+typedef struct _LightClusterStats {
+  int numLights;
+  // Lights that touch at least one cluster
+  int numVisibleLights;
+  int numLightIndices;
+  int maxClusterLights;
+  // Light indices that didn't fit in full clusters
+  int numDroppedLights;
+  double timeMs;
+} LightClusterStats;
+
+// Per cluster lists of the lights that reach into it. Lights are bounded by
+// their range sphere, so the lists of spot lights are conservative.
+typedef struct _LightClusters {
+  float nearZ;
+  float farZ;
+  // Tangents of the half angles of the projection
+  float tanHalfX;
+  float tanHalfY;
+  // Slice of view depth d is floor(log(d / nearZ) * sliceScale)
+  float sliceScale;
+
+  // View space bounds of the clusters, four per element in cluster order
+  Float4 *minX;
+  Float4 *minY;
+  Float4 *minZ;
+  Float4 *maxX;
+  Float4 *maxY;
+  Float4 *maxZ;
+
+  // First index in lightIndices and light count of each cluster, interleaved
+  uint32_t *ranges;
+  int numLightIndices;
+  int lightIndexCapacity;
+  uint32_t *lightIndices;
+
+  // Scratch of assignLightClusters
+  int lightCapacity;
+  // View space center and radius of every light
+  Float4 *viewSpheres;
+  // Conservative cluster range of every light, max inclusive
+  uint8_t (*lightBounds)[6];
+  uint16_t *clusterCounts;
+  uint32_t *clusterLights;
+  int sliceDroppedLights[LIGHT_CLUSTERS_Z];
+
+  LightClusterStats stats;
+} LightClusters;
+
+void initLightClusters(LightClusters *clusters);
+void destroyLightClusters(LightClusters *clusters);
+
+// Rebuilds the cluster bounds when the projection changed. projMat has to be
+// a symmetric perspective projection.
+void setLightClusterProjection(LightClusters *clusters, Mat4 projMat,
+                               float nearZ, float farZ);
+
+// Lights are transformed and bounded on the thread pool, then every depth
+// slice is filled on its own job, testing a light against four clusters of a
+// row at a time, and the slices are packed into lightIndices in order
+void assignLightClusters(LightClusters *clusters, Mat4 viewMat,
+                         const Light *lights, int numLights);
+
+// Cluster holding a view space position, which has to be in front of the
+// camera
+int getLightCluster(const LightClusters *clusters, Float3 viewPosition);
+
+C_INTERFACE_END
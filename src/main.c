@@ -3,18 +3,113 @@
 #include "renderer.h"
 #include "str.h"
 #include "memory.h"
+#include "thread.h"
+#include "profiler.h"
+#include "replay.h"
+#include "drawlist.h"
+#include "uniformring.h"
+#include <math.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_NUM_SCENE_LIGHTS 32
+#define DEFAULT_MODEL_NAME "AnimatedCube"
 
 typedef struct _PlaygroundScene {
+  // Under resources/gltf
+  const char *modelName;
   Model model;
   OrbitCamera cam;
+  float animationTime;
+
+  // Point lights scattered over the model, followed by the model lights
+  int numSceneLights;
+  int numLights;
+  Light *lights;
+
+  // Seconds, see setTargetFrameTime
+  float targetFrameTime;
+  // Bytes, see setTextureMemoryBudget
+  int64_t textureBudget;
+  // Chrome trace written on exit, null when not profiling
+  const char *profilePath;
+  // Render counters of every frame, streamed while running
+  const char *countersPath;
+  RenderCounterLog counterLog;
+  // Frames are recorded into the replay and saved on exit, or played back
+  // from it instead of moving the camera with dt
+  const char *recordPath;
+  const char *replayPath;
+  Replay replay;
 } PlaygroundScene;
 
-static PlaygroundScene gScene;
+static PlaygroundScene gScene = {
+    .modelName = DEFAULT_MODEL_NAME,
+    .numSceneLights = DEFAULT_NUM_SCENE_LIGHTS,
+    .targetFrameTime = DYNAMIC_RESOLUTION_DEFAULT_TARGET,
+    .textureBudget = TEXTURE_STREAM_DEFAULT_BUDGET,
+};
+
+static float randomFloat(uint32_t *state) {
+  // xorshift32
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return (float)(*state >> 8) / (float)(1 << 24);
+}
+
+// Scatters numSceneLights point lights over the bounds of the model, with
+// ranges that shrink as there are more of them
+static void createSceneLights(void) {
+  const Model *model = &gScene.model;
+  gScene.numLights = gScene.numSceneLights + model->numLights;
+  if (gScene.numLights == 0) {
+    return;
+  }
+  gScene.lights = MMALLOC_ARRAY(Light, gScene.numLights);
+
+  Float3 min = {-1, -1, -1};
+  Float3 max = {1, 1, 1};
+  if (model->bvh.numItems > 0) {
+    min = model->bvh.itemMins[0];
+    max = model->bvh.itemMaxs[0];
+    for (int i = 1; i < model->bvh.numItems; ++i) {
+      for (int k = 0; k < 3; ++k) {
+        min[k] = fminf(min[k], model->bvh.itemMins[i][k]);
+        max[k] = fmaxf(max[k], model->bvh.itemMaxs[i][k]);
+      }
+    }
+  }
+  Float3 extent = max - min;
+  float range = 0.5f * float3Length(extent) /
+                cbrtf((float)MAX(gScene.numSceneLights, 1));
+
+  uint32_t state = 0x9E3779B9u;
+  for (int i = 0; i < gScene.numSceneLights; ++i) {
+    Float3 position = {randomFloat(&state), randomFloat(&state),
+                       randomFloat(&state)};
+    Float3 color = {randomFloat(&state), randomFloat(&state),
+                    randomFloat(&state)};
+    gScene.lights[i] = (Light){
+        .type = LightType_Point,
+        .position = min + position * extent,
+        .color = color * (0.25f * range * range),
+        .range = range,
+    };
+  }
+}
 
 static void onInit() {
-  String gltfPath =
-      createResourcePath(ResourceType_Common, "gltf/AnimatedCube");
+  PROFILE_SCOPE("onInit");
+  initThreadPool(-1);
+
+#ifdef RENDERER_GL33
+  setTextureMemoryBudget(gScene.textureBudget);
+#endif
+
+  String gltfPath = createResourcePath(ResourceType_Common, "gltf");
+  appendPathCStr(&gltfPath, gScene.modelName);
   loadGLTFModel(&gScene.model, &gltfPath);
   destroyString(&gltfPath);
 
@@ -22,24 +117,207 @@ static void onInit() {
   gScene.cam.phi = -90;
   gScene.cam.theta = 0;
   gScene.cam.target = (Float3){0, 0, 0};
+
+  createSceneLights();
+
+#if defined(RENDERER_GL33) || defined(RENDERER_SOFT)
+  setTargetFrameTime(gScene.targetFrameTime);
+#endif
 }
 
 static void onUpdate(float dt) {
+  PROFILE_SCOPE("onUpdate");
   App *app = getApp();
 
+  // Played back frames also get the size they were recorded at, which
+  // headless runs have no window to disagree with
+  const ReplayFrame *replayed = NULL;
+  if (gScene.replayPath) {
+    replayed = playReplayFrame(&gScene.replay);
+    dt = replayed->dt;
+    app->width = replayed->width;
+    app->height = replayed->height;
+  }
+
+#if defined(RENDERER_GL33) || defined(RENDERER_NULL) || defined(RENDERER_SOFT)
+  writeRenderCounters(&gScene.counterLog, getRenderCounters());
+#endif
+
+#if defined(RENDERER_GL33)
+  const TextureStreamStats *textures = getTextureStreamStats();
+  const RenderCounters *counters = getRenderCounters();
+  FORMAT_STRING(&app->title,
+                "Playground (dt: %f, scale: %.2f, textures: %.1f MB, "
+                "%d pending, draws: %d, triangles: %lld, state changes: %d, "
+                "uploads: %.1f KB)",
+                dt, getDynamicResolutionStats()->scale,
+                (double)textures->residentBytes / (1024 * 1024),
+                textures->numPending, counters->numDraws,
+                (long long)counters->numTriangles,
+                getNumStateChanges(counters),
+                (double)getUploadedBytes(counters) / 1024.0);
+#elif defined(RENDERER_SOFT)
+  FORMAT_STRING(&app->title, "Playground (dt: %f, scale: %.2f)", dt,
+                getDynamicResolutionStats()->scale);
+#else
   FORMAT_STRING(&app->title, "Playground (dt: %f)", dt);
+#endif
 
-  gScene.cam.phi += 20.f * dt;
+  if (replayed) {
+    gScene.cam = replayed->camera;
+  } else {
+    gScene.cam.phi += 20.f * dt;
+  }
+  if (gScene.recordPath && !gScene.replayPath) {
+    ReplayFrame frame = {
+        .dt = dt,
+        .width = app->width,
+        .height = app->height,
+        .camera = gScene.cam,
+    };
+    recordReplayFrame(&gScene.replay, &frame);
+  }
+
+  gScene.animationTime += dt;
+  if (gScene.model.numAnimations > 0) {
+    updateModelAnimation(&gScene.model, 0, gScene.animationTime);
+  }
+  updateModelSkinning(&gScene.model);
+
+  // The model lights follow their nodes
+  for (int i = 0; i < gScene.model.numLights; ++i) {
+    gScene.lights[gScene.numSceneLights + i] = gScene.model.lights[i];
+  }
 
   setCamera(&gScene.cam);
+  setLights(gScene.lights, gScene.numLights);
   setDeferredGBufferPass();
   renderModel(&gScene.model, mat4Identity());
   setDeferredLightingPass();
 }
 
-static void onCleanup() { destroyModel(&gScene.model); }
+static void onCleanup() {
+  MFREE(gScene.lights);
+  destroyModel(&gScene.model);
+  destroyThreadPool();
+  closeRenderCounterLog(&gScene.counterLog);
+  if (gScene.recordPath && !gScene.replayPath) {
+    saveReplay(&gScene.replay, gScene.recordPath);
+  }
+  destroyReplay(&gScene.replay);
+
+  if (gScene.profilePath) {
+    endProfileCapture(gScene.profilePath);
+  }
+}
+
+// Every check runs, so one run logs all failures
+static bool runSelfChecks(void) {
+  bool passed = true;
+  passed = checkUniformRing() && passed;
+  passed = checkRadixSort() && passed;
+  passed = checkDrawList() && passed;
+  return passed;
+}
 
 int main(int argc, char **argv) {
+  // --lights N changes how many lights are scattered over the model,
+  // --target-frame-time MS the frame time the resolution is scaled for. 0
+  // turns the scaling off, which keeps headless captures repeatable.
+  // --texture-budget MB the GPU memory texture mips are streamed within.
+  // --profile <path> writes a Chrome trace of the run, from startup until
+  // cleanup. --counters <path> writes the render counters of every frame, as
+  // JSON for paths ending in .json and CSV otherwise.
+  // --model <name> loads another model of resources/gltf.
+  // --record <path> saves the dt, size and camera of every frame, and
+  // --replay <path> plays them back with the options they were recorded with,
+  // which should include --target-frame-time 0 for the same images.
+  // Replays are meant for the headless app, with --frames set to the recorded
+  // count and --counters to compare runs. --compare <a> <b> then compares two
+  // CSV counter logs, and exits with 1 when the workload differs or b is more
+  // than RENDER_COUNTER_COMPARE_TOLERANCE slower. --scaling N logs how a
+  // synthetic parallelFor workload scales from 1 to N threads and exits.
+  // --animation-benchmark N times sampling a synthetic clip of N nodes and
+  // exits. --ktx2-benchmark <name> times loading the images of a model of
+  // resources/gltf as PNG/JPEG and as KTX2 BC1, and exits.
+  // --self-check runs the checks of the modules that have one, and exits with
+  // 1 when any fails.
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--self-check") == 0) {
+      return runSelfChecks() ? 0 : 1;
+    }
+  }
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (strcmp(argv[i], "--lights") == 0) {
+      gScene.numSceneLights = MAX(atoi(argv[i + 1]), 0);
+    } else if (strcmp(argv[i], "--target-frame-time") == 0) {
+      gScene.targetFrameTime = fmaxf((float)atof(argv[i + 1]), 0) / 1000.f;
+    } else if (strcmp(argv[i], "--texture-budget") == 0) {
+      gScene.textureBudget =
+          (int64_t)(fmax(atof(argv[i + 1]), 0) * 1024 * 1024);
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      gScene.profilePath = argv[i + 1];
+    } else if (strcmp(argv[i], "--counters") == 0) {
+      gScene.countersPath = argv[i + 1];
+    } else if (strcmp(argv[i], "--model") == 0) {
+      gScene.modelName = argv[i + 1];
+    } else if (strcmp(argv[i], "--record") == 0) {
+      gScene.recordPath = argv[i + 1];
+    } else if (strcmp(argv[i], "--replay") == 0) {
+      gScene.replayPath = argv[i + 1];
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+      return compareRenderCounterLogs(argv[i + 1], argv[i + 2],
+                                      RENDER_COUNTER_COMPARE_TOLERANCE)
+                 ? 0
+                 : 1;
+    } else if (strcmp(argv[i], "--scaling") == 0) {
+      logThreadPoolScaling(atoi(argv[i + 1]));
+      return 0;
+    } else if (strcmp(argv[i], "--animation-benchmark") == 0) {
+      logAnimationBenchmark(atoi(argv[i + 1]));
+      return 0;
+    } else if (strcmp(argv[i], "--ktx2-benchmark") == 0) {
+      String gltfPath = createResourcePath(ResourceType_Common, "gltf");
+      appendPathCStr(&gltfPath, argv[i + 1]);
+      logKtx2Benchmark(&gltfPath);
+      destroyString(&gltfPath);
+      return 0;
+    }
+  }
+
+  if (gScene.replayPath) {
+    if (!loadReplay(&gScene.replay, gScene.replayPath)) {
+      return 1;
+    }
+    const ReplaySettings *settings = &gScene.replay.settings;
+    gScene.modelName = settings->modelName;
+    gScene.numSceneLights = settings->numSceneLights;
+    gScene.targetFrameTime = settings->targetFrameTime;
+    gScene.textureBudget = settings->textureBudget;
+  } else if (gScene.recordPath) {
+    ReplaySettings settings = {
+        .numSceneLights = gScene.numSceneLights,
+        .targetFrameTime = gScene.targetFrameTime,
+        .textureBudget = gScene.textureBudget,
+    };
+    snprintf(settings.modelName, sizeof(settings.modelName), "%s",
+             gScene.modelName);
+    initReplay(&gScene.replay, &settings);
+  }
+
+  setProfileThreadName("Main");
+  if (gScene.profilePath) {
+    beginProfileCapture();
+  }
+  if (gScene.countersPath) {
+#if defined(RENDERER_GL33) || defined(RENDERER_NULL) || defined(RENDERER_SOFT)
+    openRenderCounterLog(&gScene.counterLog, gScene.countersPath);
+#else
+    LOG("--counters needs the GL, null or soft renderer");
+    return 1;
+#endif
+  }
+
   int returnVal = runMain(argc, argv, "Metal Playground", 1280, 720, onInit,
                           onUpdate, onCleanup);
   return returnVal;
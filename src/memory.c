@@ -11,6 +11,9 @@
 #define MIN_ALIGNMENT 1
 #endif
 
+static int64_t gTotalAllocatedBytes;
+static int gNumAllocations;
+
 static int divideRounded(int n, int d) {
   int result = (n + d - 1) / d;
   return result;
@@ -26,6 +29,8 @@ void *allocate(int size, int alignment) {
     alignment = MIN_ALIGNMENT;
   }
   size = alignUp(size, alignment);
+  __atomic_fetch_add(&gTotalAllocatedBytes, size, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&gNumAllocations, 1, __ATOMIC_RELAXED);
   void *mem =
 #ifdef _WIN32
       _aligned_malloc(size, alignment);
@@ -41,6 +46,8 @@ void *allocateZeroes(int size, int alignment) {
     alignment = MIN_ALIGNMENT;
   }
   size = alignUp(size, alignment);
+  __atomic_fetch_add(&gTotalAllocatedBytes, size, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&gNumAllocations, 1, __ATOMIC_RELAXED);
   void *mem =
 #ifdef _WIN32
       _aligned_malloc(size, alignment);
@@ -52,6 +59,14 @@ void *allocateZeroes(int size, int alignment) {
   return mem;
 }
 
+int64_t getTotalAllocatedBytes(void) {
+  return __atomic_load_n(&gTotalAllocatedBytes, __ATOMIC_RELAXED);
+}
+
+int getNumAllocations(void) {
+  return __atomic_load_n(&gNumAllocations, __ATOMIC_RELAXED);
+}
+
 void deallocate(void *memory) {
 #ifdef _WIN32
   _aligned_free(memory);
@@ -1,12 +1,13 @@
 #include "util.h"
+#include <stdint.h>
 
 #define MMALLOC(type) (type *)allocate(sizeof(type), (int)_Alignof(type))
 #define MMALLOC_ZEROES(type)                                                   \
   (type *)allocateZeroes(sizeof(type), (int)_Alignof(type))
 #define MMALLOC_ARRAY(type, count)                                             \
-  (type *)allocate(sizeof(type) * count, (int)_Alignof(type))
+  (type *)allocate(sizeof(type) * (count), (int)_Alignof(type))
 #define MMALLOC_ARRAY_ZEROES(type, count)                                      \
-  (type *)allocateZeroes(sizeof(type) * count, (int)_Alignof(type))
+  (type *)allocateZeroes(sizeof(type) * (count), (int)_Alignof(type))
 #define MFREE(p) deallocate(p)
 
 C_INTERFACE_BEGIN
@@ -15,4 +16,8 @@ void *allocate(int size, int alignment);
 void *allocateZeroes(int size, int alignment);
 void deallocate(void *memory);
 
+// Sum of the sizes of every allocation made so far, for per frame accounting
+int64_t getTotalAllocatedBytes(void);
+int getNumAllocations(void);
+
 C_INTERFACE_END
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include "meshlet.h"
+#include "memory.h"
+#include "profiler.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+static Float3 readMeshletPosition(const float *positions, int positionStride,
+                                  uint32_t index) {
+  const float *p =
+      (const float *)((const uint8_t *)positions + positionStride * index);
+  Float3 position = {p[0], p[1], p[2]};
+  return position;
+}
+
+static void computeMeshletBounds(Meshlet *meshlet, const uint32_t *indices,
+                                 const float *positions, int positionStride) {
+  Float3 aabbMin = {FLT_MAX, FLT_MAX, FLT_MAX};
+  Float3 aabbMax = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+  Float3 normalSum = {0};
+
+  const uint32_t *triIndices = indices + meshlet->indexOffset;
+  for (int i = 0; i < meshlet->numIndices; i += 3) {
+    Float3 p[3];
+    for (int j = 0; j < 3; ++j) {
+      p[j] = readMeshletPosition(positions, positionStride, triIndices[i + j]);
+      for (int k = 0; k < 3; ++k) {
+        aabbMin[k] = fminf(aabbMin[k], p[j][k]);
+        aabbMax[k] = fmaxf(aabbMax[k], p[j][k]);
+      }
+    }
+    normalSum += float3Normalize(float3Cross(p[1] - p[0], p[2] - p[0]));
+  }
+
+  Float3 center = (aabbMin + aabbMax) * 0.5f;
+  float radiusSq = 0;
+  for (int i = 0; i < meshlet->numIndices; ++i) {
+    Float3 p = readMeshletPosition(positions, positionStride, triIndices[i]);
+    radiusSq = fmaxf(radiusSq, float3LengthSq(p - center));
+  }
+
+  Float3 axis = float3Normalize(normalSum);
+  float minDot = 1;
+  for (int i = 0; i < meshlet->numIndices; i += 3) {
+    Float3 p0 = readMeshletPosition(positions, positionStride, triIndices[i]);
+    Float3 p1 =
+        readMeshletPosition(positions, positionStride, triIndices[i + 1]);
+    Float3 p2 =
+        readMeshletPosition(positions, positionStride, triIndices[i + 2]);
+    Float3 n = float3Cross(p1 - p0, p2 - p0);
+    if (float3LengthSq(n) > 0) {
+      minDot = fminf(minDot, float3Dot(axis, float3Normalize(n)));
+    }
+  }
+
+  meshlet->center = center;
+  meshlet->radius = sqrtf(radiusSq);
+  meshlet->aabbMin = aabbMin;
+  meshlet->aabbMax = aabbMax;
+  meshlet->coneAxis = axis;
+  // A cone wider than a hemisphere can never be entirely back-facing
+  if (float3LengthSq(axis) == 0 || minDot <= 0) {
+    meshlet->coneCutoff = 1;
+  } else {
+    meshlet->coneCutoff = sqrtf(1 - minDot * minDot);
+  }
+}
+
+int buildMeshlets(Meshlet **outMeshlets, uint32_t *indices, int numIndices,
+                  const float *positions, int positionStride,
+                  int numVertices) {
+  PROFILE_SCOPE("buildMeshlets");
+  int numTriangles = numIndices / 3;
+
+  // Vertex -> triangle adjacency
+  int *adjacencyOffsets = MMALLOC_ARRAY_ZEROES(int, numVertices + 1);
+  int *adjacency = MMALLOC_ARRAY(int, numTriangles * 3);
+  for (int i = 0; i < numTriangles * 3; ++i) {
+    ++adjacencyOffsets[indices[i] + 1];
+  }
+  for (int i = 0; i < numVertices; ++i) {
+    adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+  }
+  int *adjacencyFill = MMALLOC_ARRAY(int, numVertices);
+  memcpy(adjacencyFill, adjacencyOffsets, sizeof(int) * numVertices);
+  for (int i = 0; i < numTriangles * 3; ++i) {
+    adjacency[adjacencyFill[indices[i]]++] = i / 3;
+  }
+  MFREE(adjacencyFill);
+
+  int *vertexMeshlet = MMALLOC_ARRAY(int, numVertices);
+  for (int i = 0; i < numVertices; ++i) {
+    vertexMeshlet[i] = -1;
+  }
+  bool *emitted = MMALLOC_ARRAY_ZEROES(bool, numTriangles);
+  uint32_t *reordered = MMALLOC_ARRAY(uint32_t, numTriangles * 3);
+
+  int meshletCap = MAX(numTriangles / MESHLET_MAX_TRIANGLES + 1, 4);
+  int numMeshlets = 0;
+  Meshlet *meshlets = MMALLOC_ARRAY_ZEROES(Meshlet, meshletCap);
+
+  int numWritten = 0;
+  int nextSeed = 0;
+  while (numWritten < numTriangles * 3) {
+    if (numMeshlets == meshletCap) {
+      Meshlet *oldMeshlets = meshlets;
+      meshletCap *= 2;
+      meshlets = MMALLOC_ARRAY_ZEROES(Meshlet, meshletCap);
+      memcpy(meshlets, oldMeshlets, sizeof(Meshlet) * numMeshlets);
+      MFREE(oldMeshlets);
+    }
+
+    int meshletIndex = numMeshlets++;
+    Meshlet *meshlet = &meshlets[meshletIndex];
+    meshlet->indexOffset = numWritten;
+    uint32_t meshletVertices[MESHLET_MAX_VERTICES];
+    int numTris = 0;
+
+    while (numTris < MESHLET_MAX_TRIANGLES) {
+      // Prefer the adjacent triangle that adds the fewest new vertices
+      int best = -1;
+      int bestNewVertices = 4;
+      for (int i = 0; i < meshlet->numVertices && bestNewVertices > 0; ++i) {
+        uint32_t v = meshletVertices[i];
+        for (int a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; ++a) {
+          int tri = adjacency[a];
+          if (emitted[tri]) {
+            continue;
+          }
+          int newVertices = 0;
+          for (int j = 0; j < 3; ++j) {
+            newVertices += vertexMeshlet[indices[tri * 3 + j]] != meshletIndex;
+          }
+          if (newVertices < bestNewVertices &&
+              meshlet->numVertices + newVertices <= MESHLET_MAX_VERTICES) {
+            best = tri;
+            bestNewVertices = newVertices;
+          }
+        }
+      }
+
+      if (best < 0) {
+        if (numTris > 0) {
+          break;
+        }
+        while (emitted[nextSeed]) {
+          ++nextSeed;
+        }
+        best = nextSeed;
+      }
+
+      for (int j = 0; j < 3; ++j) {
+        uint32_t v = indices[best * 3 + j];
+        if (vertexMeshlet[v] != meshletIndex) {
+          vertexMeshlet[v] = meshletIndex;
+          meshletVertices[meshlet->numVertices++] = v;
+        }
+        reordered[numWritten++] = v;
+      }
+      emitted[best] = true;
+      ++numTris;
+    }
+
+    meshlet->numIndices = numTris * 3;
+  }
+
+  memcpy(indices, reordered, sizeof(uint32_t) * numTriangles * 3);
+  for (int i = 0; i < numMeshlets; ++i) {
+    computeMeshletBounds(&meshlets[i], indices, positions, positionStride);
+  }
+
+  MFREE(reordered);
+  MFREE(emitted);
+  MFREE(vertexMeshlet);
+  MFREE(adjacency);
+  MFREE(adjacencyOffsets);
+
+  *outMeshlets = meshlets;
+  return numMeshlets;
+}
+
+int cullMeshlets(const Meshlet *meshlets, int numMeshlets,
+                 const Frustum *frustum, Float3 eye, IndexRange *outRanges) {
+  int numRanges = 0;
+
+  for (int i = 0; i < numMeshlets; ++i) {
+    const Meshlet *meshlet = &meshlets[i];
+
+    if (!frustumIntersectsSphere(frustum, meshlet->center, meshlet->radius)) {
+      continue;
+    }
+
+    Float3 toCenter = meshlet->center - eye;
+    if (float3Dot(toCenter, meshlet->coneAxis) >=
+        meshlet->coneCutoff * float3Length(toCenter) + meshlet->radius) {
+      continue;
+    }
+
+    IndexRange *last = numRanges > 0 ? &outRanges[numRanges - 1] : NULL;
+    if (last && last->offset + last->count == meshlet->indexOffset) {
+      last->count += meshlet->numIndices;
+    } else {
+      outRanges[numRanges++] = (IndexRange){
+          .offset = meshlet->indexOffset,
+          .count = meshlet->numIndices,
+      };
+    }
+  }
+
+  return numRanges;
+}
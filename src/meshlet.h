@@ -0,0 +1,43 @@
+#pragma once
+#include "util.h"
+#include "vmath.h"
+#include <stdint.h>
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+C_INTERFACE_BEGIN
+
+typedef struct _Meshlet {
+  Float3 center;
+  float radius;
+  Float3 aabbMin;
+  Float3 aabbMax;
+  // Every triangle is back-facing when
+  // dot(center - eye, coneAxis) >= coneCutoff * |center - eye| + radius
+  Float3 coneAxis;
+  float coneCutoff;
+
+  int indexOffset;
+  int numIndices;
+  int numVertices;
+} Meshlet;
+
+typedef struct _IndexRange {
+  int offset;
+  int count;
+} IndexRange;
+
+// Reorders indices in place so the triangles of each meshlet are contiguous.
+// Returns the number of meshlets written to *outMeshlets (free with MFREE).
+int buildMeshlets(Meshlet **outMeshlets, uint32_t *indices, int numIndices,
+                  const float *positions, int positionStride,
+                  int numVertices);
+
+// frustum and eye are expected in the same space as the meshlet bounds.
+// Adjacent visible meshlets are merged, so outRanges needs at most numMeshlets
+// entries.
+int cullMeshlets(const Meshlet *meshlets, int numMeshlets,
+                 const Frustum *frustum, Float3 eye, IndexRange *outRanges);
+
+C_INTERFACE_END
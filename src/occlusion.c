@@ -0,0 +1,264 @@
+#include "occlusion.h"
+#include "app.h"
+#include "memory.h"
+#include <math.h>
+#include <string.h>
+
+// Clipping a triangle against the near plane leaves at most a quad
+#define OCCLUSION_MAX_CLIPPED_VERTICES 4
+
+void initOcclusionBuffer(OcclusionBuffer *buffer) {
+  *buffer = (OcclusionBuffer){0};
+
+  int width = OCCLUSION_BUFFER_WIDTH;
+  int height = OCCLUSION_BUFFER_HEIGHT;
+  while (buffer->numLevels < OCCLUSION_MAX_LEVELS) {
+    int level = buffer->numLevels++;
+    buffer->levelWidths[level] = width;
+    buffer->levelHeights[level] = height;
+    buffer->levels[level] = MMALLOC_ARRAY_ZEROES(float, width * height);
+    if (width == 1 && height == 1) {
+      break;
+    }
+    width = MAX(width / 2, 1);
+    height = MAX(height / 2, 1);
+  }
+}
+
+void destroyOcclusionBuffer(OcclusionBuffer *buffer) {
+  for (int i = 0; i < buffer->numLevels; ++i) {
+    MFREE(buffer->levels[i]);
+  }
+  *buffer = (OcclusionBuffer){0};
+}
+
+void beginOcclusionFrame(OcclusionBuffer *buffer, Mat4 viewProj, float nearZ) {
+  double startTime = getTime();
+
+  buffer->viewProj = viewProj;
+  buffer->nearZ = nearZ;
+  buffer->stats = (OcclusionStats){0};
+  for (int i = 0; i < buffer->numLevels; ++i) {
+    memset(buffer->levels[i], 0,
+           sizeof(float) * buffer->levelWidths[i] * buffer->levelHeights[i]);
+  }
+
+  buffer->stats.timeMs += (getTime() - startTime) * 1000.0;
+}
+
+static void rasterizeOccluderTriangle(OcclusionBuffer *buffer, Float4 p0,
+                                      Float4 p1, Float4 p2) {
+  const int width = buffer->levelWidths[0];
+  const int height = buffer->levelHeights[0];
+  const Float4 p[3] = {p0, p1, p2};
+
+  float x[3], y[3], depth[3];
+  for (int i = 0; i < 3; ++i) {
+    float invW = 1.f / p[i].w;
+    x[i] = (p[i].x * invW * 0.5f + 0.5f) * (float)width;
+    y[i] = (0.5f - p[i].y * invW * 0.5f) * (float)height;
+    depth[i] = invW;
+  }
+
+  // Edge i is opposite vertex i
+  float edgeA[3], edgeB[3], edgeC[3];
+  for (int i = 0; i < 3; ++i) {
+    int i1 = (i + 1) % 3;
+    int i2 = (i + 2) % 3;
+    edgeA[i] = y[i1] - y[i2];
+    edgeB[i] = x[i2] - x[i1];
+    edgeC[i] = x[i1] * y[i2] - x[i2] * y[i1];
+  }
+  float area = edgeA[0] * x[0] + edgeB[0] * y[0] + edgeC[0];
+  if (!(fabsf(area) > 1e-8f)) {
+    return;
+  }
+  // Both windings occlude, so flip clockwise triangles
+  float sign = area < 0 ? -1.f : 1.f;
+  float invArea = 1.f / fabsf(area);
+  float depthA = 0, depthB = 0, depthC = 0;
+  for (int i = 0; i < 3; ++i) {
+    edgeA[i] *= sign;
+    edgeB[i] *= sign;
+    edgeC[i] *= sign;
+    depthA += edgeA[i] * invArea * depth[i];
+    depthB += edgeB[i] * invArea * depth[i];
+    depthC += edgeC[i] * invArea * depth[i];
+  }
+
+  int minX = MAX((int)floorf(fminf(x[0], fminf(x[1], x[2]))), 0) & ~3;
+  int minY = MAX((int)floorf(fminf(y[0], fminf(y[1], y[2]))), 0);
+  int maxX = MIN((int)ceilf(fmaxf(x[0], fmaxf(x[1], x[2]))), width);
+  int maxY = MIN((int)ceilf(fmaxf(y[0], fmaxf(y[1], y[2]))), height);
+
+  float *depthBuffer = buffer->levels[0];
+  for (int row = minY; row < maxY; ++row) {
+    float py = (float)row + 0.5f;
+    float rowE0 = edgeB[0] * py + edgeC[0];
+    float rowE1 = edgeB[1] * py + edgeC[1];
+    float rowE2 = edgeB[2] * py + edgeC[2];
+    float rowDepth = depthB * py + depthC;
+
+    for (int column = minX; column < maxX; column += 4) {
+      Float4 px = (Float4){0.5f, 1.5f, 2.5f, 3.5f} + (float)column;
+      Float4 e0 = edgeA[0] * px + rowE0;
+      Float4 e1 = edgeA[1] * px + rowE1;
+      Float4 e2 = edgeA[2] * px + rowE2;
+      Int4 lanes = (Int4){0, 1, 2, 3} + column;
+      Int4 mask = (e0 >= 0) & (e1 >= 0) & (e2 >= 0) & (lanes < maxX);
+      if (!(mask[0] | mask[1] | mask[2] | mask[3])) {
+        continue;
+      }
+
+      float *pixels = &depthBuffer[row * width + column];
+      Float4 stored;
+      memcpy(&stored, pixels, sizeof(stored));
+      Float4 pixelDepth = depthA * px + rowDepth;
+      Int4 write = mask & (pixelDepth > stored);
+      Float4 blended = float4Select(write, pixelDepth, stored);
+      memcpy(pixels, &blended, sizeof(blended));
+    }
+  }
+}
+
+static Float4 readOccluderPosition(const float *positions, int positionStride,
+                                   uint32_t index) {
+  const float *p =
+      (const float *)((const uint8_t *)positions + positionStride * index);
+  Float4 position = {p[0], p[1], p[2], 1};
+  return position;
+}
+
+void rasterizeOccluder(OcclusionBuffer *buffer, Mat4 mvp,
+                       const uint32_t *indices, int numIndices,
+                       const float *positions, int positionStride) {
+  double startTime = getTime();
+
+  for (int i = 0; i + 2 < numIndices; i += 3) {
+    Float4 in[3];
+    for (int k = 0; k < 3; ++k) {
+      in[k] = mat4MultiplyFloat4(
+          mvp, readOccluderPosition(positions, positionStride, indices[i + k]));
+    }
+
+    // Clip against w >= nearZ
+    Float4 out[OCCLUSION_MAX_CLIPPED_VERTICES];
+    int numOut = 0;
+    for (int k = 0; k < 3; ++k) {
+      Float4 a = in[k];
+      Float4 b = in[(k + 1) % 3];
+      float da = a.w - buffer->nearZ;
+      float db = b.w - buffer->nearZ;
+      if (da >= 0) {
+        out[numOut++] = a;
+      }
+      if ((da >= 0) != (db >= 0)) {
+        out[numOut++] = a + (b - a) * (da / (da - db));
+      }
+    }
+
+    for (int k = 0; k + 2 < numOut; ++k) {
+      rasterizeOccluderTriangle(buffer, out[0], out[k + 1], out[k + 2]);
+    }
+  }
+
+  ++buffer->stats.numOccluders;
+  buffer->stats.numOccluderTriangles += numIndices / 3;
+  buffer->stats.timeMs += (getTime() - startTime) * 1000.0;
+}
+
+void buildOcclusionPyramid(OcclusionBuffer *buffer) {
+  double startTime = getTime();
+
+  for (int level = 1; level < buffer->numLevels; ++level) {
+    const float *src = buffer->levels[level - 1];
+    int srcWidth = buffer->levelWidths[level - 1];
+    int srcHeight = buffer->levelHeights[level - 1];
+    float *dst = buffer->levels[level];
+    int width = buffer->levelWidths[level];
+    int height = buffer->levelHeights[level];
+
+    for (int y = 0; y < height; ++y) {
+      int y0 = y * 2;
+      int y1 = MIN(y0 + 1, srcHeight - 1);
+      for (int x = 0; x < width; ++x) {
+        int x0 = x * 2;
+        int x1 = MIN(x0 + 1, srcWidth - 1);
+        dst[y * width + x] =
+            fminf(fminf(src[y0 * srcWidth + x0], src[y0 * srcWidth + x1]),
+                  fminf(src[y1 * srcWidth + x0], src[y1 * srcWidth + x1]));
+      }
+    }
+  }
+
+  buffer->stats.timeMs += (getTime() - startTime) * 1000.0;
+}
+
+static bool isBoxBehindOccluders(const OcclusionBuffer *buffer, Mat4 mvp,
+                                 Float3 aabbMin, Float3 aabbMax) {
+  const int width = buffer->levelWidths[0];
+  const int height = buffer->levelHeights[0];
+
+  float minX = INFINITY, minY = INFINITY;
+  float maxX = -INFINITY, maxY = -INFINITY;
+  float closestDepth = 0;
+  for (int i = 0; i < 8; ++i) {
+    Float4 corner = {(i & 1) ? aabbMax.x : aabbMin.x,
+                     (i & 2) ? aabbMax.y : aabbMin.y,
+                     (i & 4) ? aabbMax.z : aabbMin.z, 1};
+    Float4 p = mat4MultiplyFloat4(mvp, corner);
+    // w is linear over the box, so no point of it is closer than the corners
+    if (p.w < buffer->nearZ) {
+      return false;
+    }
+    float invW = 1.f / p.w;
+    float x = (p.x * invW * 0.5f + 0.5f) * (float)width;
+    float y = (0.5f - p.y * invW * 0.5f) * (float)height;
+    minX = fminf(minX, x);
+    maxX = fmaxf(maxX, x);
+    minY = fminf(minY, y);
+    maxY = fmaxf(maxY, y);
+    closestDepth = fmaxf(closestDepth, invW);
+  }
+
+  // Off screen boxes are left to frustum culling
+  if (maxX < 0 || maxY < 0 || minX >= (float)width || minY >= (float)height) {
+    return false;
+  }
+  int x0 = MAX((int)floorf(minX), 0);
+  int y0 = MAX((int)floorf(minY), 0);
+  int x1 = MIN((int)floorf(maxX), width - 1);
+  int y1 = MIN((int)floorf(maxY), height - 1);
+
+  // Pick the level where the rectangle spans at most 2x2 texels
+  int size = MAX(x1 - x0, y1 - y0) + 1;
+  int level = 0;
+  while (level + 1 < buffer->numLevels && (1 << level) < size) {
+    ++level;
+  }
+
+  const float *depth = buffer->levels[level];
+  int levelWidth = buffer->levelWidths[level];
+  int levelHeight = buffer->levelHeights[level];
+  float farthestOccluder = INFINITY;
+  for (int y = y0 >> level; y <= MIN(y1 >> level, levelHeight - 1); ++y) {
+    for (int x = x0 >> level; x <= MIN(x1 >> level, levelWidth - 1); ++x) {
+      farthestOccluder = fminf(farthestOccluder, depth[y * levelWidth + x]);
+    }
+  }
+  return closestDepth < farthestOccluder;
+}
+
+bool isBoxOccluded(const OcclusionBuffer *buffer, Mat4 mvp, Float3 aabbMin,
+                   Float3 aabbMax, OcclusionStats *stats) {
+  double startTime = getTime();
+
+  bool occluded = isBoxBehindOccluders(buffer, mvp, aabbMin, aabbMax);
+  ++stats->numTested;
+  if (occluded) {
+    ++stats->numCulled;
+  }
+
+  stats->timeMs += (getTime() - startTime) * 1000.0;
+  return occluded;
+}
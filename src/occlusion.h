@@ -0,0 +1,63 @@
+#pragma once
+#include "util.h"
+#include "vmath.h"
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+#define OCCLUSION_BUFFER_WIDTH 256
+#define OCCLUSION_BUFFER_HEIGHT 128
+#define OCCLUSION_MAX_LEVELS 9
+
+// Sub-meshes whose bounds project to at least this radius on screen are drawn
+// into the occlusion buffer
+#define OCCLUDER_MIN_PIXEL_RADIUS 64.f
+
+typedef struct _OcclusionStats {
+  int numOccluders;
+  int numOccluderTriangles;
+  int numTested;
+  int numCulled;
+  double timeMs;
+} OcclusionStats;
+
+// Low resolution depth of the occluders of one view. Depth is stored as 1 / w,
+// which is linear in screen space and the same for every backend: larger is
+// closer and 0 is nothing drawn.
+typedef struct _OcclusionBuffer {
+  Mat4 viewProj;
+  float nearZ;
+
+  // Level 0 is the rasterized depth. Every level after it holds the farthest
+  // depth of each 2x2 block of the level before.
+  int numLevels;
+  int levelWidths[OCCLUSION_MAX_LEVELS];
+  int levelHeights[OCCLUSION_MAX_LEVELS];
+  float *levels[OCCLUSION_MAX_LEVELS];
+
+  OcclusionStats stats;
+} OcclusionBuffer;
+
+void initOcclusionBuffer(OcclusionBuffer *buffer);
+void destroyOcclusionBuffer(OcclusionBuffer *buffer);
+
+// Clears depth and stats for a frame seen through viewProj. Nothing closer
+// than nearZ is rasterized or culled.
+void beginOcclusionFrame(OcclusionBuffer *buffer, Mat4 viewProj, float nearZ);
+
+// Triangles are clipped against the near plane and rasterized four pixels at
+// a time. mvp takes the positions to clip space.
+void rasterizeOccluder(OcclusionBuffer *buffer, Mat4 mvp,
+                       const uint32_t *indices, int numIndices,
+                       const float *positions, int positionStride);
+
+// Call after the occluders of a model, before testing against them
+void buildOcclusionPyramid(OcclusionBuffer *buffer);
+
+// True when the box, in the space that mvp takes to clip space, lies entirely
+// behind the occluders. Doesn't touch the buffer, so jobs can test against it
+// at the same time, each counting into its own stats.
+bool isBoxOccluded(const OcclusionBuffer *buffer, Mat4 mvp, Float3 aabbMin,
+                   Float3 aabbMax, OcclusionStats *stats);
+
+C_INTERFACE_END
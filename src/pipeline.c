@@ -0,0 +1,103 @@
+#include "pipeline.h"
+#include "memory.h"
+#include <string.h>
+
+#define PIPELINE_HASH_PRIME 0x100000001b3ull
+
+uint64_t hashPipelineBytes(uint64_t hash, const void *data, int size) {
+  const uint8_t *bytes = data;
+  for (int i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * PIPELINE_HASH_PRIME;
+  }
+  return hash;
+}
+
+uint64_t hashPipelineDesc(const PipelineDesc *desc) {
+  // Field by field, the padding of the struct is undefined
+  uint8_t state[] = {
+      (uint8_t)desc->vertexLayout, (uint8_t)desc->polygonMode,
+      (uint8_t)desc->cullMode,     (uint8_t)desc->depthCompare,
+      (uint8_t)desc->depthWrite,   (uint8_t)desc->blendMode,
+  };
+  uint64_t hash = PIPELINE_HASH_SEED;
+  hash = hashPipelineBytes(hash, desc->shader, (int)strlen(desc->shader));
+  return hashPipelineBytes(hash, state, sizeof(state));
+}
+
+bool isSamePipelineDesc(const PipelineDesc *a, const PipelineDesc *b) {
+  return strcmp(a->shader, b->shader) == 0 &&
+         a->vertexLayout == b->vertexLayout &&
+         a->polygonMode == b->polygonMode && a->cullMode == b->cullMode &&
+         a->depthCompare == b->depthCompare &&
+         a->depthWrite == b->depthWrite && a->blendMode == b->blendMode;
+}
+
+void initPipelineCache(PipelineCache *cache, CreatePipeline createPipeline) {
+  *cache = (PipelineCache){.createPipeline = createPipeline};
+}
+
+void destroyPipelineCache(PipelineCache *cache) {
+  MFREE(cache->table);
+  MFREE(cache->hashes);
+  MFREE(cache->descs);
+  *cache = (PipelineCache){0};
+}
+
+static int *findPipelineSlot(const PipelineCache *cache,
+                             const PipelineDesc *desc, uint64_t hash) {
+  uint64_t slot = hash & (cache->tableSize - 1);
+  for (;;) {
+    int entry = cache->table[slot];
+    if (entry == 0 || (cache->hashes[entry - 1] == hash &&
+                       isSamePipelineDesc(&cache->descs[entry - 1], desc))) {
+      return &cache->table[slot];
+    }
+    slot = (slot + 1) & (cache->tableSize - 1);
+  }
+}
+
+// Keeps the table at most half full
+static void growPipelineCache(PipelineCache *cache) {
+  int capacity = MAX(cache->capacity * 2, 16);
+  PipelineDesc *descs = MMALLOC_ARRAY(PipelineDesc, capacity);
+  uint64_t *hashes = MMALLOC_ARRAY(uint64_t, capacity);
+  if (cache->numPipelines > 0) {
+    memcpy(descs, cache->descs, sizeof(PipelineDesc) * cache->numPipelines);
+    memcpy(hashes, cache->hashes, sizeof(uint64_t) * cache->numPipelines);
+  }
+  MFREE(cache->descs);
+  MFREE(cache->hashes);
+  cache->descs = descs;
+  cache->hashes = hashes;
+  cache->capacity = capacity;
+
+  MFREE(cache->table);
+  cache->tableSize = capacity * 2;
+  cache->table = MMALLOC_ARRAY_ZEROES(int, cache->tableSize);
+  for (int i = 0; i < cache->numPipelines; ++i) {
+    *findPipelineSlot(cache, &cache->descs[i], cache->hashes[i]) = i + 1;
+  }
+}
+
+int getPipeline(PipelineCache *cache, const PipelineDesc *desc) {
+  ASSERT(desc->shader);
+  uint64_t hash = hashPipelineDesc(desc);
+  if (cache->tableSize > 0) {
+    int entry = *findPipelineSlot(cache, desc, hash);
+    if (entry > 0) {
+      return entry - 1;
+    }
+  }
+
+  if (cache->numPipelines == cache->capacity) {
+    growPipelineCache(cache);
+  }
+  int index = cache->numPipelines++;
+  cache->descs[index] = *desc;
+  cache->hashes[index] = hash;
+  *findPipelineSlot(cache, desc, hash) = index + 1;
+  if (cache->createPipeline) {
+    cache->createPipeline(desc, index);
+  }
+  return index;
+}
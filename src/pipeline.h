@@ -0,0 +1,94 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+#define PIPELINE_HASH_SEED 0xcbf29ce484222325ull
+
+typedef enum _VertexLayout {
+  // Vertices are generated from the vertex index, like a fullscreen triangle
+  VertexLayout_None = 0,
+  // Vertex attributes plus the per-instance matrices of DrawUniforms
+  VertexLayout_Mesh,
+
+  VertexLayout_Count
+} VertexLayout;
+
+typedef enum _PolygonMode {
+  PolygonMode_Fill = 0,
+  PolygonMode_Line,
+
+  PolygonMode_Count
+} PolygonMode;
+
+typedef enum _CullMode {
+  CullMode_None = 0,
+  CullMode_Back,
+
+  CullMode_Count
+} CullMode;
+
+typedef enum _DepthCompare {
+  // Disables the depth test
+  DepthCompare_Always = 0,
+  // Reversed depth, nearer is greater
+  DepthCompare_GreaterEqual,
+
+  DepthCompare_Count
+} DepthCompare;
+
+typedef enum _BlendMode {
+  BlendMode_Opaque = 0,
+  BlendMode_Alpha,
+  BlendMode_Additive,
+
+  BlendMode_Count
+} BlendMode;
+
+// Everything a draw needs bound apart from its buffers and textures
+typedef struct _PipelineDesc {
+  // Name of the shader pair, e.g. "gbuffer" for gbuffer_vert and gbuffer_frag
+  const char *shader;
+  VertexLayout vertexLayout;
+  PolygonMode polygonMode;
+  CullMode cullMode;
+  DepthCompare depthCompare;
+  bool depthWrite;
+  BlendMode blendMode;
+} PipelineDesc;
+
+// Called once per new desc with the index it got, so backends can build
+// their own objects in an array parallel to PipelineCache.descs
+typedef void (*CreatePipeline)(const PipelineDesc *desc, int index);
+
+// Pipelines are looked up by desc in an open addressing table of hashes and
+// never removed. Indices are dense, so they also fit in draw sort keys.
+typedef struct _PipelineCache {
+  CreatePipeline createPipeline;
+
+  int numPipelines;
+  int capacity;
+  PipelineDesc *descs;
+  uint64_t *hashes;
+
+  // Pipeline index + 1 per slot, 0 for empty ones
+  int tableSize;
+  int *table;
+} PipelineCache;
+
+void initPipelineCache(PipelineCache *cache, CreatePipeline createPipeline);
+void destroyPipelineCache(PipelineCache *cache);
+
+// Returns the index of the pipeline for desc, creating it on first use. The
+// shader name has to outlive the cache.
+int getPipeline(PipelineCache *cache, const PipelineDesc *desc);
+
+uint64_t hashPipelineDesc(const PipelineDesc *desc);
+// FNV-1a, starting from PIPELINE_HASH_SEED. Backends key their shader caches
+// with it too.
+uint64_t hashPipelineBytes(uint64_t hash, const void *data, int size);
+bool isSamePipelineDesc(const PipelineDesc *a, const PipelineDesc *b);
+
+C_INTERFACE_END
@@ -0,0 +1,156 @@
+#include "profiler.h"
+#include "app.h"
+#include "memory.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct _ProfileEvent {
+  const char *name;
+  double begin;
+  double end;
+} ProfileEvent;
+
+// Only written by its thread. The capture reads up to head, which is
+// published after the event it counts.
+typedef struct _ProfileThread {
+  char name[PROFILER_MAX_THREAD_NAME];
+  int64_t head;
+  ProfileEvent events[PROFILER_RING_CAPACITY];
+} ProfileThread;
+
+static struct {
+  bool capturing;
+  double captureBegin;
+  int numThreads;
+  ProfileThread *threads[PROFILER_MAX_THREADS];
+} gProfiler;
+
+static _Thread_local ProfileThread *tProfileThread;
+static _Thread_local char tProfileThreadName[PROFILER_MAX_THREAD_NAME];
+
+static void copyThreadName(char *dst, const char *src) {
+  strncpy(dst, src, PROFILER_MAX_THREAD_NAME - 1);
+  dst[PROFILER_MAX_THREAD_NAME - 1] = 0;
+}
+
+// Rings are created the first time a thread records while capturing, and
+// kept until exit since other threads may read them
+static ProfileThread *getProfileThread(void) {
+  if (tProfileThread) {
+    return tProfileThread;
+  }
+
+  int index = __atomic_load_n(&gProfiler.numThreads, __ATOMIC_RELAXED);
+  do {
+    if (index >= PROFILER_MAX_THREADS) {
+      return NULL;
+    }
+  } while (!__atomic_compare_exchange_n(&gProfiler.numThreads, &index,
+                                        index + 1, true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+
+  ProfileThread *thread = MMALLOC_ZEROES(ProfileThread);
+  if (tProfileThreadName[0]) {
+    copyThreadName(thread->name, tProfileThreadName);
+  } else {
+    snprintf(thread->name, sizeof(thread->name), "Thread %d", index);
+  }
+  __atomic_store_n(&gProfiler.threads[index], thread, __ATOMIC_RELEASE);
+  tProfileThread = thread;
+  return thread;
+}
+
+ProfileScope beginProfileScope(const char *name) {
+  ProfileScope scope = {.name = name, .begin = -1};
+  if (__atomic_load_n(&gProfiler.capturing, __ATOMIC_RELAXED)) {
+    scope.begin = getTime();
+  }
+  return scope;
+}
+
+void endProfileScope(ProfileScope *scope) {
+  if (scope->begin < 0 ||
+      !__atomic_load_n(&gProfiler.capturing, __ATOMIC_RELAXED)) {
+    return;
+  }
+  ProfileThread *thread = getProfileThread();
+  if (!thread) {
+    return;
+  }
+
+  int64_t head = thread->head;
+  thread->events[head & (PROFILER_RING_CAPACITY - 1)] = (ProfileEvent){
+      .name = scope->name,
+      .begin = scope->begin,
+      .end = getTime(),
+  };
+  __atomic_store_n(&thread->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void setProfileThreadName(const char *name) {
+  copyThreadName(tProfileThreadName, name);
+  if (tProfileThread) {
+    copyThreadName(tProfileThread->name, name);
+  }
+}
+
+void beginProfileCapture(void) {
+  gProfiler.captureBegin = getTime();
+  __atomic_store_n(&gProfiler.capturing, true, __ATOMIC_RELEASE);
+}
+
+bool isProfileCaptureRunning(void) {
+  return __atomic_load_n(&gProfiler.capturing, __ATOMIC_RELAXED);
+}
+
+bool endProfileCapture(const char *path) {
+  __atomic_store_n(&gProfiler.capturing, false, __ATOMIC_SEQ_CST);
+
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    LOG("Can't open %s for writing", path);
+    return false;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  int numThreads = __atomic_load_n(&gProfiler.numThreads, __ATOMIC_ACQUIRE);
+  int numEvents = 0;
+  bool first = true;
+  for (int i = 0; i < numThreads; ++i) {
+    const ProfileThread *thread =
+        __atomic_load_n(&gProfiler.threads[i], __ATOMIC_ACQUIRE);
+    if (!thread) {
+      continue;
+    }
+    fprintf(file,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", i, thread->name);
+    first = false;
+
+    // A scope that began before the capture stopped can still end into the
+    // slot after head, which is the oldest one once the ring is full
+    int64_t head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+    int64_t oldest = MAX(head - PROFILER_RING_CAPACITY + 1, 0);
+    for (int64_t e = oldest; e < head; ++e) {
+      const ProfileEvent *event =
+          &thread->events[e & (PROFILER_RING_CAPACITY - 1)];
+      if (event->begin < gProfiler.captureBegin) {
+        continue;
+      }
+      fprintf(file,
+              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              event->name, i, (event->begin - gProfiler.captureBegin) * 1e6,
+              (event->end - event->begin) * 1e6);
+      ++numEvents;
+    }
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+
+  LOG("Profile: %d scopes on %d threads written to %s", numEvents, numThreads,
+      path);
+  return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+
+C_INTERFACE_BEGIN
+
+// Events each thread keeps, the oldest are overwritten once it's full
+#define PROFILER_RING_CAPACITY 16384
+#define PROFILER_MAX_THREADS 80
+#define PROFILER_MAX_THREAD_NAME 32
+
+typedef struct _ProfileScope {
+  // A string literal, or one that outlives the capture
+  const char *name;
+  // Seconds, negative when nothing was capturing as the scope began
+  double begin;
+} ProfileScope;
+
+// Timed scopes are recorded into a ring of the thread they ran on, without
+// locks, while a capture is running. Without PROFILER the macros compile to
+// nothing, otherwise they only check a flag while not capturing.
+#ifdef PROFILER
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+// Times the rest of the enclosing block
+#define PROFILE_SCOPE(name)                                                    \
+  ProfileScope PROFILE_CONCAT(profileScope, __LINE__)                          \
+      __attribute__((cleanup(endProfileScope))) = beginProfileScope(name)
+// For stages of a function that aren't blocks of their own
+#define PROFILE_BEGIN(scope, name) ProfileScope scope = beginProfileScope(name)
+#define PROFILE_END(scope) endProfileScope(&scope)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_BEGIN(scope, name)
+#define PROFILE_END(scope)
+#endif
+
+ProfileScope beginProfileScope(const char *name);
+void endProfileScope(ProfileScope *scope);
+// Shown for the calling thread in captures, copied
+void setProfileThreadName(const char *name);
+
+void beginProfileCapture(void);
+bool isProfileCaptureRunning(void);
+// Writes the scopes that ended since beginProfileCapture as Chrome trace
+// JSON, which chrome://tracing and Perfetto open. Returns false when the file
+// can't be written.
+bool endProfileCapture(const char *path);
+
+C_INTERFACE_END
@@ -0,0 +1,309 @@
+#include "rendercounters.h"
+#include "app.h"
+#include "memory.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *gStateChangeTypeNames[StateChangeType_Count] = {
+    "program",     "vertexBuffer", "indexBuffer", "uniformBuffer",
+    "framebuffer", "texture",      "raster",
+};
+
+static const char *gUploadTypeNames[UploadType_Count] = {
+    "uniform",
+    "vertex",
+    "texture",
+};
+
+void initRenderCounterFrames(RenderCounterFrames *frames) {
+  *frames = (RenderCounterFrames){
+      .numAllocations = getNumAllocations(),
+      .allocatedBytes = getTotalAllocatedBytes(),
+      .beginTime = getTime(),
+  };
+}
+
+void endRenderCounterFrame(RenderCounterFrames *frames) {
+  RenderCounters *current = &frames->current;
+  int numAllocations = getNumAllocations();
+  int64_t allocatedBytes = getTotalAllocatedBytes();
+  current->numAllocations = numAllocations - frames->numAllocations;
+  current->allocatedBytes = allocatedBytes - frames->allocatedBytes;
+  frames->numAllocations = numAllocations;
+  frames->allocatedBytes = allocatedBytes;
+  double time = getTime();
+  current->frameTimeMs = (float)((time - frames->beginTime) * 1000.0);
+  frames->beginTime = time;
+
+  current->frameIndex = frames->last.frameIndex + 1;
+  frames->last = *current;
+  *current = (RenderCounters){0};
+}
+
+void addRenderCounters(RenderCounters *total, const RenderCounters *frame) {
+  total->frameIndex = frame->frameIndex;
+  total->frameTimeMs += frame->frameTimeMs;
+  total->numDraws += frame->numDraws;
+  total->numInstances += frame->numInstances;
+  total->numTriangles += frame->numTriangles;
+  for (int i = 0; i < StateChangeType_Count; ++i) {
+    total->stateChanges[i] += frame->stateChanges[i];
+  }
+  for (int i = 0; i < UploadType_Count; ++i) {
+    total->uploadedBytes[i] += frame->uploadedBytes[i];
+  }
+  total->numAllocations += frame->numAllocations;
+  total->allocatedBytes += frame->allocatedBytes;
+}
+
+int getNumStateChanges(const RenderCounters *counters) {
+  int result = 0;
+  for (int i = 0; i < StateChangeType_Count; ++i) {
+    result += counters->stateChanges[i];
+  }
+  return result;
+}
+
+int64_t getUploadedBytes(const RenderCounters *counters) {
+  int64_t result = 0;
+  for (int i = 0; i < UploadType_Count; ++i) {
+    result += counters->uploadedBytes[i];
+  }
+  return result;
+}
+
+const char *getStateChangeTypeName(StateChangeType type) {
+  ASSERT(type >= 0 && type < StateChangeType_Count);
+  return gStateChangeTypeNames[type];
+}
+
+const char *getUploadTypeName(UploadType type) {
+  ASSERT(type >= 0 && type < UploadType_Count);
+  return gUploadTypeNames[type];
+}
+
+static bool hasExtension(const char *path, const char *extension) {
+  size_t length = strlen(path);
+  size_t extensionLength = strlen(extension);
+  return length >= extensionLength &&
+         strcmp(path + length - extensionLength, extension) == 0;
+}
+
+bool openRenderCounterLog(RenderCounterLog *log, const char *path) {
+  *log = (RenderCounterLog){
+      .file = fopen(path, "w"),
+      .format = hasExtension(path, ".json") ? RenderCounterFormat_JSON
+                                            : RenderCounterFormat_CSV,
+  };
+  if (!log->file) {
+    LOG("Can't open %s for writing", path);
+    return false;
+  }
+
+  if (log->format == RenderCounterFormat_JSON) {
+    fprintf(log->file, "[");
+    return true;
+  }
+  fprintf(log->file, "frame,frameTimeMs,draws,instances,triangles");
+  for (int i = 0; i < StateChangeType_Count; ++i) {
+    fprintf(log->file, ",%sChanges", gStateChangeTypeNames[i]);
+  }
+  for (int i = 0; i < UploadType_Count; ++i) {
+    fprintf(log->file, ",%sBytes", gUploadTypeNames[i]);
+  }
+  fprintf(log->file, ",allocations,allocatedBytes\n");
+  return true;
+}
+
+void writeRenderCounters(RenderCounterLog *log,
+                         const RenderCounters *counters) {
+  if (!log->file || counters->frameIndex <= log->lastFrameIndex) {
+    return;
+  }
+  log->lastFrameIndex = counters->frameIndex;
+
+  FILE *file = log->file;
+  if (log->format == RenderCounterFormat_JSON) {
+    fprintf(file,
+            "%s\n{\"frame\":%d,\"frameTimeMs\":%.3f,\"draws\":%d,"
+            "\"instances\":%d,\"triangles\":%lld,\"stateChanges\":{",
+            log->numFrames > 0 ? "," : "", counters->frameIndex,
+            counters->frameTimeMs, counters->numDraws, counters->numInstances,
+            (long long)counters->numTriangles);
+    for (int i = 0; i < StateChangeType_Count; ++i) {
+      fprintf(file, "%s\"%s\":%d", i > 0 ? "," : "", gStateChangeTypeNames[i],
+              counters->stateChanges[i]);
+    }
+    fprintf(file, "},\"uploadedBytes\":{");
+    for (int i = 0; i < UploadType_Count; ++i) {
+      fprintf(file, "%s\"%s\":%lld", i > 0 ? "," : "", gUploadTypeNames[i],
+              (long long)counters->uploadedBytes[i]);
+    }
+    fprintf(file, "},\"allocations\":%d,\"allocatedBytes\":%lld}",
+            counters->numAllocations, (long long)counters->allocatedBytes);
+  } else {
+    fprintf(file, "%d,%.3f,%d,%d,%lld", counters->frameIndex,
+            counters->frameTimeMs, counters->numDraws, counters->numInstances,
+            (long long)counters->numTriangles);
+    for (int i = 0; i < StateChangeType_Count; ++i) {
+      fprintf(file, ",%d", counters->stateChanges[i]);
+    }
+    for (int i = 0; i < UploadType_Count; ++i) {
+      fprintf(file, ",%lld", (long long)counters->uploadedBytes[i]);
+    }
+    fprintf(file, ",%d,%lld\n", counters->numAllocations,
+            (long long)counters->allocatedBytes);
+  }
+  ++log->numFrames;
+}
+
+void closeRenderCounterLog(RenderCounterLog *log) {
+  if (!log->file) {
+    return;
+  }
+  if (log->format == RenderCounterFormat_JSON) {
+    fprintf(log->file, "\n]\n");
+  }
+  fclose(log->file);
+  LOG("Render counters: %d frames written", log->numFrames);
+  *log = (RenderCounterLog){0};
+}
+
+// Splits in place, returns the number of fields
+static int splitCsvLine(char *line, char **fields) {
+  line[strcspn(line, "\r\n")] = 0;
+  int numFields = 0;
+  for (char *field = line; numFields < RENDER_COUNTER_MAX_COLUMNS;) {
+    fields[numFields++] = field;
+    char *comma = strchr(field, ',');
+    if (!comma) {
+      break;
+    }
+    *comma = 0;
+    field = comma + 1;
+  }
+  return numFields;
+}
+
+// Columns that depend on timing rather than on the workload
+static bool isTimingColumn(const char *name) {
+  return strcmp(name, "frame") == 0 || strcmp(name, "frameTimeMs") == 0 ||
+         strcmp(name, "allocations") == 0 ||
+         strcmp(name, "allocatedBytes") == 0;
+}
+
+bool compareRenderCounterLogs(const char *pathA, const char *pathB,
+                              float tolerance) {
+  const char *paths[2] = {pathA, pathB};
+  FILE *files[2] = {fopen(pathA, "r"), fopen(pathB, "r")};
+  static char lines[2][RENDER_COUNTER_MAX_LINE];
+  char *fields[2][RENDER_COUNTER_MAX_COLUMNS];
+  int numColumns[2] = {0};
+  for (int f = 0; f < 2; ++f) {
+    if (!files[f] || !fgets(lines[f], RENDER_COUNTER_MAX_LINE, files[f])) {
+      LOG("Can't read %s", paths[f]);
+      numColumns[f] = -1;
+      continue;
+    }
+    numColumns[f] = splitCsvLine(lines[f], fields[f]);
+  }
+  bool sameColumns = numColumns[0] > 0 && numColumns[0] == numColumns[1];
+  for (int c = 0; sameColumns && c < numColumns[0]; ++c) {
+    sameColumns = strcmp(fields[0][c], fields[1][c]) == 0;
+  }
+  if (!sameColumns) {
+    if (numColumns[0] >= 0 && numColumns[1] >= 0) {
+      LOG("%s and %s have different columns", pathA, pathB);
+    }
+    for (int f = 0; f < 2; ++f) {
+      if (files[f]) {
+        fclose(files[f]);
+      }
+    }
+    return false;
+  }
+
+  int n = numColumns[0];
+  char names[RENDER_COUNTER_MAX_COLUMNS][64];
+  int frameTimeColumn = -1;
+  for (int c = 0; c < n; ++c) {
+    snprintf(names[c], sizeof(names[c]), "%s", fields[0][c]);
+    if (strcmp(names[c], "frameTimeMs") == 0) {
+      frameTimeColumn = c;
+    }
+  }
+
+  // Frames are compared until the shorter log ends, the rest only counted
+  double sums[2][RENDER_COUNTER_MAX_COLUMNS] = {0};
+  int numFrames = 0;
+  int numDifferentFrames = 0;
+  int numRows[2] = {0};
+  for (;;) {
+    bool read[2];
+    for (int f = 0; f < 2; ++f) {
+      read[f] = fgets(lines[f], RENDER_COUNTER_MAX_LINE, files[f]) != NULL;
+      numRows[f] += read[f];
+    }
+    if (!read[0] || !read[1]) {
+      break;
+    }
+    if (splitCsvLine(lines[0], fields[0]) != n ||
+        splitCsvLine(lines[1], fields[1]) != n) {
+      break;
+    }
+    bool sameWorkload = true;
+    for (int c = 0; c < n; ++c) {
+      double a = strtod(fields[0][c], NULL);
+      double b = strtod(fields[1][c], NULL);
+      sums[0][c] += a;
+      sums[1][c] += b;
+      if (a != b && !isTimingColumn(names[c])) {
+        sameWorkload = false;
+      }
+    }
+    numDifferentFrames += !sameWorkload;
+    ++numFrames;
+  }
+  for (int f = 0; f < 2; ++f) {
+    while (fgets(lines[f], RENDER_COUNTER_MAX_LINE, files[f])) {
+      ++numRows[f];
+    }
+  }
+  fclose(files[0]);
+  fclose(files[1]);
+
+  if (numFrames == 0) {
+    LOG("%s and %s have no frames to compare", pathA, pathB);
+    return false;
+  }
+
+  LOG("Render counters: mean of %d frames, %s against %s", numFrames, pathB,
+      pathA);
+  for (int c = 0; c < n; ++c) {
+    double a = sums[0][c] / numFrames;
+    double b = sums[1][c] / numFrames;
+    double change = a != 0 ? (b - a) / fabs(a) * 100.0 : 0;
+    LOG("  %-22s %14.3f %14.3f %+8.1f%%", names[c], a, b, change);
+  }
+
+  bool passed = true;
+  if (numRows[0] != numRows[1]) {
+    LOG("Render counters: %s has %d frames and %s %d", pathA, numRows[0],
+        pathB, numRows[1]);
+    passed = false;
+  }
+  if (numDifferentFrames > 0) {
+    LOG("Render counters: the workload differs on %d frames",
+        numDifferentFrames);
+    passed = false;
+  }
+  if (frameTimeColumn >= 0 &&
+      sums[1][frameTimeColumn] >
+          sums[0][frameTimeColumn] * (1.0 + tolerance)) {
+    LOG("Render counters: frame time is more than %.1f%% slower",
+        tolerance * 100.0);
+    passed = false;
+  }
+  return passed;
+}
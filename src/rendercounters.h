@@ -0,0 +1,105 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+C_INTERFACE_BEGIN
+
+// Slower mean frame time compareRenderCounterLogs lets through
+#define RENDER_COUNTER_COMPARE_TOLERANCE 0.05f
+#define RENDER_COUNTER_MAX_COLUMNS 32
+#define RENDER_COUNTER_MAX_LINE 1024
+
+// What the state filters of a backend let through to the driver
+typedef enum _StateChangeType {
+  StateChangeType_Program = 0,
+  StateChangeType_VertexBuffer,
+  StateChangeType_IndexBuffer,
+  StateChangeType_UniformBuffer,
+  StateChangeType_Framebuffer,
+  StateChangeType_Texture,
+  // Polygon mode, culling, depth test and write, blending
+  StateChangeType_Raster,
+  StateChangeType_Count,
+} StateChangeType;
+
+typedef enum _UploadType {
+  // Uniform blocks, instance data and the light buffers
+  UploadType_Uniform = 0,
+  // Vertices and indices
+  UploadType_Vertex,
+  UploadType_Texture,
+  UploadType_Count,
+} UploadType;
+
+// Work one frame handed to the driver
+typedef struct _RenderCounters {
+  // 1 for the first frame, 0 before any finished
+  int frameIndex;
+  // Since the previous frame ended, on the thread that sends them
+  float frameTimeMs;
+  // API calls, a multi-draw counts once
+  int numDraws;
+  int numInstances;
+  int64_t numTriangles;
+  int stateChanges[StateChangeType_Count];
+  int64_t uploadedBytes[UploadType_Count];
+  // Made by every thread since the previous frame ended
+  int numAllocations;
+  int64_t allocatedBytes;
+} RenderCounters;
+
+// Backends count into current while a frame is sent and end the frame once
+// it's submitted
+typedef struct _RenderCounterFrames {
+  RenderCounters current;
+  RenderCounters last;
+  // Allocation totals and time when the current frame began
+  int numAllocations;
+  int64_t allocatedBytes;
+  double beginTime;
+} RenderCounterFrames;
+
+void initRenderCounterFrames(RenderCounterFrames *frames);
+// Fills in the allocations of the current frame, moves it to last and starts
+// the next one
+void endRenderCounterFrame(RenderCounterFrames *frames);
+void addRenderCounters(RenderCounters *total, const RenderCounters *frame);
+// Summed over the types
+int getNumStateChanges(const RenderCounters *counters);
+int64_t getUploadedBytes(const RenderCounters *counters);
+
+const char *getStateChangeTypeName(StateChangeType type);
+const char *getUploadTypeName(UploadType type);
+
+typedef enum _RenderCounterFormat {
+  RenderCounterFormat_CSV = 0,
+  RenderCounterFormat_JSON,
+} RenderCounterFormat;
+
+// Streams a row of counters per frame to a file
+typedef struct _RenderCounterLog {
+  FILE *file;
+  RenderCounterFormat format;
+  int numFrames;
+  int lastFrameIndex;
+} RenderCounterLog;
+
+// Paths ending in .json get an array of objects, the rest CSV with a header
+// row. Returns false when the file can't be written.
+bool openRenderCounterLog(RenderCounterLog *log, const char *path);
+// Frames already written are skipped, so the counters can be polled more
+// often than frames finish
+void writeRenderCounters(RenderCounterLog *log, const RenderCounters *counters);
+void closeRenderCounterLog(RenderCounterLog *log);
+
+// Compares the CSV logs of two runs of the same workload, like a replay on
+// two builds, and logs the mean of every column. Returns false when the files
+// can't be read, they have a different number of frames, the workload differs
+// on any frame, or the mean frame time of b is more than tolerance, as a
+// fraction, above that of a.
+bool compareRenderCounterLogs(const char *pathA, const char *pathB,
+                              float tolerance);
+
+C_INTERFACE_END
@@ -2,6 +2,18 @@
 #include "util.h"
 #include "vmath.h"
 #include "str.h"
+#include "bvh.h"
+#include "framegraph.h"
+#include "pipeline.h"
+#include "lightcluster.h"
+#include "dynamicresolution.h"
+#include "texturestream.h"
+#include "scenegraph.h"
+#include "meshlet.h"
+#include "occlusion.h"
+#include "animation.h"
+#include "skinning.h"
+#include "rendercounters.h"
 #include <stdint.h>
 #ifdef RENDERER_DX11
 #ifndef COBJMACROS
@@ -39,11 +51,33 @@ typedef struct _Vertex {
 
 typedef uint32_t VertexIndex;
 
+// A light in the light buffer of the lighting pass
 typedef struct _LightUniform {
-  Float3 position;
-  float intensity;
+  // xyz: world position, w: range
+  Float4 positionRange;
+  // rgb: color times intensity
+  Float4 color;
+  // xyz: spot direction
+  Float4 direction;
+  // x: scale and y: offset that map the cosine of the angle to the spot axis
+  // to the cone attenuation. Point lights get 0 and 1.
+  Float4 spot;
 } LightUniform;
 
+// Light every lit pixel gets on top of its clustered lights
+#define AMBIENT_LIGHT 0.05f
+
+typedef struct _LightingUniforms {
+  // x, y: tangents of the half angles of the projection, z: near plane,
+  // w: cluster slices per unit of log depth
+  Float4 clusterProjection;
+  // Number of clusters along x, y and z
+  Float4 clusterCounts;
+  Float4 ambientColor;
+  // xy: fraction of the G-buffer the scaled passes rendered to
+  Float4 renderScale;
+} LightingUniforms;
+
 typedef struct _UniformsPerView {
   Mat4 viewMat;
   Mat4 projMat;
@@ -81,6 +115,17 @@ typedef struct _Material {
   Float3 emissiveFactor;
 } Material;
 
+#define MAX_SUBMESH_LODS 6
+#define LOD_ERROR_THRESHOLD_PIXELS 1.f
+#define LOD_HYSTERESIS 0.75f
+
+typedef struct _SubMeshLod {
+  int indexOffset;
+  int numIndices;
+  // Accumulated geometric error against LOD 0, in mesh units
+  float error;
+} SubMeshLod;
+
 typedef struct _SubMesh {
   int numVertices;
   Vertex *vertices;
@@ -89,6 +134,24 @@ typedef struct _SubMesh {
 
   int material;
 
+  // Set for skinned submeshes. vertices then holds the skinned result of the
+  // last updateModelSkinning and bindPoseVertices the imported vertices.
+  SkinVertex *skinVertices;
+  Vertex *bindPoseVertices;
+
+  // Meshlets only cover LOD 0
+  int numMeshlets;
+  Meshlet *meshlets;
+
+  // indices holds every LOD back to back, starting with LOD 0
+  int numLods;
+  SubMeshLod lods[MAX_SUBMESH_LODS];
+  Float3 boundsCenter;
+  float boundsRadius;
+  // Texcoord units per mesh unit over the triangles of LOD 0, 0 without
+  // texcoords
+  float uvDensity;
+
   int gpuVertexBufferOffsetInBytes;
   int gpuIndexBufferOffsetInBytes;
 } SubMesh;
@@ -96,25 +159,32 @@ typedef struct _SubMesh {
 typedef struct _Mesh {
   int numSubMeshes;
   SubMesh *subMeshes;
+  // Number of scene nodes that draw the mesh
+  int numInstances;
+  // Copy of a mesh for another skinned node to skin into. Only the vertices
+  // of its skinned sub-meshes are its own, the rest is shared with the
+  // original.
+  bool isSkinnedCopy;
 } Mesh;
 
-typedef struct _Transform {
-  // Float3 position;
-  // Float3 scale;
-  // Float4 rotation;
-  Mat4 matrix;
-} Transform;
+typedef struct _Skin {
+  int numJoints;
+  // Node index of each joint
+  int *joints;
+  Mat4 *inverseBindMatrices;
+  Mat4 *palette;
+} Skin;
 
+// Transforms of the node live in Model.sceneGraph at the same index
 typedef struct _SceneNode {
-  int parent;
-
-  Transform localTransform;
-  Transform worldTransform;
-
   int mesh;
-
-  int *childNodes;
-  int numChildNodes;
+  int skin;
+  // Item of the node in Model.bvh, -1 when it isn't in it
+  int bvhItem;
+  // Index in Model.lights, -1 without one
+  int light;
+  // Currently selected LOD for each submesh of mesh
+  int *subMeshLods;
 } SceneNode;
 
 typedef struct _Scene {
@@ -122,6 +192,28 @@ typedef struct _Scene {
   int *nodes;
 } Scene;
 
+#if defined(RENDERER_NULL) || defined(RENDERER_SOFT)
+// CPU copies of what the GPU backends keep on the GPU
+typedef struct _CpuTexture {
+  int width;
+  int height;
+  int size;
+  uint8_t *data;
+} CpuTexture;
+
+typedef struct _CpuSampler {
+  int magFilter;
+  int minFilter;
+  int wrapS;
+  int wrapT;
+} CpuSampler;
+
+typedef struct _CpuBuffer {
+  int size;
+  uint8_t *data;
+} CpuBuffer;
+#endif
+
 typedef struct _Model {
   int numTextures;
 #ifdef RENDERER_GL33
@@ -130,7 +222,12 @@ typedef struct _Model {
   id<MTLTexture> __strong *textures;
 #elif defined(RENDERER_DX11)
   ID3D11Texture2D **textures;
+#elif defined(RENDERER_NULL) || defined(RENDERER_SOFT)
+  CpuTexture *textures;
 #endif
+  // Entry of each texture in the TextureStreamer of the backend, -1 for
+  // textures that aren't streamed. Null when the backend has no streamer.
+  int *textureStreams;
 
   int numSamplers;
 #ifdef RENDERER_GL33
@@ -139,6 +236,8 @@ typedef struct _Model {
   id<MTLSamplerState> __strong *samplers;
 #elif defined(RENDERER_DX11)
   ID3D11SamplerState **samplers;
+#elif defined(RENDERER_NULL) || defined(RENDERER_SOFT)
+  CpuSampler *samplers;
 #endif
 
   int numMaterials;
@@ -147,12 +246,34 @@ typedef struct _Model {
   int numMeshes;
   Mesh *meshes;
 
+  // Stored depth first, so parents come before their children and every
+  // subtree is contiguous
   int numNodes;
   SceneNode *nodes;
+  SceneGraph sceneGraph;
 
   int numScenes;
   Scene *scenes;
 
+  // World bounds of the mesh nodes of every scene. Item i of bvh is node
+  // bvhNodes[i]. Skinned mesh nodes move with their joints, so they are listed
+  // in unboundedNodes instead and never culled.
+  Bvh bvh;
+  int *bvhNodes;
+  int numUnboundedNodes;
+  int *unboundedNodes;
+
+  // Point and spot lights of KHR_lights_punctual, one per node that has one.
+  // Their position and direction follow the node.
+  int numLights;
+  Light *lights;
+
+  int numAnimations;
+  Animation *animations;
+
+  int numSkins;
+  Skin *skins;
+
 #ifdef RENDERER_GL33
   uint32_t gpuVertexBuffer;
   uint32_t gpuIndexBuffer;
@@ -162,13 +283,33 @@ typedef struct _Model {
 #elif defined(RENDERER_DX11)
   ID3D11Buffer *gpuVertexBuffer;
   ID3D11Buffer *gpuIndexBuffer;
+#elif defined(RENDERER_NULL) || defined(RENDERER_SOFT)
+  CpuBuffer gpuVertexBuffer;
+  CpuBuffer gpuIndexBuffer;
 #endif
 } Model;
 
 void loadGLTFModel(Model *model, const String *basePath);
+// Times decoding every PNG/JPEG image of the model against loading it as
+// pre-transcoded KTX2 BC1, encoded in memory beforehand, and logs the results
+void logKtx2Benchmark(const String *basePath);
 void destroyModel(Model *model);
 void renderModel(Model *model, Mat4 transform);
 
+// Backend half of loadGLTFModel and destroyModel. Images come in encoded as
+// PNG/JPEG or KTX2 and createModelTexture returns false when the backend
+// can't use one. Sampler values are the glTF ones, 0 when unspecified.
+// createModelBuffers copies every sub-mesh to its gpu*OffsetInBytes.
+void initModelTextures(Model *model, int numTextures);
+bool createModelTexture(Model *model, int index, const uint8_t *encoded,
+                        int size);
+void initModelSamplers(Model *model, int numSamplers);
+void createModelSampler(Model *model, int index, int magFilter, int minFilter,
+                        int wrapS, int wrapT);
+void createModelBuffers(Model *model, int vertexBufferSize,
+                        int indexBufferSize, bool dynamicVertices);
+void destroyModelResources(Model *model);
+
 typedef struct _OrbitCamera {
   float distance;
   float theta;
@@ -178,9 +319,95 @@ typedef struct _OrbitCamera {
 
 Mat4 getOrbitCameraMatrix(const OrbitCamera *cam);
 
+// Samples the animation at time (wrapped to its duration) into the TRS of the
+// animated nodes, then updates the model transforms
+void updateModelAnimation(Model *model, int animationIndex, float time);
+// Recomputes the transforms of the nodes marked dirty in Model.sceneGraph and
+// their descendants, moves their lights and refits the BVH around the ones
+// that moved
+void updateModelTransforms(Model *model);
+
+// Builds Model.bvh from the current world transforms of the nodes. Animation
+// updates refit it afterwards.
+void buildModelBvh(Model *model);
+// Nearest mesh node whose world bounds are hit by the ray, or -1
+int raycastModelNodes(const Model *model, Float3 origin, Float3 direction,
+                      float *outDistance);
+
+// Computes joint palettes from the node world transforms and skins the
+// vertices of every skinned mesh node on the thread pool
+void updateModelSkinning(Model *model);
+
+LightUniform makeLightUniform(const Light *light);
+
+// Pipelines of the deferred passes, looked up in the pipeline cache of the
+// backends that have one
+extern const PipelineDesc gGBufferPipelineDesc;
+extern const PipelineDesc gLightingPipelineDesc;
+
+void buildSubMeshLods(SubMesh *subMesh);
+void computeSubMeshUvDensity(SubMesh *subMesh);
+int selectSubMeshLod(const SubMesh *subMesh, int currentLod, Mat4 modelMat,
+                     Float3 eye, float pixelsPerUnit);
+
 // Command stuffs
 void setCamera(const OrbitCamera *cam);
+// Lights of the next lighting pass, which reads them, so they have to stay
+// valid until then. Every pixel is only shaded by the lights of its cluster.
+void setLights(const Light *lights, int numLights);
+// Declare the passes of the frame. The GL and null backends add them to a
+// frame graph that render compiles and runs, other backends run them right
+// away.
 void setDeferredGBufferPass(void);
 void setDeferredLightingPass(void);
 
+#if defined(RENDERER_GL33) || defined(RENDERER_NULL) || defined(RENDERER_SOFT)
+// Occlusion culling of the last G-buffer pass
+const OcclusionStats *getOcclusionStats(void);
+// Light assignment of the last lighting pass
+const LightClusterStats *getLightClusterStats(void);
+#endif
+
+#if defined(RENDERER_GL33) || defined(RENDERER_SOFT)
+// Frame time the G-buffer and lighting passes should fit in, which their
+// resolution is scaled for, in seconds. 0 renders them at full resolution.
+void setTargetFrameTime(float seconds);
+// Render scale of the current frame and the state of its controller
+const DynamicResolutionStats *getDynamicResolutionStats(void);
+#endif
+
+#ifdef RENDERER_GL33
+// The commands above record into a snapshot that render draws later, so the
+// next frame can be recorded on another thread while render draws the last
+// one. Stats getters read what render left in the recorded snapshot, which
+// lags a few frames.
+#define RENDERER_SNAPSHOTS
+#define NUM_RENDER_SNAPSHOTS 3
+// Snapshot the commands record into, and the one render draws. They're only
+// the same without a thread of their own.
+void setRecordedSnapshot(int index);
+void setRenderedSnapshot(int index);
+
+// GPU memory the mip levels of model textures are streamed within, in bytes.
+// Their coarse levels are always resident, even over budget.
+void setTextureMemoryBudget(int64_t bytes);
+// Resident bytes and pending requests as of the last frame
+const TextureStreamStats *getTextureStreamStats(void);
+#endif
+
+#if defined(RENDERER_GL33) || defined(RENDERER_NULL)
+// Passes and render targets of the last frame
+const FrameGraphStats *getFrameGraphStats(void);
+#endif
+
+#if defined(RENDERER_GL33) || defined(RENDERER_NULL) || defined(RENDERER_SOFT)
+// Draws, state changes, uploads and allocations of the last frame
+const RenderCounters *getRenderCounters(void);
+#endif
+
+#ifdef RENDERER_SOFT
+// Result of the last lighting pass as RGBA8, top row first
+const uint8_t *getSoftFramebuffer(int *outWidth, int *outHeight);
+#endif
+
 #endif
@@ -1,4 +1,25 @@
 #include "../renderer.h"
+#include "../memory.h"
+#include "../simplify.h"
+#include "../profiler.h"
+#include <float.h>
+#include <stddef.h>
+#include <math.h>
+#include <string.h>
+
+const PipelineDesc gGBufferPipelineDesc = {
+    .shader = "gbuffer",
+    .vertexLayout = VertexLayout_Mesh,
+    .depthCompare = DepthCompare_GreaterEqual,
+    .depthWrite = true,
+};
+
+// Fullscreen triangle over the G-buffer
+const PipelineDesc gLightingPipelineDesc = {
+    .shader = "deferred_lighting",
+    .vertexLayout = VertexLayout_None,
+    .depthCompare = DepthCompare_Always,
+};
 
 Mat4 getOrbitCameraMatrix(const OrbitCamera *cam) {
   Float3 camPos = sphericalToCartesian(cam->distance, degToRad(cam->theta),
@@ -6,4 +27,321 @@ Mat4 getOrbitCameraMatrix(const OrbitCamera *cam) {
                   cam->target;
   Mat4 lookAt = mat4LookAt(camPos, cam->target, (Float3){0, 1, 0});
   return lookAt;
-}
\ No newline at end of file
+}
+
+// Box around the bounding spheres of the sub-meshes of the node's mesh
+static void getNodeWorldBounds(const Model *model, int nodeIndex,
+                               Float3 *outMin, Float3 *outMax) {
+  const Mat4 *m = &model->sceneGraph.worldMatrices[nodeIndex];
+  const Mesh *mesh = &model->meshes[model->nodes[nodeIndex].mesh];
+
+  *outMin = (Float3){FLT_MAX, FLT_MAX, FLT_MAX};
+  *outMax = (Float3){-FLT_MAX, -FLT_MAX, -FLT_MAX};
+  for (int i = 0; i < mesh->numSubMeshes; ++i) {
+    const SubMesh *subMesh = &mesh->subMeshes[i];
+    Float4 center = {subMesh->boundsCenter.x, subMesh->boundsCenter.y,
+                     subMesh->boundsCenter.z, 1};
+    Float3 worldCenter = mat4MultiplyFloat4(*m, center).xyz;
+    for (int k = 0; k < 3; ++k) {
+      float extent = subMesh->boundsRadius *
+                     (fabsf(m->cols[0][k]) + fabsf(m->cols[1][k]) +
+                      fabsf(m->cols[2][k]));
+      (*outMin)[k] = fminf((*outMin)[k], worldCenter[k] - extent);
+      (*outMax)[k] = fmaxf((*outMax)[k], worldCenter[k] + extent);
+    }
+  }
+}
+
+void buildModelBvh(Model *model) {
+  PROFILE_SCOPE("buildModelBvh");
+  bool *isInScene = MMALLOC_ARRAY_ZEROES(bool, model->numNodes);
+  for (int sceneIndex = 0; sceneIndex < model->numScenes; ++sceneIndex) {
+    const Scene *scene = &model->scenes[sceneIndex];
+    for (int i = 0; i < scene->numNodes; ++i) {
+      isInScene[scene->nodes[i]] = true;
+    }
+  }
+
+  // Parents come first, so their flag is final by the time their children
+  // are visited
+  int *meshNodes = MMALLOC_ARRAY(int, model->numNodes);
+  int numMeshNodes = 0;
+  for (int i = 0; i < model->numNodes; ++i) {
+    int parent = model->sceneGraph.parents[i];
+    if (parent >= 0 && isInScene[parent]) {
+      isInScene[i] = true;
+    }
+    if (isInScene[i] && model->nodes[i].mesh >= 0) {
+      meshNodes[numMeshNodes++] = i;
+    }
+  }
+
+  model->bvhNodes = MMALLOC_ARRAY(int, numMeshNodes);
+  model->unboundedNodes = MMALLOC_ARRAY(int, numMeshNodes);
+  Float3 *aabbMins = MMALLOC_ARRAY(Float3, numMeshNodes);
+  Float3 *aabbMaxs = MMALLOC_ARRAY(Float3, numMeshNodes);
+  int numItems = 0;
+  model->numUnboundedNodes = 0;
+  for (int i = 0; i < model->numNodes; ++i) {
+    model->nodes[i].bvhItem = -1;
+  }
+  for (int i = 0; i < numMeshNodes; ++i) {
+    SceneNode *node = &model->nodes[meshNodes[i]];
+    if (node->skin >= 0) {
+      model->unboundedNodes[model->numUnboundedNodes++] = meshNodes[i];
+      continue;
+    }
+    getNodeWorldBounds(model, meshNodes[i], &aabbMins[numItems],
+                       &aabbMaxs[numItems]);
+    node->bvhItem = numItems;
+    model->bvhNodes[numItems++] = meshNodes[i];
+  }
+
+  buildBvh(&model->bvh, aabbMins, aabbMaxs, numItems);
+
+  MFREE(aabbMaxs);
+  MFREE(aabbMins);
+  MFREE(meshNodes);
+  MFREE(isInScene);
+}
+
+int raycastModelNodes(const Model *model, Float3 origin, Float3 direction,
+                      float *outDistance) {
+  int item = raycastBvh(&model->bvh, origin, direction, INFINITY, NULL, NULL,
+                        outDistance);
+  return item >= 0 ? model->bvhNodes[item] : -1;
+}
+
+void updateModelTransforms(Model *model) {
+  SceneGraph *graph = &model->sceneGraph;
+  updateSceneGraph(graph);
+
+  for (int i = 0; i < graph->numChangedNodes; ++i) {
+    int nodeIndex = graph->changedNodes[i];
+    const SceneNode *node = &model->nodes[nodeIndex];
+    if (node->bvhItem >= 0) {
+      Float3 aabbMin, aabbMax;
+      getNodeWorldBounds(model, nodeIndex, &aabbMin, &aabbMax);
+      updateBvhItem(&model->bvh, node->bvhItem, aabbMin, aabbMax);
+    }
+    // Lights shine down the -Z axis of their node
+    if (node->light >= 0) {
+      const Mat4 *m = &graph->worldMatrices[nodeIndex];
+      Light *light = &model->lights[node->light];
+      light->position = m->cols[3].xyz;
+      light->direction = float3Normalize(-m->cols[2].xyz);
+    }
+  }
+  refitBvh(&model->bvh);
+}
+
+void updateModelAnimation(Model *model, int animationIndex, float time) {
+  Animation *animation = &model->animations[animationIndex];
+  if (animation->duration > 0) {
+    time = fmodf(time, animation->duration);
+  }
+
+  sampleAnimation(animation, time);
+
+  SceneGraph *graph = &model->sceneGraph;
+  for (int i = 0; i < animation->numChannels; ++i) {
+    int node = animation->channels[i].node;
+    Float4 value = animation->values[i];
+    switch (animation->channels[i].path) {
+    case AnimationPath_Translation:
+      graph->positions[node] = value.xyz;
+      break;
+    case AnimationPath_Rotation:
+      graph->rotations[node] = value;
+      break;
+    default:
+      graph->scales[node] = value.xyz;
+      break;
+    }
+    markSceneNodeDirty(graph, node);
+  }
+
+  updateModelTransforms(model);
+}
+
+void updateModelSkinning(Model *model) {
+  for (int nodeIndex = 0; nodeIndex < model->numNodes; ++nodeIndex) {
+    SceneNode *node = &model->nodes[nodeIndex];
+    if (node->skin < 0 || node->mesh < 0 ||
+        model->skins[node->skin].numJoints == 0) {
+      continue;
+    }
+
+    // Vertices stay in the space of the mesh node, which the renderer applies
+    Skin *skin = &model->skins[node->skin];
+    const Mat4 *worldMatrices = model->sceneGraph.worldMatrices;
+    Mat4 inverseNodeMat = mat4Inverse(worldMatrices[nodeIndex]);
+    for (int i = 0; i < skin->numJoints; ++i) {
+      Mat4 jointMat = worldMatrices[skin->joints[i]];
+      skin->palette[i] =
+          mat4Multiply(mat4Multiply(inverseNodeMat, jointMat),
+                       skin->inverseBindMatrices[i]);
+    }
+
+    Mesh *mesh = &model->meshes[node->mesh];
+    for (int i = 0; i < mesh->numSubMeshes; ++i) {
+      SubMesh *subMesh = &mesh->subMeshes[i];
+      if (!subMesh->skinVertices) {
+        continue;
+      }
+      SkinningJob job = {
+          .palette = skin->palette,
+          .skinVertices = subMesh->skinVertices,
+          .srcVertices = subMesh->bindPoseVertices,
+          .dstVertices = subMesh->vertices,
+          .stride = sizeof(Vertex),
+          .positionOffset = offsetof(Vertex, position),
+          .normalOffset = offsetof(Vertex, normal),
+      };
+      skinVertices(&job, subMesh->numVertices);
+    }
+  }
+}
+
+LightUniform makeLightUniform(const Light *light) {
+  LightUniform uniform = {
+      .positionRange = {light->position.x, light->position.y,
+                        light->position.z, light->range},
+      .color = {light->color.x, light->color.y, light->color.z, 0},
+      .direction = {light->direction.x, light->direction.y,
+                    light->direction.z, 0},
+      .spot = {0, 1, 0, 0},
+  };
+  if (light->type == LightType_Spot) {
+    float scale =
+        1.f / fmaxf(light->innerConeCos - light->outerConeCos, 0.001f);
+    uniform.spot.x = scale;
+    uniform.spot.y = -light->outerConeCos * scale;
+  }
+  return uniform;
+}
+
+void buildSubMeshLods(SubMesh *subMesh) {
+  PROFILE_SCOPE("buildSubMeshLods");
+  const float *positions = (const float *)&subMesh->vertices[0].position;
+
+  Float3 aabbMin = {FLT_MAX, FLT_MAX, FLT_MAX};
+  Float3 aabbMax = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+  for (int i = 0; i < subMesh->numVertices; ++i) {
+    for (int k = 0; k < 3; ++k) {
+      aabbMin[k] = fminf(aabbMin[k], subMesh->vertices[i].position[k]);
+      aabbMax[k] = fmaxf(aabbMax[k], subMesh->vertices[i].position[k]);
+    }
+  }
+  subMesh->boundsCenter = (aabbMin + aabbMax) * 0.5f;
+  subMesh->boundsRadius = float3Length(aabbMax - aabbMin) * 0.5f;
+
+  subMesh->numLods = 1;
+  subMesh->lods[0] = (SubMeshLod){0, subMesh->numIndices, 0};
+
+  VertexIndex *lodIndices[MAX_SUBMESH_LODS] = {subMesh->indices};
+  int totalNumIndices = subMesh->numIndices;
+  float maxError = subMesh->boundsRadius * 0.1f;
+
+  while (subMesh->numLods < MAX_SUBMESH_LODS) {
+    SubMeshLod *prev = &subMesh->lods[subMesh->numLods - 1];
+    // Not worth a draw call of its own
+    if (prev->numIndices < 64 * 3) {
+      break;
+    }
+
+    VertexIndex *dst = MMALLOC_ARRAY(VertexIndex, prev->numIndices);
+    float error;
+    int count = simplifyMesh(dst, lodIndices[subMesh->numLods - 1],
+                             prev->numIndices, positions, sizeof(Vertex),
+                             subMesh->numVertices, prev->numIndices / 2,
+                             maxError, &error);
+    if (count > (int64_t)prev->numIndices * 85 / 100) {
+      MFREE(dst);
+      break;
+    }
+
+    lodIndices[subMesh->numLods] = dst;
+    subMesh->lods[subMesh->numLods] = (SubMeshLod){
+        .indexOffset = totalNumIndices,
+        .numIndices = count,
+        .error = prev->error + error,
+    };
+    totalNumIndices += count;
+    ++subMesh->numLods;
+  }
+
+  if (subMesh->numLods == 1) {
+    return;
+  }
+
+  VertexIndex *indices = MMALLOC_ARRAY(VertexIndex, totalNumIndices);
+  for (int i = 0; i < subMesh->numLods; ++i) {
+    memcpy(indices + subMesh->lods[i].indexOffset, lodIndices[i],
+           subMesh->lods[i].numIndices * sizeof(VertexIndex));
+    MFREE(lodIndices[i]);
+  }
+  subMesh->indices = indices;
+  subMesh->numIndices = totalNumIndices;
+}
+
+// Square root of the ratio of texcoord to mesh area, so that a texture of
+// size texels covers about size * uvDensity texels per mesh unit
+void computeSubMeshUvDensity(SubMesh *subMesh) {
+  float area = 0;
+  float uvArea = 0;
+  const VertexIndex *indices = subMesh->indices;
+  for (int i = 0; i + 2 < subMesh->lods[0].numIndices; i += 3) {
+    const Vertex *a = &subMesh->vertices[indices[i]];
+    const Vertex *b = &subMesh->vertices[indices[i + 1]];
+    const Vertex *c = &subMesh->vertices[indices[i + 2]];
+    area += float3Length(
+        float3Cross(b->position - a->position, c->position - a->position));
+    Float2 uvB = b->texcoord - a->texcoord;
+    Float2 uvC = c->texcoord - a->texcoord;
+    uvArea += fabsf(uvB.x * uvC.y - uvB.y * uvC.x);
+  }
+  subMesh->uvDensity = area > 0 ? sqrtf(uvArea / area) : 0;
+}
+
+// pixelsPerUnit is the on-screen size in pixels of a unit-length object at
+// unit distance from the eye.
+int selectSubMeshLod(const SubMesh *subMesh, int currentLod, Mat4 modelMat,
+                     Float3 eye, float pixelsPerUnit) {
+  if (subMesh->numLods <= 1) {
+    return 0;
+  }
+
+  float scale = sqrtf(MAX(float3LengthSq(modelMat.cols[0].xyz),
+                          MAX(float3LengthSq(modelMat.cols[1].xyz),
+                              float3LengthSq(modelMat.cols[2].xyz))));
+  Float3 center =
+      mat4MultiplyFloat4(modelMat, (Float4){subMesh->boundsCenter.x,
+                                            subMesh->boundsCenter.y,
+                                            subMesh->boundsCenter.z, 1})
+          .xyz;
+  float distance =
+      float3Length(center - eye) - subMesh->boundsRadius * scale;
+  if (distance <= 0) {
+    return 0;
+  }
+
+  float pixelsPerError = scale * pixelsPerUnit / distance;
+  int lod = MIN(currentLod, subMesh->numLods - 1);
+  if (subMesh->lods[lod].error * pixelsPerError > LOD_ERROR_THRESHOLD_PIXELS) {
+    while (lod > 0 && subMesh->lods[lod].error * pixelsPerError >
+                          LOD_ERROR_THRESHOLD_PIXELS) {
+      --lod;
+    }
+  } else {
+    // Only go coarser once the next LOD is comfortably under the threshold,
+    // so objects sitting at a switch distance don't flicker between LODs
+    while (lod + 1 < subMesh->numLods &&
+           subMesh->lods[lod + 1].error * pixelsPerError <=
+               LOD_ERROR_THRESHOLD_PIXELS * LOD_HYSTERESIS) {
+      ++lod;
+    }
+  }
+
+  return lod;
+}
@@ -1,62 +1,296 @@
 #include "../renderer.h"
 #include "../memory.h"
 #include "../app.h"
+#include "../ktx2.h"
+#include "../drawlist.h"
+#include "../uniformring.h"
+#include "../pipeline.h"
+#include "../profiler.h"
 #include "../external/glad/gl.h"
 #include <stdint.h>
-#define CGLTF_IMPLEMENTATION
-#include "../external/cgltf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "../external/stb_image.h"
 
+// Not part of the GL 3.3 core headers
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#define GL_COMPRESSED_RGBA_BPTC_UNORM_ARB 0x8E8C
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+typedef void(GLAD_API_PTR *BufferStorageProc)(uint32_t target, intptr_t size,
+                                               const void *data,
+                                               uint32_t flags);
+typedef void(GLAD_API_PTR *GetProgramBinaryProc)(uint32_t program,
+                                                  int32_t bufSize,
+                                                  int32_t *length,
+                                                  uint32_t *binaryFormat,
+                                                  void *binary);
+typedef void(GLAD_API_PTR *ProgramBinaryProc)(uint32_t program,
+                                               uint32_t binaryFormat,
+                                               const void *binary,
+                                               int32_t length);
+typedef void(GLAD_API_PTR *ProgramParameteriProc)(uint32_t program,
+                                                   uint32_t pname,
+                                                   int32_t value);
+typedef void(GLAD_API_PTR *MaxShaderCompilerThreadsProc)(uint32_t count);
+
+#define NUM_FRAMES_IN_FLIGHT 3
+#define UNIFORM_RING_FRAME_SIZE (4 * 1024 * 1024)
+
 #define VIEW_BINDING 0
 #define MATERIAL_BINDING 1
 #define DRAW_BINDING 2
+#define LIGHTING_BINDING 3
+
+// Texture units of the light buffers, after the three G-buffer textures
+#define LIGHTS_TEXTURE_UNIT 3
+
+// Programs are shared by the pipelines that use the same shader
+#define MAX_SHADER_PROGRAMS 16
+
+// Per-instance vertex attributes, one per matrix column (see InstanceIn)
+#define INSTANCE_MODEL_MAT_ATTRIB 4
+#define INSTANCE_NORMAL_MAT_ATTRIB 8
+
+// Start of the program binary cache files, followed by the binary
+typedef struct _ProgramBinaryHeader {
+  uint64_t hash;
+  uint32_t format;
+  int32_t length;
+} ProgramBinaryHeader;
+
+// Programs are created when a pipeline first asks for them and finished, which
+// waits for the driver, when a pipeline that uses them is first set. Until
+// then uncached programs compile in the background where the driver can.
+typedef struct _ShaderProgram {
+  const char *name;
+  uint32_t program;
+  // Hash of the sources and the driver, which keys the binary cache
+  uint64_t hash;
+  // Still attached while the program compiles and links
+  uint32_t vertexShader;
+  uint32_t fragmentShader;
+  bool cached;
+  bool ready;
+  double requestTime;
+} ShaderProgram;
+
+// Upload-ready copy of every level of a streamed texture, kept for as long as
+// the texture so evicted levels can be streamed in again
+typedef struct _TextureSource {
+  uint32_t texture;
+  // 0 for RGBA8 levels
+  uint32_t compressedFormat;
+  uint8_t *data;
+  int levelOffsets[TEXTURE_STREAM_MAX_LEVELS];
+} TextureSource;
+
+// Skinned vertices of a sub-mesh, copied out since the next update skins
+// over them
+typedef struct _VertexUpload {
+  uint32_t buffer;
+  int offsetInBytes;
+  int size;
+  // Into RenderSnapshot.vertexData
+  int dataOffset;
+} VertexUpload;
+
+// What the commands of a frame record for render, which draws it with nothing
+// else but GL state. The next frame can be recorded into another snapshot on
+// another thread while render draws this one.
+typedef struct _RenderSnapshot {
+  // App size the frame was recorded at
+  int width;
+  int height;
+  ViewUniforms viewUniforms;
+  Float3 eye;
+  float farZ;
+  bool hasGBufferPass;
+  bool hasLightingPass;
+
+  // Draws of the G-buffer pass
+  DrawList drawList;
+  int numVertexUploads;
+  int vertexUploadCapacity;
+  VertexUpload *vertexUploads;
+  int vertexDataSize;
+  int vertexDataCapacity;
+  uint8_t *vertexData;
+
+  // Lights of setLights, converted and assigned to clusters by
+  // setDeferredLightingPass
+  const Light *lights;
+  int numLights;
+  LightClusters clusters;
+  int numLightUniforms;
+  int lightUniformCapacity;
+  LightUniform *lightUniforms;
+
+  // Copied by render once it's done with the snapshot, for the stats getters
+  // of the thread that records into it next
+  DynamicResolutionStats resolutionStats;
+  TextureStreamStats textureStreamStats;
+  FrameGraphStats frameGraphStats;
+  RenderCounters renderCounters;
+} RenderSnapshot;
 
 typedef struct _Renderer {
   uint32_t vao;
-  struct {
-    uint32_t program;
-  } phong;
 
   // GBuffer pixel data
   // Texture 1: baseColor(rgb), metallic(a)
   // Texture 2: normal(rgb), roughness(a)
   // Texture 3: position(rgb), occlusion(a)
+  // The textures are frame graph resources, attached to gbufferFBO when the
+  // G-buffer pass runs
   struct {
     uint32_t gbufferFBO;
-    uint32_t gbufferTextures[3];
-    uint32_t gbufferDepth;
+    uint32_t gbufferAttachments[4];
+    FrameGraphResource gbuffer[3];
+    FrameGraphResource gbufferDepth;
     uint32_t gbufferSampler;
-    uint32_t gbufferProgram;
     int32_t gbufferTextureLocations[3];
-    uint32_t lightingProgram;
+    // Locations of the lighting program are looked up once it's ready
+    bool hasLocations;
   } deferred;
 
-  uint32_t viewUniformBuffer;
-  uint32_t materialUniformBuffer;
-  uint32_t drawUniformBuffer;
+  // Shader program of every entry of the pipeline cache, the rest of a
+  // pipeline is applied as a diff against glState
+  struct {
+    PipelineCache cache;
+    int capacity;
+    int *programs;
+    int numShaders;
+    ShaderProgram shaders[MAX_SHADER_PROGRAMS];
+    int gbuffer;
+    int lighting;
+    // Hash of the driver strings, binaries of other drivers are stale
+    uint64_t driverHash;
+    // Null without ARB_get_program_binary or binary formats
+    GetProgramBinaryProc getProgramBinary;
+    ProgramBinaryProc programBinary;
+    ProgramParameteriProc programParameteri;
+  } pipelines;
+
+  // Texture buffers read by the lighting pass: the lights, a range per
+  // cluster and the packed light indices
+  struct {
+    uint32_t buffers[3];
+    uint32_t textures[3];
+    int32_t locations[3];
+  } lighting;
+
+  // Every uniform block of a frame is written into the region of the ring
+  // that belongs to it and bound by offset. The fence of a region is waited
+  // on before the ring wraps around to it.
+  struct {
+    uint32_t buffer;
+    UniformRing ring;
+    bool persistent;
+    GLsync fences[NUM_FRAMES_IN_FLIGHT];
+  } uniforms;
+
+  // Passes of the frame, compiled and run by render
+  FrameGraph frameGraph;
+
+  // Resident mip levels of the model textures. Levels go in and out by
+  // specifying them and moving the base level of their texture.
+  TextureStreamer textureStreamer;
+
+  // The G-buffer and lighting passes render into a corner of the full size
+  // targets, sized by the controller from timer queries of the frame graph.
+  // When it's scaled down, lighting goes to sceneColor, which the upscale
+  // pass blits to the backbuffer.
+  struct {
+    DynamicResolution controller;
+    uint32_t queries[NUM_FRAMES_IN_FLIGHT];
+    bool queryPending[NUM_FRAMES_IN_FLIGHT];
+    uint32_t sceneColorFBO;
+    uint32_t sceneColorAttachment;
+    // -1 at full resolution
+    FrameGraphResource sceneColor;
+  } resolution;
+
+  // Commands record into one snapshot while render draws another, see
+  // setRecordedSnapshot
+  RenderSnapshot snapshots[NUM_RENDER_SNAPSHOTS];
+  int recordedSnapshot;
+  int renderedSnapshot;
+
+  int viewUniformsOffset;
+  // Only used on the recording side
+  OcclusionBuffer occlusion;
+  // What render and the loaders hand to GL, counted by the state filters
+  // below and at the draw and upload calls
+  RenderCounterFrames counters;
+  // Only used when the uniform ring isn't persistently mapped
+  int instanceStagingSize;
+  uint8_t *instanceStaging;
+
+  // Scratch space for the multi-draw arguments of a packet
+  struct {
+    int capacity;
+    int32_t *counts;
+    const void **offsets;
+    int32_t *baseVertices;
+  } meshletDraws;
 
-  ViewUniforms viewUniforms;
-  MaterialUniforms materialUniforms;
+  struct {
+    bool textureCompressionS3TC;
+    bool textureCompressionBPTC;
+  } caps;
 
   struct {
     uint32_t vertexBuffer;
     uint32_t indexBuffer;
     uint32_t uniformBuffer;
-    uint32_t program;
     uint32_t framebuffer;
-    uint32_t polygonMode;
-    bool depthTestEnabled;
+    int pipeline;
+    uint32_t program;
+    PolygonMode polygonMode;
+    CullMode cullMode;
+    DepthCompare depthCompare;
+    bool depthWrite;
+    BlendMode blendMode;
   } glState;
 } Renderer;
 
 static Renderer gRenderer = {.glState = {
-                                 .polygonMode = GL_FILL,
-                                 .depthTestEnabled = false,
+                                 .pipeline = -1,
+                                 .polygonMode = PolygonMode_Fill,
+                                 .cullMode = CullMode_None,
+                                 .depthCompare = DepthCompare_Always,
+                                 .depthWrite = true,
+                                 .blendMode = BlendMode_Opaque,
                              }};
 
-static uint32_t createShaderProgram(const char *vertexShaderFilePath,
-                                    const char *fragmentShaderFilePath);
+static void requestShaderProgram(ShaderProgram *shader);
+static void finishShaderProgram(ShaderProgram *shader);
+static void applyTextureStreamChanges(void);
+static void declareGBufferPass(RenderSnapshot *snapshot);
+static void declareLightingPass(RenderSnapshot *snapshot);
+
+static void countStateChange(StateChangeType type) {
+  ++gRenderer.counters.current.stateChanges[type];
+}
+
+static void countUpload(UploadType type, int64_t size) {
+  gRenderer.counters.current.uploadedBytes[type] += size;
+}
+
+static void countDraw(int numInstances, int64_t numTriangles) {
+  RenderCounters *counters = &gRenderer.counters.current;
+  ++counters->numDraws;
+  counters->numInstances += numInstances;
+  counters->numTriangles += numTriangles * numInstances;
+}
 
 static void setUniformBinding(uint32_t program, const char *name,
                               uint32_t binding) {
@@ -76,6 +310,7 @@ static void setTexture(uint32_t texture, uint32_t sampler, int32_t location,
   glBindTexture(GL_TEXTURE_2D, texture);
   glUniform1i(location, unit);
   glBindSampler(unit, sampler);
+  countStateChange(StateChangeType_Texture);
 }
 
 static void GLAPIENTRY openglDebugCallback(UNUSED uint32_t source,
@@ -94,6 +329,7 @@ static void setVertexBuffer(uint32_t vertexBuffer) {
   if (gRenderer.glState.vertexBuffer != vertexBuffer) {
     glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
     gRenderer.glState.vertexBuffer = vertexBuffer;
+    countStateChange(StateChangeType_VertexBuffer);
   }
 }
 
@@ -101,6 +337,7 @@ static void setIndexBuffer(uint32_t indexBuffer) {
   if (gRenderer.glState.indexBuffer != indexBuffer) {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
     gRenderer.glState.indexBuffer = indexBuffer;
+    countStateChange(StateChangeType_IndexBuffer);
   }
 }
 
@@ -108,6 +345,7 @@ static void setUniformBuffer(uint32_t uniformBuffer) {
   if (gRenderer.glState.uniformBuffer != uniformBuffer) {
     glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
     gRenderer.glState.uniformBuffer = uniformBuffer;
+    countStateChange(StateChangeType_UniformBuffer);
   }
 }
 
@@ -115,6 +353,7 @@ static void setProgram(uint32_t program) {
   if (gRenderer.glState.program != program) {
     glUseProgram(program);
     gRenderer.glState.program = program;
+    countStateChange(StateChangeType_Program);
   }
 }
 
@@ -122,13 +361,16 @@ static void setFramebuffer(uint32_t framebuffer) {
   if (gRenderer.glState.framebuffer != framebuffer) {
     glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
     gRenderer.glState.framebuffer = framebuffer;
+    countStateChange(StateChangeType_Framebuffer);
   }
 }
 
-static void setPolygonMode(uint32_t polygonMode) {
+static void setPolygonMode(PolygonMode polygonMode) {
   if (gRenderer.glState.polygonMode != polygonMode) {
-    glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
+    glPolygonMode(GL_FRONT_AND_BACK,
+                  polygonMode == PolygonMode_Line ? GL_LINE : GL_FILL);
     gRenderer.glState.polygonMode = polygonMode;
+    countStateChange(StateChangeType_Raster);
   }
 }
 
@@ -140,109 +382,323 @@ static void setModeEnable(uint32_t mode, bool enable) {
   }
 }
 
-static void setDepthTestEnable(bool enable) {
-  if (gRenderer.glState.depthTestEnabled != enable) {
-    setModeEnable(GL_DEPTH_TEST, enable);
-    gRenderer.glState.depthTestEnabled = enable;
+// glCullFace stays at its GL_BACK default
+static void setCullMode(CullMode cullMode) {
+  if (gRenderer.glState.cullMode != cullMode) {
+    setModeEnable(GL_CULL_FACE, cullMode != CullMode_None);
+    gRenderer.glState.cullMode = cullMode;
+    countStateChange(StateChangeType_Raster);
+  }
+}
+
+// GL_GEQUAL is the only compare function, so it's set once in initRenderer
+static void setDepthCompare(DepthCompare depthCompare) {
+  if (gRenderer.glState.depthCompare != depthCompare) {
+    setModeEnable(GL_DEPTH_TEST, depthCompare != DepthCompare_Always);
+    gRenderer.glState.depthCompare = depthCompare;
+    countStateChange(StateChangeType_Raster);
+  }
+}
+
+static void setDepthWrite(bool depthWrite) {
+  if (gRenderer.glState.depthWrite != depthWrite) {
+    glDepthMask(depthWrite ? GL_TRUE : GL_FALSE);
+    gRenderer.glState.depthWrite = depthWrite;
+    countStateChange(StateChangeType_Raster);
+  }
+}
+
+static void setBlendMode(BlendMode blendMode) {
+  if (gRenderer.glState.blendMode == blendMode) {
+    return;
+  }
+  if (blendMode == BlendMode_Opaque) {
+    glDisable(GL_BLEND);
+  } else {
+    if (gRenderer.glState.blendMode == BlendMode_Opaque) {
+      glEnable(GL_BLEND);
+    }
+    if (blendMode == BlendMode_Alpha) {
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    } else {
+      glBlendFunc(GL_ONE, GL_ONE);
+    }
+  }
+  gRenderer.glState.blendMode = blendMode;
+  countStateChange(StateChangeType_Raster);
+}
+
+// Only the state that differs from the current pipeline is touched. Vertex
+// layouts have nothing to apply, GL 3.3 binds attribute formats together with
+// the buffers in setModelBuffers.
+static void setPipeline(int pipeline) {
+  if (gRenderer.glState.pipeline == pipeline) {
+    return;
+  }
+  const PipelineDesc *desc = &gRenderer.pipelines.cache.descs[pipeline];
+  ShaderProgram *shader =
+      &gRenderer.pipelines.shaders[gRenderer.pipelines.programs[pipeline]];
+  finishShaderProgram(shader);
+  setProgram(shader->program);
+  setPolygonMode(desc->polygonMode);
+  setCullMode(desc->cullMode);
+  setDepthCompare(desc->depthCompare);
+  setDepthWrite(desc->depthWrite);
+  setBlendMode(desc->blendMode);
+  gRenderer.glState.pipeline = pipeline;
+}
+
+static bool hasGLExtension(const char *name) {
+  int32_t numExtensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+  for (int32_t i = 0; i < numExtensions; ++i) {
+    const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (strcmp(extension, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Creates the buffer of the uniform ring with NUM_FRAMES_IN_FLIGHT regions
+static void createUniformBuffer(int frameSize) {
+  int32_t alignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  int size = frameSize * NUM_FRAMES_IN_FLIGHT;
+
+  glGenBuffers(1, &gRenderer.uniforms.buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, gRenderer.uniforms.buffer);
+
+  // Without ARB_buffer_storage the regions are written with glBufferSubData,
+  // which the fences keep from stalling as well
+  BufferStorageProc bufferStorage = NULL;
+  if (hasGLExtension("GL_ARB_buffer_storage")) {
+    bufferStorage = (BufferStorageProc)getGLProcAddress("glBufferStorage");
+  }
+
+  void *mapped = NULL;
+  if (bufferStorage) {
+    uint32_t flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    bufferStorage(GL_UNIFORM_BUFFER, size, NULL, flags);
+    mapped = glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+    gRenderer.uniforms.persistent = mapped != NULL;
+  } else {
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, gRenderer.glState.uniformBuffer);
+
+  initUniformRing(&gRenderer.uniforms.ring, mapped, frameSize,
+                  NUM_FRAMES_IN_FLIGHT, MAX(alignment, 16));
+  LOG("Uniform ring: %d x %d bytes, %s", NUM_FRAMES_IN_FLIGHT, frameSize,
+      gRenderer.uniforms.persistent ? "persistent mapped" : "buffer updates");
+}
+
+static void destroyUniformBuffer(void) {
+  uint32_t buffer = gRenderer.uniforms.buffer;
+  if (gRenderer.uniforms.persistent) {
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, gRenderer.glState.uniformBuffer);
+  }
+  glDeleteBuffers(1, &buffer);
+  gRenderer.uniforms.buffer = 0;
+  gRenderer.uniforms.persistent = false;
+
+  // Deleting unbinds it, and the name may come back for the next buffer
+  if (gRenderer.glState.uniformBuffer == buffer) {
+    gRenderer.glState.uniformBuffer = 0;
+  }
+  if (gRenderer.glState.vertexBuffer == buffer) {
+    gRenderer.glState.vertexBuffer = 0;
+  }
+}
+
+static RenderTargetHandle createGLRenderTarget(const RenderTargetDesc *desc) {
+  uint32_t texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  switch (desc->format) {
+  case RenderTargetFormat_RGBA8:
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, desc->width, desc->height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    break;
+  case RenderTargetFormat_RGBA16F:
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, desc->width, desc->height, 0,
+                 GL_RGBA, GL_FLOAT, NULL);
+    break;
+  case RenderTargetFormat_Depth32F:
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, desc->width,
+                 desc->height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    break;
+  default:
+    ASSERT(false);
+    break;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return texture;
+}
+
+static void destroyGLRenderTarget(RenderTargetHandle handle) {
+  // The name may come back for a new texture, which has to be attached again
+  for (int i = 0; i < 4; ++i) {
+    if (gRenderer.deferred.gbufferAttachments[i] == handle) {
+      gRenderer.deferred.gbufferAttachments[i] = 0;
+    }
+  }
+  if (gRenderer.resolution.sceneColorAttachment == handle) {
+    gRenderer.resolution.sceneColorAttachment = 0;
   }
+  glDeleteTextures(1, &handle);
 }
 
 static void registerUniformBindings(uint32_t program) {
   setUniformBinding(program, "type_ViewData", VIEW_BINDING);
   setUniformBinding(program, "type_MaterialData", MATERIAL_BINDING);
   setUniformBinding(program, "type_DrawData", DRAW_BINDING);
+  setUniformBinding(program, "type_LightingData", LIGHTING_BINDING);
 }
 
-void initRenderer(void) {
-  App *app = getApp();
+// Returns the index of the shader program in pipelines.shaders, requesting it
+// the first time
+static int getShaderProgram(const char *name) {
+  for (int i = 0; i < gRenderer.pipelines.numShaders; ++i) {
+    if (strcmp(gRenderer.pipelines.shaders[i].name, name) == 0) {
+      return i;
+    }
+  }
+
+  ASSERT(gRenderer.pipelines.numShaders < MAX_SHADER_PROGRAMS);
+  int index = gRenderer.pipelines.numShaders++;
+  ShaderProgram *shader = &gRenderer.pipelines.shaders[index];
+  *shader = (ShaderProgram){.name = name};
+  requestShaderProgram(shader);
+  return index;
+}
+
+static void createGLPipeline(const PipelineDesc *desc, int index) {
+  if (index >= gRenderer.pipelines.capacity) {
+    int capacity = MAX(gRenderer.pipelines.capacity * 2, 16);
+    int *programs = MMALLOC_ARRAY(int, capacity);
+    if (gRenderer.pipelines.programs) {
+      memcpy(programs, gRenderer.pipelines.programs,
+             sizeof(int) * gRenderer.pipelines.capacity);
+      MFREE(gRenderer.pipelines.programs);
+    }
+    gRenderer.pipelines.programs = programs;
+    gRenderer.pipelines.capacity = capacity;
+  }
+  gRenderer.pipelines.programs[index] = getShaderProgram(desc->shader);
+}
 
+void initRenderer(void) {
   if (GLAD_GL_KHR_debug) {
     glEnable(GL_DEBUG_OUTPUT);
     glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
     glDebugMessageCallback(openglDebugCallback, NULL);
   }
 
+  gRenderer.caps.textureCompressionS3TC =
+      hasGLExtension("GL_EXT_texture_compression_s3tc");
+  gRenderer.caps.textureCompressionBPTC =
+      hasGLExtension("GL_ARB_texture_compression_bptc");
+
   glGenVertexArrays(1, &gRenderer.vao);
   glBindVertexArray(gRenderer.vao);
+  for (uint32_t i = 0; i < 4; ++i) {
+    glVertexAttribDivisor(INSTANCE_MODEL_MAT_ATTRIB + i, 1);
+    glVertexAttribDivisor(INSTANCE_NORMAL_MAT_ATTRIB + i, 1);
+  }
 
-  gRenderer.phong.program =
-      createShaderProgram("phong_vert.glsl", "phong_frag.glsl");
-  registerUniformBindings(gRenderer.phong.program);
+  // Binaries are only reused on the driver that built them
+  {
+    uint64_t hash = PIPELINE_HASH_SEED;
+    uint32_t strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    for (int i = 0; i < (int)ARRAY_COUNT(strings); ++i) {
+      const char *string = (const char *)glGetString(strings[i]);
+      hash = hashPipelineBytes(hash, string, (int)strlen(string) + 1);
+    }
+    gRenderer.pipelines.driverHash = hash;
+
+    int32_t numFormats = 0;
+    if (hasGLExtension("GL_ARB_get_program_binary")) {
+      glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    }
+    if (numFormats > 0) {
+      gRenderer.pipelines.getProgramBinary =
+          (GetProgramBinaryProc)getGLProcAddress("glGetProgramBinary");
+      gRenderer.pipelines.programBinary =
+          (ProgramBinaryProc)getGLProcAddress("glProgramBinary");
+      gRenderer.pipelines.programParameteri =
+          (ProgramParameteriProc)getGLProcAddress("glProgramParameteri");
+    }
+    if (!gRenderer.pipelines.getProgramBinary ||
+        !gRenderer.pipelines.programBinary ||
+        !gRenderer.pipelines.programParameteri) {
+      gRenderer.pipelines.getProgramBinary = NULL;
+      gRenderer.pipelines.programBinary = NULL;
+      gRenderer.pipelines.programParameteri = NULL;
+    }
+
+    // Lets the driver compile on its own threads until the programs are
+    // first used
+    MaxShaderCompilerThreadsProc maxShaderCompilerThreads = NULL;
+    if (hasGLExtension("GL_KHR_parallel_shader_compile")) {
+      maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)getGLProcAddress(
+          "glMaxShaderCompilerThreadsKHR");
+    }
+    if (maxShaderCompilerThreads) {
+      // All the threads the driver wants
+      maxShaderCompilerThreads(0xFFFFFFFF);
+    }
+    LOG("Program binaries: %s, parallel compile: %s",
+        gRenderer.pipelines.programBinary ? "yes" : "no",
+        maxShaderCompilerThreads ? "yes" : "no");
+  }
 
   // Init deferred pipeline
   {
     glGenFramebuffers(1, &gRenderer.deferred.gbufferFBO);
     glBindFramebuffer(GL_FRAMEBUFFER, gRenderer.deferred.gbufferFBO);
-    glGenTextures(ARRAY_COUNT(gRenderer.deferred.gbufferTextures),
-                  gRenderer.deferred.gbufferTextures);
-
-    // TODO: Handle window resizing
-    glBindTexture(GL_TEXTURE_2D, gRenderer.deferred.gbufferTextures[0]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->width, app->height, 0,
-                 GL_RGBA, GL_FLOAT, NULL);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                           gRenderer.deferred.gbufferTextures[0], 0);
-
-    glBindTexture(GL_TEXTURE_2D, gRenderer.deferred.gbufferTextures[1]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->width, app->height, 0,
-                 GL_RGBA, GL_FLOAT, NULL);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
-                           gRenderer.deferred.gbufferTextures[1], 0);
-
-    glBindTexture(GL_TEXTURE_2D, gRenderer.deferred.gbufferTextures[2]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->width, app->height, 0,
-                 GL_RGBA, GL_FLOAT, NULL);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D,
-                           gRenderer.deferred.gbufferTextures[2], 0);
-
     uint32_t attachmentEnums[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
                                   GL_COLOR_ATTACHMENT2};
     glDrawBuffers(ARRAY_COUNT(attachmentEnums), attachmentEnums);
 
-    glGenRenderbuffers(1, &gRenderer.deferred.gbufferDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, gRenderer.deferred.gbufferDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, app->width,
-                          app->height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                              GL_RENDERBUFFER, gRenderer.deferred.gbufferDepth);
-
-    ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
-
     glGenSamplers(1, &gRenderer.deferred.gbufferSampler);
     glSamplerParameteri(gRenderer.deferred.gbufferSampler,
                         GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glSamplerParameteri(gRenderer.deferred.gbufferSampler,
                         GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
-    gRenderer.deferred.gbufferProgram =
-        createShaderProgram("gbuffer_vert.glsl", "gbuffer_frag.glsl");
-    registerUniformBindings(gRenderer.deferred.gbufferProgram);
-    gRenderer.deferred.lightingProgram = createShaderProgram(
-        "deferred_lighting_vert.glsl", "deferred_lighting_frag.glsl");
-
-    gRenderer.deferred.gbufferTextureLocations[0] =
-        glGetUniformLocation(gRenderer.deferred.lightingProgram,
-                             "SPIRV_Cross_Combinedgbuffer0gbufferSampler");
-    gRenderer.deferred.gbufferTextureLocations[1] =
-        glGetUniformLocation(gRenderer.deferred.lightingProgram,
-                             "SPIRV_Cross_Combinedgbuffer1gbufferSampler");
-    gRenderer.deferred.gbufferTextureLocations[2] =
-        glGetUniformLocation(gRenderer.deferred.lightingProgram,
-                             "SPIRV_Cross_Combinedgbuffer2gbufferSampler");
+    initPipelineCache(&gRenderer.pipelines.cache, createGLPipeline);
+    gRenderer.pipelines.gbuffer =
+        getPipeline(&gRenderer.pipelines.cache, &gGBufferPipelineDesc);
+    gRenderer.pipelines.lighting =
+        getPipeline(&gRenderer.pipelines.cache, &gLightingPipelineDesc);
   }
 
-  glGenBuffers(1, &gRenderer.viewUniformBuffer);
-  glBindBuffer(GL_UNIFORM_BUFFER, gRenderer.viewUniformBuffer);
-  glBufferData(GL_UNIFORM_BUFFER, sizeof(ViewUniforms), NULL, GL_DYNAMIC_DRAW);
+  {
+    static const uint32_t formats[] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+
+    glGenBuffers(3, gRenderer.lighting.buffers);
+    glGenTextures(3, gRenderer.lighting.textures);
+    for (int i = 0; i < 3; ++i) {
+      glBindBuffer(GL_TEXTURE_BUFFER, gRenderer.lighting.buffers[i]);
+      glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+      glBindTexture(GL_TEXTURE_BUFFER, gRenderer.lighting.textures[i]);
+      glTexBuffer(GL_TEXTURE_BUFFER, formats[i],
+                  gRenderer.lighting.buffers[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+  }
 
-  glGenBuffers(1, &gRenderer.materialUniformBuffer);
-  glBindBuffer(GL_UNIFORM_BUFFER, gRenderer.materialUniformBuffer);
-  glBufferData(GL_UNIFORM_BUFFER, sizeof(MaterialUniforms), NULL,
-               GL_DYNAMIC_DRAW);
+  initDynamicResolution(&gRenderer.resolution.controller,
+                        DYNAMIC_RESOLUTION_DEFAULT_TARGET);
+  glGenQueries(NUM_FRAMES_IN_FLIGHT, gRenderer.resolution.queries);
+  glGenFramebuffers(1, &gRenderer.resolution.sceneColorFBO);
 
-  glGenBuffers(1, &gRenderer.drawUniformBuffer);
-  glBindBuffer(GL_UNIFORM_BUFFER, gRenderer.drawUniformBuffer);
-  glBufferData(GL_UNIFORM_BUFFER, sizeof(DrawUniforms), NULL, GL_DYNAMIC_DRAW);
+  createUniformBuffer(UNIFORM_RING_FRAME_SIZE);
 
   // set initial opengl states
   glBindBuffer(GL_ARRAY_BUFFER, gRenderer.glState.vertexBuffer);
@@ -250,420 +706,663 @@ void initRenderer(void) {
   glBindBuffer(GL_UNIFORM_BUFFER, gRenderer.glState.uniformBuffer);
   glUseProgram(gRenderer.glState.program);
   glBindFramebuffer(GL_FRAMEBUFFER, gRenderer.glState.framebuffer);
-  glPolygonMode(GL_FRONT_AND_BACK, gRenderer.glState.polygonMode);
-  setModeEnable(GL_DEPTH_TEST, gRenderer.glState.depthTestEnabled);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_DEPTH_TEST);
+  glDepthMask(GL_TRUE);
+  glDisable(GL_BLEND);
   glDepthFunc(GL_GEQUAL);
   glDepthRange(-1, 1);
+
+  initOcclusionBuffer(&gRenderer.occlusion);
+  initFrameGraph(&gRenderer.frameGraph, createGLRenderTarget,
+                 destroyGLRenderTarget);
+  initTextureStreamer(&gRenderer.textureStreamer,
+                      TEXTURE_STREAM_DEFAULT_BUDGET);
+  initRenderCounterFrames(&gRenderer.counters);
+  for (int i = 0; i < NUM_RENDER_SNAPSHOTS; ++i) {
+    RenderSnapshot *snapshot = &gRenderer.snapshots[i];
+    initLightClusters(&snapshot->clusters);
+    snapshot->resolutionStats = gRenderer.resolution.controller.stats;
+    snapshot->textureStreamStats = gRenderer.textureStreamer.stats;
+  }
 }
 
 void destroyRenderer(void) {
-  glDeleteBuffers(1, &gRenderer.drawUniformBuffer);
-  glDeleteBuffers(1, &gRenderer.materialUniformBuffer);
-  glDeleteBuffers(1, &gRenderer.viewUniformBuffer);
+  const DynamicResolutionStats *resolution =
+      &gRenderer.resolution.controller.stats;
+  LOG("Dynamic resolution: scale %.2f (%dx%d), %.2f ms per frame for a "
+      "%.2f ms target",
+      resolution->scale, resolution->width, resolution->height,
+      resolution->smoothedFrameTime * 1000, resolution->targetFrameTime * 1000);
+  const TextureStreamStats *streaming = &gRenderer.textureStreamer.stats;
+  LOG("Texture streaming: %d levels streamed in, %d evicted",
+      streaming->numStreamedIn, streaming->numEvicted);
+
+  MFREE(gRenderer.meshletDraws.baseVertices);
+  MFREE(gRenderer.meshletDraws.offsets);
+  MFREE(gRenderer.meshletDraws.counts);
+  MFREE(gRenderer.instanceStaging);
+  for (int i = 0; i < NUM_RENDER_SNAPSHOTS; ++i) {
+    RenderSnapshot *snapshot = &gRenderer.snapshots[i];
+    destroyDrawList(&snapshot->drawList);
+    MFREE(snapshot->vertexUploads);
+    MFREE(snapshot->vertexData);
+    destroyLightClusters(&snapshot->clusters);
+    MFREE(snapshot->lightUniforms);
+  }
+  destroyOcclusionBuffer(&gRenderer.occlusion);
+  destroyTextureStreamer(&gRenderer.textureStreamer);
+
+  for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; ++i) {
+    if (gRenderer.uniforms.fences[i]) {
+      glDeleteSync(gRenderer.uniforms.fences[i]);
+    }
+  }
+  destroyUniformBuffer();
+
+  glDeleteTextures(3, gRenderer.lighting.textures);
+  glDeleteBuffers(3, gRenderer.lighting.buffers);
 
-  glDeleteProgram(gRenderer.deferred.lightingProgram);
-  glDeleteProgram(gRenderer.deferred.gbufferProgram);
+  glDeleteQueries(NUM_FRAMES_IN_FLIGHT, gRenderer.resolution.queries);
+  glDeleteFramebuffers(1, &gRenderer.resolution.sceneColorFBO);
+
+  for (int i = 0; i < gRenderer.pipelines.numShaders; ++i) {
+    const ShaderProgram *shader = &gRenderer.pipelines.shaders[i];
+    // Programs no pipeline was set with are still compiling
+    glDeleteShader(shader->vertexShader);
+    glDeleteShader(shader->fragmentShader);
+    glDeleteProgram(shader->program);
+  }
+  MFREE(gRenderer.pipelines.programs);
+  destroyPipelineCache(&gRenderer.pipelines.cache);
   glDeleteSamplers(1, &gRenderer.deferred.gbufferSampler);
-  glDeleteRenderbuffers(1, &gRenderer.deferred.gbufferDepth);
-  glDeleteTextures(ARRAY_COUNT(gRenderer.deferred.gbufferTextures),
-                   gRenderer.deferred.gbufferTextures);
+  destroyFrameGraph(&gRenderer.frameGraph);
   glDeleteFramebuffers(1, &gRenderer.deferred.gbufferFBO);
 
   glDeleteVertexArrays(1, &gRenderer.vao);
-  glDeleteProgram(gRenderer.phong.program);
 
   gRenderer = (Renderer){0};
 }
 
-void render(float dt) {
+static void waitForUniformRegion(int frameIndex) {
+  GLsync fence = gRenderer.uniforms.fences[frameIndex];
+  if (!fence) {
+    return;
+  }
 
-  // renderModel(&gRenderer.tempModel, mat4Identity());
+  uint32_t result = glClientWaitSync(fence, 0, 0);
+  while (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED &&
+         result != GL_WAIT_FAILED) {
+    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+  }
+  glDeleteSync(fence);
+  gRenderer.uniforms.fences[frameIndex] = NULL;
+}
 
-  // int test;
-  // glGetActiveUniformBlockiv(
-  //     gRenderer.phong.program,
-  //     glGetUniformBlockIndex(gRenderer.phong.program, "type_DrawData"),
-  //     GL_UNIFORM_BLOCK_BINDING, &test);
+// Recreates the uniform buffer between frames when a frame asking for size
+// bytes wouldn't fit, after waiting for every region
+static void reserveUniformRing(int size) {
+  UniformRing *ring = &gRenderer.uniforms.ring;
+  int frameSize = getUniformRingGrowSize(ring, size);
+  if (frameSize == ring->frameSize) {
+    return;
+  }
 
-  // LOG("%d", test);
+  for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; ++i) {
+    waitForUniformRegion(i);
+  }
+  int highWaterMark = ring->highWaterMark;
+  destroyUniformBuffer();
+  createUniformBuffer(frameSize);
+  ring->highWaterMark = highWaterMark;
 }
 
-void loadGLTFModel(Model *model, const String *basePath) {
-  String filePath = {0};
+// Returns the offset of the copy in the uniform ring, or -1 when the frame
+// ran out of it
+static int pushUniformData(const void *data, int size) {
+  UniformRing *ring = &gRenderer.uniforms.ring;
+  int offset = pushUniforms(ring, data, size);
+  if (offset < 0) {
+    return -1;
+  }
+  countUpload(UploadType_Uniform, size);
+  if (!ring->mapped) {
+    setUniformBuffer(gRenderer.uniforms.buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+  }
+  return offset;
+}
 
-  if (endsWithCString(basePath, ".glb")) {
-    copyString(&filePath, basePath);
-  } else {
-    copyString(&filePath, basePath);
-    appendPathCStr(&filePath, pathBaseName(basePath));
-    appendCStr(&filePath, ".gltf");
+// Skinned vertices change every frame, upload them before any draw
+static void uploadSnapshotVertices(const RenderSnapshot *snapshot) {
+  for (int i = 0; i < snapshot->numVertexUploads; ++i) {
+    const VertexUpload *upload = &snapshot->vertexUploads[i];
+    setVertexBuffer(upload->buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, upload->offsetInBytes, upload->size,
+                    snapshot->vertexData + upload->dataOffset);
+    countUpload(UploadType_Vertex, upload->size);
   }
+}
 
-  cgltf_options options = {0};
-  cgltf_data *gltf;
-  cgltf_result gltfLoadResult = cgltf_parse_file(&options, filePath.buf, &gltf);
-  ASSERT(gltfLoadResult == cgltf_result_success);
-  cgltf_load_buffers(&options, gltf, filePath.buf);
+// Textures sampled by the draws get their levels for the next frame, picked
+// for the size they're rendered at now
+static void requestSnapshotTextureLevels(const RenderSnapshot *snapshot) {
+  DrawView view = {
+      .viewProj = mat4Multiply(snapshot->viewUniforms.projMat,
+                               snapshot->viewUniforms.viewMat),
+      .eye = snapshot->eye,
+      .farZ = snapshot->farZ,
+      .pixelsPerUnit =
+          snapshot->viewUniforms.projMat.cols[1].y *
+          (float)gRenderer.resolution.controller.stats.height * 0.5f,
+  };
+  requestDrawTextureLevels(&gRenderer.textureStreamer, &snapshot->drawList, 0,
+                           &view);
+}
 
-  model->numTextures = gltf->textures_count;
-  model->textures = MMALLOC_ARRAY_ZEROES(uint32_t, model->numTextures);
+void render(float dt) {
+  PROFILE_SCOPE("render");
+  UniformRing *ring = &gRenderer.uniforms.ring;
+  FrameGraph *graph = &gRenderer.frameGraph;
+  RenderSnapshot *snapshot = &gRenderer.snapshots[gRenderer.renderedSnapshot];
+  // A frame that ran out of the ring drew what fit, the next ones get room
+  // for it and for the instance data of this one
+  reserveUniformRing(
+      MAX(ring->highWaterMark,
+          (int)sizeof(DrawUniforms) * snapshot->drawList.numPackets));
+  uploadSnapshotVertices(snapshot);
+  if (snapshot->hasGBufferPass) {
+    declareGBufferPass(snapshot);
+    requestSnapshotTextureLevels(snapshot);
+  }
+  if (snapshot->hasLightingPass) {
+    declareLightingPass(snapshot);
+  }
+  compileFrameGraph(graph);
+  // The first frame also waits for programs and uploads, so it isn't timed
+  bool timed = graph->frameIndex > 1;
+  if (timed) {
+    glBeginQuery(GL_TIME_ELAPSED,
+                 gRenderer.resolution.queries[ring->frameIndex]);
+  }
+  executeFrameGraph(graph);
+  if (timed) {
+    glEndQuery(GL_TIME_ELAPSED);
+    gRenderer.resolution.queryPending[ring->frameIndex] = true;
+  }
+  resetFrameGraph(graph);
+  updateTextureStreamer(&gRenderer.textureStreamer);
+  applyTextureStreamChanges();
+
+  // End of the frame: fence its uniform region and move on to the oldest one
+  gRenderer.uniforms.fences[ring->frameIndex] =
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  advanceUniformRing(ring);
+  waitForUniformRegion(ring->frameIndex);
+
+  // The oldest frame is done, so its query is ready without stalling
+  if (gRenderer.resolution.queryPending[ring->frameIndex]) {
+    uint64_t elapsed = 0;
+    glGetQueryObjectui64v(gRenderer.resolution.queries[ring->frameIndex],
+                          GL_QUERY_RESULT, &elapsed);
+    gRenderer.resolution.queryPending[ring->frameIndex] = false;
+    updateDynamicResolution(&gRenderer.resolution.controller,
+                            (float)((double)elapsed * 1e-9));
+  }
 
-  {
-    String imageFilePath = {0};
-    for (cgltf_size textureIndex = 0; textureIndex < gltf->images_count;
-         ++textureIndex) {
-      cgltf_image *gltfImage = &gltf->images[textureIndex];
-      int w, h, numComponents;
-      stbi_uc *data;
-      if (gltfImage->buffer_view) {
-        data = stbi_load_from_memory(
-            (uint8_t *)gltfImage->buffer_view->buffer->data +
-                gltfImage->buffer_view->offset,
-            gltfImage->buffer_view->size, &w, &h, &numComponents,
-            STBI_rgb_alpha);
-      } else {
-        copyString(&imageFilePath, basePath);
-        appendPathCStr(&imageFilePath, gltfImage->uri);
-
-        data = stbi_load(imageFilePath.buf, &w, &h, &numComponents,
-                         STBI_rgb_alpha);
-      }
-      ASSERT(data);
+  // The snapshot goes back to the update side with the stats of this frame
+  snapshot->resolutionStats = gRenderer.resolution.controller.stats;
+  snapshot->textureStreamStats = gRenderer.textureStreamer.stats;
+  snapshot->frameGraphStats = graph->stats;
+  endRenderCounterFrame(&gRenderer.counters);
+  snapshot->renderCounters = gRenderer.counters.last;
+  resetDrawList(&snapshot->drawList);
+  snapshot->numVertexUploads = 0;
+  snapshot->vertexDataSize = 0;
+  snapshot->hasGBufferPass = false;
+  snapshot->hasLightingPass = false;
+
+  // renderModel(&gRenderer.tempModel, mat4Identity());
+}
+
+static uint32_t getCompressedTextureFormat(Ktx2Format format) {
+  switch (format) {
+  case Ktx2Format_BC1:
+    return gRenderer.caps.textureCompressionS3TC
+               ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+               : 0;
+  case Ktx2Format_BC3:
+    return gRenderer.caps.textureCompressionS3TC
+               ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+               : 0;
+  case Ktx2Format_BC4:
+    return GL_COMPRESSED_RED_RGTC1;
+  case Ktx2Format_BC5:
+    return GL_COMPRESSED_RG_RGTC2;
+  case Ktx2Format_BC7:
+    return gRenderer.caps.textureCompressionBPTC
+               ? GL_COMPRESSED_RGBA_BPTC_UNORM_ARB
+               : 0;
+  default:
+    return 0;
+  }
+}
+
+static void uploadTextureLevel(const TextureSource *source,
+                               const StreamedTexture *t, int level) {
+  int width = MAX(t->width >> level, 1);
+  int height = MAX(t->height >> level, 1);
+  const uint8_t *data = source->data + source->levelOffsets[level];
+  if (source->compressedFormat) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, source->compressedFormat,
+                           width, height, 0, t->levelSizes[level], data);
+  } else {
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, data);
+  }
+  countUpload(UploadType_Texture, t->levelSizes[level]);
+}
 
-      uint32_t *tex = &model->textures[textureIndex];
-      glGenTextures(1, tex);
-      glBindTexture(GL_TEXTURE_2D, *tex);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
-                   GL_UNSIGNED_BYTE, data);
-      glGenerateMipmap(GL_TEXTURE_2D);
+// Creates the texture with only its coarse levels resident, the streamer
+// takes it from there
+static void createStreamedTexture(Model *model, int index,
+                                  TextureSource *source, int width,
+                                  int height, int numLevels,
+                                  const int *levelSizes) {
+  int entry = addStreamedTexture(&gRenderer.textureStreamer, source, width,
+                                 height, numLevels, levelSizes);
+  const StreamedTexture *t = &gRenderer.textureStreamer.textures[entry];
+  model->textureStreams[index] = entry;
+
+  glGenTextures(1, &source->texture);
+  glBindTexture(GL_TEXTURE_2D, source->texture);
+  for (int i = t->coarseLevel; i < numLevels; ++i) {
+    uploadTextureLevel(source, t, i);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t->coarseLevel);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  model->textures[index] = source->texture;
+}
 
-      stbi_image_free(data);
+static int getMipChainLength(int width, int height) {
+  int numLevels = 1;
+  while ((width | height) >> numLevels) {
+    ++numLevels;
+  }
+  return MIN(numLevels, TEXTURE_STREAM_MAX_LEVELS);
+}
+
+// Fills the levels of source after level 0 with 2x2 box filtered RGBA8
+static void buildMipChain(TextureSource *source, int width, int height,
+                          int numLevels) {
+  for (int level = 1; level < numLevels; ++level) {
+    int srcWidth = MAX(width >> (level - 1), 1);
+    int srcHeight = MAX(height >> (level - 1), 1);
+    int dstWidth = MAX(width >> level, 1);
+    int dstHeight = MAX(height >> level, 1);
+    const uint8_t *src = source->data + source->levelOffsets[level - 1];
+    uint8_t *dst = source->data + source->levelOffsets[level];
+    for (int y = 0; y < dstHeight; ++y) {
+      int y0 = MIN(y * 2, srcHeight - 1);
+      int y1 = MIN(y * 2 + 1, srcHeight - 1);
+      for (int x = 0; x < dstWidth; ++x) {
+        int x0 = MIN(x * 2, srcWidth - 1);
+        int x1 = MIN(x * 2 + 1, srcWidth - 1);
+        for (int c = 0; c < 4; ++c) {
+          int sum = src[(y0 * srcWidth + x0) * 4 + c] +
+                    src[(y0 * srcWidth + x1) * 4 + c] +
+                    src[(y1 * srcWidth + x0) * 4 + c] +
+                    src[(y1 * srcWidth + x1) * 4 + c];
+          dst[(y * dstWidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+        }
+      }
     }
-    glBindTexture(GL_TEXTURE_2D, 0);
-    destroyString(&imageFilePath);
   }
+}
 
-  model->numSamplers = gltf->samplers_count;
-  model->samplers = MMALLOC_ARRAY_ZEROES(uint32_t, model->numSamplers);
+// RGBA8 source with room for numLevels levels, level 0 left to the caller
+static TextureSource *createRgba8Source(int width, int height, int numLevels,
+                                        int *outLevelSizes) {
+  TextureSource *source = MMALLOC_ZEROES(TextureSource);
+  int size = 0;
+  for (int i = 0; i < numLevels; ++i) {
+    source->levelOffsets[i] = size;
+    outLevelSizes[i] = MAX(width >> i, 1) * MAX(height >> i, 1) * 4;
+    size += outLevelSizes[i];
+  }
+  source->data = MMALLOC_ARRAY(uint8_t, size);
+  return source;
+}
+
+// Keeps the blocks as they are when the driver can sample them, otherwise
+// expands them to RGBA8 on the CPU. Images without mips get a box filtered
+// chain.
+static bool createKtx2Texture(Model *model, int index, const uint8_t *data,
+                              int size) {
+  Ktx2Image image;
+  if (!parseKtx2(&image, data, size)) {
+    return false;
+  }
 
-  for (cgltf_size samplerIndex = 0; samplerIndex < gltf->samplers_count;
-       ++samplerIndex) {
-    cgltf_sampler *gltfSampler = &gltf->samplers[samplerIndex];
+  uint32_t compressedFormat = getCompressedTextureFormat(image.format);
+  if (!compressedFormat && !canDecodeKtx2Format(image.format)) {
+    return false;
+  }
 
-    uint32_t *sampler = &model->samplers[samplerIndex];
-    glGenSamplers(1, sampler);
-    int32_t magFilter = gltfSampler->mag_filter;
-    if (magFilter == 0) {
-      magFilter = GL_LINEAR;
+  int numLevels = MIN(image.numLevels, TEXTURE_STREAM_MAX_LEVELS);
+  int levelSizes[TEXTURE_STREAM_MAX_LEVELS];
+  TextureSource *source;
+  if (compressedFormat) {
+    source = MMALLOC_ZEROES(TextureSource);
+    source->compressedFormat = compressedFormat;
+    int totalSize = 0;
+    for (int i = 0; i < numLevels; ++i) {
+      source->levelOffsets[i] = totalSize;
+      levelSizes[i] = image.levels[i].size;
+      totalSize += levelSizes[i];
     }
-    int32_t minFilter = gltfSampler->min_filter;
-    if (minFilter == 0) {
-      minFilter = GL_NEAREST_MIPMAP_LINEAR;
+    source->data = MMALLOC_ARRAY(uint8_t, totalSize);
+    for (int i = 0; i < numLevels; ++i) {
+      memcpy(source->data + source->levelOffsets[i], image.levels[i].data,
+             levelSizes[i]);
     }
-    glSamplerParameteri(*sampler, GL_TEXTURE_MAG_FILTER, magFilter);
-    glSamplerParameteri(*sampler, GL_TEXTURE_MIN_FILTER, minFilter);
-    int32_t wrapModeS = gltfSampler->wrap_s;
-    if (wrapModeS == 0) {
-      wrapModeS = GL_REPEAT;
+  } else {
+    if (numLevels == 1) {
+      numLevels = getMipChainLength(image.width, image.height);
     }
-    int32_t wrapModeT = gltfSampler->wrap_t;
-    if (wrapModeT == 0) {
-      wrapModeT = GL_REPEAT;
+    source = createRgba8Source(image.width, image.height, numLevels,
+                               levelSizes);
+    for (int i = 0; i < image.numLevels && i < numLevels; ++i) {
+      decodeKtx2Level(&image, i, source->data + source->levelOffsets[i]);
+    }
+    if (image.numLevels == 1) {
+      buildMipChain(source, image.width, image.height, numLevels);
     }
-    glSamplerParameteri(*sampler, GL_TEXTURE_WRAP_S, wrapModeS);
-    glSamplerParameteri(*sampler, GL_TEXTURE_WRAP_T, wrapModeT);
-    glSamplerParameteri(*sampler, GL_TEXTURE_WRAP_R, GL_REPEAT);
   }
 
-  model->numMaterials = gltf->materials_count;
-  model->materials = MMALLOC_ARRAY_ZEROES(Material, model->numMaterials);
-  for (cgltf_size materialIndex = 0; materialIndex < gltf->materials_count;
-       ++materialIndex) {
-    cgltf_material *gltfMaterial = &gltf->materials[materialIndex];
-    Material *material = &model->materials[materialIndex];
-    ASSERT(gltfMaterial->has_pbr_metallic_roughness);
-
-    cgltf_pbr_metallic_roughness *pbrMR = &gltfMaterial->pbr_metallic_roughness;
-
-    memcpy(&material->baseColorFactor, pbrMR->base_color_factor,
-           sizeof(Float4));
-
-    if (pbrMR->base_color_texture.texture) {
-      material->baseColorTexture = gltfMaterial->pbr_metallic_roughness
-                                       .base_color_texture.texture->image -
-                                   gltf->images;
+  createStreamedTexture(model, index, source, image.width, image.height,
+                        numLevels, levelSizes);
+  return true;
+}
 
-      if (pbrMR->base_color_texture.texture->sampler) {
-        material->baseColorSampler = gltfMaterial->pbr_metallic_roughness
-                                         .base_color_texture.texture->sampler -
-                                     gltf->samplers;
-      } else {
-        material->baseColorSampler = -1;
-      }
-    } else {
-      material->baseColorTexture = -1;
-      material->baseColorSampler = -1;
-    }
+void initModelTextures(Model *model, int numTextures) {
+  model->numTextures = numTextures;
+  model->textures = MMALLOC_ARRAY_ZEROES(uint32_t, numTextures);
+  model->textureStreams = MMALLOC_ARRAY(int, numTextures);
+  for (int i = 0; i < numTextures; ++i) {
+    model->textureStreams[i] = -1;
   }
+}
 
-  model->numMeshes = gltf->meshes_count;
-  model->meshes = MMALLOC_ARRAY_ZEROES(Mesh, model->numMeshes);
+bool createModelTexture(Model *model, int index, const uint8_t *encoded,
+                        int size) {
+  if (isKtx2Data(encoded, size)) {
+    return createKtx2Texture(model, index, encoded, size);
+  }
 
-  int vertexBufferSize = 0;
-  int indexBufferSize = 0;
+  int w, h, numComponents;
+  stbi_uc *data = stbi_load_from_memory(encoded, size, &w, &h, &numComponents,
+                                        STBI_rgb_alpha);
+  if (!data) {
+    return false;
+  }
 
-  for (cgltf_size meshIndex = 0; meshIndex < gltf->meshes_count; ++meshIndex) {
-    cgltf_mesh *gltfMesh = &gltf->meshes[meshIndex];
-    Mesh *mesh = &model->meshes[meshIndex];
+  int numLevels = getMipChainLength(w, h);
+  int levelSizes[TEXTURE_STREAM_MAX_LEVELS];
+  TextureSource *source = createRgba8Source(w, h, numLevels, levelSizes);
+  memcpy(source->data, data, levelSizes[0]);
+  buildMipChain(source, w, h, numLevels);
+  createStreamedTexture(model, index, source, w, h, numLevels, levelSizes);
 
-    mesh->numSubMeshes = gltfMesh->primitives_count;
-    mesh->subMeshes = MMALLOC_ARRAY_ZEROES(SubMesh, mesh->numSubMeshes);
-
-    for (cgltf_size primIndex = 0; primIndex < gltfMesh->primitives_count;
-         ++primIndex) {
-      cgltf_primitive *prim = &gltfMesh->primitives[primIndex];
-      SubMesh *subMesh = &mesh->subMeshes[primIndex];
-
-      subMesh->numIndices = prim->indices->count;
-      subMesh->indices = MMALLOC_ARRAY(VertexIndex, subMesh->numIndices);
-      VertexIndex maxIndex = 0;
-      for (cgltf_size i = 0; i < prim->indices->count; ++i) {
-        subMesh->indices[i] = cgltf_accessor_read_index(prim->indices, i);
-        if (maxIndex < subMesh->indices[i]) {
-          maxIndex = subMesh->indices[i];
-        }
-      }
+  stbi_image_free(data);
+  return true;
+}
 
-      subMesh->numVertices = maxIndex + 1;
-      subMesh->vertices = MMALLOC_ARRAY_ZEROES(Vertex, subMesh->numVertices);
-      for (int i = 0; i < subMesh->numVertices; ++i) {
-        subMesh->vertices[i].color = (Float4){1, 1, 1, 1};
-      }
-      for (cgltf_size attribIndex = 0; attribIndex < prim->attributes_count;
-           ++attribIndex) {
-        cgltf_attribute *attrib = &prim->attributes[attribIndex];
-        ASSERT(!attrib->data->is_sparse); // Sparse is not supported yet;
-        switch (attrib->type) {
-        case cgltf_attribute_type_position:
-          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
-               ++vertexIndex) {
-            cgltf_size numComponents = cgltf_num_components(attrib->data->type);
-            cgltf_bool readResult = cgltf_accessor_read_float(
-                attrib->data, vertexIndex,
-                (float *)&subMesh->vertices[vertexIndex].position,
-                numComponents);
-            ASSERT(readResult);
-          }
-          break;
-        case cgltf_attribute_type_texcoord:
-          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
-               ++vertexIndex) {
-            cgltf_size numComponents = cgltf_num_components(attrib->data->type);
-            cgltf_bool readResult = cgltf_accessor_read_float(
-                attrib->data, vertexIndex,
-                (float *)&subMesh->vertices[vertexIndex].texcoord,
-                numComponents);
-            ASSERT(readResult);
-          }
-          break;
-        case cgltf_attribute_type_color:
-          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
-               ++vertexIndex) {
-            cgltf_size numComponents = cgltf_num_components(attrib->data->type);
-            cgltf_bool readResult = cgltf_accessor_read_float(
-                attrib->data, vertexIndex,
-                (float *)&subMesh->vertices[vertexIndex].color, numComponents);
-            ASSERT(readResult);
-          }
-          break;
-        case cgltf_attribute_type_normal:
-          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
-               ++vertexIndex) {
-            cgltf_size numComponents = cgltf_num_components(attrib->data->type);
-            cgltf_bool readResult = cgltf_accessor_read_float(
-                attrib->data, vertexIndex,
-                (float *)&subMesh->vertices[vertexIndex].normal, numComponents);
-            ASSERT(readResult);
-          }
-          break;
-        default:
-          break;
-        }
-      }
-      vertexBufferSize += subMesh->numVertices * sizeof(Vertex);
-      indexBufferSize += subMesh->numIndices * sizeof(VertexIndex);
+void initModelSamplers(Model *model, int numSamplers) {
+  model->numSamplers = numSamplers;
+  model->samplers = MMALLOC_ARRAY_ZEROES(uint32_t, numSamplers);
+}
 
-      subMesh->material = prim->material - gltf->materials;
-    }
+void createModelSampler(Model *model, int index, int magFilter, int minFilter,
+                        int wrapS, int wrapT) {
+  uint32_t *sampler = &model->samplers[index];
+  glGenSamplers(1, sampler);
+  if (magFilter == 0) {
+    magFilter = GL_LINEAR;
+  }
+  if (minFilter == 0) {
+    minFilter = GL_NEAREST_MIPMAP_LINEAR;
   }
+  glSamplerParameteri(*sampler, GL_TEXTURE_MAG_FILTER, magFilter);
+  glSamplerParameteri(*sampler, GL_TEXTURE_MIN_FILTER, minFilter);
+  if (wrapS == 0) {
+    wrapS = GL_REPEAT;
+  }
+  if (wrapT == 0) {
+    wrapT = GL_REPEAT;
+  }
+  glSamplerParameteri(*sampler, GL_TEXTURE_WRAP_S, wrapS);
+  glSamplerParameteri(*sampler, GL_TEXTURE_WRAP_T, wrapT);
+  glSamplerParameteri(*sampler, GL_TEXTURE_WRAP_R, GL_REPEAT);
+}
 
+void createModelBuffers(Model *model, int vertexBufferSize,
+                        int indexBufferSize, bool dynamicVertices) {
   uint32_t *vb = &model->gpuVertexBuffer;
   uint32_t *ib = &model->gpuIndexBuffer;
   glGenBuffers(1, vb);
   setVertexBuffer(*vb);
-  glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+  // Skinned vertices are re-uploaded every frame
+  glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL,
+               dynamicVertices ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
   glGenBuffers(1, ib);
   setIndexBuffer(*ib);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
 
-  int vertexOffsetInBytes = 0;
-  int indexOffsetInBytes = 0;
-
   for (int meshIndex = 0; meshIndex < model->numMeshes; ++meshIndex) {
     Mesh *mesh = &model->meshes[meshIndex];
     for (int subMeshIndex = 0; subMeshIndex < mesh->numSubMeshes;
          ++subMeshIndex) {
       SubMesh *subMesh = &mesh->subMeshes[subMeshIndex];
-      glBufferSubData(GL_ARRAY_BUFFER, vertexOffsetInBytes,
+      glBufferSubData(GL_ARRAY_BUFFER, subMesh->gpuVertexBufferOffsetInBytes,
                       subMesh->numVertices * sizeof(Vertex), subMesh->vertices);
-      glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexOffsetInBytes,
+      glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                      subMesh->gpuIndexBufferOffsetInBytes,
                       subMesh->numIndices * sizeof(VertexIndex),
                       subMesh->indices);
-      subMesh->gpuVertexBufferOffsetInBytes = vertexOffsetInBytes;
-      subMesh->gpuIndexBufferOffsetInBytes = indexOffsetInBytes;
-      vertexOffsetInBytes += subMesh->numVertices * sizeof(Vertex);
-      indexOffsetInBytes += subMesh->numIndices * sizeof(VertexIndex);
+      countUpload(UploadType_Vertex,
+                  subMesh->numVertices * sizeof(Vertex) +
+                      subMesh->numIndices * sizeof(VertexIndex));
     }
   }
+}
 
-  model->numNodes = gltf->nodes_count;
-  model->nodes = MMALLOC_ARRAY_ZEROES(SceneNode, model->numNodes);
-  for (cgltf_size nodeIndex = 0; nodeIndex < gltf->nodes_count; ++nodeIndex) {
-    cgltf_node *gltfNode = &gltf->nodes[nodeIndex];
-    SceneNode *node = &model->nodes[nodeIndex];
-
-    cgltf_node_transform_local(gltfNode,
-                               (float *)node->localTransform.matrix.cols);
-    cgltf_node_transform_world(gltfNode,
-                               (float *)node->worldTransform.matrix.cols);
-
-    if (gltfNode->parent) {
-      node->parent = gltfNode->parent - gltf->nodes;
-    } else {
-      node->parent = -1;
-    }
+void destroyModelResources(Model *model) {
+  glDeleteBuffers(1, &model->gpuIndexBuffer);
+  glDeleteBuffers(1, &model->gpuVertexBuffer);
 
-    if (gltfNode->mesh) {
-      node->mesh = gltfNode->mesh - gltf->meshes;
-    } else {
-      node->mesh = -1;
-    }
+  for (int i = 0; i < model->numSamplers; ++i) {
+    glDeleteSamplers(1, &model->samplers[i]);
+  }
+  MFREE(model->samplers);
 
-    if (gltfNode->children_count > 0) {
-      node->numChildNodes = gltfNode->children_count;
-      node->childNodes = MMALLOC_ARRAY(int, node->numChildNodes);
-      for (cgltf_size childIndex = 0; childIndex < gltfNode->children_count;
-           ++childIndex) {
-        node->childNodes[childIndex] =
-            gltfNode->children[childIndex] - gltf->nodes;
-      }
+  for (int i = 0; i < model->numTextures; ++i) {
+    int entry = model->textureStreams[i];
+    if (entry >= 0) {
+      TextureSource *source = gRenderer.textureStreamer.textures[entry].source;
+      removeStreamedTexture(&gRenderer.textureStreamer, entry);
+      MFREE(source->data);
+      MFREE(source);
     }
+    glDeleteTextures(1, &model->textures[i]);
   }
+  MFREE(model->textureStreams);
+  MFREE(model->textures);
+}
 
-  model->numScenes = gltf->scenes_count;
-  model->scenes = MMALLOC_ARRAY_ZEROES(Scene, model->numScenes);
-
-  for (cgltf_size sceneIndex = 0; sceneIndex < gltf->scenes_count;
-       ++sceneIndex) {
-    cgltf_scene *gltfScene = &gltf->scenes[sceneIndex];
-    Scene *scene = &model->scenes[sceneIndex];
-
-    if (gltfScene->nodes_count > 0) {
-      scene->numNodes = gltfScene->nodes_count;
-      scene->nodes = MMALLOC_ARRAY(int, scene->numNodes);
-
-      for (cgltf_size nodeIndex = 0; nodeIndex < gltfScene->nodes_count;
-           ++nodeIndex) {
-        cgltf_node *gltfNode = gltfScene->nodes[nodeIndex];
-        scene->nodes[nodeIndex] = gltfNode - gltf->nodes;
-      }
-    }
+static void reserveMeshletDraws(int count) {
+  if (gRenderer.meshletDraws.capacity >= count) {
+    return;
   }
 
-  cgltf_free(gltf);
+  MFREE(gRenderer.meshletDraws.baseVertices);
+  MFREE(gRenderer.meshletDraws.offsets);
+  MFREE(gRenderer.meshletDraws.counts);
 
-  destroyString(&filePath);
+  int capacity = MAX(count, gRenderer.meshletDraws.capacity * 2);
+  gRenderer.meshletDraws.capacity = capacity;
+  gRenderer.meshletDraws.counts = MMALLOC_ARRAY(int32_t, capacity);
+  gRenderer.meshletDraws.offsets = MMALLOC_ARRAY(const void *, capacity);
+  gRenderer.meshletDraws.baseVertices = MMALLOC_ARRAY(int32_t, capacity);
 }
 
-void destroyModel(Model *model) {
-  glDeleteBuffers(1, &model->gpuIndexBuffer);
-  glDeleteBuffers(1, &model->gpuVertexBuffer);
-
-  for (int i = 0; i < model->numScenes; ++i) {
-    MFREE(model->scenes[i].nodes);
-  }
-  MFREE(model->scenes);
+static RenderSnapshot *getRecordedSnapshot(void) {
+  return &gRenderer.snapshots[gRenderer.recordedSnapshot];
+}
 
-  for (int i = 0; i < model->numNodes; ++i) {
-    MFREE(model->nodes[i].childNodes);
+// Copies the vertices for render to upload, since the next update skins over
+// them
+static void recordVertexUpload(RenderSnapshot *snapshot, uint32_t buffer,
+                               const SubMesh *subMesh) {
+  int size = subMesh->numVertices * (int)sizeof(Vertex);
+  if (snapshot->vertexUploadCapacity == snapshot->numVertexUploads) {
+    snapshot->vertexUploadCapacity =
+        MAX(16, snapshot->vertexUploadCapacity * 2);
+    VertexUpload *uploads =
+        MMALLOC_ARRAY(VertexUpload, snapshot->vertexUploadCapacity);
+    if (snapshot->numVertexUploads > 0) {
+      memcpy(uploads, snapshot->vertexUploads,
+             sizeof(VertexUpload) * snapshot->numVertexUploads);
+    }
+    MFREE(snapshot->vertexUploads);
+    snapshot->vertexUploads = uploads;
   }
-  MFREE(model->nodes);
-
-  for (int i = 0; i < model->numMeshes; ++i) {
-    for (int j = 0; j < model->meshes[i].numSubMeshes; ++j) {
-      MFREE(model->meshes[i].subMeshes[j].vertices);
-      MFREE(model->meshes[i].subMeshes[j].indices);
+  if (snapshot->vertexDataCapacity < snapshot->vertexDataSize + size) {
+    snapshot->vertexDataCapacity = MAX(snapshot->vertexDataSize + size,
+                                       snapshot->vertexDataCapacity * 2);
+    uint8_t *data = MMALLOC_ARRAY(uint8_t, snapshot->vertexDataCapacity);
+    if (snapshot->vertexDataSize > 0) {
+      memcpy(data, snapshot->vertexData, snapshot->vertexDataSize);
     }
-    MFREE(model->meshes[i].subMeshes);
+    MFREE(snapshot->vertexData);
+    snapshot->vertexData = data;
   }
-  MFREE(model->meshes);
 
-  MFREE(model->materials);
+  memcpy(snapshot->vertexData + snapshot->vertexDataSize, subMesh->vertices,
+         size);
+  snapshot->vertexUploads[snapshot->numVertexUploads++] = (VertexUpload){
+      .buffer = buffer,
+      .offsetInBytes = subMesh->gpuVertexBufferOffsetInBytes,
+      .size = size,
+      .dataOffset = snapshot->vertexDataSize,
+  };
+  snapshot->vertexDataSize += size;
+}
 
-  for (int i = 0; i < model->numSamplers; ++i) {
-    glDeleteSamplers(1, &model->samplers[i]);
+void renderModel(Model *model, Mat4 transform) {
+  PROFILE_SCOPE("renderModel");
+  RenderSnapshot *snapshot = getRecordedSnapshot();
+  ASSERT(snapshot->hasGBufferPass);
+  for (int meshIndex = 0; meshIndex < model->numMeshes; ++meshIndex) {
+    const Mesh *mesh = &model->meshes[meshIndex];
+    for (int i = 0; i < mesh->numSubMeshes; ++i) {
+      const SubMesh *subMesh = &mesh->subMeshes[i];
+      if (subMesh->skinVertices) {
+        recordVertexUpload(snapshot, model->gpuVertexBuffer, subMesh);
+      }
+    }
   }
-  MFREE(model->samplers);
 
-  for (int i = 0; i < model->numTextures; ++i) {
-    glDeleteTextures(1, &model->textures[i]);
-  }
-  MFREE(model->textures);
+  // The LODs are picked for the scale this snapshot was last rendered at
+  DynamicResolution resolution = {.stats = snapshot->resolutionStats};
+  setDynamicResolutionTargetSize(&resolution, snapshot->width,
+                                 snapshot->height);
+  DrawView view = {
+      .viewProj = mat4Multiply(snapshot->viewUniforms.projMat,
+                               snapshot->viewUniforms.viewMat),
+      .eye = snapshot->eye,
+      .farZ = snapshot->farZ,
+      .pixelsPerUnit = snapshot->viewUniforms.projMat.cols[1].y *
+                       (float)resolution.stats.height * 0.5f,
+      .occlusion = &gRenderer.occlusion,
+  };
+  recordModelDraws(&snapshot->drawList, model, transform, &view,
+                   DrawPass_GBuffer, gRenderer.pipelines.gbuffer);
+}
 
-  *model = (Model){0};
+void setRecordedSnapshot(int index) {
+  ASSERT(index >= 0 && index < NUM_RENDER_SNAPSHOTS);
+  gRenderer.recordedSnapshot = index;
 }
 
-static void renderMesh(const Model *model, const Mesh *mesh) {
-  for (int subMeshIndex = 0; subMeshIndex < mesh->numSubMeshes;
-       ++subMeshIndex) {
-    SubMesh *subMesh = &mesh->subMeshes[subMeshIndex];
+void setRenderedSnapshot(int index) {
+  ASSERT(index >= 0 && index < NUM_RENDER_SNAPSHOTS);
+  gRenderer.renderedSnapshot = index;
+}
 
-    Material *material = &model->materials[subMesh->material];
+const OcclusionStats *getOcclusionStats(void) {
+  return &gRenderer.occlusion.stats;
+}
 
-    MaterialUniforms uniforms = {.baseColorFactor = material->baseColorFactor};
-    setUniformBuffer(gRenderer.materialUniformBuffer);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniforms), &uniforms);
+const LightClusterStats *getLightClusterStats(void) {
+  return &getRecordedSnapshot()->clusters.stats;
+}
 
-    glDrawElementsBaseVertex(
-        GL_TRIANGLES, subMesh->numIndices, GL_UNSIGNED_INT,
-        (void *)(uintptr_t)subMesh->gpuIndexBufferOffsetInBytes,
-        subMesh->gpuVertexBufferOffsetInBytes / sizeof(Vertex));
-  }
+const FrameGraphStats *getFrameGraphStats(void) {
+  return &getRecordedSnapshot()->frameGraphStats;
 }
 
-static void renderSceneNode(const Model *model, const SceneNode *node,
-                            Mat4 baseTransform) {
-  if (node->mesh >= 0) {
-    DrawUniforms uniform;
-    uniform.modelMat = mat4Multiply(node->worldTransform.matrix, baseTransform);
-    uniform.normalMat = mat4Transpose(mat4Inverse(uniform.modelMat));
+const RenderCounters *getRenderCounters(void) {
+  return &getRecordedSnapshot()->renderCounters;
+}
 
-    setUniformBuffer(gRenderer.drawUniformBuffer);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniform), &uniform);
+const DynamicResolutionStats *getDynamicResolutionStats(void) {
+  return &getRecordedSnapshot()->resolutionStats;
+}
 
-    Mesh *mesh = &model->meshes[node->mesh];
-    renderMesh(model, mesh);
+void setTargetFrameTime(float seconds) {
+  initDynamicResolution(&gRenderer.resolution.controller, seconds);
+  for (int i = 0; i < NUM_RENDER_SNAPSHOTS; ++i) {
+    gRenderer.snapshots[i].resolutionStats =
+        gRenderer.resolution.controller.stats;
   }
+}
 
-  if (node->numChildNodes > 0) {
-    for (int i = 0; i < node->numChildNodes; ++i) {
-      SceneNode *childNode = &model->nodes[node->childNodes[i]];
-      renderSceneNode(model, childNode, baseTransform);
+const TextureStreamStats *getTextureStreamStats(void) {
+  return &getRecordedSnapshot()->textureStreamStats;
+}
+
+void setTextureMemoryBudget(int64_t bytes) {
+  ASSERT(bytes >= 0);
+  gRenderer.textureStreamer.budget = bytes;
+}
+
+// An evicted level is specified as empty so the driver can free it
+static void applyTextureStreamChanges(void) {
+  TextureStreamer *streamer = &gRenderer.textureStreamer;
+  for (int i = 0; i < streamer->numChanges; ++i) {
+    const TextureStreamChange *change = &streamer->changes[i];
+    const StreamedTexture *t = &streamer->textures[change->texture];
+    const TextureSource *source = t->source;
+    glBindTexture(GL_TEXTURE_2D, source->texture);
+    countStateChange(StateChangeType_Texture);
+    if (change->resident) {
+      uploadTextureLevel(source, t, change->level);
+    } else {
+      glTexImage2D(GL_TEXTURE_2D, change->level, GL_RGBA, 0, 0, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, NULL);
     }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL,
+                    change->resident ? change->level : change->level + 1);
+  }
+  if (streamer->numChanges > 0) {
+    glBindTexture(GL_TEXTURE_2D, 0);
   }
 }
 
-void renderModel(Model *model, Mat4 transform) {
+static void setModelBuffers(const Model *model) {
   setVertexBuffer(model->gpuVertexBuffer);
   setIndexBuffer(model->gpuIndexBuffer);
 
@@ -679,37 +1378,145 @@ void renderModel(Model *model, Mat4 transform) {
   glEnableVertexAttribArray(3);
   glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
                         (void *)offsetof(Vertex, normal));
+}
 
-  glBindBufferRange(GL_UNIFORM_BUFFER, VIEW_BINDING,
-                    gRenderer.viewUniformBuffer, 0, sizeof(ViewUniforms));
-  glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BINDING,
-                    gRenderer.materialUniformBuffer, 0,
-                    sizeof(MaterialUniforms));
-  glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_BINDING,
-                    gRenderer.drawUniformBuffer, 0, sizeof(DrawUniforms));
+// Points the instance attributes at the instance data starting at offset in
+// the uniform ring. GL 3.3 has no base instance, so every batch rebinds them.
+static void setInstanceAttributes(int offset) {
+  setVertexBuffer(gRenderer.uniforms.buffer);
+  for (uint32_t i = 0; i < 4; ++i) {
+    glEnableVertexAttribArray(INSTANCE_MODEL_MAT_ATTRIB + i);
+    glVertexAttribPointer(INSTANCE_MODEL_MAT_ATTRIB + i, 4, GL_FLOAT, GL_FALSE,
+                          sizeof(DrawUniforms),
+                          (void *)(uintptr_t)(offset +
+                                              offsetof(DrawUniforms, modelMat) +
+                                              i * sizeof(Float4)));
+    glEnableVertexAttribArray(INSTANCE_NORMAL_MAT_ATTRIB + i);
+    glVertexAttribPointer(INSTANCE_NORMAL_MAT_ATTRIB + i, 4, GL_FLOAT,
+                          GL_FALSE, sizeof(DrawUniforms),
+                          (void *)(uintptr_t)(offset +
+                                              offsetof(DrawUniforms,
+                                                       normalMat) +
+                                              i * sizeof(Float4)));
+  }
+}
 
-  for (int sceneIndex = 0; sceneIndex < model->numScenes; ++sceneIndex) {
-    Scene *scene = &model->scenes[sceneIndex];
-    for (int nodeIndex = 0; nodeIndex < scene->numNodes; ++nodeIndex) {
-      SceneNode *node = &model->nodes[scene->nodes[nodeIndex]];
-      renderSceneNode(model, node, transform);
+// Sorts the recorded packets and draws them, only touching state that
+// differs from the previous packet. Runs of packets that only differ in their
+// instance data go out as one instanced draw.
+static void submitDrawList(DrawList *list) {
+  if (list->numPackets == 0) {
+    return;
+  }
+
+  sortDrawList(list);
+
+  // The instance data of the pass goes into one block of the ring, in sorted
+  // order so every batch reads a contiguous run
+  UniformRing *ring = &gRenderer.uniforms.ring;
+  int size = sizeof(DrawUniforms) * list->numPackets;
+  DrawUniforms *instanceData;
+  int instancesOffset = allocateUniforms(ring, size, (void **)&instanceData);
+  if (instancesOffset < 0 || gRenderer.viewUniformsOffset < 0) {
+    return;
+  }
+  if (!instanceData) {
+    if (gRenderer.instanceStagingSize < size) {
+      MFREE(gRenderer.instanceStaging);
+      gRenderer.instanceStagingSize =
+          MAX(size, gRenderer.instanceStagingSize * 2);
+      gRenderer.instanceStaging =
+          MMALLOC_ARRAY(uint8_t, gRenderer.instanceStagingSize);
     }
+    instanceData = (DrawUniforms *)gRenderer.instanceStaging;
   }
-}
+  for (int i = 0; i < list->numPackets; ++i) {
+    const DrawPacket *packet = &list->packets[list->sortItems[i].index];
+    instanceData[i] = list->drawUniforms[packet->drawUniforms];
+  }
+  if (!ring->mapped) {
+    setUniformBuffer(gRenderer.uniforms.buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, instancesOffset, size, instanceData);
+  }
+  countUpload(UploadType_Uniform, size);
 
-static uint32_t createShader(uint32_t shaderType, const char *shaderFilePath) {
-  LOG("Compiling %s", shaderFilePath);
+  glBindBufferRange(GL_UNIFORM_BUFFER, VIEW_BINDING, gRenderer.uniforms.buffer,
+                    gRenderer.viewUniformsOffset, sizeof(ViewUniforms));
 
-  String resourcePath = createResourcePath(ResourceType_Shader, shaderFilePath);
-  uint32_t shader = glCreateShader(shaderType);
+  const Model *currentModel = NULL;
+  const Material *currentMaterial = NULL;
+
+  int numInstances;
+  for (int i = 0; i < list->numPackets; i += numInstances) {
+    numInstances = getDrawBatchSize(list, i);
+    const DrawPacket *packet = &list->packets[list->sortItems[i].index];
+    const SubMesh *subMesh = packet->subMesh;
+
+    setPipeline(packet->pipeline);
+
+    if (packet->model != currentModel) {
+      setModelBuffers(packet->model);
+      currentModel = packet->model;
+    }
+
+    const Material *material = &packet->model->materials[packet->material];
+    if (material != currentMaterial) {
+      MaterialUniforms uniforms = {.baseColorFactor =
+                                       material->baseColorFactor};
+      int offset = pushUniformData(&uniforms, sizeof(uniforms));
+      if (offset < 0) {
+        continue;
+      }
+      glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BINDING,
+                        gRenderer.uniforms.buffer, offset, sizeof(uniforms));
+      currentMaterial = material;
+    }
 
-  int length;
-  void *source = readFileData(&resourcePath, true, &length);
+    setInstanceAttributes(instancesOffset + i * (int)sizeof(DrawUniforms));
 
-  const char *sources[] = {(char *)source};
-  int lengths[] = {(int)length};
+    int32_t baseVertex = subMesh->gpuVertexBufferOffsetInBytes / sizeof(Vertex);
+    const IndexRange *ranges = &list->ranges[packet->firstRange];
+    int64_t numTriangles = 0;
+    for (int r = 0; r < packet->numRanges; ++r) {
+      numTriangles += ranges[r].count / 3;
+    }
+    countDraw(numInstances, numTriangles);
+
+    if (packet->numRanges > 1) {
+      reserveMeshletDraws(packet->numRanges);
+      for (int r = 0; r < packet->numRanges; ++r) {
+        gRenderer.meshletDraws.counts[r] = ranges[r].count;
+        gRenderer.meshletDraws.offsets[r] =
+            (void *)(uintptr_t)(subMesh->gpuIndexBufferOffsetInBytes +
+                                ranges[r].offset * sizeof(VertexIndex));
+        gRenderer.meshletDraws.baseVertices[r] = baseVertex;
+      }
+      glMultiDrawElementsBaseVertex(
+          GL_TRIANGLES, gRenderer.meshletDraws.counts, GL_UNSIGNED_INT,
+          gRenderer.meshletDraws.offsets, packet->numRanges,
+          gRenderer.meshletDraws.baseVertices);
+    } else {
+      glDrawElementsInstancedBaseVertex(
+          GL_TRIANGLES, ranges[0].count, GL_UNSIGNED_INT,
+          (void *)(uintptr_t)(subMesh->gpuIndexBufferOffsetInBytes +
+                              ranges[0].offset * sizeof(VertexIndex)),
+          numInstances, baseVertex);
+    }
+  }
+}
+
+// Compiles without waiting, the status is checked when the program is finished
+static uint32_t createShader(uint32_t shaderType, const char *source,
+                             int length) {
+  uint32_t shader = glCreateShader(shaderType);
+  const char *sources[] = {source};
+  int lengths[] = {length};
   glShaderSource(shader, 1, sources, lengths);
   glCompileShader(shader);
+  return shader;
+}
+
+static void checkShader(uint32_t shader) {
   int compileResult = 0;
   glGetShaderiv(shader, GL_COMPILE_STATUS, &compileResult);
   if (compileResult != GL_TRUE) {
@@ -719,76 +1526,421 @@ static uint32_t createShader(uint32_t shaderType, const char *shaderFilePath) {
     LOG("Compile Error: %s", errorLog);
   }
   ASSERT(compileResult == GL_TRUE);
+}
 
-  destroyFileData(source);
+static String createProgramBinaryPath(const char *name) {
+  char fileName[128];
+  snprintf(fileName, sizeof(fileName), "%s.glbin", name);
+  return createResourcePath(ResourceType_Cache, fileName);
+}
 
-  destroyString(&resourcePath);
+// Returns false when there's no binary for the hash of the program or the
+// driver rejects it
+static bool loadProgramBinary(const ShaderProgram *shader) {
+  if (!gRenderer.pipelines.programBinary) {
+    return false;
+  }
 
-  return shader;
+  String path = createProgramBinaryPath(shader->name);
+  bool loaded = false;
+  if (fileExists(&path)) {
+    int size;
+    uint8_t *data = readFileData(&path, false, &size);
+    ProgramBinaryHeader header = {0};
+    if (size >= (int)sizeof(header)) {
+      memcpy(&header, data, sizeof(header));
+    }
+    if (header.hash == shader->hash &&
+        header.length == size - (int)sizeof(header)) {
+      gRenderer.pipelines.programBinary(shader->program, header.format,
+                                        data + sizeof(header), header.length);
+      int linkResult = 0;
+      glGetProgramiv(shader->program, GL_LINK_STATUS, &linkResult);
+      loaded = linkResult == GL_TRUE;
+    }
+    destroyFileData(data);
+  }
+  destroyString(&path);
+  return loaded;
+}
+
+static void saveProgramBinary(const ShaderProgram *shader) {
+  if (!gRenderer.pipelines.getProgramBinary) {
+    return;
+  }
+
+  int32_t length = 0;
+  glGetProgramiv(shader->program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  uint8_t *data = MMALLOC_ARRAY(uint8_t, sizeof(ProgramBinaryHeader) + length);
+  ProgramBinaryHeader header = {.hash = shader->hash};
+  gRenderer.pipelines.getProgramBinary(shader->program, length, &length,
+                                       &header.format,
+                                       data + sizeof(header));
+  header.length = length;
+  memcpy(data, &header, sizeof(header));
+
+  String path = createProgramBinaryPath(shader->name);
+  if (!writeFileData(&path, data, (int)sizeof(header) + length)) {
+    LOG("Can't write the program binary %s", path.buf);
+  }
+  destroyString(&path);
+  MFREE(data);
 }
 
-static uint32_t createShaderProgram(const char *vertexShaderFilePath,
-                                    const char *fragmentShaderFilePath) {
-  uint32_t vertexShader = createShader(GL_VERTEX_SHADER, vertexShaderFilePath);
-  uint32_t fragmentShader =
-      createShader(GL_FRAGMENT_SHADER, fragmentShaderFilePath);
+// Loads the binary of the program when the cache has one for its sources,
+// otherwise starts compiling and linking it
+static void requestShaderProgram(ShaderProgram *shader) {
+  PROFILE_SCOPE("requestShaderProgram");
+  shader->requestTime = getTime();
+
+  void *sources[2];
+  int lengths[2];
+  uint64_t hash = gRenderer.pipelines.driverHash;
+  static const char *suffixes[] = {"vert", "frag"};
+  for (int i = 0; i < 2; ++i) {
+    char fileName[128];
+    snprintf(fileName, sizeof(fileName), "%s_%s.glsl", shader->name,
+             suffixes[i]);
+    String path = createResourcePath(ResourceType_Shader, fileName);
+    sources[i] = readFileData(&path, true, &lengths[i]);
+    hash = hashPipelineBytes(hash, sources[i], lengths[i]);
+    destroyString(&path);
+  }
+  shader->hash = hash;
+
+  shader->program = glCreateProgram();
+  shader->cached = loadProgramBinary(shader);
+  if (!shader->cached) {
+    shader->vertexShader =
+        createShader(GL_VERTEX_SHADER, sources[0], lengths[0]);
+    shader->fragmentShader =
+        createShader(GL_FRAGMENT_SHADER, sources[1], lengths[1]);
+    glAttachShader(shader->program, shader->vertexShader);
+    glAttachShader(shader->program, shader->fragmentShader);
+    if (gRenderer.pipelines.programParameteri) {
+      gRenderer.pipelines.programParameteri(
+          shader->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(shader->program);
+  }
 
-  uint32_t program = glCreateProgram();
-  glAttachShader(program, vertexShader);
-  glAttachShader(program, fragmentShader);
-  glLinkProgram(program);
-  int linkResult = 0;
-  glGetProgramiv(program, GL_LINK_STATUS, &linkResult);
-  if (linkResult != GL_TRUE) {
-    static char errorLog[512];
-    int errorLogLength;
-    glGetProgramInfoLog(program, sizeof(errorLog), &errorLogLength, errorLog);
-    LOG("Link Error: %s", errorLog);
+  destroyFileData(sources[0]);
+  destroyFileData(sources[1]);
+  LOG("%s %s in %.2f ms", shader->cached ? "Loaded the binary of" : "Compiling",
+      shader->name, (getTime() - shader->requestTime) * 1000);
+}
+
+// Waits for the compile and link of a requested program and stores its binary
+static void finishShaderProgram(ShaderProgram *shader) {
+  if (shader->ready) {
+    return;
   }
-  ASSERT(linkResult == GL_TRUE);
 
-  glDetachShader(program, vertexShader);
-  glDetachShader(program, fragmentShader);
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
+  PROFILE_SCOPE("finishShaderProgram");
+  double waitTime = getTime();
+  if (!shader->cached) {
+    checkShader(shader->vertexShader);
+    checkShader(shader->fragmentShader);
+
+    int linkResult = 0;
+    glGetProgramiv(shader->program, GL_LINK_STATUS, &linkResult);
+    if (linkResult != GL_TRUE) {
+      static char errorLog[512];
+      int errorLogLength;
+      glGetProgramInfoLog(shader->program, sizeof(errorLog), &errorLogLength,
+                          errorLog);
+      LOG("Link Error: %s", errorLog);
+    }
+    ASSERT(linkResult == GL_TRUE);
+
+    glDetachShader(shader->program, shader->vertexShader);
+    glDetachShader(shader->program, shader->fragmentShader);
+    glDeleteShader(shader->vertexShader);
+    glDeleteShader(shader->fragmentShader);
+    shader->vertexShader = 0;
+    shader->fragmentShader = 0;
 
-  return program;
+    saveProgramBinary(shader);
+  }
+  // Linking and loading a binary both reset the block bindings
+  registerUniformBindings(shader->program);
+  shader->ready = true;
+
+  double time = getTime();
+  LOG("Program %s ready %.2f ms after its request, waited %.2f ms",
+      shader->name, (time - shader->requestTime) * 1000,
+      (time - waitTime) * 1000);
 }
 
 void setCamera(const OrbitCamera *cam) {
-  gRenderer.viewUniforms.viewMat = getOrbitCameraMatrix(cam);
+  RenderSnapshot *snapshot = getRecordedSnapshot();
+  snapshot->viewUniforms.viewMat = getOrbitCameraMatrix(cam);
+  snapshot->eye = mat4Inverse(snapshot->viewUniforms.viewMat).cols[3].xyz;
 }
 
-void setDeferredGBufferPass(void) {
-  const App *app = getApp();
-
-  gRenderer.viewUniforms.projMat = mat4Perspective(
-      degToRad(60), (float)app->width / (float)app->height, 0.1f, 2000.f);
-  setUniformBuffer(gRenderer.viewUniformBuffer);
-  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ViewUniforms),
-                  &gRenderer.viewUniforms);
+void setLights(const Light *lights, int numLights) {
+  RenderSnapshot *snapshot = getRecordedSnapshot();
+  snapshot->lights = lights;
+  snapshot->numLights = numLights;
+}
 
+static void executeGBufferPass(const FrameGraph *graph, void *data) {
+  const DynamicResolutionStats *resolution =
+      &gRenderer.resolution.controller.stats;
+
+  // Pooled targets change on resize, so the attachments are checked every
+  // frame
+  uint32_t attachments[4] = {
+      getFrameGraphTarget(graph, gRenderer.deferred.gbuffer[0]),
+      getFrameGraphTarget(graph, gRenderer.deferred.gbuffer[1]),
+      getFrameGraphTarget(graph, gRenderer.deferred.gbuffer[2]),
+      getFrameGraphTarget(graph, gRenderer.deferred.gbufferDepth),
+  };
   setFramebuffer(gRenderer.deferred.gbufferFBO);
-  setProgram(gRenderer.deferred.gbufferProgram);
+  for (int i = 0; i < 4; ++i) {
+    if (gRenderer.deferred.gbufferAttachments[i] != attachments[i]) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER,
+                             i < 3 ? GL_COLOR_ATTACHMENT0 + i
+                                   : GL_DEPTH_ATTACHMENT,
+                             GL_TEXTURE_2D, attachments[i], 0);
+      gRenderer.deferred.gbufferAttachments[i] = attachments[i];
+    }
+  }
+  ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+  // Also enables the depth writes the clear needs
+  setPipeline(gRenderer.pipelines.gbuffer);
 
+  // Lighting only reads the scaled corner, which is all that gets cleared
   glClearColor(0, 0, 0, 0);
   glClearDepth(0);
-  setPolygonMode(GL_FILL);
-  setDepthTestEnable(true);
-  glViewport(0, 0, app->width, app->height);
+  glViewport(0, 0, resolution->width, resolution->height);
+  glScissor(0, 0, resolution->width, resolution->height);
+  glEnable(GL_SCISSOR_TEST);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glDisable(GL_SCISSOR_TEST);
+
+  submitDrawList(&((RenderSnapshot *)data)->drawList);
 }
 
-void setDeferredLightingPass(void) {
-  setFramebuffer(0);
-  setProgram(gRenderer.deferred.lightingProgram);
+void setDeferredGBufferPass(void) {
+  const App *app = getApp();
+  RenderSnapshot *snapshot = getRecordedSnapshot();
+  snapshot->width = app->width;
+  snapshot->height = app->height;
+  snapshot->farZ = 2000.f;
+  snapshot->viewUniforms.projMat =
+      mat4Perspective(degToRad(60), (float)app->width / (float)app->height,
+                      0.1f, snapshot->farZ);
+  beginOcclusionFrame(&gRenderer.occlusion,
+                      mat4Multiply(snapshot->viewUniforms.projMat,
+                                   snapshot->viewUniforms.viewMat),
+                      0.1f);
+  // The draws of renderModel are recorded until render declares the pass
+  snapshot->hasGBufferPass = true;
+}
+
+static void declareGBufferPass(RenderSnapshot *snapshot) {
+  setDynamicResolutionTargetSize(&gRenderer.resolution.controller,
+                                 snapshot->width, snapshot->height);
+  gRenderer.viewUniformsOffset =
+      pushUniformData(&snapshot->viewUniforms, sizeof(ViewUniforms));
+
+  FrameGraph *graph = &gRenderer.frameGraph;
+  RenderTargetDesc desc = {snapshot->width, snapshot->height,
+                           RenderTargetFormat_RGBA16F};
+  gRenderer.deferred.gbuffer[0] =
+      createFrameGraphTexture(graph, "GBuffer0", desc);
+  gRenderer.deferred.gbuffer[1] =
+      createFrameGraphTexture(graph, "GBuffer1", desc);
+  gRenderer.deferred.gbuffer[2] =
+      createFrameGraphTexture(graph, "GBuffer2", desc);
+  desc.format = RenderTargetFormat_Depth32F;
+  gRenderer.deferred.gbufferDepth =
+      createFrameGraphTexture(graph, "GBufferDepth", desc);
+
+  int pass =
+      addFrameGraphPass(graph, "GBuffer", executeGBufferPass, snapshot);
+  for (int i = 0; i < 3; ++i) {
+    writeFrameGraphResource(graph, pass, gRenderer.deferred.gbuffer[i]);
+  }
+  writeFrameGraphResource(graph, pass, gRenderer.deferred.gbufferDepth);
+}
+
+static void uploadTextureBuffer(int index, const void *data, int size) {
+  glBindBuffer(GL_TEXTURE_BUFFER, gRenderer.lighting.buffers[index]);
+  // Orphans last frame's storage, which the GPU may still be reading
+  glBufferData(GL_TEXTURE_BUFFER, MAX(size, 16), NULL, GL_STREAM_DRAW);
+  if (size > 0) {
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+  }
+  countUpload(UploadType_Uniform, size);
+
+  uint32_t unit = LIGHTS_TEXTURE_UNIT + index;
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_BUFFER, gRenderer.lighting.textures[index]);
+  glBindSampler(unit, 0);
+  glUniform1i(gRenderer.lighting.locations[index], unit);
+  countStateChange(StateChangeType_Texture);
+}
+
+// Binds the lights and clusters of setDeferredLightingPass for the lighting
+// program. Returns false when the uniform ring ran out.
+static bool uploadLights(const RenderSnapshot *snapshot) {
+  const LightClusters *clusters = &snapshot->clusters;
+  uploadTextureBuffer(0, snapshot->lightUniforms,
+                      (int)sizeof(LightUniform) * snapshot->numLightUniforms);
+  uploadTextureBuffer(1, clusters->ranges,
+                      (int)sizeof(uint32_t) * 2 * LIGHT_CLUSTER_COUNT);
+  uploadTextureBuffer(2, clusters->lightIndices,
+                      (int)sizeof(uint32_t) * clusters->numLightIndices);
+
+  const DynamicResolutionStats *resolution =
+      &gRenderer.resolution.controller.stats;
+  LightingUniforms uniforms = {
+      .clusterProjection = {clusters->tanHalfX, clusters->tanHalfY,
+                            clusters->nearZ, clusters->sliceScale},
+      .clusterCounts = {LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z,
+                        0},
+      .ambientColor = {AMBIENT_LIGHT, AMBIENT_LIGHT, AMBIENT_LIGHT, 1},
+      .renderScale = {(float)resolution->width / (float)snapshot->width,
+                      (float)resolution->height / (float)snapshot->height, 0,
+                      0},
+  };
+  int offset = pushUniformData(&uniforms, sizeof(uniforms));
+  if (offset < 0 || gRenderer.viewUniformsOffset < 0) {
+    return false;
+  }
+  glBindBufferRange(GL_UNIFORM_BUFFER, LIGHTING_BINDING,
+                    gRenderer.uniforms.buffer, offset, sizeof(uniforms));
+  glBindBufferRange(GL_UNIFORM_BUFFER, VIEW_BINDING, gRenderer.uniforms.buffer,
+                    gRenderer.viewUniformsOffset, sizeof(ViewUniforms));
+  return true;
+}
+
+static void getLightingLocations(uint32_t program) {
+  static const char *gbufferNames[] = {
+      "SPIRV_Cross_Combinedgbuffer0gbufferSampler",
+      "SPIRV_Cross_Combinedgbuffer1gbufferSampler",
+      "SPIRV_Cross_Combinedgbuffer2gbufferSampler",
+  };
+  static const char *lightNames[] = {
+      "SPIRV_Cross_CombinedlightsSPIRV_Cross_DummySampler",
+      "SPIRV_Cross_CombinedclusterRangesSPIRV_Cross_DummySampler",
+      "SPIRV_Cross_CombinedlightIndicesSPIRV_Cross_DummySampler",
+  };
+  for (int i = 0; i < 3; ++i) {
+    gRenderer.deferred.gbufferTextureLocations[i] =
+        glGetUniformLocation(program, gbufferNames[i]);
+    gRenderer.lighting.locations[i] =
+        glGetUniformLocation(program, lightNames[i]);
+  }
+  gRenderer.deferred.hasLocations = true;
+}
+
+static void executeLightingPass(const FrameGraph *graph, void *data) {
+  const DynamicResolutionStats *resolution =
+      &gRenderer.resolution.controller.stats;
+  if (gRenderer.resolution.sceneColor < 0) {
+    setFramebuffer(0);
+  } else {
+    uint32_t sceneColor =
+        getFrameGraphTarget(graph, gRenderer.resolution.sceneColor);
+    setFramebuffer(gRenderer.resolution.sceneColorFBO);
+    if (gRenderer.resolution.sceneColorAttachment != sceneColor) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                             GL_TEXTURE_2D, sceneColor, 0);
+      gRenderer.resolution.sceneColorAttachment = sceneColor;
+    }
+  }
+  glViewport(0, 0, resolution->width, resolution->height);
+  // Waits for the program the first time
+  setPipeline(gRenderer.pipelines.lighting);
+  if (!gRenderer.deferred.hasLocations) {
+    getLightingLocations(gRenderer.glState.program);
+  }
   for (uint32_t i = 0; i < 3; ++i) {
-    setTexture(gRenderer.deferred.gbufferTextures[i],
+    setTexture(getFrameGraphTarget(graph, gRenderer.deferred.gbuffer[i]),
                gRenderer.deferred.gbufferSampler,
                gRenderer.deferred.gbufferTextureLocations[i], i);
   }
+  if (!uploadLights(data)) {
+    return;
+  }
 
-  setDepthTestEnable(false);
   setVertexBuffer(0);
   glDrawArrays(GL_TRIANGLES, 0, 3);
-}
\ No newline at end of file
+  countDraw(1, 1);
+}
+
+// Bilinear blit of the scaled corner of sceneColor to the whole backbuffer
+static void executeUpscalePass(UNUSED const FrameGraph *graph, void *data) {
+  const RenderSnapshot *snapshot = data;
+  const DynamicResolutionStats *resolution =
+      &gRenderer.resolution.controller.stats;
+  setFramebuffer(0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, gRenderer.resolution.sceneColorFBO);
+  glBlitFramebuffer(0, 0, resolution->width, resolution->height, 0, 0,
+                    snapshot->width, snapshot->height, GL_COLOR_BUFFER_BIT,
+                    GL_LINEAR);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void setDeferredLightingPass(void) {
+  RenderSnapshot *snapshot = getRecordedSnapshot();
+  ASSERT(snapshot->hasGBufferPass);
+
+  // Lights are assigned now since setLights only keeps them until here
+  LightClusters *clusters = &snapshot->clusters;
+  setLightClusterProjection(clusters, snapshot->viewUniforms.projMat, 0.1f,
+                            snapshot->farZ);
+  assignLightClusters(clusters, snapshot->viewUniforms.viewMat,
+                      snapshot->lights, snapshot->numLights);
+
+  int numLights = snapshot->numLights;
+  if (snapshot->lightUniformCapacity < numLights) {
+    MFREE(snapshot->lightUniforms);
+    snapshot->lightUniformCapacity =
+        MAX(numLights, snapshot->lightUniformCapacity * 2);
+    snapshot->lightUniforms =
+        MMALLOC_ARRAY(LightUniform, snapshot->lightUniformCapacity);
+  }
+  for (int i = 0; i < numLights; ++i) {
+    snapshot->lightUniforms[i] = makeLightUniform(&snapshot->lights[i]);
+  }
+  snapshot->numLightUniforms = numLights;
+  snapshot->lights = NULL;
+  snapshot->numLights = 0;
+  snapshot->hasLightingPass = true;
+}
+
+static void declareLightingPass(RenderSnapshot *snapshot) {
+  FrameGraph *graph = &gRenderer.frameGraph;
+  RenderTargetDesc desc = {snapshot->width, snapshot->height,
+                           RenderTargetFormat_RGBA8};
+  FrameGraphResource backbuffer =
+      importFrameGraphTexture(graph, "Backbuffer", desc, 0);
+  const DynamicResolutionStats *resolution =
+      &gRenderer.resolution.controller.stats;
+  bool scaled = resolution->width != snapshot->width ||
+                resolution->height != snapshot->height;
+  gRenderer.resolution.sceneColor =
+      scaled ? createFrameGraphTexture(graph, "SceneColor", desc) : -1;
+
+  int pass =
+      addFrameGraphPass(graph, "Lighting", executeLightingPass, snapshot);
+  for (int i = 0; i < 3; ++i) {
+    readFrameGraphResource(graph, pass, gRenderer.deferred.gbuffer[i]);
+  }
+  if (!scaled) {
+    writeFrameGraphResource(graph, pass, backbuffer);
+    return;
+  }
+  writeFrameGraphResource(graph, pass, gRenderer.resolution.sceneColor);
+
+  pass = addFrameGraphPass(graph, "Upscale", executeUpscalePass, snapshot);
+  readFrameGraphResource(graph, pass, gRenderer.resolution.sceneColor);
+  writeFrameGraphResource(graph, pass, backbuffer);
+}
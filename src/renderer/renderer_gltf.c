@@ -0,0 +1,902 @@
+#include "../renderer.h"
+#include "../memory.h"
+#include "../app.h"
+#include "../ktx2.h"
+#include "../profiler.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#define CGLTF_IMPLEMENTATION
+#include "../external/cgltf.h"
+// The backend has the implementation and may come first in a unity file
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include "../external/stb_image.h"
+#endif
+
+// Best of this many runs for logKtx2Benchmark
+#define KTX2_BENCHMARK_RUNS 5
+
+// Image of the KHR_texture_basisu extension of texture, -1 without one
+static int getBasisuImage(const cgltf_data *gltf,
+                          const cgltf_texture *texture) {
+  for (cgltf_size i = 0; i < texture->extensions_count; ++i) {
+    cgltf_extension *extension = &texture->extensions[i];
+    if (strcmp(extension->name, "KHR_texture_basisu") != 0) {
+      continue;
+    }
+    const char *source = strstr(extension->data, "\"source\"");
+    if (source && (source = strchr(source, ':'))) {
+      int image = atoi(source + 1);
+      if (image >= 0 && image < (int)gltf->images_count) {
+        return image;
+      }
+    }
+  }
+  return -1;
+}
+
+// Prefers the KTX2 image of KHR_texture_basisu when it could be loaded
+static int resolveTextureImage(const cgltf_data *gltf,
+                               const cgltf_texture *texture,
+                               const bool *imageLoaded) {
+  int image = getBasisuImage(gltf, texture);
+  if (image >= 0 && imageLoaded[image]) {
+    return image;
+  }
+
+  if (texture->image && imageLoaded[texture->image - gltf->images]) {
+    return texture->image - gltf->images;
+  }
+
+  return -1;
+}
+
+// A core image is skipped when every texture that samples it has a
+// KHR_texture_basisu image that loaded
+static void findReplacedImages(const cgltf_data *gltf, const bool *imageLoaded,
+                               bool *imageReplaced) {
+  // Set by the textures whose KTX2 image loaded, then cleared by the rest
+  for (int pass = 0; pass < 2; ++pass) {
+    for (cgltf_size i = 0; i < gltf->textures_count; ++i) {
+      const cgltf_texture *texture = &gltf->textures[i];
+      int basisuImage = getBasisuImage(gltf, texture);
+      bool replaced = basisuImage >= 0 && imageLoaded[basisuImage];
+      if (texture->image && replaced == (pass == 0)) {
+        imageReplaced[texture->image - gltf->images] = replaced;
+      }
+    }
+  }
+}
+
+static void getGLTFFilePath(String *filePath, const String *basePath) {
+  copyString(filePath, basePath);
+  if (!endsWithCString(basePath, ".glb")) {
+    appendPathCStr(filePath, pathBaseName(basePath));
+    appendCStr(filePath, ".gltf");
+  }
+}
+
+// Points encoded at the bytes of the image. Images outside the buffers are
+// read from their file, which is returned for destroyFileData, else null.
+static void *readGLTFImage(const cgltf_image *gltfImage,
+                           const String *basePath, String *imageFilePath,
+                           const uint8_t **encoded, int *encodedSize) {
+  if (gltfImage->buffer_view) {
+    *encoded = (uint8_t *)gltfImage->buffer_view->buffer->data +
+               gltfImage->buffer_view->offset;
+    *encodedSize = gltfImage->buffer_view->size;
+    return NULL;
+  }
+
+  copyString(imageFilePath, basePath);
+  appendPathCStr(imageFilePath, gltfImage->uri);
+  void *fileData = readFileData(imageFilePath, false, encodedSize);
+  *encoded = fileData;
+  return fileData;
+}
+
+// Gives the nodes of the subtree at gltfNode their index in Model.nodes,
+// depth first
+static void orderGLTFNodes(const cgltf_data *gltf, const cgltf_node *gltfNode,
+                           int *nodeIndices, int *numOrdered) {
+  nodeIndices[gltfNode - gltf->nodes] = (*numOrdered)++;
+  for (cgltf_size i = 0; i < gltfNode->children_count; ++i) {
+    orderGLTFNodes(gltf, gltfNode->children[i], nodeIndices, numOrdered);
+  }
+}
+
+// Directional lights light the whole scene and aren't clustered, so only
+// point and spot lights are loaded
+static bool isGLTFLightSupported(const cgltf_light *gltfLight) {
+  return gltfLight && (gltfLight->type == cgltf_light_type_point ||
+                       gltfLight->type == cgltf_light_type_spot);
+}
+
+static void loadGLTFLight(Light *light, const cgltf_light *gltfLight) {
+  *light = (Light){
+      .type = gltfLight->type == cgltf_light_type_spot ? LightType_Spot
+                                                       : LightType_Point,
+      .color = (Float3){gltfLight->color[0], gltfLight->color[1],
+                        gltfLight->color[2]} *
+               gltfLight->intensity,
+      .range = gltfLight->range,
+      .innerConeCos = cosf(gltfLight->spot_inner_cone_angle),
+      .outerConeCos = cosf(gltfLight->spot_outer_cone_angle),
+  };
+  // Unlimited range, so cut it off where the inverse square falloff makes
+  // the light too dim to see
+  if (!(light->range > 0)) {
+    float intensity =
+        fmaxf(light->color.x, fmaxf(light->color.y, light->color.z));
+    light->range = sqrtf(fmaxf(intensity, 0) / LIGHT_MIN_INTENSITY);
+  }
+}
+
+// Morph target weights are not supported and their channels are skipped.
+// Cubic spline channels keep their keyframe values and play back linearly.
+// nodeIndices maps glTF nodes to those of the model.
+static void loadGLTFAnimation(Animation *animation, const cgltf_data *gltf,
+                              const cgltf_animation *gltfAnimation,
+                              const int *nodeIndices) {
+  int numChannels = 0;
+  int numKeys = 0;
+  for (cgltf_size i = 0; i < gltfAnimation->channels_count; ++i) {
+    cgltf_animation_channel *gltfChannel = &gltfAnimation->channels[i];
+    if (gltfChannel->target_node &&
+        gltfChannel->target_path != cgltf_animation_path_type_weights) {
+      ++numChannels;
+      numKeys += gltfChannel->sampler->input->count;
+    }
+  }
+
+  initAnimation(animation, numChannels, numKeys);
+
+  int channelIndex = 0;
+  int keyOffset = 0;
+  for (cgltf_size i = 0; i < gltfAnimation->channels_count; ++i) {
+    cgltf_animation_channel *gltfChannel = &gltfAnimation->channels[i];
+    if (!gltfChannel->target_node ||
+        gltfChannel->target_path == cgltf_animation_path_type_weights) {
+      continue;
+    }
+    cgltf_animation_sampler *gltfSampler = gltfChannel->sampler;
+
+    AnimationChannel *channel = &animation->channels[channelIndex++];
+    channel->node = nodeIndices[gltfChannel->target_node - gltf->nodes];
+    switch (gltfChannel->target_path) {
+    case cgltf_animation_path_type_translation:
+      channel->path = AnimationPath_Translation;
+      break;
+    case cgltf_animation_path_type_rotation:
+      channel->path = AnimationPath_Rotation;
+      break;
+    default:
+      channel->path = AnimationPath_Scale;
+      break;
+    }
+    channel->interpolation =
+        gltfSampler->interpolation == cgltf_interpolation_type_step
+            ? AnimationInterpolation_Step
+            : AnimationInterpolation_Linear;
+    channel->keyOffset = keyOffset;
+    channel->numKeys = gltfSampler->input->count;
+
+    bool cubicSpline =
+        gltfSampler->interpolation == cgltf_interpolation_type_cubic_spline;
+    for (int k = 0; k < channel->numKeys; ++k) {
+      float *time = &animation->keyTimes[keyOffset + k];
+      cgltf_accessor_read_float(gltfSampler->input, k, time, 1);
+      animation->duration = MAX(animation->duration, *time);
+
+      // Cubic spline outputs are (in-tangent, value, out-tangent) triplets
+      Float4 *value = &animation->keyValues[keyOffset + k];
+      *value = (Float4){0, 0, 0, 0};
+      cgltf_accessor_read_float(gltfSampler->output,
+                                cubicSpline ? k * 3 + 1 : k, (float *)value,
+                                4);
+    }
+    keyOffset += channel->numKeys;
+  }
+}
+
+static bool isMeshSkinned(const Mesh *mesh) {
+  for (int i = 0; i < mesh->numSubMeshes; ++i) {
+    if (mesh->subMeshes[i].skinVertices) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Joints past the end of the skin would be read from outside its palette, so
+// they're moved to joint 0 without weight
+static void validateSkinJoints(SubMesh *subMesh, int numJoints,
+                               int meshIndex) {
+  int numInvalid = 0;
+  for (int i = 0; i < subMesh->numVertices; ++i) {
+    SkinVertex *skin = &subMesh->skinVertices[i];
+    for (int k = 0; k < 4; ++k) {
+      if (skin->joints[k] >= numJoints) {
+        skin->joints[k] = 0;
+        skin->weights[k] = 0;
+        ++numInvalid;
+      }
+    }
+  }
+  if (numInvalid > 0) {
+    LOG("Mesh %d: %d joint indices past the %d joints of its skin", meshIndex,
+        numInvalid, numJoints);
+  }
+}
+
+// The copy draws the indices of the original from the index buffer and gets
+// its own range of the vertex buffer, starting at *vertexOffsetInBytes
+static void copySkinnedMesh(Mesh *dst, const Mesh *src,
+                            int *vertexOffsetInBytes) {
+  *dst = (Mesh){
+      .numSubMeshes = src->numSubMeshes,
+      .subMeshes = MMALLOC_ARRAY(SubMesh, src->numSubMeshes),
+      .isSkinnedCopy = true,
+  };
+  memcpy(dst->subMeshes, src->subMeshes, sizeof(SubMesh) * src->numSubMeshes);
+  for (int i = 0; i < dst->numSubMeshes; ++i) {
+    SubMesh *subMesh = &dst->subMeshes[i];
+    if (subMesh->skinVertices) {
+      subMesh->vertices = MMALLOC_ARRAY(Vertex, subMesh->numVertices);
+      memcpy(subMesh->vertices, subMesh->bindPoseVertices,
+             sizeof(Vertex) * subMesh->numVertices);
+    }
+    subMesh->gpuVertexBufferOffsetInBytes = *vertexOffsetInBytes;
+    *vertexOffsetInBytes += subMesh->numVertices * sizeof(Vertex);
+  }
+}
+
+void loadGLTFModel(Model *model, const String *basePath) {
+  PROFILE_SCOPE("loadGLTFModel");
+  String filePath = {0};
+  getGLTFFilePath(&filePath, basePath);
+
+  PROFILE_BEGIN(parseScope, "parseGLTF");
+  cgltf_options options = {0};
+  cgltf_data *gltf;
+  cgltf_result gltfLoadResult = cgltf_parse_file(&options, filePath.buf, &gltf);
+  ASSERT(gltfLoadResult == cgltf_result_success);
+  cgltf_load_buffers(&options, gltf, filePath.buf);
+  PROFILE_END(parseScope);
+
+  // Materials refer to textures by image index
+  initModelTextures(model, gltf->images_count);
+  bool *imageLoaded = MMALLOC_ARRAY_ZEROES(bool, gltf->images_count);
+  bool *isBasisuImage = MMALLOC_ARRAY_ZEROES(bool, gltf->images_count);
+  bool *imageReplaced = MMALLOC_ARRAY_ZEROES(bool, gltf->images_count);
+  for (cgltf_size i = 0; i < gltf->textures_count; ++i) {
+    int image = getBasisuImage(gltf, &gltf->textures[i]);
+    if (image >= 0) {
+      isBasisuImage[image] = true;
+    }
+  }
+
+  {
+    PROFILE_SCOPE("loadGLTFImages");
+    String imageFilePath = {0};
+    int numDecodedImages = 0;
+    double decodeTime = 0;
+    int numKtx2Images = 0;
+    double ktx2Time = 0;
+
+    // KTX2 images load first so the core images they replace can be skipped
+    int numReplacedImages = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+      if (pass == 1) {
+        findReplacedImages(gltf, imageLoaded, imageReplaced);
+      }
+      for (cgltf_size imageIndex = 0; imageIndex < gltf->images_count;
+           ++imageIndex) {
+        if (isBasisuImage[imageIndex] != (pass == 0)) {
+          continue;
+        }
+        if (imageReplaced[imageIndex]) {
+          ++numReplacedImages;
+          continue;
+        }
+
+        cgltf_image *gltfImage = &gltf->images[imageIndex];
+        double startTime = getTime();
+
+        const uint8_t *encoded;
+        int encodedSize;
+        void *fileData = readGLTFImage(gltfImage, basePath, &imageFilePath,
+                                       &encoded, &encodedSize);
+
+        imageLoaded[imageIndex] =
+            createModelTexture(model, imageIndex, encoded, encodedSize);
+        if (isKtx2Data(encoded, encodedSize)) {
+          if (!imageLoaded[imageIndex] &&
+              isKtx2BasisData(encoded, encodedSize)) {
+            LOG("KTX2 image %zu needs a Basis Universal transcoder, using the "
+                "fallback source",
+                imageIndex);
+          } else if (!imageLoaded[imageIndex]) {
+            LOG("Unsupported KTX2 image %zu, using the fallback source",
+                imageIndex);
+          }
+          ++numKtx2Images;
+          ktx2Time += getTime() - startTime;
+        } else {
+          ASSERT(imageLoaded[imageIndex]);
+          ++numDecodedImages;
+          decodeTime += getTime() - startTime;
+        }
+
+        if (fileData) {
+          destroyFileData(fileData);
+        }
+      }
+    }
+    destroyString(&imageFilePath);
+
+    LOG("Images: %d PNG/JPEG in %.2f ms, %d KTX2 in %.2f ms, %d replaced by "
+        "KTX2",
+        numDecodedImages, decodeTime * 1000.0, numKtx2Images,
+        ktx2Time * 1000.0, numReplacedImages);
+  }
+
+  initModelSamplers(model, gltf->samplers_count);
+  for (cgltf_size samplerIndex = 0; samplerIndex < gltf->samplers_count;
+       ++samplerIndex) {
+    cgltf_sampler *gltfSampler = &gltf->samplers[samplerIndex];
+    createModelSampler(model, samplerIndex, gltfSampler->mag_filter,
+                       gltfSampler->min_filter, gltfSampler->wrap_s,
+                       gltfSampler->wrap_t);
+  }
+
+  model->numMaterials = gltf->materials_count;
+  model->materials = MMALLOC_ARRAY_ZEROES(Material, model->numMaterials);
+  for (cgltf_size materialIndex = 0; materialIndex < gltf->materials_count;
+       ++materialIndex) {
+    cgltf_material *gltfMaterial = &gltf->materials[materialIndex];
+    Material *material = &model->materials[materialIndex];
+    ASSERT(gltfMaterial->has_pbr_metallic_roughness);
+
+    cgltf_pbr_metallic_roughness *pbrMR = &gltfMaterial->pbr_metallic_roughness;
+
+    memcpy(&material->baseColorFactor, pbrMR->base_color_factor,
+           sizeof(Float4));
+
+    if (pbrMR->base_color_texture.texture) {
+      material->baseColorTexture = resolveTextureImage(
+          gltf, pbrMR->base_color_texture.texture, imageLoaded);
+
+      if (pbrMR->base_color_texture.texture->sampler) {
+        material->baseColorSampler = gltfMaterial->pbr_metallic_roughness
+                                         .base_color_texture.texture->sampler -
+                                     gltf->samplers;
+      } else {
+        material->baseColorSampler = -1;
+      }
+    } else {
+      material->baseColorTexture = -1;
+      material->baseColorSampler = -1;
+    }
+  }
+
+  MFREE(imageReplaced);
+  MFREE(isBasisuImage);
+  MFREE(imageLoaded);
+
+  PROFILE_BEGIN(meshScope, "loadGLTFMeshes");
+  model->numMeshes = gltf->meshes_count;
+  model->meshes = MMALLOC_ARRAY_ZEROES(Mesh, model->numMeshes);
+
+  int vertexBufferSize = 0;
+  int indexBufferSize = 0;
+  bool hasSkinnedVertices = false;
+
+  for (cgltf_size meshIndex = 0; meshIndex < gltf->meshes_count; ++meshIndex) {
+    cgltf_mesh *gltfMesh = &gltf->meshes[meshIndex];
+    Mesh *mesh = &model->meshes[meshIndex];
+
+    mesh->numSubMeshes = gltfMesh->primitives_count;
+    mesh->subMeshes = MMALLOC_ARRAY_ZEROES(SubMesh, mesh->numSubMeshes);
+
+    for (cgltf_size primIndex = 0; primIndex < gltfMesh->primitives_count;
+         ++primIndex) {
+      cgltf_primitive *prim = &gltfMesh->primitives[primIndex];
+      SubMesh *subMesh = &mesh->subMeshes[primIndex];
+
+      subMesh->numIndices = prim->indices->count;
+      subMesh->indices = MMALLOC_ARRAY(VertexIndex, subMesh->numIndices);
+      VertexIndex maxIndex = 0;
+      for (cgltf_size i = 0; i < prim->indices->count; ++i) {
+        subMesh->indices[i] = cgltf_accessor_read_index(prim->indices, i);
+        if (maxIndex < subMesh->indices[i]) {
+          maxIndex = subMesh->indices[i];
+        }
+      }
+
+      subMesh->numVertices = maxIndex + 1;
+      subMesh->vertices = MMALLOC_ARRAY_ZEROES(Vertex, subMesh->numVertices);
+      for (int i = 0; i < subMesh->numVertices; ++i) {
+        subMesh->vertices[i].color = (Float4){1, 1, 1, 1};
+      }
+      for (cgltf_size attribIndex = 0; attribIndex < prim->attributes_count;
+           ++attribIndex) {
+        cgltf_attribute *attrib = &prim->attributes[attribIndex];
+        ASSERT(!attrib->data->is_sparse); // Sparse is not supported yet;
+        switch (attrib->type) {
+        case cgltf_attribute_type_position:
+          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
+               ++vertexIndex) {
+            cgltf_size numComponents = cgltf_num_components(attrib->data->type);
+            cgltf_bool readResult = cgltf_accessor_read_float(
+                attrib->data, vertexIndex,
+                (float *)&subMesh->vertices[vertexIndex].position,
+                numComponents);
+            ASSERT(readResult);
+          }
+          break;
+        case cgltf_attribute_type_texcoord:
+          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
+               ++vertexIndex) {
+            cgltf_size numComponents = cgltf_num_components(attrib->data->type);
+            cgltf_bool readResult = cgltf_accessor_read_float(
+                attrib->data, vertexIndex,
+                (float *)&subMesh->vertices[vertexIndex].texcoord,
+                numComponents);
+            ASSERT(readResult);
+          }
+          break;
+        case cgltf_attribute_type_color:
+          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
+               ++vertexIndex) {
+            cgltf_size numComponents = cgltf_num_components(attrib->data->type);
+            cgltf_bool readResult = cgltf_accessor_read_float(
+                attrib->data, vertexIndex,
+                (float *)&subMesh->vertices[vertexIndex].color, numComponents);
+            ASSERT(readResult);
+          }
+          break;
+        case cgltf_attribute_type_normal:
+          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
+               ++vertexIndex) {
+            cgltf_size numComponents = cgltf_num_components(attrib->data->type);
+            cgltf_bool readResult = cgltf_accessor_read_float(
+                attrib->data, vertexIndex,
+                (float *)&subMesh->vertices[vertexIndex].normal, numComponents);
+            ASSERT(readResult);
+          }
+          break;
+        case cgltf_attribute_type_joints:
+          if (attrib->index != 0) {
+            break;
+          }
+          if (!subMesh->skinVertices) {
+            subMesh->skinVertices =
+                MMALLOC_ARRAY_ZEROES(SkinVertex, subMesh->numVertices);
+          }
+          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
+               ++vertexIndex) {
+            cgltf_uint joints[4] = {0};
+            cgltf_bool readResult =
+                cgltf_accessor_read_uint(attrib->data, vertexIndex, joints, 4);
+            ASSERT(readResult);
+            for (int i = 0; i < 4; ++i) {
+              subMesh->skinVertices[vertexIndex].joints[i] =
+                  (uint16_t)joints[i];
+            }
+          }
+          break;
+        case cgltf_attribute_type_weights:
+          if (attrib->index != 0) {
+            break;
+          }
+          if (!subMesh->skinVertices) {
+            subMesh->skinVertices =
+                MMALLOC_ARRAY_ZEROES(SkinVertex, subMesh->numVertices);
+          }
+          for (cgltf_size vertexIndex = 0; vertexIndex < attrib->data->count;
+               ++vertexIndex) {
+            cgltf_bool readResult = cgltf_accessor_read_float(
+                attrib->data, vertexIndex,
+                (float *)&subMesh->skinVertices[vertexIndex].weights, 4);
+            ASSERT(readResult);
+          }
+          break;
+        default:
+          break;
+        }
+      }
+      if (subMesh->skinVertices) {
+        subMesh->bindPoseVertices =
+            MMALLOC_ARRAY(Vertex, subMesh->numVertices);
+        memcpy(subMesh->bindPoseVertices, subMesh->vertices,
+               sizeof(Vertex) * subMesh->numVertices);
+        hasSkinnedVertices = true;
+      }
+      // Meshlet bounds are computed in bind pose and don't hold once skinned
+      if (!subMesh->skinVertices) {
+        subMesh->numMeshlets = buildMeshlets(
+            &subMesh->meshlets, subMesh->indices, subMesh->numIndices,
+            (const float *)&subMesh->vertices[0].position, sizeof(Vertex),
+            subMesh->numVertices);
+      }
+      buildSubMeshLods(subMesh);
+      computeSubMeshUvDensity(subMesh);
+
+      vertexBufferSize += subMesh->numVertices * sizeof(Vertex);
+      indexBufferSize += subMesh->numIndices * sizeof(VertexIndex);
+
+      subMesh->material = prim->material - gltf->materials;
+    }
+  }
+
+  // Every sub-mesh gets its own range of the model buffers
+  int vertexOffsetInBytes = 0;
+  int indexOffsetInBytes = 0;
+  for (int meshIndex = 0; meshIndex < model->numMeshes; ++meshIndex) {
+    Mesh *mesh = &model->meshes[meshIndex];
+    for (int subMeshIndex = 0; subMeshIndex < mesh->numSubMeshes;
+         ++subMeshIndex) {
+      SubMesh *subMesh = &mesh->subMeshes[subMeshIndex];
+      subMesh->gpuVertexBufferOffsetInBytes = vertexOffsetInBytes;
+      subMesh->gpuIndexBufferOffsetInBytes = indexOffsetInBytes;
+      vertexOffsetInBytes += subMesh->numVertices * sizeof(Vertex);
+      indexOffsetInBytes += subMesh->numIndices * sizeof(VertexIndex);
+    }
+  }
+
+  // Every skinned node after the first that draws a mesh gets a copy of it,
+  // since each skins the vertices with its own joints
+  int *nodeMeshes = MMALLOC_ARRAY(int, gltf->nodes_count);
+  bool *isMeshSkinnedByNode = MMALLOC_ARRAY_ZEROES(bool, gltf->meshes_count);
+  int numMeshes = model->numMeshes;
+  for (cgltf_size nodeIndex = 0; nodeIndex < gltf->nodes_count; ++nodeIndex) {
+    const cgltf_node *gltfNode = &gltf->nodes[nodeIndex];
+    int meshIndex = gltfNode->mesh ? gltfNode->mesh - gltf->meshes : -1;
+    nodeMeshes[nodeIndex] = meshIndex;
+    if (meshIndex < 0 || !gltfNode->skin ||
+        !isMeshSkinned(&model->meshes[meshIndex])) {
+      continue;
+    }
+
+    Mesh *mesh = &model->meshes[meshIndex];
+    for (int i = 0; i < mesh->numSubMeshes; ++i) {
+      if (mesh->subMeshes[i].skinVertices) {
+        validateSkinJoints(&mesh->subMeshes[i],
+                           gltfNode->skin->joints_count, meshIndex);
+      }
+    }
+    if (isMeshSkinnedByNode[meshIndex]) {
+      nodeMeshes[nodeIndex] = numMeshes++;
+    }
+    isMeshSkinnedByNode[meshIndex] = true;
+  }
+  MFREE(isMeshSkinnedByNode);
+
+  if (numMeshes > model->numMeshes) {
+    Mesh *meshes = MMALLOC_ARRAY_ZEROES(Mesh, numMeshes);
+    memcpy(meshes, model->meshes, sizeof(Mesh) * model->numMeshes);
+    MFREE(model->meshes);
+    model->meshes = meshes;
+    for (cgltf_size nodeIndex = 0; nodeIndex < gltf->nodes_count;
+         ++nodeIndex) {
+      int meshIndex = nodeMeshes[nodeIndex];
+      if (meshIndex >= model->numMeshes) {
+        copySkinnedMesh(
+            &model->meshes[meshIndex],
+            &model->meshes[gltf->nodes[nodeIndex].mesh - gltf->meshes],
+            &vertexOffsetInBytes);
+      }
+    }
+    model->numMeshes = numMeshes;
+    vertexBufferSize = vertexOffsetInBytes;
+  }
+
+  createModelBuffers(model, vertexBufferSize, indexBufferSize,
+                     hasSkinnedVertices);
+  PROFILE_END(meshScope);
+
+  PROFILE_BEGIN(nodeScope, "loadGLTFNodes");
+
+  int *nodeIndices = MMALLOC_ARRAY(int, gltf->nodes_count);
+  int numOrderedNodes = 0;
+  for (cgltf_size nodeIndex = 0; nodeIndex < gltf->nodes_count; ++nodeIndex) {
+    if (!gltf->nodes[nodeIndex].parent) {
+      orderGLTFNodes(gltf, &gltf->nodes[nodeIndex], nodeIndices,
+                     &numOrderedNodes);
+    }
+  }
+  ASSERT(numOrderedNodes == (int)gltf->nodes_count);
+
+  model->numLights = 0;
+  for (cgltf_size nodeIndex = 0; nodeIndex < gltf->nodes_count; ++nodeIndex) {
+    if (isGLTFLightSupported(gltf->nodes[nodeIndex].light)) {
+      ++model->numLights;
+    }
+  }
+  model->lights = MMALLOC_ARRAY(Light, model->numLights);
+  int numLoadedLights = 0;
+
+  model->numNodes = gltf->nodes_count;
+  model->nodes = MMALLOC_ARRAY_ZEROES(SceneNode, model->numNodes);
+  SceneGraph *graph = &model->sceneGraph;
+  initSceneGraph(graph, model->numNodes);
+  for (cgltf_size gltfNodeIndex = 0; gltfNodeIndex < gltf->nodes_count;
+       ++gltfNodeIndex) {
+    cgltf_node *gltfNode = &gltf->nodes[gltfNodeIndex];
+    int nodeIndex = nodeIndices[gltfNodeIndex];
+    SceneNode *node = &model->nodes[nodeIndex];
+
+    if (gltfNode->has_translation) {
+      graph->positions[nodeIndex] =
+          (Float3){gltfNode->translation[0], gltfNode->translation[1],
+                   gltfNode->translation[2]};
+    }
+    if (gltfNode->has_rotation) {
+      graph->rotations[nodeIndex] =
+          (Float4){gltfNode->rotation[0], gltfNode->rotation[1],
+                   gltfNode->rotation[2], gltfNode->rotation[3]};
+    }
+    if (gltfNode->has_scale) {
+      graph->scales[nodeIndex] = (Float3){
+          gltfNode->scale[0], gltfNode->scale[1], gltfNode->scale[2]};
+    }
+    // Also covers nodes given as a matrix, which can't be animated
+    cgltf_node_transform_local(gltfNode,
+                               (float *)graph->localMatrices[nodeIndex].cols);
+
+    if (gltfNode->parent) {
+      graph->parents[nodeIndex] = nodeIndices[gltfNode->parent - gltf->nodes];
+    }
+
+    node->skin = gltfNode->skin ? gltfNode->skin - gltf->skins : -1;
+
+    if (gltfNode->mesh) {
+      node->mesh = nodeMeshes[gltfNodeIndex];
+      ++model->meshes[node->mesh].numInstances;
+      node->subMeshLods =
+          MMALLOC_ARRAY_ZEROES(int, gltfNode->mesh->primitives_count);
+    } else {
+      node->mesh = -1;
+    }
+    node->bvhItem = -1;
+
+    if (isGLTFLightSupported(gltfNode->light)) {
+      node->light = numLoadedLights++;
+      loadGLTFLight(&model->lights[node->light], gltfNode->light);
+    } else {
+      node->light = -1;
+    }
+  }
+  // Computes the world matrices and places the lights. The BVH is built from
+  // them further down.
+  updateModelTransforms(model);
+
+  model->numScenes = gltf->scenes_count;
+  model->scenes = MMALLOC_ARRAY_ZEROES(Scene, model->numScenes);
+
+  for (cgltf_size sceneIndex = 0; sceneIndex < gltf->scenes_count;
+       ++sceneIndex) {
+    cgltf_scene *gltfScene = &gltf->scenes[sceneIndex];
+    Scene *scene = &model->scenes[sceneIndex];
+
+    if (gltfScene->nodes_count > 0) {
+      scene->numNodes = gltfScene->nodes_count;
+      scene->nodes = MMALLOC_ARRAY(int, scene->numNodes);
+
+      for (cgltf_size nodeIndex = 0; nodeIndex < gltfScene->nodes_count;
+           ++nodeIndex) {
+        cgltf_node *gltfNode = gltfScene->nodes[nodeIndex];
+        scene->nodes[nodeIndex] = nodeIndices[gltfNode - gltf->nodes];
+      }
+    }
+  }
+
+  PROFILE_END(nodeScope);
+
+  buildModelBvh(model);
+
+  PROFILE_BEGIN(animationScope, "loadGLTFAnimations");
+  model->numSkins = gltf->skins_count;
+  model->skins = MMALLOC_ARRAY_ZEROES(Skin, model->numSkins);
+  for (cgltf_size skinIndex = 0; skinIndex < gltf->skins_count; ++skinIndex) {
+    cgltf_skin *gltfSkin = &gltf->skins[skinIndex];
+    Skin *skin = &model->skins[skinIndex];
+    skin->numJoints = gltfSkin->joints_count;
+    skin->joints = MMALLOC_ARRAY(int, skin->numJoints);
+    skin->inverseBindMatrices = MMALLOC_ARRAY(Mat4, skin->numJoints);
+    skin->palette = MMALLOC_ARRAY(Mat4, skin->numJoints);
+    for (int i = 0; i < skin->numJoints; ++i) {
+      skin->joints[i] = nodeIndices[gltfSkin->joints[i] - gltf->nodes];
+      skin->inverseBindMatrices[i] = mat4Identity();
+      if (gltfSkin->inverse_bind_matrices) {
+        cgltf_bool readResult = cgltf_accessor_read_float(
+            gltfSkin->inverse_bind_matrices, i,
+            (float *)skin->inverseBindMatrices[i].cols, 16);
+        ASSERT(readResult);
+      }
+      skin->palette[i] = mat4Identity();
+    }
+  }
+
+  model->numAnimations = gltf->animations_count;
+  model->animations = MMALLOC_ARRAY_ZEROES(Animation, model->numAnimations);
+  for (cgltf_size animationIndex = 0; animationIndex < gltf->animations_count;
+       ++animationIndex) {
+    Animation *animation = &model->animations[animationIndex];
+    loadGLTFAnimation(animation, gltf, &gltf->animations[animationIndex],
+                      nodeIndices);
+  }
+
+  PROFILE_END(animationScope);
+  MFREE(nodeMeshes);
+  MFREE(nodeIndices);
+
+  cgltf_free(gltf);
+
+  destroyString(&filePath);
+}
+
+void logKtx2Benchmark(const String *basePath) {
+  String filePath = {0};
+  getGLTFFilePath(&filePath, basePath);
+  cgltf_options options = {0};
+  cgltf_data *gltf;
+  if (cgltf_parse_file(&options, filePath.buf, &gltf) !=
+          cgltf_result_success ||
+      cgltf_load_buffers(&options, gltf, filePath.buf) !=
+          cgltf_result_success) {
+    LOG("KTX2 benchmark: can't load %s", filePath.buf);
+    destroyString(&filePath);
+    return;
+  }
+
+  String imageFilePath = {0};
+  double totalDecodeTime = 0;
+  double totalCopyTime = 0;
+  double totalExpandTime = 0;
+  for (cgltf_size imageIndex = 0; imageIndex < gltf->images_count;
+       ++imageIndex) {
+    const uint8_t *encoded;
+    int encodedSize;
+    void *fileData = readGLTFImage(&gltf->images[imageIndex], basePath,
+                                   &imageFilePath, &encoded, &encodedSize);
+    if (!encoded || isKtx2Data(encoded, encodedSize)) {
+      if (fileData) {
+        destroyFileData(fileData);
+      }
+      continue;
+    }
+
+    // What loadGLTFModel does for a PNG/JPEG image before the upload
+    double decodeTime = INFINITY;
+    int width = 0;
+    int height = 0;
+    stbi_uc *pixels = NULL;
+    for (int run = 0; run < KTX2_BENCHMARK_RUNS; ++run) {
+      if (pixels) {
+        stbi_image_free(pixels);
+      }
+      double startTime = getTime();
+      int numComponents;
+      pixels = stbi_load_from_memory(encoded, encodedSize, &width, &height,
+                                     &numComponents, STBI_rgb_alpha);
+      decodeTime = fmin(decodeTime, getTime() - startTime);
+    }
+    if (!pixels) {
+      LOG("KTX2 benchmark: can't decode image %zu", imageIndex);
+      if (fileData) {
+        destroyFileData(fileData);
+      }
+      continue;
+    }
+
+    int ktx2Size;
+    uint8_t *ktx2 = createKtx2BC1(pixels, width, height, &ktx2Size);
+    uint8_t *levelCopy = MMALLOC_ARRAY(uint8_t, ktx2Size);
+    uint8_t *expanded = MMALLOC_ARRAY(uint8_t, width * height * 4);
+
+    // Backends that sample BC1 copy the levels to the GPU as they are, the
+    // others expand them to RGBA8
+    double copyTime = INFINITY;
+    double expandTime = INFINITY;
+    for (int run = 0; run < KTX2_BENCHMARK_RUNS; ++run) {
+      double startTime = getTime();
+      Ktx2Image image;
+      bool parsed = parseKtx2(&image, ktx2, ktx2Size);
+      ASSERT(parsed);
+      uint8_t *dst = levelCopy;
+      for (int level = 0; level < image.numLevels; ++level) {
+        memcpy(dst, image.levels[level].data, image.levels[level].size);
+        dst += image.levels[level].size;
+      }
+      copyTime = fmin(copyTime, getTime() - startTime);
+
+      startTime = getTime();
+      parsed = parseKtx2(&image, ktx2, ktx2Size);
+      ASSERT(parsed);
+      for (int level = 0; level < image.numLevels; ++level) {
+        decodeKtx2Level(&image, level, expanded);
+      }
+      expandTime = fmin(expandTime, getTime() - startTime);
+    }
+
+    LOG("KTX2 benchmark: image %zu, %dx%d, PNG/JPEG %d KB decoded in %.2f "
+        "ms, KTX2 BC1 %d KB copied in %.2f ms or expanded to RGBA8 in %.2f ms",
+        imageIndex, width, height, encodedSize / 1024, decodeTime * 1000.0,
+        ktx2Size / 1024, copyTime * 1000.0, expandTime * 1000.0);
+    totalDecodeTime += decodeTime;
+    totalCopyTime += copyTime;
+    totalExpandTime += expandTime;
+
+    MFREE(expanded);
+    MFREE(levelCopy);
+    MFREE(ktx2);
+    stbi_image_free(pixels);
+    if (fileData) {
+      destroyFileData(fileData);
+    }
+  }
+  LOG("KTX2 benchmark: PNG/JPEG %.2f ms, KTX2 BC1 copied %.2f ms, expanded "
+      "%.2f ms",
+      totalDecodeTime * 1000.0, totalCopyTime * 1000.0,
+      totalExpandTime * 1000.0);
+
+  destroyString(&imageFilePath);
+  cgltf_free(gltf);
+  destroyString(&filePath);
+}
+
+void destroyModel(Model *model) {
+  destroyModelResources(model);
+
+  for (int i = 0; i < model->numAnimations; ++i) {
+    destroyAnimation(&model->animations[i]);
+  }
+  MFREE(model->animations);
+
+  for (int i = 0; i < model->numSkins; ++i) {
+    MFREE(model->skins[i].joints);
+    MFREE(model->skins[i].inverseBindMatrices);
+    MFREE(model->skins[i].palette);
+  }
+  MFREE(model->skins);
+
+  MFREE(model->unboundedNodes);
+  MFREE(model->bvhNodes);
+  destroyBvh(&model->bvh);
+
+  for (int i = 0; i < model->numScenes; ++i) {
+    MFREE(model->scenes[i].nodes);
+  }
+  MFREE(model->scenes);
+
+  for (int i = 0; i < model->numNodes; ++i) {
+    MFREE(model->nodes[i].subMeshLods);
+  }
+  MFREE(model->nodes);
+  destroySceneGraph(&model->sceneGraph);
+  MFREE(model->lights);
+
+  for (int i = 0; i < model->numMeshes; ++i) {
+    for (int j = 0; j < model->meshes[i].numSubMeshes; ++j) {
+      if (model->meshes[i].isSkinnedCopy) {
+        if (model->meshes[i].subMeshes[j].skinVertices) {
+          MFREE(model->meshes[i].subMeshes[j].vertices);
+        }
+        continue;
+      }
+      MFREE(model->meshes[i].subMeshes[j].vertices);
+      MFREE(model->meshes[i].subMeshes[j].indices);
+      MFREE(model->meshes[i].subMeshes[j].meshlets);
+      MFREE(model->meshes[i].subMeshes[j].skinVertices);
+      MFREE(model->meshes[i].subMeshes[j].bindPoseVertices);
+    }
+    MFREE(model->meshes[i].subMeshes);
+  }
+  MFREE(model->meshes);
+
+  MFREE(model->materials);
+
+  *model = (Model){0};
+}
@@ -3,6 +3,7 @@
 #include "vmath.h"
 #include "gui.h"
 #include "memory.h"
+#include "uniformring.h"
 #define CGLTF_IMPLEMENTATION
 #include "external/cgltf.h"
 #define STB_IMAGE_IMPLEMENTATION
@@ -20,6 +21,7 @@ typedef struct _Vertex {
 #define METAL_INDEX_TYPE MTLIndexTypeUInt32
 #define METAL_CONSTANT_ALIGNMENT 256
 #define NUM_BUFFERS_IN_FLIGHT 3
+#define UNIFORM_RING_FRAME_SIZE (1024 * 1024)
 
 typedef struct _UniformsPerView {
   Mat4 viewMat;
@@ -144,11 +146,20 @@ static struct {
   id<MTLTexture> defaultBaseColorTexture;
   id<MTLSamplerState> defaultSampler;
 
+  // Shared buffer with one ring region per frame in flight. The semaphore
+  // keeps the CPU from writing a region the GPU may still be reading.
+  id<MTLBuffer> uniformBuffer;
+  UniformRing uniformRing;
+  dispatch_semaphore_t frameSemaphore;
+
   Model model;
 
   OrbitCamera cam;
 
   UniformsPerView uniformsPerView;
+
+  // Shown by the counters overlay a frame late
+  RenderCounterFrames counters;
 } gRenderer;
 
 static struct {
@@ -542,6 +553,48 @@ void destroyModel(Model *model) {
   MFREE(model->textures);
 }
 
+// Waits for every frame in flight and recreates the uniform buffer when a
+// frame asked for more than its region holds
+static void reserveUniformRing(int size) {
+  UniformRing *ring = &gRenderer.uniformRing;
+  int frameSize = getUniformRingGrowSize(ring, size);
+  if (frameSize == ring->frameSize) {
+    return;
+  }
+
+  for (int i = 0; i < NUM_BUFFERS_IN_FLIGHT; ++i) {
+    dispatch_semaphore_wait(gRenderer.frameSemaphore, DISPATCH_TIME_FOREVER);
+  }
+  int highWaterMark = ring->highWaterMark;
+  gRenderer.uniformBuffer = [gRenderer.device
+      newBufferWithLength:frameSize * NUM_BUFFERS_IN_FLIGHT
+                  options:MTLResourceStorageModeShared];
+  initUniformRing(ring, [gRenderer.uniformBuffer contents], frameSize,
+                  NUM_BUFFERS_IN_FLIGHT, METAL_CONSTANT_ALIGNMENT);
+  ring->highWaterMark = highWaterMark;
+  for (int i = 0; i < NUM_BUFFERS_IN_FLIGHT; ++i) {
+    dispatch_semaphore_signal(gRenderer.frameSemaphore);
+  }
+  LOG("Uniform ring grown to %d bytes per frame", frameSize);
+}
+
+// Returns false without binding anything when the frame ran out of the
+// uniform ring, and the draws that need the uniforms are skipped
+static bool setVertexUniforms(id<MTLRenderCommandEncoder> renderEncoder,
+                              const void *data, int size, int index) {
+  int offset = pushUniforms(&gRenderer.uniformRing, data, size);
+  if (offset < 0) {
+    return false;
+  }
+  [renderEncoder setVertexBuffer:gRenderer.uniformBuffer
+                          offset:offset
+                         atIndex:index];
+  RenderCounters *counters = &gRenderer.counters.current;
+  counters->uploadedBytes[UploadType_Uniform] += size;
+  ++counters->stateChanges[StateChangeType_UniformBuffer];
+  return true;
+}
+
 void renderMesh(const Model *model, const Mesh *mesh,
                 id<MTLRenderCommandEncoder> renderEncoder) {
   for (int subMeshIndex = 0; subMeshIndex < mesh->numSubMeshes;
@@ -552,7 +605,9 @@ void renderMesh(const Model *model, const Mesh *mesh,
 
     UniformsPerMaterial uniforms = {.baseColorFactor =
                                         material->baseColorFactor};
-    [renderEncoder setVertexBytes:&uniforms length:sizeof(uniforms) atIndex:2];
+    if (!setVertexUniforms(renderEncoder, &uniforms, sizeof(uniforms), 2)) {
+      continue;
+    }
 
     if (material->baseColorTexture >= 0) {
       [renderEncoder
@@ -580,6 +635,14 @@ void renderMesh(const Model *model, const Mesh *mesh,
                                indexType:METAL_INDEX_TYPE
                              indexBuffer:model->gpuIndexBuffer
                        indexBufferOffset:subMesh->gpuIndexBufferOffsetInBytes];
+
+    // Every draw binds its texture, sampler and vertex offset
+    RenderCounters *counters = &gRenderer.counters.current;
+    counters->stateChanges[StateChangeType_Texture] += 2;
+    ++counters->stateChanges[StateChangeType_VertexBuffer];
+    ++counters->numDraws;
+    ++counters->numInstances;
+    counters->numTriangles += subMesh->numIndices / 3;
   }
 }
 
@@ -589,9 +652,10 @@ void renderSceneNode(const Model *model, const SceneNode *node,
   uniform.modelMat = node->worldTransform.matrix;
   uniform.normalMat = mat4Transpose(mat4Inverse(uniform.modelMat));
 
-  [renderEncoder setVertexBytes:&uniform length:sizeof(uniform) atIndex:3];
+  bool hasUniforms =
+      setVertexUniforms(renderEncoder, &uniform, sizeof(uniform), 3);
 
-  if (node->mesh >= 0) {
+  if (node->mesh >= 0 && hasUniforms) {
     Mesh *mesh = &model->meshes[node->mesh];
     renderMesh(model, mesh, renderEncoder);
   }
@@ -607,6 +671,7 @@ void renderSceneNode(const Model *model, const SceneNode *node,
 void renderModel(const Model *model,
                  id<MTLRenderCommandEncoder> renderEncoder) {
   [renderEncoder setVertexBuffer:model->gpuVertexBuffer offset:0 atIndex:0];
+  ++gRenderer.counters.current.stateChanges[StateChangeType_VertexBuffer];
 
   for (int sceneIndex = 0; sceneIndex < model->numScenes; ++sceneIndex) {
     Scene *scene = &model->scenes[sceneIndex];
@@ -636,6 +701,7 @@ void initRenderer(MTKView *view) {
   view.device = gRenderer.device;
 
   initGUI(gRenderer.device);
+  initRenderCounterFrames(&gRenderer.counters);
 
   gRenderer.queue = [gRenderer.device newCommandQueue];
   gRenderer.viewPixelFormat = view.colorPixelFormat;
@@ -691,6 +757,14 @@ void initRenderer(MTKView *view) {
   gRenderer.defaultSampler =
       [gRenderer.device newSamplerStateWithDescriptor:defaultSamplerDesc];
 
+  gRenderer.uniformBuffer = [gRenderer.device
+      newBufferWithLength:UNIFORM_RING_FRAME_SIZE * NUM_BUFFERS_IN_FLIGHT
+                  options:MTLResourceStorageModeShared];
+  initUniformRing(&gRenderer.uniformRing, [gRenderer.uniformBuffer contents],
+                  UNIFORM_RING_FRAME_SIZE, NUM_BUFFERS_IN_FLIGHT,
+                  METAL_CONSTANT_ALIGNMENT);
+  gRenderer.frameSemaphore = dispatch_semaphore_create(NUM_BUFFERS_IN_FLIGHT);
+
   loadModel();
 
   gRenderer.cam.distance = 5;
@@ -700,6 +774,8 @@ void initRenderer(MTKView *view) {
 
 void destroyRenderer(void) {
   destroyModel(&gRenderer.model);
+  gRenderer.uniformBuffer = nil;
+  gRenderer.frameSemaphore = nil;
   gRenderer.defaultSampler = nil;
   gRenderer.depthStencilState = nil;
   gRenderer.pipeline = nil;
@@ -725,6 +801,7 @@ void render(MTKView *view, float dt) {
   guiBeginFrame(view);
   bool shouldLoadNewModel;
   doGUI(&shouldLoadNewModel);
+  doRenderCountersGUI(&gRenderer.counters.last);
 
   if (shouldLoadNewModel) {
     destroyModel(&gRenderer.model);
@@ -737,6 +814,11 @@ void render(MTKView *view, float dt) {
       1000.f);
   gRenderer.uniformsPerView.projMat = projection;
 
+  reserveUniformRing(gRenderer.uniformRing.highWaterMark);
+
+  // The region of this frame was last used NUM_BUFFERS_IN_FLIGHT frames ago
+  dispatch_semaphore_wait(gRenderer.frameSemaphore, DISPATCH_TIME_FOREVER);
+
   id<MTLCommandBuffer> commandBuffer = [gRenderer.queue commandBuffer];
   MTLRenderPassDescriptor *renderPassDescriptor =
       view.currentRenderPassDescriptor;
@@ -747,6 +829,7 @@ void render(MTKView *view, float dt) {
       [commandBuffer renderCommandEncoderWithDescriptor:renderPassDescriptor];
   [renderEncoder setRenderPipelineState:gRenderer.pipeline];
   [renderEncoder setDepthStencilState:gRenderer.depthStencilState];
+  ++gRenderer.counters.current.stateChanges[StateChangeType_Program];
 
   [renderEncoder setFrontFacingWinding:MTLWindingCounterClockwise];
   [renderEncoder setCullMode:MTLCullModeBack];
@@ -756,17 +839,23 @@ void render(MTKView *view, float dt) {
     [renderEncoder setTriangleFillMode:MTLTriangleFillModeFill];
   }
 
-  [renderEncoder setVertexBytes:&gRenderer.uniformsPerView
-                         length:sizeof(gRenderer.uniformsPerView)
-                        atIndex:1];
-  renderModel(&gRenderer.model, renderEncoder);
+  if (setVertexUniforms(renderEncoder, &gRenderer.uniformsPerView,
+                        sizeof(gRenderer.uniformsPerView), 1)) {
+    renderModel(&gRenderer.model, renderEncoder);
+  }
 
   [renderEncoder setTriangleFillMode:MTLTriangleFillModeFill];
   guiEndFrameAndRender(commandBuffer, renderEncoder);
 
   [renderEncoder endEncoding];
   [commandBuffer presentDrawable:view.currentDrawable];
+  dispatch_semaphore_t frameSemaphore = gRenderer.frameSemaphore;
+  [commandBuffer addCompletedHandler:^(UNUSED id<MTLCommandBuffer> buffer) {
+    dispatch_semaphore_signal(frameSemaphore);
+  }];
   [commandBuffer commit];
+  advanceUniformRing(&gRenderer.uniformRing);
+  endRenderCounterFrame(&gRenderer.counters);
 
   gInput.mouseDelta = (Float2){0};
   gInput.wheelDelta = 0;
@@ -0,0 +1,573 @@
+#include "../renderer.h"
+#include "../memory.h"
+#include "../app.h"
+#include "../ktx2.h"
+#include "../drawlist.h"
+#include "../uniformring.h"
+#include "../profiler.h"
+#include <stdint.h>
+#include <string.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "../external/stb_image.h"
+
+// Does the CPU side of every frame like the GPU backends do (traversal,
+// culling, sorting and writing uniforms) but never talks to a driver. What
+// would have gone to the GPU is counted instead, so CPU cost can be measured
+// apart from driver cost on a headless machine.
+
+#define NULL_NUM_FRAMES_IN_FLIGHT 3
+#define NULL_UNIFORM_RING_FRAME_SIZE (4 * 1024 * 1024)
+#define NULL_UNIFORM_ALIGNMENT 256
+
+typedef struct _NullRenderer {
+  uint8_t *uniformMemory;
+  UniformRing uniformRing;
+
+  ViewUniforms viewUniforms;
+  Float3 eye;
+  float farZ;
+
+  DrawList drawList;
+  OcclusionBuffer occlusion;
+
+  // Passes of the frame, compiled and run by render like in the GL backend.
+  // Render targets are only names.
+  FrameGraph frameGraph;
+  RenderTargetHandle lastRenderTarget;
+  FrameGraphResource gbuffer[3];
+  FrameGraphResource gbufferDepth;
+
+  const Light *lights;
+  int numLights;
+  LightClusters lightClusters;
+
+  // Same descs as the GL backend, so pipelines get the same indices
+  struct {
+    PipelineCache cache;
+    int gbuffer;
+    int lighting;
+  } pipelines;
+
+  // Last bound state, so only actual changes are counted
+  struct {
+    const void *vertexBuffer;
+    const void *indexBuffer;
+    int pipeline;
+    int framebuffer;
+    const Material *material;
+  } state;
+
+  RenderCounterFrames counters;
+  RenderCounters totalCounters;
+  OcclusionStats totalOcclusionStats;
+  LightClusterStats totalLightClusterStats;
+  FrameGraphStats totalFrameGraphStats;
+  int numFrames;
+} NullRenderer;
+
+static NullRenderer gNullRenderer;
+
+static void countUpload(int64_t size) {
+  gNullRenderer.counters.current.uploadedBytes[UploadType_Uniform] += size;
+}
+
+static void countStateChange(StateChangeType type, int count) {
+  gNullRenderer.counters.current.stateChanges[type] += count;
+}
+
+static void setNullVertexBuffer(const void *buffer) {
+  if (gNullRenderer.state.vertexBuffer != buffer) {
+    gNullRenderer.state.vertexBuffer = buffer;
+    countStateChange(StateChangeType_VertexBuffer, 1);
+  }
+}
+
+static void setNullIndexBuffer(const void *buffer) {
+  if (gNullRenderer.state.indexBuffer != buffer) {
+    gNullRenderer.state.indexBuffer = buffer;
+    countStateChange(StateChangeType_IndexBuffer, 1);
+  }
+}
+
+// Counts a state change per field that differs from the current pipeline,
+// like the calls the GL backend makes
+static void setNullPipeline(int pipeline) {
+  int current = gNullRenderer.state.pipeline;
+  if (current == pipeline) {
+    return;
+  }
+  const PipelineDesc *descs = gNullRenderer.pipelines.cache.descs;
+  const PipelineDesc *desc = &descs[pipeline];
+  if (current < 0) {
+    countStateChange(StateChangeType_Program, 1);
+    countStateChange(StateChangeType_Raster, 5);
+  } else {
+    const PipelineDesc *old = &descs[current];
+    countStateChange(StateChangeType_Program,
+                     strcmp(old->shader, desc->shader) != 0);
+    countStateChange(StateChangeType_Raster,
+                     (old->polygonMode != desc->polygonMode) +
+                         (old->cullMode != desc->cullMode) +
+                         (old->depthCompare != desc->depthCompare) +
+                         (old->depthWrite != desc->depthWrite) +
+                         (old->blendMode != desc->blendMode));
+  }
+  gNullRenderer.state.pipeline = pipeline;
+}
+
+static void setNullFramebuffer(int framebuffer) {
+  if (gNullRenderer.state.framebuffer != framebuffer) {
+    gNullRenderer.state.framebuffer = framebuffer;
+    countStateChange(StateChangeType_Framebuffer, 1);
+  }
+}
+
+// Returns -1 when the frame ran out of the uniform ring
+static int pushNullUniforms(const void *data, int size) {
+  int offset = pushUniforms(&gNullRenderer.uniformRing, data, size);
+  if (offset >= 0) {
+    countUpload(size);
+  }
+  return offset;
+}
+
+// Reallocates the uniform ring between frames when a frame asking for size
+// bytes wouldn't fit
+static void reserveNullUniforms(int size) {
+  UniformRing *ring = &gNullRenderer.uniformRing;
+  int frameSize = getUniformRingGrowSize(ring, size);
+  if (frameSize == ring->frameSize) {
+    return;
+  }
+
+  int highWaterMark = ring->highWaterMark;
+  MFREE(gNullRenderer.uniformMemory);
+  gNullRenderer.uniformMemory =
+      MMALLOC_ARRAY(uint8_t, frameSize * NULL_NUM_FRAMES_IN_FLIGHT);
+  initUniformRing(ring, gNullRenderer.uniformMemory, frameSize,
+                  NULL_NUM_FRAMES_IN_FLIGHT, NULL_UNIFORM_ALIGNMENT);
+  ring->highWaterMark = highWaterMark;
+  LOG("Null renderer: uniform ring grown to %d bytes per frame", frameSize);
+}
+
+static RenderTargetHandle
+createNullRenderTarget(UNUSED const RenderTargetDesc *desc) {
+  return ++gNullRenderer.lastRenderTarget;
+}
+
+static void destroyNullRenderTarget(UNUSED RenderTargetHandle handle) {}
+
+void initRenderer(void) {
+  gNullRenderer.uniformMemory = MMALLOC_ARRAY(
+      uint8_t, NULL_UNIFORM_RING_FRAME_SIZE * NULL_NUM_FRAMES_IN_FLIGHT);
+  initUniformRing(&gNullRenderer.uniformRing, gNullRenderer.uniformMemory,
+                  NULL_UNIFORM_RING_FRAME_SIZE, NULL_NUM_FRAMES_IN_FLIGHT,
+                  NULL_UNIFORM_ALIGNMENT);
+  gNullRenderer.state.framebuffer = -1;
+  gNullRenderer.state.pipeline = -1;
+  initPipelineCache(&gNullRenderer.pipelines.cache, NULL);
+  gNullRenderer.pipelines.gbuffer =
+      getPipeline(&gNullRenderer.pipelines.cache, &gGBufferPipelineDesc);
+  gNullRenderer.pipelines.lighting =
+      getPipeline(&gNullRenderer.pipelines.cache, &gLightingPipelineDesc);
+  initOcclusionBuffer(&gNullRenderer.occlusion);
+  initLightClusters(&gNullRenderer.lightClusters);
+  initFrameGraph(&gNullRenderer.frameGraph, createNullRenderTarget,
+                 destroyNullRenderTarget);
+  initRenderCounterFrames(&gNullRenderer.counters);
+
+  LOG("Null renderer: no GPU work is submitted");
+}
+
+void destroyRenderer(void) {
+  if (gNullRenderer.numFrames > 0) {
+    const RenderCounters *total = &gNullRenderer.totalCounters;
+    double numFrames = (double)gNullRenderer.numFrames;
+    int numStateChanges = getNumStateChanges(total);
+    int64_t uploadedBytes = getUploadedBytes(total);
+    LOG("Null renderer: %d frames, per frame %.1f draws, %.1f instances, "
+        "%.1f triangles, %.1f state changes, %.1f KB uploaded, %.1f "
+        "allocations of %.1f KB",
+        gNullRenderer.numFrames, total->numDraws / numFrames,
+        total->numInstances / numFrames, total->numTriangles / numFrames,
+        numStateChanges / numFrames,
+        uploadedBytes / numFrames / 1024.0,
+        total->numAllocations / numFrames,
+        total->allocatedBytes / numFrames / 1024.0);
+
+    const OcclusionStats *occlusion = &gNullRenderer.totalOcclusionStats;
+    LOG("Null renderer: per frame %.1f occluders (%.1f triangles), %.1f of "
+        "%.1f sub-meshes occluded in %.3f ms",
+        occlusion->numOccluders / numFrames,
+        occlusion->numOccluderTriangles / numFrames,
+        occlusion->numCulled / numFrames, occlusion->numTested / numFrames,
+        occlusion->timeMs / numFrames);
+
+    const LightClusterStats *lights = &gNullRenderer.totalLightClusterStats;
+    LOG("Null renderer: per frame %.1f of %.1f lights visible, %.1f light "
+        "indices, at most %.1f lights in a cluster and %.1f dropped, in "
+        "%.3f ms",
+        lights->numVisibleLights / numFrames, lights->numLights / numFrames,
+        lights->numLightIndices / numFrames,
+        lights->maxClusterLights / numFrames,
+        lights->numDroppedLights / numFrames, lights->timeMs / numFrames);
+
+    const FrameGraphStats *graph = &gNullRenderer.totalFrameGraphStats;
+    LOG("Null renderer: per frame %.1f passes (%.1f culled), %.1f transient "
+        "resources in %.1f targets, %.1f KB live at most and %.1f KB pooled, "
+        "%d targets created and %d destroyed",
+        graph->numPasses / numFrames, graph->numCulledPasses / numFrames,
+        graph->numTransientResources / numFrames,
+        graph->numTargetsUsed / numFrames,
+        graph->peakLiveBytes / numFrames / 1024.0,
+        graph->pooledBytes / numFrames / 1024.0, graph->numTargetsCreated,
+        graph->numTargetsDestroyed);
+  }
+
+  destroyFrameGraph(&gNullRenderer.frameGraph);
+  destroyPipelineCache(&gNullRenderer.pipelines.cache);
+  destroyLightClusters(&gNullRenderer.lightClusters);
+  destroyOcclusionBuffer(&gNullRenderer.occlusion);
+  destroyDrawList(&gNullRenderer.drawList);
+  MFREE(gNullRenderer.uniformMemory);
+  gNullRenderer = (NullRenderer){0};
+}
+
+void render(UNUSED float dt) {
+  PROFILE_SCOPE("render");
+  FrameGraph *graph = &gNullRenderer.frameGraph;
+  compileFrameGraph(graph);
+  executeFrameGraph(graph);
+  resetFrameGraph(graph);
+  // Draws of a culled G-buffer pass
+  resetDrawList(&gNullRenderer.drawList);
+
+  endRenderCounterFrame(&gNullRenderer.counters);
+  addRenderCounters(&gNullRenderer.totalCounters,
+                    &gNullRenderer.counters.last);
+  ++gNullRenderer.numFrames;
+
+  const OcclusionStats *occlusion = &gNullRenderer.occlusion.stats;
+  OcclusionStats *totalOcclusion = &gNullRenderer.totalOcclusionStats;
+  totalOcclusion->numOccluders += occlusion->numOccluders;
+  totalOcclusion->numOccluderTriangles += occlusion->numOccluderTriangles;
+  totalOcclusion->numTested += occlusion->numTested;
+  totalOcclusion->numCulled += occlusion->numCulled;
+  totalOcclusion->timeMs += occlusion->timeMs;
+
+  const LightClusterStats *lights = &gNullRenderer.lightClusters.stats;
+  LightClusterStats *totalLights = &gNullRenderer.totalLightClusterStats;
+  totalLights->numLights += lights->numLights;
+  totalLights->numVisibleLights += lights->numVisibleLights;
+  totalLights->numLightIndices += lights->numLightIndices;
+  totalLights->maxClusterLights += lights->maxClusterLights;
+  totalLights->numDroppedLights += lights->numDroppedLights;
+  totalLights->timeMs += lights->timeMs;
+
+  const FrameGraphStats *graphStats = &graph->stats;
+  FrameGraphStats *totalGraph = &gNullRenderer.totalFrameGraphStats;
+  totalGraph->numPasses += graphStats->numPasses;
+  totalGraph->numCulledPasses += graphStats->numCulledPasses;
+  totalGraph->numTransientResources += graphStats->numTransientResources;
+  totalGraph->numTargetsUsed += graphStats->numTargetsUsed;
+  totalGraph->numTargetsCreated += graphStats->numTargetsCreated;
+  totalGraph->numTargetsDestroyed += graphStats->numTargetsDestroyed;
+  totalGraph->peakLiveBytes += graphStats->peakLiveBytes;
+  totalGraph->pooledBytes += graphStats->pooledBytes;
+
+  // Nothing is in flight, so the next region is free right away, and the
+  // ring can grow for frames that ran out of it
+  advanceUniformRing(&gNullRenderer.uniformRing);
+  reserveNullUniforms(gNullRenderer.uniformRing.highWaterMark);
+}
+
+const RenderCounters *getRenderCounters(void) {
+  return &gNullRenderer.counters.last;
+}
+
+const OcclusionStats *getOcclusionStats(void) {
+  return &gNullRenderer.occlusion.stats;
+}
+
+const LightClusterStats *getLightClusterStats(void) {
+  return &gNullRenderer.lightClusters.stats;
+}
+
+const FrameGraphStats *getFrameGraphStats(void) {
+  return &gNullRenderer.frameGraph.stats;
+}
+
+void initModelTextures(Model *model, int numTextures) {
+  model->numTextures = numTextures;
+  model->textures = MMALLOC_ARRAY_ZEROES(CpuTexture, numTextures);
+}
+
+bool createModelTexture(Model *model, int index, const uint8_t *encoded,
+                        int size) {
+  CpuTexture *texture = &model->textures[index];
+
+  // KTX2 levels are kept as they are, back to back
+  if (isKtx2Data(encoded, size)) {
+    Ktx2Image image;
+    if (!parseKtx2(&image, encoded, size)) {
+      return false;
+    }
+    texture->width = image.width;
+    texture->height = image.height;
+    for (int i = 0; i < image.numLevels; ++i) {
+      texture->size += image.levels[i].size;
+    }
+    texture->data = MMALLOC_ARRAY(uint8_t, texture->size);
+    int offset = 0;
+    for (int i = 0; i < image.numLevels; ++i) {
+      memcpy(texture->data + offset, image.levels[i].data,
+             image.levels[i].size);
+      offset += image.levels[i].size;
+    }
+    countUpload(texture->size);
+    return true;
+  }
+
+  int w, h, numComponents;
+  stbi_uc *data = stbi_load_from_memory(encoded, size, &w, &h, &numComponents,
+                                        STBI_rgb_alpha);
+  if (!data) {
+    return false;
+  }
+  texture->width = w;
+  texture->height = h;
+  texture->size = w * h * 4;
+  texture->data = MMALLOC_ARRAY(uint8_t, texture->size);
+  memcpy(texture->data, data, texture->size);
+  stbi_image_free(data);
+  countUpload(texture->size);
+  return true;
+}
+
+void initModelSamplers(Model *model, int numSamplers) {
+  model->numSamplers = numSamplers;
+  model->samplers = MMALLOC_ARRAY_ZEROES(CpuSampler, numSamplers);
+}
+
+void createModelSampler(Model *model, int index, int magFilter, int minFilter,
+                        int wrapS, int wrapT) {
+  model->samplers[index] = (CpuSampler){
+      .magFilter = magFilter,
+      .minFilter = minFilter,
+      .wrapS = wrapS,
+      .wrapT = wrapT,
+  };
+}
+
+void createModelBuffers(Model *model, int vertexBufferSize,
+                        int indexBufferSize, UNUSED bool dynamicVertices) {
+  CpuBuffer *vb = &model->gpuVertexBuffer;
+  CpuBuffer *ib = &model->gpuIndexBuffer;
+  vb->size = vertexBufferSize;
+  vb->data = MMALLOC_ARRAY(uint8_t, vertexBufferSize);
+  ib->size = indexBufferSize;
+  ib->data = MMALLOC_ARRAY(uint8_t, indexBufferSize);
+
+  for (int meshIndex = 0; meshIndex < model->numMeshes; ++meshIndex) {
+    Mesh *mesh = &model->meshes[meshIndex];
+    for (int subMeshIndex = 0; subMeshIndex < mesh->numSubMeshes;
+         ++subMeshIndex) {
+      SubMesh *subMesh = &mesh->subMeshes[subMeshIndex];
+      memcpy(vb->data + subMesh->gpuVertexBufferOffsetInBytes,
+             subMesh->vertices, subMesh->numVertices * sizeof(Vertex));
+      memcpy(ib->data + subMesh->gpuIndexBufferOffsetInBytes,
+             subMesh->indices, subMesh->numIndices * sizeof(VertexIndex));
+    }
+  }
+  countUpload(vertexBufferSize + indexBufferSize);
+}
+
+void destroyModelResources(Model *model) {
+  MFREE(model->gpuIndexBuffer.data);
+  MFREE(model->gpuVertexBuffer.data);
+  MFREE(model->samplers);
+  for (int i = 0; i < model->numTextures; ++i) {
+    MFREE(model->textures[i].data);
+  }
+  MFREE(model->textures);
+}
+
+void renderModel(Model *model, Mat4 transform) {
+  PROFILE_SCOPE("renderModel");
+  // Skinned vertices change every frame, upload them before any draw
+  for (int meshIndex = 0; meshIndex < model->numMeshes; ++meshIndex) {
+    Mesh *mesh = &model->meshes[meshIndex];
+    for (int i = 0; i < mesh->numSubMeshes; ++i) {
+      SubMesh *subMesh = &mesh->subMeshes[i];
+      if (subMesh->skinVertices) {
+        int size = subMesh->numVertices * sizeof(Vertex);
+        memcpy(model->gpuVertexBuffer.data +
+                   subMesh->gpuVertexBufferOffsetInBytes,
+               subMesh->vertices, size);
+        countUpload(size);
+      }
+    }
+  }
+
+  DrawView view = {
+      .viewProj = mat4Multiply(gNullRenderer.viewUniforms.projMat,
+                               gNullRenderer.viewUniforms.viewMat),
+      .eye = gNullRenderer.eye,
+      .farZ = gNullRenderer.farZ,
+      .pixelsPerUnit = gNullRenderer.viewUniforms.projMat.cols[1].y *
+                       (float)getApp()->height * 0.5f,
+      .occlusion = &gNullRenderer.occlusion,
+  };
+  recordModelDraws(&gNullRenderer.drawList, model, transform, &view,
+                   DrawPass_GBuffer, gNullRenderer.pipelines.gbuffer);
+}
+
+// Same batching as the GL backend, with the draws counted instead of issued
+static void submitDrawList(void) {
+  DrawList *list = &gNullRenderer.drawList;
+  if (list->numPackets == 0) {
+    resetDrawList(list);
+    return;
+  }
+
+  sortDrawList(list);
+
+  int size = sizeof(DrawUniforms) * list->numPackets;
+  DrawUniforms *instanceData;
+  int instancesOffset = allocateUniforms(&gNullRenderer.uniformRing, size,
+                                         (void **)&instanceData);
+  if (instancesOffset < 0) {
+    resetDrawList(list);
+    return;
+  }
+  for (int i = 0; i < list->numPackets; ++i) {
+    const DrawPacket *packet = &list->packets[list->sortItems[i].index];
+    instanceData[i] = list->drawUniforms[packet->drawUniforms];
+  }
+  countUpload(size);
+
+  int numInstances;
+  for (int i = 0; i < list->numPackets; i += numInstances) {
+    numInstances = getDrawBatchSize(list, i);
+    const DrawPacket *packet = &list->packets[list->sortItems[i].index];
+
+    setNullPipeline(packet->pipeline);
+    setNullVertexBuffer(&packet->model->gpuVertexBuffer);
+    setNullIndexBuffer(&packet->model->gpuIndexBuffer);
+
+    const Material *material = &packet->model->materials[packet->material];
+    if (material != gNullRenderer.state.material) {
+      MaterialUniforms uniforms = {.baseColorFactor =
+                                       material->baseColorFactor};
+      pushNullUniforms(&uniforms, sizeof(uniforms));
+      gNullRenderer.state.material = material;
+      countStateChange(StateChangeType_UniformBuffer, 1);
+    }
+
+    // The instance attributes are rebound for every batch
+    countStateChange(StateChangeType_VertexBuffer, 1);
+
+    const IndexRange *ranges = &list->ranges[packet->firstRange];
+    int64_t numTriangles = 0;
+    for (int r = 0; r < packet->numRanges; ++r) {
+      numTriangles += ranges[r].count / 3;
+    }
+    RenderCounters *counters = &gNullRenderer.counters.current;
+    ++counters->numDraws;
+    counters->numInstances += numInstances;
+    counters->numTriangles += numTriangles * numInstances;
+  }
+
+  resetDrawList(list);
+}
+
+void setCamera(const OrbitCamera *cam) {
+  gNullRenderer.viewUniforms.viewMat = getOrbitCameraMatrix(cam);
+  gNullRenderer.eye =
+      mat4Inverse(gNullRenderer.viewUniforms.viewMat).cols[3].xyz;
+}
+
+void setLights(const Light *lights, int numLights) {
+  gNullRenderer.lights = lights;
+  gNullRenderer.numLights = numLights;
+}
+
+static void executeNullGBufferPass(UNUSED const FrameGraph *graph,
+                                  UNUSED void *data) {
+  setNullFramebuffer(1);
+  setNullPipeline(gNullRenderer.pipelines.gbuffer);
+  submitDrawList();
+}
+
+void setDeferredGBufferPass(void) {
+  const App *app = getApp();
+
+  gNullRenderer.farZ = 2000.f;
+  gNullRenderer.viewUniforms.projMat =
+      mat4Perspective(degToRad(60), (float)app->width / (float)app->height,
+                      0.1f, gNullRenderer.farZ);
+  beginOcclusionFrame(&gNullRenderer.occlusion,
+                      mat4Multiply(gNullRenderer.viewUniforms.projMat,
+                                   gNullRenderer.viewUniforms.viewMat),
+                      0.1f);
+  pushNullUniforms(&gNullRenderer.viewUniforms, sizeof(ViewUniforms));
+
+  FrameGraph *graph = &gNullRenderer.frameGraph;
+  RenderTargetDesc desc = {app->width, app->height,
+                           RenderTargetFormat_RGBA16F};
+  gNullRenderer.gbuffer[0] = createFrameGraphTexture(graph, "GBuffer0", desc);
+  gNullRenderer.gbuffer[1] = createFrameGraphTexture(graph, "GBuffer1", desc);
+  gNullRenderer.gbuffer[2] = createFrameGraphTexture(graph, "GBuffer2", desc);
+  desc.format = RenderTargetFormat_Depth32F;
+  gNullRenderer.gbufferDepth =
+      createFrameGraphTexture(graph, "GBufferDepth", desc);
+
+  int pass = addFrameGraphPass(graph, "GBuffer", executeNullGBufferPass, NULL);
+  for (int i = 0; i < 3; ++i) {
+    writeFrameGraphResource(graph, pass, gNullRenderer.gbuffer[i]);
+  }
+  writeFrameGraphResource(graph, pass, gNullRenderer.gbufferDepth);
+}
+
+static void executeNullLightingPass(UNUSED const FrameGraph *graph,
+                                    UNUSED void *data) {
+  // Uploaded like the GL backend does: the lights, a range per cluster and
+  // the packed light indices
+  const LightClusters *clusters = &gNullRenderer.lightClusters;
+  countUpload((int64_t)sizeof(LightUniform) * clusters->stats.numLights);
+  countUpload((int64_t)sizeof(uint32_t) * 2 * LIGHT_CLUSTER_COUNT);
+  countUpload((int64_t)sizeof(uint32_t) * clusters->numLightIndices);
+  pushNullUniforms(&(LightingUniforms){0}, sizeof(LightingUniforms));
+
+  setNullFramebuffer(0);
+  setNullPipeline(gNullRenderer.pipelines.lighting);
+  setNullVertexBuffer(NULL);
+  RenderCounters *counters = &gNullRenderer.counters.current;
+  ++counters->numDraws;
+  ++counters->numInstances;
+  ++counters->numTriangles;
+}
+
+void setDeferredLightingPass(void) {
+  const App *app = getApp();
+
+  LightClusters *clusters = &gNullRenderer.lightClusters;
+  setLightClusterProjection(clusters, gNullRenderer.viewUniforms.projMat, 0.1f,
+                            gNullRenderer.farZ);
+  assignLightClusters(clusters, gNullRenderer.viewUniforms.viewMat,
+                      gNullRenderer.lights, gNullRenderer.numLights);
+  gNullRenderer.lights = NULL;
+  gNullRenderer.numLights = 0;
+
+  FrameGraph *graph = &gNullRenderer.frameGraph;
+  FrameGraphResource backbuffer = importFrameGraphTexture(
+      graph, "Backbuffer",
+      (RenderTargetDesc){app->width, app->height, RenderTargetFormat_RGBA8},
+      0);
+  int pass =
+      addFrameGraphPass(graph, "Lighting", executeNullLightingPass, NULL);
+  for (int i = 0; i < 3; ++i) {
+    readFrameGraphResource(graph, pass, gNullRenderer.gbuffer[i]);
+  }
+  writeFrameGraphResource(graph, pass, backbuffer);
+}
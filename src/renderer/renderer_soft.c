@@ -0,0 +1,800 @@
+#include "../renderer.h"
+#include "../memory.h"
+#include "../app.h"
+#include "../ktx2.h"
+#include "../drawlist.h"
+#include "../thread.h"
+#include "../profiler.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "../external/stb_image.h"
+
+// Runs the deferred pipeline of the GL backend on the CPU. Triangles are
+// shaded, clipped and set up on the thread pool, binned into screen tiles in
+// submission order and then every tile is rasterized on its own job, four
+// pixels at a time. Depth is reversed like on the GPU: cleared to 0 and
+// tested with >=. The G-buffer layout and the lighting output match
+// gbuffer.hlsl and deferred_lighting.hlsl.
+
+#define SOFT_TILE_SIZE 64
+#define SOFT_SETUP_GRAIN_SIZE 8
+#define SOFT_UPSCALE_GRAIN_SIZE 16
+// Clipping a triangle against the near and far planes leaves at most a
+// pentagon, which is three triangles
+#define SOFT_MAX_CLIPPED_TRIANGLES 3
+#define SOFT_MAX_CLIPPED_VERTICES 5
+
+// Stand-in for the pipeline index of the GL backend, only used for sorting
+#define SOFT_GBUFFER_PIPELINE 0
+
+typedef struct _SoftVertex {
+  // Clip space
+  Float4 position;
+  Float4 color;
+  Float4 normal;
+  Float4 positionWorld;
+} SoftVertex;
+
+typedef struct _SoftTriangle {
+  // Edge i is opposite vertex i and is a * x + b * y + c in pixels, positive
+  // inside. topLeft is -1 for edges that own the pixels exactly on them.
+  float edgeA[3];
+  float edgeB[3];
+  float edgeC[3];
+  int32_t topLeft[3];
+  // Window depth in [0, 1], linear in screen space
+  float depthA;
+  float depthB;
+  float depthC;
+  float invW[3];
+  Float4 color[3];
+  Float4 normal[3];
+  Float4 positionWorld[3];
+  // Pixel bounds, max exclusive
+  int minX;
+  int minY;
+  int maxX;
+  int maxY;
+  bool valid;
+} SoftTriangle;
+
+typedef struct _SoftTileBin {
+  int numTriangles;
+  int capacity;
+  int *triangles;
+} SoftTileBin;
+
+// Source texels and 8 bit weight of the second one, for bilinear filtering
+typedef struct _SoftUpscaleTap {
+  int first;
+  int second;
+  int weight;
+} SoftUpscaleTap;
+
+typedef struct _SoftRenderer {
+  int width;
+  int height;
+  // Rows of the float targets are padded to a multiple of four pixels
+  int stride;
+  int numTilesX;
+  int numTilesY;
+  SoftTileBin *tileBins;
+
+  float *depth;
+  // Texture 1: baseColor(rgb), metallic(a)
+  // Texture 2: normal(rgb), roughness(a)
+  // Texture 3: position(rgb), occlusion(a)
+  Float4 *gbuffer[3];
+  uint8_t *color;
+  // The passes render into the top left corner of the targets, at the size
+  // picked by the controller from the time setDeferredLightingPass takes.
+  // Scaled down frames are lit into scaledColor and upscaled into color.
+  DynamicResolution resolution;
+  uint8_t *scaledColor;
+  // Horizontal taps of every pixel of color, the same for all rows
+  SoftUpscaleTap *upscaleColumns;
+
+  ViewUniforms viewUniforms;
+  Mat4 viewProj;
+  Float3 eye;
+  float farZ;
+
+  DrawList drawList;
+  OcclusionBuffer occlusion;
+
+  const Light *lights;
+  int numLights;
+  LightClusters lightClusters;
+  int lightUniformCapacity;
+  LightUniform *lightUniforms;
+
+  // SOFT_MAX_CLIPPED_TRIANGLES slots per recorded triangle, in sort order
+  int triangleCapacity;
+  SoftTriangle *triangles;
+  int packetCapacity;
+  int *packetFirstTriangle;
+
+  // There is no driver to change state or upload to, so only the draws,
+  // triangles, time and allocations are counted
+  RenderCounterFrames counters;
+} SoftRenderer;
+
+static SoftRenderer gSoftRenderer;
+
+void initRenderer(void) {
+  const App *app = getApp();
+  SoftRenderer *r = &gSoftRenderer;
+
+  r->width = app->width;
+  r->height = app->height;
+  r->stride = (app->width + 3) & ~3;
+  r->numTilesX = (r->width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+  r->numTilesY = (r->height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+  r->tileBins = MMALLOC_ARRAY_ZEROES(SoftTileBin, r->numTilesX * r->numTilesY);
+
+  int numPixels = r->stride * r->height;
+  r->depth = MMALLOC_ARRAY(float, numPixels);
+  for (int i = 0; i < 3; ++i) {
+    r->gbuffer[i] = MMALLOC_ARRAY(Float4, numPixels);
+  }
+  r->color = MMALLOC_ARRAY_ZEROES(uint8_t, r->width * r->height * 4);
+  r->scaledColor = MMALLOC_ARRAY(uint8_t, r->width * r->height * 4);
+  r->upscaleColumns = MMALLOC_ARRAY(SoftUpscaleTap, r->width);
+  initDynamicResolution(&r->resolution, DYNAMIC_RESOLUTION_DEFAULT_TARGET);
+  initOcclusionBuffer(&r->occlusion);
+  initLightClusters(&r->lightClusters);
+  initRenderCounterFrames(&r->counters);
+
+  LOG("Soft renderer: %dx%d in %dx%d tiles", r->width, r->height,
+      r->numTilesX, r->numTilesY);
+}
+
+void destroyRenderer(void) {
+  SoftRenderer *r = &gSoftRenderer;
+
+  const DynamicResolutionStats *resolution = &r->resolution.stats;
+  LOG("Dynamic resolution: scale %.2f (%dx%d), %.2f ms per frame for a "
+      "%.2f ms target",
+      resolution->scale, resolution->width, resolution->height,
+      resolution->smoothedFrameTime * 1000, resolution->targetFrameTime * 1000);
+
+  MFREE(r->lightUniforms);
+  destroyLightClusters(&r->lightClusters);
+  destroyOcclusionBuffer(&r->occlusion);
+  destroyDrawList(&r->drawList);
+  MFREE(r->packetFirstTriangle);
+  MFREE(r->triangles);
+  for (int i = 0; i < r->numTilesX * r->numTilesY; ++i) {
+    MFREE(r->tileBins[i].triangles);
+  }
+  MFREE(r->tileBins);
+  MFREE(r->upscaleColumns);
+  MFREE(r->scaledColor);
+  MFREE(r->color);
+  for (int i = 0; i < 3; ++i) {
+    MFREE(r->gbuffer[i]);
+  }
+  MFREE(r->depth);
+  *r = (SoftRenderer){0};
+}
+
+void render(UNUSED float dt) {}
+
+const OcclusionStats *getOcclusionStats(void) {
+  return &gSoftRenderer.occlusion.stats;
+}
+
+const LightClusterStats *getLightClusterStats(void) {
+  return &gSoftRenderer.lightClusters.stats;
+}
+
+const DynamicResolutionStats *getDynamicResolutionStats(void) {
+  return &gSoftRenderer.resolution.stats;
+}
+
+const RenderCounters *getRenderCounters(void) {
+  return &gSoftRenderer.counters.last;
+}
+
+void setTargetFrameTime(float seconds) {
+  initDynamicResolution(&gSoftRenderer.resolution, seconds);
+}
+
+const uint8_t *getSoftFramebuffer(int *outWidth, int *outHeight) {
+  *outWidth = gSoftRenderer.width;
+  *outHeight = gSoftRenderer.height;
+  return gSoftRenderer.color;
+}
+
+void initModelTextures(Model *model, int numTextures) {
+  model->numTextures = numTextures;
+  model->textures = MMALLOC_ARRAY_ZEROES(CpuTexture, numTextures);
+}
+
+// The G-buffer shader doesn't sample textures yet, they are only kept for
+// parity with the GPU backends
+bool createModelTexture(Model *model, int index, const uint8_t *encoded,
+                        int size) {
+  CpuTexture *texture = &model->textures[index];
+
+  if (isKtx2Data(encoded, size)) {
+    Ktx2Image image;
+    if (!parseKtx2(&image, encoded, size) ||
+        !canDecodeKtx2Format(image.format)) {
+      return false;
+    }
+    texture->width = image.width;
+    texture->height = image.height;
+    texture->size = image.width * image.height * 4;
+    texture->data = MMALLOC_ARRAY(uint8_t, texture->size);
+    decodeKtx2Level(&image, 0, texture->data);
+    return true;
+  }
+
+  int w, h, numComponents;
+  stbi_uc *data = stbi_load_from_memory(encoded, size, &w, &h, &numComponents,
+                                        STBI_rgb_alpha);
+  if (!data) {
+    return false;
+  }
+  texture->width = w;
+  texture->height = h;
+  texture->size = w * h * 4;
+  texture->data = MMALLOC_ARRAY(uint8_t, texture->size);
+  memcpy(texture->data, data, texture->size);
+  stbi_image_free(data);
+  return true;
+}
+
+void initModelSamplers(Model *model, int numSamplers) {
+  model->numSamplers = numSamplers;
+  model->samplers = MMALLOC_ARRAY_ZEROES(CpuSampler, numSamplers);
+}
+
+void createModelSampler(Model *model, int index, int magFilter, int minFilter,
+                        int wrapS, int wrapT) {
+  model->samplers[index] = (CpuSampler){
+      .magFilter = magFilter,
+      .minFilter = minFilter,
+      .wrapS = wrapS,
+      .wrapT = wrapT,
+  };
+}
+
+// Draws read straight from the sub-mesh arrays, so the model buffers stay
+// empty
+void createModelBuffers(UNUSED Model *model, UNUSED int vertexBufferSize,
+                        UNUSED int indexBufferSize,
+                        UNUSED bool dynamicVertices) {}
+
+void destroyModelResources(Model *model) {
+  MFREE(model->samplers);
+  for (int i = 0; i < model->numTextures; ++i) {
+    MFREE(model->textures[i].data);
+  }
+  MFREE(model->textures);
+}
+
+void renderModel(Model *model, Mat4 transform) {
+  PROFILE_SCOPE("renderModel");
+  SoftRenderer *r = &gSoftRenderer;
+  DrawView view = {
+      .viewProj = r->viewProj,
+      .eye = r->eye,
+      .farZ = r->farZ,
+      .pixelsPerUnit = r->viewUniforms.projMat.cols[1].y *
+                       (float)r->resolution.stats.height * 0.5f,
+      .occlusion = &r->occlusion,
+  };
+  recordModelDraws(&r->drawList, model, transform, &view, DrawPass_GBuffer,
+                   SOFT_GBUFFER_PIPELINE);
+}
+
+// gbuffer_vert
+static SoftVertex shadeVertex(const Vertex *vertex, const Mat4 *mvp,
+                              const DrawUniforms *uniforms) {
+  Float4 position = {vertex->position.x, vertex->position.y,
+                     vertex->position.z, 1};
+  Float4 normal = {vertex->normal.x, vertex->normal.y, vertex->normal.z, 0};
+  SoftVertex result = {
+      .position = mat4MultiplyFloat4(*mvp, position),
+      .color = vertex->color,
+      .normal = mat4MultiplyFloat4(uniforms->normalMat, normal),
+      .positionWorld = mat4MultiplyFloat4(uniforms->modelMat, position),
+  };
+  return result;
+}
+
+static SoftVertex lerpVertex(const SoftVertex *a, const SoftVertex *b,
+                             float t) {
+  SoftVertex result = {
+      .position = a->position + (b->position - a->position) * t,
+      .color = a->color + (b->color - a->color) * t,
+      .normal = a->normal + (b->normal - a->normal) * t,
+      .positionWorld =
+          a->positionWorld + (b->positionWorld - a->positionWorld) * t,
+  };
+  return result;
+}
+
+// Sutherland-Hodgman against dot(plane, position) >= 0
+static int clipPolygon(const SoftVertex *in, int numIn, Float4 plane,
+                       SoftVertex *out) {
+  int numOut = 0;
+  for (int i = 0; i < numIn; ++i) {
+    const SoftVertex *a = &in[i];
+    const SoftVertex *b = &in[(i + 1) % numIn];
+    float da = float4Dot(plane, a->position);
+    float db = float4Dot(plane, b->position);
+    if (da >= 0) {
+      out[numOut++] = *a;
+    }
+    if ((da >= 0) != (db >= 0)) {
+      out[numOut++] = lerpVertex(a, b, da / (da - db));
+    }
+  }
+  return numOut;
+}
+
+static void setupTriangle(SoftTriangle *tri, const SoftVertex *v0,
+                          const SoftVertex *v1, const SoftVertex *v2) {
+  const DynamicResolutionStats *resolution = &gSoftRenderer.resolution.stats;
+  const SoftVertex *v[3] = {v0, v1, v2};
+
+  float x[3], y[3], depth[3];
+  for (int i = 0; i < 3; ++i) {
+    float invW = 1.f / v[i]->position.w;
+    x[i] = (v[i]->position.x * invW * 0.5f + 0.5f) * (float)resolution->width;
+    y[i] =
+        (0.5f - v[i]->position.y * invW * 0.5f) * (float)resolution->height;
+    depth[i] = v[i]->position.z * invW * 0.5f + 0.5f;
+    tri->invW[i] = invW;
+    tri->color[i] = v[i]->color;
+    tri->normal[i] = v[i]->normal;
+    tri->positionWorld[i] = v[i]->positionWorld;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    int i1 = (i + 1) % 3;
+    int i2 = (i + 2) % 3;
+    tri->edgeA[i] = y[i1] - y[i2];
+    tri->edgeB[i] = x[i2] - x[i1];
+    tri->edgeC[i] = x[i1] * y[i2] - x[i2] * y[i1];
+  }
+
+  // No face culling, so flip clockwise triangles to keep the inside positive
+  float area = tri->edgeA[0] * x[0] + tri->edgeB[0] * y[0] + tri->edgeC[0];
+  if (!(fabsf(area) > 1e-12f)) {
+    tri->valid = false;
+    return;
+  }
+  float sign = area < 0 ? -1.f : 1.f;
+  float invArea = 1.f / fabsf(area);
+
+  tri->depthA = 0;
+  tri->depthB = 0;
+  tri->depthC = 0;
+  for (int i = 0; i < 3; ++i) {
+    tri->edgeA[i] *= sign;
+    tri->edgeB[i] *= sign;
+    tri->edgeC[i] *= sign;
+    tri->topLeft[i] =
+        tri->edgeA[i] > 0 || (tri->edgeA[i] == 0 && tri->edgeB[i] > 0) ? -1
+                                                                        : 0;
+    tri->depthA += tri->edgeA[i] * invArea * depth[i];
+    tri->depthB += tri->edgeB[i] * invArea * depth[i];
+    tri->depthC += tri->edgeC[i] * invArea * depth[i];
+  }
+
+  float minX = fminf(x[0], fminf(x[1], x[2]));
+  float maxX = fmaxf(x[0], fmaxf(x[1], x[2]));
+  float minY = fminf(y[0], fminf(y[1], y[2]));
+  float maxY = fmaxf(y[0], fmaxf(y[1], y[2]));
+  tri->minX = MAX((int)floorf(minX), 0);
+  tri->minY = MAX((int)floorf(minY), 0);
+  tri->maxX = MIN((int)ceilf(maxX), resolution->width);
+  tri->maxY = MIN((int)ceilf(maxY), resolution->height);
+  tri->valid = tri->minX < tri->maxX && tri->minY < tri->maxY;
+}
+
+static void setupPacketRange(UNUSED void *data, int begin, int end) {
+  SoftRenderer *r = &gSoftRenderer;
+  const DrawList *list = &r->drawList;
+
+  // Near (z <= w) and far (z >= -w) planes of the GL clip volume
+  const Float4 clipPlanes[2] = {{0, 0, -1, 1}, {0, 0, 1, 1}};
+
+  for (int i = begin; i < end; ++i) {
+    const DrawPacket *packet = &list->packets[list->sortItems[i].index];
+    const SubMesh *subMesh = packet->subMesh;
+    const DrawUniforms *uniforms = &list->drawUniforms[packet->drawUniforms];
+    Mat4 mvp = mat4Multiply(r->viewProj, uniforms->modelMat);
+
+    SoftTriangle *tri = &r->triangles[r->packetFirstTriangle[i]];
+    for (int rangeIndex = 0; rangeIndex < packet->numRanges; ++rangeIndex) {
+      const IndexRange *range = &list->ranges[packet->firstRange + rangeIndex];
+      const VertexIndex *indices = &subMesh->indices[range->offset];
+
+      for (int t = 0; t + 2 < range->count; t += 3) {
+        SoftVertex polygon[2][SOFT_MAX_CLIPPED_VERTICES];
+        for (int k = 0; k < 3; ++k) {
+          polygon[0][k] =
+              shadeVertex(&subMesh->vertices[indices[t + k]], &mvp, uniforms);
+        }
+        int numVertices = clipPolygon(polygon[0], 3, clipPlanes[0], polygon[1]);
+        numVertices =
+            clipPolygon(polygon[1], numVertices, clipPlanes[1], polygon[0]);
+
+        for (int k = 0; k < SOFT_MAX_CLIPPED_TRIANGLES; ++k) {
+          if (k + 2 < numVertices) {
+            setupTriangle(&tri[k], &polygon[0][0], &polygon[0][k + 1],
+                          &polygon[0][k + 2]);
+          } else {
+            tri[k].valid = false;
+          }
+        }
+        tri += SOFT_MAX_CLIPPED_TRIANGLES;
+      }
+    }
+  }
+}
+
+static void binTriangle(int triangleIndex) {
+  SoftRenderer *r = &gSoftRenderer;
+  const SoftTriangle *tri = &r->triangles[triangleIndex];
+
+  int minTileX = tri->minX / SOFT_TILE_SIZE;
+  int minTileY = tri->minY / SOFT_TILE_SIZE;
+  int maxTileX = (tri->maxX - 1) / SOFT_TILE_SIZE;
+  int maxTileY = (tri->maxY - 1) / SOFT_TILE_SIZE;
+  for (int tileY = minTileY; tileY <= maxTileY; ++tileY) {
+    for (int tileX = minTileX; tileX <= maxTileX; ++tileX) {
+      SoftTileBin *bin = &r->tileBins[tileY * r->numTilesX + tileX];
+      if (bin->numTriangles == bin->capacity) {
+        int capacity = MAX(bin->capacity * 2, 256);
+        int *triangles = MMALLOC_ARRAY(int, capacity);
+        if (bin->triangles) {
+          memcpy(triangles, bin->triangles, sizeof(int) * bin->numTriangles);
+          MFREE(bin->triangles);
+        }
+        bin->triangles = triangles;
+        bin->capacity = capacity;
+      }
+      bin->triangles[bin->numTriangles++] = triangleIndex;
+    }
+  }
+}
+
+static Int4 edgeCoverage(Float4 edge, int32_t topLeft) {
+  return (edge > 0) | ((edge == 0) & topLeft);
+}
+
+// gbuffer_frag for the covered pixels of four, with perspective correct
+// interpolation
+static void shadePixels(const SoftTriangle *tri, int pixel, Int4 mask,
+                        Float4 e0, Float4 e1, Float4 e2, Float4 depth) {
+  SoftRenderer *r = &gSoftRenderer;
+  for (int lane = 0; lane < 4; ++lane) {
+    if (!mask[lane]) {
+      continue;
+    }
+    float w0 = e0[lane] * tri->invW[0];
+    float w1 = e1[lane] * tri->invW[1];
+    float w2 = e2[lane] * tri->invW[2];
+    float invSum = 1.f / (w0 + w1 + w2);
+    w0 *= invSum;
+    w1 *= invSum;
+    w2 *= invSum;
+
+    Float4 color = tri->color[0] * w0 + tri->color[1] * w1 + tri->color[2] * w2;
+    Float4 normal =
+        tri->normal[0] * w0 + tri->normal[1] * w1 + tri->normal[2] * w2;
+    Float4 position = tri->positionWorld[0] * w0 +
+                      tri->positionWorld[1] * w1 + tri->positionWorld[2] * w2;
+
+    int index = pixel + lane;
+    r->depth[index] = depth[lane];
+    r->gbuffer[0][index] = (Float4){color.x, color.y, color.z, 1};
+    r->gbuffer[1][index] = (Float4){normal.x, normal.y, normal.z, 1};
+    r->gbuffer[2][index] = (Float4){position.x, position.y, position.z, 1};
+  }
+}
+
+static void rasterizeTriangle(const SoftTriangle *tri, int tileMinX,
+                              int tileMinY, int tileMaxX, int tileMaxY) {
+  SoftRenderer *r = &gSoftRenderer;
+
+  // Rows are walked in aligned groups of four pixels
+  int minX = MAX(tri->minX, tileMinX) & ~3;
+  int maxX = MIN(tri->maxX, tileMaxX);
+  int minY = MAX(tri->minY, tileMinY);
+  int maxY = MIN(tri->maxY, tileMaxY);
+
+  for (int y = minY; y < maxY; ++y) {
+    float py = (float)y + 0.5f;
+    float rowE0 = tri->edgeB[0] * py + tri->edgeC[0];
+    float rowE1 = tri->edgeB[1] * py + tri->edgeC[1];
+    float rowE2 = tri->edgeB[2] * py + tri->edgeC[2];
+    float rowDepth = tri->depthB * py + tri->depthC;
+
+    for (int x = minX; x < maxX; x += 4) {
+      Float4 px = (Float4){0.5f, 1.5f, 2.5f, 3.5f} + (float)x;
+      Float4 e0 = tri->edgeA[0] * px + rowE0;
+      Float4 e1 = tri->edgeA[1] * px + rowE1;
+      Float4 e2 = tri->edgeA[2] * px + rowE2;
+      Int4 lanes = (Int4){0, 1, 2, 3} + x;
+      Int4 mask = edgeCoverage(e0, tri->topLeft[0]) &
+                      edgeCoverage(e1, tri->topLeft[1]) &
+                      edgeCoverage(e2, tri->topLeft[2]) & (lanes < maxX);
+      if (!(mask[0] | mask[1] | mask[2] | mask[3])) {
+        continue;
+      }
+
+      int pixel = y * r->stride + x;
+      Float4 depth = tri->depthA * px + rowDepth;
+      Float4 storedDepth;
+      memcpy(&storedDepth, &r->depth[pixel], sizeof(storedDepth));
+      mask &= depth >= storedDepth;
+      if (!(mask[0] | mask[1] | mask[2] | mask[3])) {
+        continue;
+      }
+      shadePixels(tri, pixel, mask, e0, e1, e2, depth);
+    }
+  }
+}
+
+// Tiles past the scaled size come out empty
+static void getTileBounds(int tile, int *minX, int *minY, int *maxX,
+                          int *maxY) {
+  const SoftRenderer *r = &gSoftRenderer;
+  *minX = (tile % r->numTilesX) * SOFT_TILE_SIZE;
+  *minY = (tile / r->numTilesX) * SOFT_TILE_SIZE;
+  *maxX = MAX(MIN(*minX + SOFT_TILE_SIZE, r->resolution.stats.width), *minX);
+  *maxY = MAX(MIN(*minY + SOFT_TILE_SIZE, r->resolution.stats.height), *minY);
+}
+
+// Clears the tile like glClear in setDeferredGBufferPass, then draws its
+// triangles in submission order
+static void rasterizeTiles(UNUSED void *data, int begin, int end) {
+  SoftRenderer *r = &gSoftRenderer;
+  for (int tile = begin; tile < end; ++tile) {
+    int minX, minY, maxX, maxY;
+    getTileBounds(tile, &minX, &minY, &maxX, &maxY);
+
+    for (int y = minY; y < maxY; ++y) {
+      int row = y * r->stride;
+      int alignedMaxX = (maxX + 3) & ~3;
+      memset(&r->depth[row + minX], 0, sizeof(float) * (alignedMaxX - minX));
+      for (int i = 0; i < 3; ++i) {
+        memset(&r->gbuffer[i][row + minX], 0,
+               sizeof(Float4) * (alignedMaxX - minX));
+      }
+    }
+
+    const SoftTileBin *bin = &r->tileBins[tile];
+    for (int i = 0; i < bin->numTriangles; ++i) {
+      rasterizeTriangle(&r->triangles[bin->triangles[i]], minX, minY, maxX,
+                        maxY);
+    }
+  }
+}
+
+// shadeLight of deferred_lighting.hlsl
+static Float3 shadeSoftLight(const LightUniform *light, Float3 position,
+                             Float3 normal) {
+  Float3 result = {0, 0, 0};
+  Float3 toLight = light->positionRange.xyz - position;
+  float distanceSquared = float3Dot(toLight, toLight);
+  float rangeSquared = light->positionRange.w * light->positionRange.w;
+  if (distanceSquared >= rangeSquared || distanceSquared == 0) {
+    return result;
+  }
+  Float3 direction = toLight / sqrtf(distanceSquared);
+  float nDotL = float3Dot(normal, direction);
+  if (nDotL <= 0) {
+    return result;
+  }
+
+  float ratio = distanceSquared / rangeSquared;
+  float window = fminf(fmaxf(1 - ratio * ratio, 0), 1);
+  float attenuation = window * window / fmaxf(distanceSquared, 0.0001f);
+  float cone = fminf(
+      fmaxf(-float3Dot(direction, light->direction.xyz) * light->spot.x +
+                light->spot.y,
+            0),
+      1);
+  return light->color.xyz * (nDotL * attenuation * cone * cone);
+}
+
+// deferred_lighting_frag, into data with rows of r->width pixels
+static void lightTiles(void *data, int begin, int end) {
+  SoftRenderer *r = &gSoftRenderer;
+  uint8_t *target = data;
+  const LightClusters *clusters = &r->lightClusters;
+  for (int tile = begin; tile < end; ++tile) {
+    int minX, minY, maxX, maxY;
+    getTileBounds(tile, &minX, &minY, &maxX, &maxY);
+
+    for (int y = minY; y < maxY; ++y) {
+      for (int x = minX; x < maxX; ++x) {
+        int pixel = y * r->stride + x;
+        Float3 normal = r->gbuffer[1][pixel].xyz;
+        Float3 color = {0, 0, 0};
+        // Nothing was drawn here
+        if (float3Dot(normal, normal) > 0) {
+          normal = float3Normalize(normal);
+          Float4 position = r->gbuffer[2][pixel];
+          position.w = 1;
+          Float3 viewPosition =
+              mat4MultiplyFloat4(r->viewUniforms.viewMat, position).xyz;
+          int cluster = getLightCluster(clusters, viewPosition);
+          uint32_t first = clusters->ranges[cluster * 2];
+          uint32_t count = clusters->ranges[cluster * 2 + 1];
+
+          Float3 light = {AMBIENT_LIGHT, AMBIENT_LIGHT, AMBIENT_LIGHT};
+          for (uint32_t i = 0; i < count; ++i) {
+            const LightUniform *lightUniform =
+                &r->lightUniforms[clusters->lightIndices[first + i]];
+            light += shadeSoftLight(lightUniform, position.xyz, normal);
+          }
+          color = r->gbuffer[0][pixel].xyz * light;
+        }
+
+        uint8_t *out = &target[(y * r->width + x) * 4];
+        for (int i = 0; i < 3; ++i) {
+          out[i] = (uint8_t)(fminf(fmaxf(color[i], 0), 1) * 255.f + 0.5f);
+        }
+        out[3] = 255;
+      }
+    }
+  }
+}
+
+static SoftUpscaleTap getUpscaleTap(int x, int size, int scaledSize) {
+  float source =
+      fmaxf(((float)x + 0.5f) * (float)scaledSize / (float)size - 0.5f, 0);
+  int first = (int)source;
+  SoftUpscaleTap tap = {
+      .first = first,
+      .second = MIN(first + 1, scaledSize - 1),
+      .weight = (int)((source - (float)first) * 256.f + 0.5f),
+  };
+  return tap;
+}
+
+// Bilinear filter of the scaled corner of scaledColor over all of color
+static void upscaleRows(UNUSED void *data, int begin, int end) {
+  SoftRenderer *r = &gSoftRenderer;
+  const DynamicResolutionStats *resolution = &r->resolution.stats;
+  for (int y = begin; y < end; ++y) {
+    SoftUpscaleTap row = getUpscaleTap(y, r->height, resolution->height);
+    const uint8_t *top = &r->scaledColor[row.first * r->width * 4];
+    const uint8_t *bottom = &r->scaledColor[row.second * r->width * 4];
+    uint8_t *out = &r->color[y * r->width * 4];
+    for (int x = 0; x < r->width; ++x) {
+      const SoftUpscaleTap *column = &r->upscaleColumns[x];
+      int first = column->first * 4;
+      int second = column->second * 4;
+      for (int i = 0; i < 4; ++i) {
+        int t = top[first + i] * (256 - column->weight) +
+                top[second + i] * column->weight;
+        int b = bottom[first + i] * (256 - column->weight) +
+                bottom[second + i] * column->weight;
+        out[x * 4 + i] =
+            (uint8_t)((t * (256 - row.weight) + b * row.weight + 32768) >> 16);
+      }
+    }
+  }
+}
+
+static void submitDrawList(void) {
+  SoftRenderer *r = &gSoftRenderer;
+  DrawList *list = &r->drawList;
+
+  sortDrawList(list);
+
+  // Every packet gets a fixed run of triangle slots, so setup can run on any
+  // thread and binning still sees the triangles in sort order
+  if (r->packetCapacity < list->numPackets) {
+    MFREE(r->packetFirstTriangle);
+    r->packetCapacity = MAX(list->numPackets, r->packetCapacity * 2);
+    r->packetFirstTriangle = MMALLOC_ARRAY(int, r->packetCapacity);
+  }
+  int numTriangles = 0;
+  for (int i = 0; i < list->numPackets; ++i) {
+    const DrawPacket *packet = &list->packets[list->sortItems[i].index];
+    r->packetFirstTriangle[i] = numTriangles;
+    for (int rangeIndex = 0; rangeIndex < packet->numRanges; ++rangeIndex) {
+      numTriangles += list->ranges[packet->firstRange + rangeIndex].count / 3 *
+                      SOFT_MAX_CLIPPED_TRIANGLES;
+    }
+  }
+  if (r->triangleCapacity < numTriangles) {
+    MFREE(r->triangles);
+    r->triangleCapacity = MAX(numTriangles, r->triangleCapacity * 2);
+    r->triangles = MMALLOC_ARRAY(SoftTriangle, r->triangleCapacity);
+  }
+
+  parallelFor(list->numPackets, SOFT_SETUP_GRAIN_SIZE, setupPacketRange, NULL);
+
+  int numTiles = r->numTilesX * r->numTilesY;
+  for (int i = 0; i < numTiles; ++i) {
+    r->tileBins[i].numTriangles = 0;
+  }
+  for (int i = 0; i < numTriangles; ++i) {
+    if (r->triangles[i].valid) {
+      binTriangle(i);
+    }
+  }
+
+  parallelFor(numTiles, 1, rasterizeTiles, NULL);
+
+  RenderCounters *counters = &r->counters.current;
+  counters->numDraws += list->numPackets;
+  counters->numInstances += list->numPackets;
+  counters->numTriangles += numTriangles / SOFT_MAX_CLIPPED_TRIANGLES;
+
+  resetDrawList(list);
+}
+
+void setCamera(const OrbitCamera *cam) {
+  gSoftRenderer.viewUniforms.viewMat = getOrbitCameraMatrix(cam);
+  gSoftRenderer.eye =
+      mat4Inverse(gSoftRenderer.viewUniforms.viewMat).cols[3].xyz;
+}
+
+void setLights(const Light *lights, int numLights) {
+  gSoftRenderer.lights = lights;
+  gSoftRenderer.numLights = numLights;
+}
+
+void setDeferredGBufferPass(void) {
+  SoftRenderer *r = &gSoftRenderer;
+  setDynamicResolutionTargetSize(&r->resolution, r->width, r->height);
+
+  r->farZ = 2000.f;
+  r->viewUniforms.projMat =
+      mat4Perspective(degToRad(60), (float)r->width / (float)r->height, 0.1f,
+                      r->farZ);
+  r->viewProj = mat4Multiply(r->viewUniforms.projMat, r->viewUniforms.viewMat);
+  beginOcclusionFrame(&r->occlusion, r->viewProj, 0.1f);
+}
+
+void setDeferredLightingPass(void) {
+  PROFILE_SCOPE("setDeferredLightingPass");
+  SoftRenderer *r = &gSoftRenderer;
+  double startTime = getTime();
+
+  submitDrawList();
+
+  setLightClusterProjection(&r->lightClusters, r->viewUniforms.projMat, 0.1f,
+                            r->farZ);
+  assignLightClusters(&r->lightClusters, r->viewUniforms.viewMat, r->lights,
+                      r->numLights);
+  if (r->lightUniformCapacity < r->numLights) {
+    MFREE(r->lightUniforms);
+    r->lightUniformCapacity = MAX(r->numLights, r->lightUniformCapacity * 2);
+    r->lightUniforms = MMALLOC_ARRAY(LightUniform, r->lightUniformCapacity);
+  }
+  for (int i = 0; i < r->numLights; ++i) {
+    r->lightUniforms[i] = makeLightUniform(&r->lights[i]);
+  }
+  r->lights = NULL;
+  r->numLights = 0;
+
+  const DynamicResolutionStats *resolution = &r->resolution.stats;
+  if (resolution->width == r->width && resolution->height == r->height) {
+    parallelFor(r->numTilesX * r->numTilesY, 1, lightTiles, r->color);
+  } else {
+    parallelFor(r->numTilesX * r->numTilesY, 1, lightTiles, r->scaledColor);
+    for (int x = 0; x < r->width; ++x) {
+      r->upscaleColumns[x] = getUpscaleTap(x, r->width, resolution->width);
+    }
+    parallelFor(r->height, SOFT_UPSCALE_GRAIN_SIZE, upscaleRows, NULL);
+  }
+
+  updateDynamicResolution(&r->resolution, (float)(getTime() - startTime));
+  endRenderCounterFrame(&r->counters);
+}
@@ -0,0 +1,162 @@
+#include "replay.h"
+#include "memory.h"
+#include <stdio.h>
+#include <string.h>
+
+#define REPLAY_MAGIC 0x50524750u // "PGRP"
+#define REPLAY_VERSION 1
+
+typedef struct _ReplayFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  int64_t textureBudget;
+  int32_t numFrames;
+  int32_t numSceneLights;
+  float targetFrameTime;
+  char modelName[REPLAY_MAX_MODEL_NAME];
+} ReplayFileHeader;
+
+// ReplayFrame without the padding of Float3
+typedef struct _ReplayFileFrame {
+  float dt;
+  int32_t width;
+  int32_t height;
+  float distance;
+  float theta;
+  float phi;
+  float target[3];
+} ReplayFileFrame;
+
+void initReplay(Replay *replay, const ReplaySettings *settings) {
+  *replay = (Replay){.settings = *settings};
+  replay->settings.modelName[REPLAY_MAX_MODEL_NAME - 1] = 0;
+}
+
+void destroyReplay(Replay *replay) {
+  MFREE(replay->frames);
+  *replay = (Replay){0};
+}
+
+void recordReplayFrame(Replay *replay, const ReplayFrame *frame) {
+  if (replay->numFrames == replay->frameCapacity) {
+    int capacity = MAX(replay->frameCapacity * 2, 256);
+    ReplayFrame *frames = MMALLOC_ARRAY(ReplayFrame, capacity);
+    if (replay->numFrames > 0) {
+      memcpy(frames, replay->frames, sizeof(ReplayFrame) * replay->numFrames);
+    }
+    MFREE(replay->frames);
+    replay->frames = frames;
+    replay->frameCapacity = capacity;
+  }
+  replay->frames[replay->numFrames++] = *frame;
+}
+
+bool saveReplay(const Replay *replay, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    LOG("Can't open %s for writing", path);
+    return false;
+  }
+
+  ReplayFileHeader header = {
+      .magic = REPLAY_MAGIC,
+      .version = REPLAY_VERSION,
+      .textureBudget = replay->settings.textureBudget,
+      .numFrames = replay->numFrames,
+      .numSceneLights = replay->settings.numSceneLights,
+      .targetFrameTime = replay->settings.targetFrameTime,
+  };
+  memcpy(header.modelName, replay->settings.modelName,
+         REPLAY_MAX_MODEL_NAME);
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (int i = 0; i < replay->numFrames && written; ++i) {
+    const ReplayFrame *frame = &replay->frames[i];
+    ReplayFileFrame fileFrame = {
+        .dt = frame->dt,
+        .width = frame->width,
+        .height = frame->height,
+        .distance = frame->camera.distance,
+        .theta = frame->camera.theta,
+        .phi = frame->camera.phi,
+        .target = {frame->camera.target.x, frame->camera.target.y,
+                   frame->camera.target.z},
+    };
+    written = fwrite(&fileFrame, sizeof(fileFrame), 1, file) == 1;
+  }
+  fclose(file);
+
+  if (!written) {
+    LOG("Can't write %s", path);
+    return false;
+  }
+  LOG("Replay: %d frames recorded to %s", replay->numFrames, path);
+  return true;
+}
+
+bool loadReplay(Replay *replay, const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    LOG("Can't open %s", path);
+    return false;
+  }
+
+  ReplayFileHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION ||
+      header.numFrames < 0) {
+    LOG("%s isn't a replay of version %d", path, REPLAY_VERSION);
+    fclose(file);
+    return false;
+  }
+
+  ReplaySettings settings = {
+      .numSceneLights = header.numSceneLights,
+      .targetFrameTime = header.targetFrameTime,
+      .textureBudget = header.textureBudget,
+  };
+  memcpy(settings.modelName, header.modelName, REPLAY_MAX_MODEL_NAME);
+  initReplay(replay, &settings);
+
+  for (int i = 0; i < header.numFrames; ++i) {
+    ReplayFileFrame fileFrame;
+    if (fread(&fileFrame, sizeof(fileFrame), 1, file) != 1) {
+      LOG("%s ends after %d of %d frames", path, i, header.numFrames);
+      break;
+    }
+    ReplayFrame frame = {
+        .dt = fileFrame.dt,
+        .width = fileFrame.width,
+        .height = fileFrame.height,
+        .camera =
+            {
+                .distance = fileFrame.distance,
+                .theta = fileFrame.theta,
+                .phi = fileFrame.phi,
+                .target = {fileFrame.target[0], fileFrame.target[1],
+                           fileFrame.target[2]},
+            },
+    };
+    recordReplayFrame(replay, &frame);
+  }
+  fclose(file);
+
+  if (replay->numFrames == 0) {
+    LOG("%s has no frames", path);
+    destroyReplay(replay);
+    return false;
+  }
+  LOG("Replay: %d frames of %s loaded from %s", replay->numFrames,
+      replay->settings.modelName, path);
+  return true;
+}
+
+const ReplayFrame *playReplayFrame(Replay *replay) {
+  ASSERT(replay->numFrames > 0);
+  if (replay->playhead == replay->numFrames) {
+    LOG("Replay: past the %d recorded frames, holding the last one",
+        replay->numFrames);
+  }
+  int index = MIN(replay->playhead, replay->numFrames - 1);
+  ++replay->playhead;
+  return &replay->frames[index];
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "util.h"
+#include "renderer.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+#define REPLAY_MAX_MODEL_NAME 64
+
+// Scene options the frames were recorded with, a replay runs with the same
+typedef struct _ReplaySettings {
+  // Under resources/gltf
+  char modelName[REPLAY_MAX_MODEL_NAME];
+  int numSceneLights;
+  float targetFrameTime;
+  int64_t textureBudget;
+} ReplaySettings;
+
+// What one update read from the clock, the window and the input
+typedef struct _ReplayFrame {
+  float dt;
+  int width;
+  int height;
+  OrbitCamera camera;
+} ReplayFrame;
+
+// Frames of a run, recorded so the same workload can be played back
+// headlessly and compared between builds
+typedef struct _Replay {
+  ReplaySettings settings;
+  int numFrames;
+  int frameCapacity;
+  ReplayFrame *frames;
+  // Next frame to play back
+  int playhead;
+} Replay;
+
+void initReplay(Replay *replay, const ReplaySettings *settings);
+void destroyReplay(Replay *replay);
+void recordReplayFrame(Replay *replay, const ReplayFrame *frame);
+// Binary, in the byte order of the machine. Return false when the file can't
+// be written or read, or isn't a replay of this version.
+bool saveReplay(const Replay *replay, const char *path);
+bool loadReplay(Replay *replay, const char *path);
+// Next recorded frame, the last one again once they run out
+const ReplayFrame *playReplayFrame(Replay *replay);
+
+C_INTERFACE_END
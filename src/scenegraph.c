@@ -0,0 +1,87 @@
+#include "scenegraph.h"
+#include "memory.h"
+
+void initSceneGraph(SceneGraph *graph, int numNodes) {
+  *graph = (SceneGraph){0};
+  graph->numNodes = numNodes;
+  graph->parents = MMALLOC_ARRAY(int, numNodes);
+  graph->positions = MMALLOC_ARRAY(Float3, numNodes);
+  graph->rotations = MMALLOC_ARRAY(Float4, numNodes);
+  graph->scales = MMALLOC_ARRAY(Float3, numNodes);
+  graph->localMatrices = MMALLOC_ARRAY(Mat4, numNodes);
+  graph->worldMatrices = MMALLOC_ARRAY(Mat4, numNodes);
+  graph->normalMatrices = MMALLOC_ARRAY(Mat4, numNodes);
+  graph->dirtyFlags = MMALLOC_ARRAY(uint8_t, numNodes);
+  graph->changedNodes = MMALLOC_ARRAY(int, numNodes);
+
+  for (int i = 0; i < numNodes; ++i) {
+    graph->parents[i] = -1;
+    graph->positions[i] = (Float3){0, 0, 0};
+    graph->rotations[i] = (Float4){0, 0, 0, 1};
+    graph->scales[i] = (Float3){1, 1, 1};
+    graph->localMatrices[i] = mat4Identity();
+    graph->worldMatrices[i] = mat4Identity();
+    graph->normalMatrices[i] = mat4Identity();
+    graph->dirtyFlags[i] = SceneNodeDirty_World;
+  }
+  graph->firstDirtyNode = 0;
+}
+
+void destroySceneGraph(SceneGraph *graph) {
+  MFREE(graph->changedNodes);
+  MFREE(graph->dirtyFlags);
+  MFREE(graph->normalMatrices);
+  MFREE(graph->worldMatrices);
+  MFREE(graph->localMatrices);
+  MFREE(graph->scales);
+  MFREE(graph->rotations);
+  MFREE(graph->positions);
+  MFREE(graph->parents);
+  *graph = (SceneGraph){0};
+}
+
+void markSceneNodeDirty(SceneGraph *graph, int node) {
+  ASSERT(node >= 0 && node < graph->numNodes);
+  graph->dirtyFlags[node] |= SceneNodeDirty_Local;
+  graph->firstDirtyNode = MIN(graph->firstDirtyNode, node);
+}
+
+void updateSceneGraph(SceneGraph *graph) {
+  graph->numChangedNodes = 0;
+
+  // Nodes before firstDirtyNode are clean and so are their world matrices
+  for (int i = graph->firstDirtyNode; i < graph->numNodes; ++i) {
+    int parent = graph->parents[i];
+    ASSERT(parent < i);
+    uint8_t flags = graph->dirtyFlags[i];
+    if (parent >= 0 && (graph->dirtyFlags[parent] & SceneNodeDirty_Updated)) {
+      flags |= SceneNodeDirty_World;
+    }
+    if (!flags) {
+      continue;
+    }
+
+    if (flags & SceneNodeDirty_Local) {
+      graph->localMatrices[i] = mat4Multiply(
+          mat4Multiply(mat4Translate(graph->positions[i]),
+                       quatToMat4(graph->rotations[i])),
+          mat4Scale(graph->scales[i]));
+    }
+    if (parent >= 0) {
+      graph->worldMatrices[i] =
+          mat4Multiply(graph->worldMatrices[parent], graph->localMatrices[i]);
+    } else {
+      graph->worldMatrices[i] = graph->localMatrices[i];
+    }
+    graph->normalMatrices[i] =
+        mat4Transpose(mat4Inverse(graph->worldMatrices[i]));
+
+    graph->dirtyFlags[i] = SceneNodeDirty_Updated;
+    graph->changedNodes[graph->numChangedNodes++] = i;
+  }
+
+  for (int i = 0; i < graph->numChangedNodes; ++i) {
+    graph->dirtyFlags[graph->changedNodes[i]] = 0;
+  }
+  graph->firstDirtyNode = graph->numNodes;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "util.h"
+#include "vmath.h"
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+typedef enum _SceneNodeDirty {
+  // Local matrix needs to be rebuilt from the TRS
+  SceneNodeDirty_Local = 1 << 0,
+  // World matrix needs to be recomputed from the local one
+  SceneNodeDirty_World = 1 << 1,
+  // World matrix was recomputed by the running update
+  SceneNodeDirty_Updated = 1 << 2,
+} SceneNodeDirty;
+
+// Node transforms stored an attribute at a time. Parents always come before
+// their children, so world matrices are computed in one pass in node order.
+typedef struct _SceneGraph {
+  int numNodes;
+  // -1 for roots
+  int *parents;
+
+  Float3 *positions;
+  Float4 *rotations;
+  Float3 *scales;
+  Mat4 *localMatrices;
+  Mat4 *worldMatrices;
+  // Inverse transpose of the world matrices
+  Mat4 *normalMatrices;
+
+  uint8_t *dirtyFlags;
+  // Lowest node with dirty flags, numNodes when there is none
+  int firstDirtyNode;
+
+  // Nodes whose world matrix changed in the last updateSceneGraph, in order
+  int numChangedNodes;
+  int *changedNodes;
+} SceneGraph;
+
+// Every node starts as a root with an identity transform. The caller fills
+// parents, TRS and local matrices, and the first update computes the world
+// matrices of all nodes from the local ones.
+void initSceneGraph(SceneGraph *graph, int numNodes);
+void destroySceneGraph(SceneGraph *graph);
+
+// Call after changing the TRS of node
+void markSceneNodeDirty(SceneGraph *graph, int node);
+
+// Recomputes the dirty nodes and their descendants. Costs nothing when no
+// node was marked since the last update.
+void updateSceneGraph(SceneGraph *graph);
+
+C_INTERFACE_END
@@ -25,7 +25,14 @@ cbuffer MaterialData : register(b1) {
   float4 baseColorFactor;
 };
 
-cbuffer DrawData : register(b2) {
-  float4x4 modelMat;
-  float4x4 normalMat;
+// Per-instance vertex data, one row of the model and normal matrices each
+struct InstanceIn {
+  float4 modelMat0 : INSTANCE_MODEL0;
+  float4 modelMat1 : INSTANCE_MODEL1;
+  float4 modelMat2 : INSTANCE_MODEL2;
+  float4 modelMat3 : INSTANCE_MODEL3;
+  float4 normalMat0 : INSTANCE_NORMAL0;
+  float4 normalMat1 : INSTANCE_NORMAL1;
+  float4 normalMat2 : INSTANCE_NORMAL2;
+  float4 normalMat3 : INSTANCE_NORMAL3;
 };
@@ -1,10 +1,26 @@
 #include "common.hlsli"
 
 Texture2D gbuffer0 : register(t0);
-Texture2D gbuffer1 : register(t0);
-Texture2D gbuffer2 : register(t0);
+Texture2D gbuffer1 : register(t1);
+Texture2D gbuffer2 : register(t2);
 SamplerState gbufferSampler : register(s0);
 
+// Four texels per light, laid out like LightUniform
+Buffer<float4> lights : register(t3);
+// First index in lightIndices and light count of every cluster
+Buffer<uint2> clusterRanges : register(t4);
+Buffer<uint> lightIndices : register(t5);
+
+cbuffer LightingData : register(b3) {
+  // x, y: tangents of the half angles of the projection, z: near plane,
+  // w: cluster slices per unit of log depth
+  float4 clusterProjection;
+  float4 clusterCounts;
+  float4 ambientColor;
+  // xy: fraction of the G-buffer the scaled passes rendered to
+  float4 renderScale;
+};
+
 struct DeferredLightingVertexOut {
     float4 position : SV_POSITION;
     float2 texcoord : TEXCOORD;
@@ -19,8 +35,55 @@ DeferredLightingVertexOut deferred_lighting_vert(uint id: SV_VERTEXID) {
     return output;
 }
 
+// getLightCluster of lightcluster.c
+uint getLightCluster(float3 viewPosition) {
+    float depth = -viewPosition.z;
+    float2 ndc = viewPosition.xy / (depth * clusterProjection.xy);
+    float3 cluster = float3(floor((ndc * 0.5 + 0.5) * clusterCounts.xy),
+                            floor(log(depth / clusterProjection.z) * clusterProjection.w));
+    cluster = clamp(cluster, float3(0, 0, 0), clusterCounts.xyz - 1);
+    return (uint)((cluster.z * clusterCounts.y + cluster.y) * clusterCounts.x + cluster.x);
+}
+
+// Windowed inverse square falloff, with a smooth cone for spot lights
+float3 shadeLight(uint light, float3 position, float3 normal) {
+    float4 positionRange = lights.Load(light * 4);
+    float4 color = lights.Load(light * 4 + 1);
+    float4 direction = lights.Load(light * 4 + 2);
+    float4 spot = lights.Load(light * 4 + 3);
+
+    float3 toLight = positionRange.xyz - position;
+    float distanceSquared = dot(toLight, toLight);
+    float rangeSquared = positionRange.w * positionRange.w;
+    if (distanceSquared >= rangeSquared || distanceSquared == 0) {
+        return float3(0, 0, 0);
+    }
+    float3 lightDirection = toLight * rsqrt(distanceSquared);
+    float nDotL = saturate(dot(normal, lightDirection));
+
+    float ratio = distanceSquared / rangeSquared;
+    float window = saturate(1 - ratio * ratio);
+    float attenuation = window * window / max(distanceSquared, 0.0001);
+    float cone = saturate(-dot(lightDirection, direction.xyz) * spot.x + spot.y);
+    return color.rgb * (nDotL * attenuation * cone * cone);
+}
+
 float4 deferred_lighting_frag(DeferredLightingVertexOut input) : SV_Target {
-    float2 texcoord = float2(input.texcoord.x, 1 - input.texcoord.y);
+    float2 texcoord = float2(input.texcoord.x, 1 - input.texcoord.y) * renderScale.xy;
     float3 normal = gbuffer1.Sample(gbufferSampler, texcoord).xyz;
-    return float4((normal + float3(1, 1, 1)) * 0.5, 1);
-}
\ No newline at end of file
+    // Nothing was drawn here
+    if (dot(normal, normal) == 0) {
+        return float4(0, 0, 0, 1);
+    }
+    normal = normalize(normal);
+    float3 baseColor = gbuffer0.Sample(gbufferSampler, texcoord).rgb;
+    float3 position = gbuffer2.Sample(gbufferSampler, texcoord).xyz;
+
+    float3 viewPosition = mul(float4(position, 1), viewMat).xyz;
+    uint2 range = clusterRanges.Load(getLightCluster(viewPosition));
+    float3 light = ambientColor.rgb;
+    for (uint i = 0; i < range.y; ++i) {
+        light += shadeLight(lightIndices.Load(range.x + i), position, normal);
+    }
+    return float4(baseColor * light, 1);
+}
@@ -1,15 +1,18 @@
 #include "common.hlsli"
 
-VertexOut gbuffer_vert(VertexIn input) {
+VertexOut gbuffer_vert(VertexIn input, InstanceIn instance) {
   VertexOut output;
+  float4x4 modelMat = float4x4(instance.modelMat0, instance.modelMat1,
+                               instance.modelMat2, instance.modelMat3);
+  float4x4 normalMat = float4x4(instance.normalMat0, instance.normalMat1,
+                                instance.normalMat2, instance.normalMat3);
   float4x4 mvp = mul(modelMat, mul(viewMat, projMat));
   
   output.position = mul(float4(input.position.xyz, 1), mvp);
   output.color = input.color;
   output.texcoord = input.texcoord;
-  // float3x3 normalMat33 = (float3x3)normalMat;
-  // output.normal = mul(input.normal, normalMat33);
-  output.normal = input.normal;
+  float3x3 normalMat33 = (float3x3)normalMat;
+  output.normal = mul(input.normal, normalMat33);
   output.positionWorld = mul(float4(input.position.xyz, 1), modelMat);
 
   return output;
@@ -1,12 +1,71 @@
 #version 330
 
+layout(std140) uniform type_ViewData
+{
+    mat4 viewMat;
+    mat4 projMat;
+} ViewData;
+
+layout(std140) uniform type_LightingData
+{
+    vec4 clusterProjection;
+    vec4 clusterCounts;
+    vec4 ambientColor;
+    vec4 renderScale;
+} LightingData;
+
+uniform sampler2D SPIRV_Cross_Combinedgbuffer0gbufferSampler;
 uniform sampler2D SPIRV_Cross_Combinedgbuffer1gbufferSampler;
+uniform sampler2D SPIRV_Cross_Combinedgbuffer2gbufferSampler;
+uniform samplerBuffer SPIRV_Cross_CombinedlightsSPIRV_Cross_DummySampler;
+uniform usamplerBuffer SPIRV_Cross_CombinedclusterRangesSPIRV_Cross_DummySampler;
+uniform usamplerBuffer SPIRV_Cross_CombinedlightIndicesSPIRV_Cross_DummySampler;
 
 in vec2 VertexOut0;
 layout(location = 0) out vec4 out_var_SV_Target;
 
+vec3 shadeLight(uint light, vec3 position, vec3 normal)
+{
+    int _base = int(light * 4u);
+    vec4 _positionRange = texelFetch(SPIRV_Cross_CombinedlightsSPIRV_Cross_DummySampler, _base);
+    vec4 _color = texelFetch(SPIRV_Cross_CombinedlightsSPIRV_Cross_DummySampler, _base + 1);
+    vec4 _direction = texelFetch(SPIRV_Cross_CombinedlightsSPIRV_Cross_DummySampler, _base + 2);
+    vec4 _spot = texelFetch(SPIRV_Cross_CombinedlightsSPIRV_Cross_DummySampler, _base + 3);
+    vec3 _toLight = _positionRange.xyz - position;
+    float _distanceSquared = dot(_toLight, _toLight);
+    float _rangeSquared = _positionRange.w * _positionRange.w;
+    if ((_distanceSquared >= _rangeSquared) || (_distanceSquared == 0.0))
+    {
+        return vec3(0.0);
+    }
+    vec3 _lightDirection = _toLight * inversesqrt(_distanceSquared);
+    float _ratio = _distanceSquared / _rangeSquared;
+    float _window = clamp(1.0 - (_ratio * _ratio), 0.0, 1.0);
+    float _cone = clamp((-dot(_lightDirection, _direction.xyz) * _spot.x) + _spot.y, 0.0, 1.0);
+    return _color.xyz * (((clamp(dot(normal, _lightDirection), 0.0, 1.0) * ((_window * _window) / max(_distanceSquared, 9.9999997473787516355514526367188e-05))) * _cone) * _cone);
+}
+
 void main()
 {
-    out_var_SV_Target = vec4((texture(SPIRV_Cross_Combinedgbuffer1gbufferSampler, vec2(VertexOut0.x, 1.0 - VertexOut0.y)).xyz + vec3(1.0)) * 0.5, 1.0);
+    vec2 _texcoord = vec2(VertexOut0.x, 1.0 - VertexOut0.y) * LightingData.renderScale.xy;
+    vec3 _normal = texture(SPIRV_Cross_Combinedgbuffer1gbufferSampler, _texcoord).xyz;
+    if (dot(_normal, _normal) == 0.0)
+    {
+        out_var_SV_Target = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+    vec3 _normalized = normalize(_normal);
+    vec3 _position = texture(SPIRV_Cross_Combinedgbuffer2gbufferSampler, _texcoord).xyz;
+    vec3 _viewPosition = (ViewData.viewMat * vec4(_position, 1.0)).xyz;
+    float _depth = -_viewPosition.z;
+    vec2 _ndc = _viewPosition.xy / (LightingData.clusterProjection.xy * _depth);
+    vec3 _cluster = clamp(vec3(floor(((_ndc * 0.5) + vec2(0.5)) * LightingData.clusterCounts.xy), floor(log(_depth / LightingData.clusterProjection.z) * LightingData.clusterProjection.w)), vec3(0.0), LightingData.clusterCounts.xyz - vec3(1.0));
+    uvec2 _range = texelFetch(SPIRV_Cross_CombinedclusterRangesSPIRV_Cross_DummySampler, int(uint((((_cluster.z * LightingData.clusterCounts.y) + _cluster.y) * LightingData.clusterCounts.x) + _cluster.x))).xy;
+    vec3 _light = LightingData.ambientColor.xyz;
+    for (uint _i = 0u; _i < _range.y; _i++)
+    {
+        _light += shadeLight(texelFetch(SPIRV_Cross_CombinedlightIndicesSPIRV_Cross_DummySampler, int(_range.x + _i)).x, _position, _normalized);
+    }
+    out_var_SV_Target = vec4(texture(SPIRV_Cross_Combinedgbuffer0gbufferSampler, _texcoord).xyz * _light, 1.0);
 }
 
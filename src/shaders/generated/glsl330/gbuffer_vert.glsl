@@ -6,16 +6,18 @@ layout(std140) uniform type_ViewData
     mat4 projMat;
 } ViewData;
 
-layout(std140) uniform type_DrawData
-{
-    mat4 modelMat;
-    mat4 normalMat;
-} DrawData;
-
 layout(location = 0) in vec3 in_var_POSITION;
 layout(location = 1) in vec4 in_var_COLOR;
 layout(location = 2) in vec2 in_var_TEXCOORD;
 layout(location = 3) in vec3 in_var_NORMAL;
+layout(location = 4) in vec4 in_var_INSTANCE_MODEL0;
+layout(location = 5) in vec4 in_var_INSTANCE_MODEL1;
+layout(location = 6) in vec4 in_var_INSTANCE_MODEL2;
+layout(location = 7) in vec4 in_var_INSTANCE_MODEL3;
+layout(location = 8) in vec4 in_var_INSTANCE_NORMAL0;
+layout(location = 9) in vec4 in_var_INSTANCE_NORMAL1;
+layout(location = 10) in vec4 in_var_INSTANCE_NORMAL2;
+layout(location = 11) in vec4 in_var_INSTANCE_NORMAL3;
 out vec4 VertexOut0;
 out vec2 VertexOut1;
 out vec3 VertexOut2;
@@ -23,11 +25,13 @@ out vec4 VertexOut3;
 
 void main()
 {
-    vec4 _51 = vec4(in_var_POSITION, 1.0);
-    gl_Position = ((ViewData.projMat * ViewData.viewMat) * DrawData.modelMat) * _51;
+    mat4 _67 = mat4(in_var_INSTANCE_MODEL0, in_var_INSTANCE_MODEL1, in_var_INSTANCE_MODEL2, in_var_INSTANCE_MODEL3);
+    mat4 _72 = mat4(in_var_INSTANCE_NORMAL0, in_var_INSTANCE_NORMAL1, in_var_INSTANCE_NORMAL2, in_var_INSTANCE_NORMAL3);
+    vec4 _80 = vec4(in_var_POSITION, 1.0);
+    gl_Position = ((ViewData.projMat * ViewData.viewMat) * _67) * _80;
     VertexOut0 = in_var_COLOR;
     VertexOut1 = in_var_TEXCOORD;
-    VertexOut2 = in_var_NORMAL;
-    VertexOut3 = DrawData.modelMat * _51;
+    VertexOut2 = mat3(_72[0].xyz, _72[1].xyz, _72[2].xyz) * in_var_NORMAL;
+    VertexOut3 = _67 * _80;
 }
 
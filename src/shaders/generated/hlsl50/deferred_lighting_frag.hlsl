@@ -1,5 +1,24 @@
-Texture2D<float4> gbuffer1 : register(t0);
+cbuffer type_ViewData : register(b0)
+{
+    row_major float4x4 ViewData_viewMat : packoffset(c0);
+    row_major float4x4 ViewData_projMat : packoffset(c4);
+};
+
+cbuffer type_LightingData : register(b3)
+{
+    float4 LightingData_clusterProjection : packoffset(c0);
+    float4 LightingData_clusterCounts : packoffset(c1);
+    float4 LightingData_ambientColor : packoffset(c2);
+    float4 LightingData_renderScale : packoffset(c3);
+};
+
+Texture2D<float4> gbuffer0 : register(t0);
+Texture2D<float4> gbuffer1 : register(t1);
+Texture2D<float4> gbuffer2 : register(t2);
 SamplerState gbufferSampler : register(s0);
+Buffer<float4> lights : register(t3);
+Buffer<uint2> clusterRanges : register(t4);
+Buffer<uint> lightIndices : register(t5);
 
 static float2 in_var_TEXCOORD;
 static float4 out_var_SV_Target;
@@ -14,9 +33,49 @@ struct SPIRV_Cross_Output
     float4 out_var_SV_Target : SV_Target0;
 };
 
+float3 shadeLight(uint light, float3 position, float3 normal)
+{
+    int _base = int(light * 4u);
+    float4 _positionRange = lights.Load(_base);
+    float4 _color = lights.Load(_base + 1);
+    float4 _direction = lights.Load(_base + 2);
+    float4 _spot = lights.Load(_base + 3);
+    float3 _toLight = _positionRange.xyz - position;
+    float _distanceSquared = dot(_toLight, _toLight);
+    float _rangeSquared = _positionRange.w * _positionRange.w;
+    if ((_distanceSquared >= _rangeSquared) || (_distanceSquared == 0.0f))
+    {
+        return 0.0f.xxx;
+    }
+    float3 _lightDirection = _toLight * rsqrt(_distanceSquared);
+    float _ratio = _distanceSquared / _rangeSquared;
+    float _window = clamp(1.0f - (_ratio * _ratio), 0.0f, 1.0f);
+    float _cone = clamp((-dot(_lightDirection, _direction.xyz) * _spot.x) + _spot.y, 0.0f, 1.0f);
+    return _color.xyz * (((clamp(dot(normal, _lightDirection), 0.0f, 1.0f) * ((_window * _window) / max(_distanceSquared, 9.9999997473787516355514526367188e-05f))) * _cone) * _cone);
+}
+
 void frag_main()
 {
-    out_var_SV_Target = float4((gbuffer1.Sample(gbufferSampler, float2(in_var_TEXCOORD.x, 1.0f - in_var_TEXCOORD.y)).xyz + 1.0f.xxx) * 0.5f, 1.0f);
+    float2 _texcoord = float2(in_var_TEXCOORD.x, 1.0f - in_var_TEXCOORD.y) * LightingData_renderScale.xy;
+    float3 _normal = gbuffer1.Sample(gbufferSampler, _texcoord).xyz;
+    if (dot(_normal, _normal) == 0.0f)
+    {
+        out_var_SV_Target = float4(0.0f, 0.0f, 0.0f, 1.0f);
+        return;
+    }
+    float3 _normalized = normalize(_normal);
+    float3 _position = gbuffer2.Sample(gbufferSampler, _texcoord).xyz;
+    float3 _viewPosition = mul(float4(_position, 1.0f), ViewData_viewMat).xyz;
+    float _depth = -_viewPosition.z;
+    float2 _ndc = _viewPosition.xy / (LightingData_clusterProjection.xy * _depth);
+    float3 _cluster = clamp(float3(floor(((_ndc * 0.5f) + 0.5f.xx) * LightingData_clusterCounts.xy), floor(log(_depth / LightingData_clusterProjection.z) * LightingData_clusterProjection.w)), 0.0f.xxx, LightingData_clusterCounts.xyz - 1.0f.xxx);
+    uint2 _range = clusterRanges.Load(int(uint((((_cluster.z * LightingData_clusterCounts.y) + _cluster.y) * LightingData_clusterCounts.x) + _cluster.x))).xy;
+    float3 _light = LightingData_ambientColor.xyz;
+    for (uint _i = 0u; _i < _range.y; _i++)
+    {
+        _light += shadeLight(lightIndices.Load(int(_range.x + _i)).x, _position, _normalized);
+    }
+    out_var_SV_Target = float4(gbuffer0.Sample(gbufferSampler, _texcoord).xyz * _light, 1.0f);
 }
 
 SPIRV_Cross_Output main(SPIRV_Cross_Input stage_input)
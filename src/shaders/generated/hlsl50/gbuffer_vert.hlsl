@@ -4,18 +4,20 @@ cbuffer type_ViewData : register(b0)
     row_major float4x4 ViewData_projMat : packoffset(c4);
 };
 
-cbuffer type_DrawData : register(b2)
-{
-    row_major float4x4 DrawData_modelMat : packoffset(c0);
-    row_major float4x4 DrawData_normalMat : packoffset(c4);
-};
-
 
 static float4 gl_Position;
 static float3 in_var_POSITION;
 static float4 in_var_COLOR;
 static float2 in_var_TEXCOORD;
 static float3 in_var_NORMAL;
+static float4 in_var_INSTANCE_MODEL0;
+static float4 in_var_INSTANCE_MODEL1;
+static float4 in_var_INSTANCE_MODEL2;
+static float4 in_var_INSTANCE_MODEL3;
+static float4 in_var_INSTANCE_NORMAL0;
+static float4 in_var_INSTANCE_NORMAL1;
+static float4 in_var_INSTANCE_NORMAL2;
+static float4 in_var_INSTANCE_NORMAL3;
 static float4 out_var_COLOR;
 static float2 out_var_TEXCOORD0;
 static float3 out_var_NORMAL;
@@ -27,6 +29,14 @@ struct SPIRV_Cross_Input
     float4 in_var_COLOR : TEXCOORD1;
     float2 in_var_TEXCOORD : TEXCOORD2;
     float3 in_var_NORMAL : TEXCOORD3;
+    float4 in_var_INSTANCE_MODEL0 : TEXCOORD4;
+    float4 in_var_INSTANCE_MODEL1 : TEXCOORD5;
+    float4 in_var_INSTANCE_MODEL2 : TEXCOORD6;
+    float4 in_var_INSTANCE_MODEL3 : TEXCOORD7;
+    float4 in_var_INSTANCE_NORMAL0 : TEXCOORD8;
+    float4 in_var_INSTANCE_NORMAL1 : TEXCOORD9;
+    float4 in_var_INSTANCE_NORMAL2 : TEXCOORD10;
+    float4 in_var_INSTANCE_NORMAL3 : TEXCOORD11;
 };
 
 struct SPIRV_Cross_Output
@@ -40,12 +50,14 @@ struct SPIRV_Cross_Output
 
 void vert_main()
 {
-    float4 _51 = float4(in_var_POSITION, 1.0f);
-    gl_Position = mul(_51, mul(DrawData_modelMat, mul(ViewData_viewMat, ViewData_projMat)));
+    float4x4 _67 = float4x4(in_var_INSTANCE_MODEL0, in_var_INSTANCE_MODEL1, in_var_INSTANCE_MODEL2, in_var_INSTANCE_MODEL3);
+    float4x4 _72 = float4x4(in_var_INSTANCE_NORMAL0, in_var_INSTANCE_NORMAL1, in_var_INSTANCE_NORMAL2, in_var_INSTANCE_NORMAL3);
+    float4 _80 = float4(in_var_POSITION, 1.0f);
+    gl_Position = mul(_80, mul(_67, mul(ViewData_viewMat, ViewData_projMat)));
     out_var_COLOR = in_var_COLOR;
     out_var_TEXCOORD0 = in_var_TEXCOORD;
-    out_var_NORMAL = in_var_NORMAL;
-    out_var_TEXCOORD1 = mul(_51, DrawData_modelMat);
+    out_var_NORMAL = mul(in_var_NORMAL, float3x3(_72[0].xyz, _72[1].xyz, _72[2].xyz));
+    out_var_TEXCOORD1 = mul(_80, _67);
 }
 
 SPIRV_Cross_Output main(SPIRV_Cross_Input stage_input)
@@ -54,6 +66,14 @@ SPIRV_Cross_Output main(SPIRV_Cross_Input stage_input)
     in_var_COLOR = stage_input.in_var_COLOR;
     in_var_TEXCOORD = stage_input.in_var_TEXCOORD;
     in_var_NORMAL = stage_input.in_var_NORMAL;
+    in_var_INSTANCE_MODEL0 = stage_input.in_var_INSTANCE_MODEL0;
+    in_var_INSTANCE_MODEL1 = stage_input.in_var_INSTANCE_MODEL1;
+    in_var_INSTANCE_MODEL2 = stage_input.in_var_INSTANCE_MODEL2;
+    in_var_INSTANCE_MODEL3 = stage_input.in_var_INSTANCE_MODEL3;
+    in_var_INSTANCE_NORMAL0 = stage_input.in_var_INSTANCE_NORMAL0;
+    in_var_INSTANCE_NORMAL1 = stage_input.in_var_INSTANCE_NORMAL1;
+    in_var_INSTANCE_NORMAL2 = stage_input.in_var_INSTANCE_NORMAL2;
+    in_var_INSTANCE_NORMAL3 = stage_input.in_var_INSTANCE_NORMAL3;
     vert_main();
     SPIRV_Cross_Output stage_output;
     stage_output.gl_Position = gl_Position;
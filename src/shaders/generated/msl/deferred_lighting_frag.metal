@@ -3,6 +3,20 @@
 
 using namespace metal;
 
+struct type_ViewData
+{
+    float4x4 viewMat;
+    float4x4 projMat;
+};
+
+struct type_LightingData
+{
+    float4 clusterProjection;
+    float4 clusterCounts;
+    float4 ambientColor;
+    float4 renderScale;
+};
+
 struct deferred_lighting_frag_out
 {
     float4 out_var_SV_Target [[color(0)]];
@@ -13,10 +27,52 @@ struct deferred_lighting_frag_in
     float2 in_var_TEXCOORD [[user(locn0)]];
 };
 
-fragment deferred_lighting_frag_out deferred_lighting_frag(deferred_lighting_frag_in in [[stage_in]], texture2d<float> gbuffer1 [[texture(0)]], sampler gbufferSampler [[sampler(0)]])
+static inline __attribute__((always_inline))
+float3 shadeLight(thread const uint& light, thread const float3& position, thread const float3& normal, texture_buffer<float> lights)
+{
+    uint _base = light * 4u;
+    float4 _positionRange = lights.read(_base);
+    float4 _color = lights.read(_base + 1u);
+    float4 _direction = lights.read(_base + 2u);
+    float4 _spot = lights.read(_base + 3u);
+    float3 _toLight = _positionRange.xyz - position;
+    float _distanceSquared = dot(_toLight, _toLight);
+    float _rangeSquared = _positionRange.w * _positionRange.w;
+    if ((_distanceSquared >= _rangeSquared) || (_distanceSquared == 0.0))
+    {
+        return float3(0.0);
+    }
+    float3 _lightDirection = _toLight * rsqrt(_distanceSquared);
+    float _ratio = _distanceSquared / _rangeSquared;
+    float _window = fast::clamp(1.0 - (_ratio * _ratio), 0.0, 1.0);
+    float _cone = fast::clamp((-dot(_lightDirection, _direction.xyz) * _spot.x) + _spot.y, 0.0, 1.0);
+    return _color.xyz * (((fast::clamp(dot(normal, _lightDirection), 0.0, 1.0) * ((_window * _window) / fast::max(_distanceSquared, 9.9999997473787516355514526367188e-05))) * _cone) * _cone);
+}
+
+fragment deferred_lighting_frag_out deferred_lighting_frag(deferred_lighting_frag_in in [[stage_in]], constant type_ViewData& ViewData [[buffer(0)]], constant type_LightingData& LightingData [[buffer(1)]], texture2d<float> gbuffer0 [[texture(0)]], texture2d<float> gbuffer1 [[texture(1)]], texture2d<float> gbuffer2 [[texture(2)]], texture_buffer<float> lights [[texture(3)]], texture_buffer<uint> clusterRanges [[texture(4)]], texture_buffer<uint> lightIndices [[texture(5)]], sampler gbufferSampler [[sampler(0)]])
 {
     deferred_lighting_frag_out out = {};
-    out.out_var_SV_Target = float4((gbuffer1.sample(gbufferSampler, float2(in.in_var_TEXCOORD.x, 1.0 - in.in_var_TEXCOORD.y)).xyz + float3(1.0)) * 0.5, 1.0);
+    float2 _texcoord = float2(in.in_var_TEXCOORD.x, 1.0 - in.in_var_TEXCOORD.y) * LightingData.renderScale.xy;
+    float3 _normal = gbuffer1.sample(gbufferSampler, _texcoord).xyz;
+    if (dot(_normal, _normal) == 0.0)
+    {
+        out.out_var_SV_Target = float4(0.0, 0.0, 0.0, 1.0);
+        return out;
+    }
+    float3 _normalized = fast::normalize(_normal);
+    float3 _position = gbuffer2.sample(gbufferSampler, _texcoord).xyz;
+    float3 _viewPosition = (ViewData.viewMat * float4(_position, 1.0)).xyz;
+    float _depth = -_viewPosition.z;
+    float2 _ndc = _viewPosition.xy / (LightingData.clusterProjection.xy * _depth);
+    float3 _cluster = fast::clamp(float3(floor(((_ndc * 0.5) + float2(0.5)) * LightingData.clusterCounts.xy), floor(log(_depth / LightingData.clusterProjection.z) * LightingData.clusterProjection.w)), float3(0.0), LightingData.clusterCounts.xyz - float3(1.0));
+    uint2 _range = clusterRanges.read(uint((((_cluster.z * LightingData.clusterCounts.y) + _cluster.y) * LightingData.clusterCounts.x) + _cluster.x)).xy;
+    float3 _light = LightingData.ambientColor.xyz;
+    for (uint _i = 0u; _i < _range.y; _i++)
+    {
+        uint _index = lightIndices.read(_range.x + _i).x;
+        _light += shadeLight(_index, _position, _normalized, lights);
+    }
+    out.out_var_SV_Target = float4(gbuffer0.sample(gbufferSampler, _texcoord).xyz * _light, 1.0);
     return out;
 }
 
@@ -9,12 +9,6 @@ struct type_ViewData
     float4x4 projMat;
 };
 
-struct type_DrawData
-{
-    float4x4 modelMat;
-    float4x4 normalMat;
-};
-
 struct gbuffer_vert_out
 {
     float4 out_var_COLOR [[user(locn0)]];
@@ -30,17 +24,27 @@ struct gbuffer_vert_in
     float4 in_var_COLOR [[attribute(1)]];
     float2 in_var_TEXCOORD [[attribute(2)]];
     float3 in_var_NORMAL [[attribute(3)]];
+    float4 in_var_INSTANCE_MODEL0 [[attribute(4)]];
+    float4 in_var_INSTANCE_MODEL1 [[attribute(5)]];
+    float4 in_var_INSTANCE_MODEL2 [[attribute(6)]];
+    float4 in_var_INSTANCE_MODEL3 [[attribute(7)]];
+    float4 in_var_INSTANCE_NORMAL0 [[attribute(8)]];
+    float4 in_var_INSTANCE_NORMAL1 [[attribute(9)]];
+    float4 in_var_INSTANCE_NORMAL2 [[attribute(10)]];
+    float4 in_var_INSTANCE_NORMAL3 [[attribute(11)]];
 };
 
-vertex gbuffer_vert_out gbuffer_vert(gbuffer_vert_in in [[stage_in]], constant type_ViewData& ViewData [[buffer(0)]], constant type_DrawData& DrawData [[buffer(1)]])
+vertex gbuffer_vert_out gbuffer_vert(gbuffer_vert_in in [[stage_in]], constant type_ViewData& ViewData [[buffer(0)]])
 {
     gbuffer_vert_out out = {};
-    float4 _51 = float4(in.in_var_POSITION, 1.0);
-    out.gl_Position = ((ViewData.projMat * ViewData.viewMat) * DrawData.modelMat) * _51;
+    float4x4 _67 = float4x4(in.in_var_INSTANCE_MODEL0, in.in_var_INSTANCE_MODEL1, in.in_var_INSTANCE_MODEL2, in.in_var_INSTANCE_MODEL3);
+    float4x4 _72 = float4x4(in.in_var_INSTANCE_NORMAL0, in.in_var_INSTANCE_NORMAL1, in.in_var_INSTANCE_NORMAL2, in.in_var_INSTANCE_NORMAL3);
+    float4 _80 = float4(in.in_var_POSITION, 1.0);
+    out.gl_Position = ((ViewData.projMat * ViewData.viewMat) * _67) * _80;
     out.out_var_COLOR = in.in_var_COLOR;
     out.out_var_TEXCOORD0 = in.in_var_TEXCOORD;
-    out.out_var_NORMAL = in.in_var_NORMAL;
-    out.out_var_TEXCOORD1 = DrawData.modelMat * _51;
+    out.out_var_NORMAL = float3x3(_72[0].xyz, _72[1].xyz, _72[2].xyz) * in.in_var_NORMAL;
+    out.out_var_TEXCOORD1 = _67 * _80;
     return out;
 }
 
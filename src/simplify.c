@@ -0,0 +1,291 @@
+#include "simplify.h"
+#include "memory.h"
+#include "vmath.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _Quadric {
+  float a00, a01, a02, a11, a12, a22;
+  float b0, b1, b2;
+  float c;
+  float weight;
+} Quadric;
+
+typedef struct _EdgeCollapse {
+  uint32_t from;
+  uint32_t to;
+  float cost;
+} EdgeCollapse;
+
+static Float3 readSimplifyPosition(const float *positions, int positionStride,
+                                   uint32_t index) {
+  const float *p =
+      (const float *)((const uint8_t *)positions + positionStride * index);
+  Float3 position = {p[0], p[1], p[2]};
+  return position;
+}
+
+static void quadricAdd(Quadric *q, const Quadric *other) {
+  q->a00 += other->a00;
+  q->a01 += other->a01;
+  q->a02 += other->a02;
+  q->a11 += other->a11;
+  q->a12 += other->a12;
+  q->a22 += other->a22;
+  q->b0 += other->b0;
+  q->b1 += other->b1;
+  q->b2 += other->b2;
+  q->c += other->c;
+  q->weight += other->weight;
+}
+
+static Quadric quadricFromPlane(Float3 n, float d, float weight) {
+  Quadric q = {
+      .a00 = n.x * n.x * weight,
+      .a01 = n.x * n.y * weight,
+      .a02 = n.x * n.z * weight,
+      .a11 = n.y * n.y * weight,
+      .a12 = n.y * n.z * weight,
+      .a22 = n.z * n.z * weight,
+      .b0 = n.x * d * weight,
+      .b1 = n.y * d * weight,
+      .b2 = n.z * d * weight,
+      .c = d * d * weight,
+      .weight = weight,
+  };
+  return q;
+}
+
+// Weighted mean squared distance from p to the planes accumulated in q
+static float quadricError(const Quadric *q, Float3 p) {
+  float rx = q->a00 * p.x + q->a01 * p.y + q->a02 * p.z + q->b0;
+  float ry = q->a01 * p.x + q->a11 * p.y + q->a12 * p.z + q->b1;
+  float rz = q->a02 * p.x + q->a12 * p.y + q->a22 * p.z + q->b2;
+  float error = rx * p.x + ry * p.y + rz * p.z + q->b0 * p.x + q->b1 * p.y +
+                q->b2 * p.z + q->c;
+  return q->weight > 0 ? fabsf(error) / q->weight : 0;
+}
+
+static int compareEdgeCollapses(const void *a, const void *b) {
+  float costA = ((const EdgeCollapse *)a)->cost;
+  float costB = ((const EdgeCollapse *)b)->cost;
+  return (costA > costB) - (costA < costB);
+}
+
+static uint64_t hashEdge(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  return key;
+}
+
+// Marks every vertex that has a half-edge without a twin. In index space this
+// catches both real borders and attribute seams.
+static void findOpenEdgeVertices(bool *outLocked, const uint32_t *indices,
+                                 int numIndices) {
+  int tableSize = 1;
+  while (tableSize < numIndices * 2) {
+    tableSize <<= 1;
+  }
+  uint64_t *table = MMALLOC_ARRAY(uint64_t, tableSize);
+  memset(table, 0xff, sizeof(uint64_t) * tableSize);
+
+  for (int i = 0; i < numIndices; ++i) {
+    uint32_t a = indices[i];
+    uint32_t b = indices[i - i % 3 + (i + 1) % 3];
+    uint64_t key = ((uint64_t)a << 32) | b;
+    uint64_t slot = hashEdge(key) & (tableSize - 1);
+    while (table[slot] != UINT64_MAX && table[slot] != key) {
+      slot = (slot + 1) & (tableSize - 1);
+    }
+    table[slot] = key;
+  }
+
+  for (int i = 0; i < numIndices; ++i) {
+    uint32_t a = indices[i];
+    uint32_t b = indices[i - i % 3 + (i + 1) % 3];
+    uint64_t twin = ((uint64_t)b << 32) | a;
+    uint64_t slot = hashEdge(twin) & (tableSize - 1);
+    while (table[slot] != UINT64_MAX && table[slot] != twin) {
+      slot = (slot + 1) & (tableSize - 1);
+    }
+    if (table[slot] != twin) {
+      outLocked[a] = true;
+      outLocked[b] = true;
+    }
+  }
+
+  MFREE(table);
+}
+
+static bool collapseFlipsTriangle(const uint32_t *indices,
+                                  const int *adjacencyOffsets,
+                                  const int *adjacency, const float *positions,
+                                  int positionStride, uint32_t from,
+                                  uint32_t to) {
+  Float3 target = readSimplifyPosition(positions, positionStride, to);
+
+  for (int a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; ++a) {
+    const uint32_t *tri = &indices[adjacency[a] * 3];
+    if (tri[0] == to || tri[1] == to || tri[2] == to) {
+      continue;
+    }
+
+    Float3 p[3];
+    Float3 moved[3];
+    for (int j = 0; j < 3; ++j) {
+      p[j] = readSimplifyPosition(positions, positionStride, tri[j]);
+      moved[j] = tri[j] == from ? target : p[j];
+    }
+    Float3 before = float3Cross(p[1] - p[0], p[2] - p[0]);
+    Float3 after = float3Cross(moved[1] - moved[0], moved[2] - moved[0]);
+    if (float3Dot(before, after) <= 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int simplifyMesh(uint32_t *destination, const uint32_t *indices,
+                 int numIndices, const float *positions, int positionStride,
+                 int numVertices, int targetNumIndices, float maxError,
+                 float *outError) {
+  memcpy(destination, indices, sizeof(uint32_t) * numIndices);
+
+  bool *locked = MMALLOC_ARRAY_ZEROES(bool, numVertices);
+  findOpenEdgeVertices(locked, indices, numIndices);
+
+  Quadric *quadrics = MMALLOC_ARRAY_ZEROES(Quadric, numVertices);
+  for (int i = 0; i < numIndices; i += 3) {
+    Float3 p0 = readSimplifyPosition(positions, positionStride, indices[i]);
+    Float3 p1 =
+        readSimplifyPosition(positions, positionStride, indices[i + 1]);
+    Float3 p2 =
+        readSimplifyPosition(positions, positionStride, indices[i + 2]);
+    Float3 n = float3Cross(p1 - p0, p2 - p0);
+    float area = float3Length(n);
+    if (area == 0) {
+      continue;
+    }
+    n /= area;
+    Quadric q = quadricFromPlane(n, -float3Dot(n, p0), area);
+    for (int j = 0; j < 3; ++j) {
+      quadricAdd(&quadrics[indices[i + j]], &q);
+    }
+  }
+
+  int *adjacencyOffsets = MMALLOC_ARRAY(int, numVertices + 1);
+  int *adjacency = MMALLOC_ARRAY(int, numIndices);
+  uint32_t *remap = MMALLOC_ARRAY(uint32_t, numVertices);
+  bool *touched = MMALLOC_ARRAY(bool, numVertices);
+  EdgeCollapse *collapses = MMALLOC_ARRAY(EdgeCollapse, numIndices);
+
+  float maxErrorSq = maxError * maxError;
+  float resultErrorSq = 0;
+  int count = numIndices;
+
+  while (count > targetNumIndices) {
+    memset(adjacencyOffsets, 0, sizeof(int) * (numVertices + 1));
+    for (int i = 0; i < count; ++i) {
+      ++adjacencyOffsets[destination[i] + 1];
+    }
+    for (int i = 0; i < numVertices; ++i) {
+      adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+      remap[i] = i;
+      touched[i] = false;
+    }
+    for (int i = 0; i < count; ++i) {
+      adjacency[adjacencyOffsets[destination[i]]++] = i / 3;
+    }
+    for (int i = numVertices; i > 0; --i) {
+      adjacencyOffsets[i] = adjacencyOffsets[i - 1];
+    }
+    adjacencyOffsets[0] = 0;
+
+    int numCollapses = 0;
+    for (int i = 0; i < count; ++i) {
+      uint32_t a = destination[i];
+      uint32_t b = destination[i - i % 3 + (i + 1) % 3];
+      Quadric q = quadrics[a];
+      quadricAdd(&q, &quadrics[b]);
+      float costAB = locked[a] ? INFINITY
+                               : quadricError(&q, readSimplifyPosition(
+                                                      positions,
+                                                      positionStride, b));
+      float costBA = locked[b] ? INFINITY
+                               : quadricError(&q, readSimplifyPosition(
+                                                      positions,
+                                                      positionStride, a));
+      if (costAB == INFINITY && costBA == INFINITY) {
+        continue;
+      }
+      collapses[numCollapses++] = costAB <= costBA
+                                      ? (EdgeCollapse){a, b, costAB}
+                                      : (EdgeCollapse){b, a, costBA};
+    }
+    qsort(collapses, numCollapses, sizeof(EdgeCollapse),
+          compareEdgeCollapses);
+
+    // Each collapse removes about two triangles
+    int collapseBudget = (count - targetNumIndices) / 6 + 1;
+    int numApplied = 0;
+    for (int i = 0; i < numCollapses && numApplied < collapseBudget; ++i) {
+      EdgeCollapse *collapse = &collapses[i];
+      if (collapse->cost > maxErrorSq) {
+        break;
+      }
+      if (touched[collapse->from] || touched[collapse->to]) {
+        continue;
+      }
+      if (collapseFlipsTriangle(destination, adjacencyOffsets, adjacency,
+                                positions, positionStride, collapse->from,
+                                collapse->to)) {
+        continue;
+      }
+
+      remap[collapse->from] = collapse->to;
+      quadricAdd(&quadrics[collapse->to], &quadrics[collapse->from]);
+      for (int a = adjacencyOffsets[collapse->from];
+           a < adjacencyOffsets[collapse->from + 1]; ++a) {
+        const uint32_t *tri = &destination[adjacency[a] * 3];
+        touched[tri[0]] = true;
+        touched[tri[1]] = true;
+        touched[tri[2]] = true;
+      }
+      resultErrorSq = MAX(resultErrorSq, collapse->cost);
+      ++numApplied;
+    }
+
+    if (numApplied == 0) {
+      break;
+    }
+
+    int newCount = 0;
+    for (int i = 0; i < count; i += 3) {
+      uint32_t a = remap[destination[i]];
+      uint32_t b = remap[destination[i + 1]];
+      uint32_t c = remap[destination[i + 2]];
+      if (a != b && b != c && c != a) {
+        destination[newCount++] = a;
+        destination[newCount++] = b;
+        destination[newCount++] = c;
+      }
+    }
+    count = newCount;
+  }
+
+  MFREE(collapses);
+  MFREE(touched);
+  MFREE(remap);
+  MFREE(adjacency);
+  MFREE(adjacencyOffsets);
+  MFREE(quadrics);
+  MFREE(locked);
+
+  if (outError) {
+    *outError = sqrtf(resultErrorSq);
+  }
+  return count;
+}
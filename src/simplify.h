@@ -0,0 +1,19 @@
+#pragma once
+#include "util.h"
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+// Quadric-error edge collapse that only ever moves a vertex onto one of its
+// neighbours, so the result indexes the same vertex buffer as the input.
+// Vertices on an open edge of the index topology are never moved. That covers
+// mesh borders as well as UV/normal seams, where the loader has split a
+// position into several vertices.
+// Writes at most numIndices indices to destination and returns the count.
+// outError receives the geometric error of the result in mesh units.
+int simplifyMesh(uint32_t *destination, const uint32_t *indices,
+                 int numIndices, const float *positions, int positionStride,
+                 int numVertices, int targetNumIndices, float maxError,
+                 float *outError);
+
+C_INTERFACE_END
@@ -0,0 +1,55 @@
+#include "skinning.h"
+#include "thread.h"
+#include <math.h>
+
+void skinVertexRange(const SkinningJob *job, int begin, int end) {
+  const uint8_t *src = (const uint8_t *)job->srcVertices;
+  uint8_t *dst = (uint8_t *)job->dstVertices;
+
+  for (int i = begin; i < end; ++i) {
+    const SkinVertex *skin = &job->skinVertices[i];
+    const Mat4 *m0 = &job->palette[skin->joints[0]];
+    const Mat4 *m1 = &job->palette[skin->joints[1]];
+    const Mat4 *m2 = &job->palette[skin->joints[2]];
+    const Mat4 *m3 = &job->palette[skin->joints[3]];
+    Float4 w = skin->weights;
+
+    // Blend the four joint matrices a column at a time
+    Float4 c0 = m0->cols[0] * w.x + m1->cols[0] * w.y + m2->cols[0] * w.z +
+                m3->cols[0] * w.w;
+    Float4 c1 = m0->cols[1] * w.x + m1->cols[1] * w.y + m2->cols[1] * w.z +
+                m3->cols[1] * w.w;
+    Float4 c2 = m0->cols[2] * w.x + m1->cols[2] * w.y + m2->cols[2] * w.z +
+                m3->cols[2] * w.w;
+    Float4 c3 = m0->cols[3] * w.x + m1->cols[3] * w.y + m2->cols[3] * w.z +
+                m3->cols[3] * w.w;
+
+    const uint8_t *srcVertex = src + (size_t)i * job->stride;
+    uint8_t *dstVertex = dst + (size_t)i * job->stride;
+    const Float3 *srcPosition =
+        (const Float3 *)(srcVertex + job->positionOffset);
+    const Float3 *srcNormal = (const Float3 *)(srcVertex + job->normalOffset);
+
+    Float3 p = *srcPosition;
+    Float3 n = *srcNormal;
+    Float4 position = c0 * p.x + c1 * p.y + c2 * p.z + c3;
+    Float4 normal = c0 * n.x + c1 * n.y + c2 * n.z;
+
+    float normalLengthSq = float3LengthSq(normal.xyz);
+    if (normalLengthSq > 0) {
+      normal *= 1.f / sqrtf(normalLengthSq);
+    }
+
+    *(Float3 *)(dstVertex + job->positionOffset) = position.xyz;
+    *(Float3 *)(dstVertex + job->normalOffset) = normal.xyz;
+  }
+}
+
+static void skinVertexRangeTask(void *data, int begin, int end) {
+  skinVertexRange((const SkinningJob *)data, begin, end);
+}
+
+void skinVertices(const SkinningJob *job, int numVertices) {
+  parallelFor(numVertices, SKINNING_GRAIN_SIZE, skinVertexRangeTask,
+              (void *)job);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "util.h"
+#include "vmath.h"
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+#define SKINNING_GRAIN_SIZE 1024
+
+typedef struct _SkinVertex {
+  Float4 weights;
+  uint16_t joints[4];
+} SkinVertex;
+
+// Positions and normals are Float3 fields at the given offsets of vertices
+// laid out with stride bytes. Source and destination share the layout, and
+// every other field of the destination is left untouched.
+typedef struct _SkinningJob {
+  const Mat4 *palette;
+  const SkinVertex *skinVertices;
+  const void *srcVertices;
+  void *dstVertices;
+  int stride;
+  int positionOffset;
+  int normalOffset;
+} SkinningJob;
+
+// Linear blend skinning of vertices [begin, end)
+void skinVertexRange(const SkinningJob *job, int begin, int end);
+
+// Splits the vertices across the thread pool in SKINNING_GRAIN_SIZE ranges
+void skinVertices(const SkinningJob *job, int numVertices);
+
+C_INTERFACE_END
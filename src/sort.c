@@ -0,0 +1,126 @@
+#include "sort.h"
+#include "memory.h"
+#include <string.h>
+
+#define RADIX_SORT_PASSES 8
+
+void radixSortItems(SortItem *items, SortItem *scratch, int count) {
+  // Histograms for every pass in one read over the keys
+  int histograms[RADIX_SORT_PASSES][256];
+  memset(histograms, 0, sizeof(histograms));
+  for (int i = 0; i < count; ++i) {
+    uint64_t key = items[i].key;
+    for (int pass = 0; pass < RADIX_SORT_PASSES; ++pass) {
+      ++histograms[pass][(key >> (pass * 8)) & 0xff];
+    }
+  }
+
+  SortItem *src = items;
+  SortItem *dst = scratch;
+  for (int pass = 0; pass < RADIX_SORT_PASSES; ++pass) {
+    int *histogram = histograms[pass];
+    if (count == 0 || histogram[(src[0].key >> (pass * 8)) & 0xff] == count) {
+      continue;
+    }
+
+    int offset = 0;
+    for (int i = 0; i < 256; ++i) {
+      int bucketCount = histogram[i];
+      histogram[i] = offset;
+      offset += bucketCount;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      int bucket = (src[i].key >> (pass * 8)) & 0xff;
+      dst[histogram[bucket]++] = src[i];
+    }
+
+    SortItem *temp = src;
+    src = dst;
+    dst = temp;
+  }
+
+  if (src != items) {
+    memcpy(items, src, sizeof(SortItem) * count);
+  }
+}
+
+#define RADIX_SORT_CHECK_COUNT 1000
+
+// Sorted by key, with equal keys in index order, and every item of input
+// once
+static bool isSortedStable(const SortItem *items, const SortItem *input,
+                           int count) {
+  bool result = true;
+  bool *seen = MMALLOC_ARRAY_ZEROES(bool, count);
+  for (int i = 0; i < count && result; ++i) {
+    uint32_t index = items[i].index;
+    result = index < (uint32_t)count && !seen[index] &&
+             items[i].key == input[index].key;
+    seen[index] = true;
+    if (i > 0) {
+      result = result && (items[i - 1].key < items[i].key ||
+                          (items[i - 1].key == items[i].key &&
+                           items[i - 1].index < index));
+    }
+  }
+  MFREE(seen);
+  return result;
+}
+
+// Sorts items, keeping a copy of them in input to check against
+static bool sortsStable(SortItem *items, SortItem *scratch, SortItem *input,
+                        int count) {
+  memcpy(input, items, sizeof(SortItem) * count);
+  radixSortItems(items, scratch, count);
+  return isSortedStable(items, input, count);
+}
+
+bool checkRadixSort(void) {
+  bool passed = true;
+  SortItem *items = MMALLOC_ARRAY(SortItem, RADIX_SORT_CHECK_COUNT);
+  SortItem *scratch = MMALLOC_ARRAY(SortItem, RADIX_SORT_CHECK_COUNT);
+  SortItem *input = MMALLOC_ARRAY(SortItem, RADIX_SORT_CHECK_COUNT);
+
+  // Few distinct keys spread over all bytes, so every pass runs and most
+  // keys repeat
+  uint64_t state = 1;
+  for (int i = 0; i < RADIX_SORT_CHECK_COUNT; ++i) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    uint64_t key = (state >> 61) * 0x0101010101010101ull;
+    items[i] = (SortItem){.key = key ^ ((state >> 62) << 56), .index = i};
+  }
+  CHECK(passed, sortsStable(items, scratch, input, RADIX_SORT_CHECK_COUNT));
+
+  // Only byte 3 differs, so one pass runs and leaves the result in scratch
+  for (int i = 0; i < RADIX_SORT_CHECK_COUNT; ++i) {
+    uint64_t byte = (uint64_t)((RADIX_SORT_CHECK_COUNT - i) % 7);
+    items[i] = (SortItem){.key = 0xaa000000bb000000ull | byte << 24,
+                          .index = i};
+  }
+  CHECK(passed, sortsStable(items, scratch, input, RADIX_SORT_CHECK_COUNT));
+
+  // Bytes 0 and 7 differ, two passes
+  for (int i = 0; i < RADIX_SORT_CHECK_COUNT; ++i) {
+    uint64_t low = (uint64_t)(i % 3);
+    uint64_t high = (uint64_t)(i % 5);
+    items[i] = (SortItem){.key = high << 56 | 0x1200 | low, .index = i};
+  }
+  CHECK(passed, sortsStable(items, scratch, input, RADIX_SORT_CHECK_COUNT));
+
+  // Every pass is skipped and the order stays
+  for (int i = 0; i < RADIX_SORT_CHECK_COUNT; ++i) {
+    items[i] = (SortItem){.key = 42, .index = i};
+  }
+  CHECK(passed, sortsStable(items, scratch, input, RADIX_SORT_CHECK_COUNT));
+
+  radixSortItems(items, scratch, 0);
+  radixSortItems(items, scratch, 1);
+  CHECK(passed, items[0].key == 42 && items[0].index == 0);
+
+  MFREE(input);
+  MFREE(scratch);
+  MFREE(items);
+  LOG("Radix sort: checks %s", passed ? "passed" : "failed");
+  return passed;
+}
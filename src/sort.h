@@ -0,0 +1,23 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+typedef struct _SortItem {
+  uint64_t key;
+  uint32_t index;
+} SortItem;
+
+// Stable LSD radix sort on the full 64-bit key, one byte per pass. Passes
+// where every key has the same byte are skipped. scratch must hold count
+// items; the sorted result always ends up in items.
+void radixSortItems(SortItem *items, SortItem *scratch, int count);
+
+// Sorts keys that differ in many, one, two or none of their bytes and checks
+// the order, that equal keys keep theirs and that the result is in items.
+// Logs every check that fails.
+bool checkRadixSort(void);
+
+C_INTERFACE_END
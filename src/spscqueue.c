@@ -0,0 +1,43 @@
+#include "spscqueue.h"
+#include "memory.h"
+#include <string.h>
+
+void initSpscQueue(SpscQueue *queue, int elementSize, int capacity) {
+  ASSERT(elementSize > 0 && capacity > 0 && (capacity & (capacity - 1)) == 0);
+  *queue = (SpscQueue){
+      .elementSize = elementSize,
+      .capacity = capacity,
+      .elements = MMALLOC_ARRAY(uint8_t, elementSize * capacity),
+  };
+}
+
+void destroySpscQueue(SpscQueue *queue) {
+  MFREE(queue->elements);
+  *queue = (SpscQueue){0};
+}
+
+bool pushSpscQueue(SpscQueue *queue, const void *element) {
+  uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+  uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+  if (tail - head == (uint32_t)queue->capacity) {
+    return false;
+  }
+  int index = (int)(tail & (uint32_t)(queue->capacity - 1));
+  memcpy(queue->elements + index * queue->elementSize, element,
+         queue->elementSize);
+  __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool popSpscQueue(SpscQueue *queue, void *outElement) {
+  uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+  uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return false;
+  }
+  int index = (int)(head & (uint32_t)(queue->capacity - 1));
+  memcpy(outElement, queue->elements + index * queue->elementSize,
+         queue->elementSize);
+  __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+// Bounded FIFO of fixed size elements between exactly one producer thread and
+// one consumer thread, without locks
+typedef struct _SpscQueue {
+  int elementSize;
+  // Power of two
+  int capacity;
+  uint8_t *elements;
+  // Counts of pushed and popped elements, only written by the producer and
+  // the consumer respectively. Kept on their own cache lines so the two
+  // sides don't keep stealing each other's line.
+  _Alignas(64) uint32_t tail;
+  _Alignas(64) uint32_t head;
+} SpscQueue;
+
+void initSpscQueue(SpscQueue *queue, int elementSize, int capacity);
+void destroySpscQueue(SpscQueue *queue);
+
+// Returns false when the queue is full
+bool pushSpscQueue(SpscQueue *queue, const void *element);
+// Returns false when the queue is empty
+bool popSpscQueue(SpscQueue *queue, void *outElement);
+
+C_INTERFACE_END
@@ -0,0 +1,229 @@
+#include "texturestream.h"
+#include "memory.h"
+#include <string.h>
+
+void initTextureStreamer(TextureStreamer *streamer, int64_t budget) {
+  ASSERT(budget >= 0);
+  *streamer = (TextureStreamer){
+      .budget = budget,
+      .stats = {.budget = budget},
+  };
+}
+
+void destroyTextureStreamer(TextureStreamer *streamer) {
+  MFREE(streamer->pendingScratch);
+  MFREE(streamer->pending);
+  MFREE(streamer->changes);
+  MFREE(streamer->textures);
+  *streamer = (TextureStreamer){0};
+}
+
+int addStreamedTexture(TextureStreamer *streamer, void *source, int width,
+                       int height, int numLevels, const int *levelSizes) {
+  ASSERT(source && numLevels > 0 && numLevels <= TEXTURE_STREAM_MAX_LEVELS);
+
+  int index = 0;
+  while (index < streamer->numTextures && streamer->textures[index].source) {
+    ++index;
+  }
+  if (index == streamer->textureCapacity) {
+    int capacity = MAX(streamer->textureCapacity * 2, 16);
+    StreamedTexture *textures = MMALLOC_ARRAY(StreamedTexture, capacity);
+    if (streamer->textures) {
+      memcpy(textures, streamer->textures,
+             sizeof(StreamedTexture) * streamer->numTextures);
+      MFREE(streamer->textures);
+    }
+    streamer->textures = textures;
+    MFREE(streamer->pendingScratch);
+    MFREE(streamer->pending);
+    streamer->pending = MMALLOC_ARRAY(SortItem, capacity);
+    streamer->pendingScratch = MMALLOC_ARRAY(SortItem, capacity);
+    streamer->textureCapacity = capacity;
+  }
+  if (index == streamer->numTextures) {
+    ++streamer->numTextures;
+  }
+
+  int coarseLevel = 0;
+  while (coarseLevel < numLevels - 1 &&
+         MAX(width >> coarseLevel, height >> coarseLevel) >
+             TEXTURE_STREAM_COARSE_SIZE) {
+    ++coarseLevel;
+  }
+
+  StreamedTexture *texture = &streamer->textures[index];
+  *texture = (StreamedTexture){
+      .source = source,
+      .width = width,
+      .height = height,
+      .numLevels = numLevels,
+      .coarseLevel = coarseLevel,
+      .residentLevel = coarseLevel,
+      .requestedLevel = coarseLevel,
+      .lastUsedFrame = streamer->frameIndex,
+  };
+  memcpy(texture->levelSizes, levelSizes, sizeof(int) * numLevels);
+  for (int i = coarseLevel; i < numLevels; ++i) {
+    streamer->stats.residentBytes += levelSizes[i];
+  }
+  ++streamer->stats.numTextures;
+  return index;
+}
+
+void removeStreamedTexture(TextureStreamer *streamer, int texture) {
+  StreamedTexture *t = &streamer->textures[texture];
+  ASSERT(t->source);
+  for (int i = t->residentLevel; i < t->numLevels; ++i) {
+    streamer->stats.residentBytes -= t->levelSizes[i];
+  }
+  *t = (StreamedTexture){0};
+  --streamer->stats.numTextures;
+  while (streamer->numTextures > 0 &&
+         !streamer->textures[streamer->numTextures - 1].source) {
+    --streamer->numTextures;
+  }
+}
+
+void requestTextureLevel(TextureStreamer *streamer, int texture, int level) {
+  StreamedTexture *t = &streamer->textures[texture];
+  t->requestedLevel = MIN(t->requestedLevel, MAX(level, 0));
+}
+
+static void pushTextureStreamChange(TextureStreamer *streamer, int texture,
+                                    int level, bool resident) {
+  if (streamer->numChanges == streamer->changeCapacity) {
+    int capacity = MAX(streamer->changeCapacity * 2, 16);
+    TextureStreamChange *changes = MMALLOC_ARRAY(TextureStreamChange, capacity);
+    if (streamer->changes) {
+      memcpy(changes, streamer->changes,
+             sizeof(TextureStreamChange) * streamer->numChanges);
+      MFREE(streamer->changes);
+    }
+    streamer->changes = changes;
+    streamer->changeCapacity = capacity;
+  }
+  streamer->changes[streamer->numChanges++] = (TextureStreamChange){
+      .texture = texture,
+      .level = level,
+      .resident = resident,
+  };
+}
+
+static void evictTextureLevel(TextureStreamer *streamer, int texture) {
+  StreamedTexture *t = &streamer->textures[texture];
+  ASSERT(t->residentLevel < t->coarseLevel);
+  pushTextureStreamChange(streamer, texture, t->residentLevel, false);
+  streamer->stats.residentBytes -= t->levelSizes[t->residentLevel];
+  ++streamer->stats.numEvicted;
+  ++t->residentLevel;
+}
+
+// Evicts the finest level of the least recently used texture that has a
+// finer level than it was asked for. With needed set, any streamed level can
+// go instead, largest first. Returns false when there's nothing to evict.
+static bool evictLevelForBudget(TextureStreamer *streamer, bool needed) {
+  int victim = -1;
+  int victimSize = 0;
+  int victimFrame = 0;
+  for (int i = 0; i < streamer->numTextures; ++i) {
+    const StreamedTexture *t = &streamer->textures[i];
+    if (!t->source || t->residentLevel >= t->coarseLevel) {
+      continue;
+    }
+    int size = t->levelSizes[t->residentLevel];
+    bool isBetter =
+        needed ? size > victimSize
+               : t->residentLevel < t->requestedLevel &&
+                     (victim < 0 || t->lastUsedFrame < victimFrame);
+    if (isBetter) {
+      victim = i;
+      victimSize = size;
+      victimFrame = t->lastUsedFrame;
+    }
+  }
+  if (victim < 0) {
+    return false;
+  }
+  evictTextureLevel(streamer, victim);
+  return true;
+}
+
+void updateTextureStreamer(TextureStreamer *streamer) {
+  TextureStreamStats *stats = &streamer->stats;
+  stats->budget = streamer->budget;
+  streamer->numChanges = 0;
+  ++streamer->frameIndex;
+
+  // Levels nobody asked for in a while go even with room to spare
+  for (int i = 0; i < streamer->numTextures; ++i) {
+    StreamedTexture *t = &streamer->textures[i];
+    if (!t->source) {
+      continue;
+    }
+    if (t->requestedLevel <= t->residentLevel) {
+      t->lastUsedFrame = streamer->frameIndex;
+    } else if (t->residentLevel < t->coarseLevel &&
+               streamer->frameIndex - t->lastUsedFrame >
+                   TEXTURE_STREAM_EVICT_FRAMES) {
+      evictTextureLevel(streamer, i);
+      t->lastUsedFrame = streamer->frameIndex;
+    }
+  }
+
+  // The budget may have shrunk
+  while (stats->residentBytes > streamer->budget &&
+         evictLevelForBudget(streamer, false)) {
+  }
+  while (stats->residentBytes > streamer->budget &&
+         evictLevelForBudget(streamer, true)) {
+  }
+
+  // Furthest from their requested level first, then in entry order
+  int numPending = 0;
+  for (int i = 0; i < streamer->numTextures; ++i) {
+    const StreamedTexture *t = &streamer->textures[i];
+    if (t->source && t->requestedLevel < t->residentLevel) {
+      int gap = t->residentLevel - t->requestedLevel;
+      streamer->pending[numPending++] = (SortItem){
+          .key = ((uint64_t)(TEXTURE_STREAM_MAX_LEVELS - gap) << 32) |
+                 (uint32_t)i,
+          .index = (uint32_t)i,
+      };
+    }
+  }
+  radixSortItems(streamer->pending, streamer->pendingScratch, numPending);
+
+  int uploadSize = 0;
+  for (int i = 0; i < numPending; ++i) {
+    int index = (int)streamer->pending[i].index;
+    StreamedTexture *t = &streamer->textures[index];
+    int level = t->residentLevel - 1;
+    int size = t->levelSizes[level];
+    if (uploadSize > 0 && uploadSize + size > TEXTURE_STREAM_MAX_UPLOAD_SIZE) {
+      break;
+    }
+    while (stats->residentBytes + size > streamer->budget &&
+           evictLevelForBudget(streamer, false)) {
+    }
+    if (stats->residentBytes + size > streamer->budget) {
+      continue;
+    }
+
+    pushTextureStreamChange(streamer, index, level, true);
+    stats->residentBytes += size;
+    ++stats->numStreamedIn;
+    uploadSize += size;
+    t->residentLevel = level;
+    t->lastUsedFrame = streamer->frameIndex;
+  }
+
+  stats->numPending = 0;
+  for (int i = 0; i < streamer->numTextures; ++i) {
+    StreamedTexture *t = &streamer->textures[i];
+    if (t->source && t->requestedLevel < t->residentLevel) {
+      ++stats->numPending;
+    }
+    t->requestedLevel = t->coarseLevel;
+  }
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "util.h"
+#include "sort.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+#define TEXTURE_STREAM_MAX_LEVELS 16
+// Levels this size and smaller are resident for as long as the texture is
+#define TEXTURE_STREAM_COARSE_SIZE 64
+#define TEXTURE_STREAM_DEFAULT_BUDGET (64 * 1024 * 1024)
+// Bytes streamed in per update, so a burst of requests is spread over
+// frames. A single level larger than this still goes in on its own.
+#define TEXTURE_STREAM_MAX_UPLOAD_SIZE (4 * 1024 * 1024)
+// Updates the finest level of a texture can go unused before it is evicted
+// without any pressure on the budget
+#define TEXTURE_STREAM_EVICT_FRAMES 120
+
+typedef struct _StreamedTexture {
+  // Owned by the backend, null for free entries
+  void *source;
+  int width;
+  int height;
+  int numLevels;
+  // Bytes of each level once resident
+  int levelSizes[TEXTURE_STREAM_MAX_LEVELS];
+  // Finest level that is always resident
+  int coarseLevel;
+  // Finest resident level, every coarser one is resident too
+  int residentLevel;
+  // Finest level asked for since the last update
+  int requestedLevel;
+  // Last update residentLevel was asked for
+  int lastUsedFrame;
+} StreamedTexture;
+
+// Made resident or evicted, in the order the backend has to apply them
+typedef struct _TextureStreamChange {
+  int texture;
+  int level;
+  bool resident;
+} TextureStreamChange;
+
+typedef struct _TextureStreamStats {
+  int64_t budget;
+  int64_t residentBytes;
+  int numTextures;
+  // Textures that want a finer level than the resident one
+  int numPending;
+  // Levels since the streamer was created
+  int numStreamedIn;
+  int numEvicted;
+} TextureStreamStats;
+
+// Keeps the mip levels of textures resident from the finest one their draws
+// need on, within a byte budget. Finer levels are streamed in a level per
+// texture per update, blurriest texture first, evicting the levels other
+// textures no longer need to make room. Requests that don't fit stay pending.
+typedef struct _TextureStreamer {
+  int64_t budget;
+  int numTextures;
+  int textureCapacity;
+  StreamedTexture *textures;
+  int numChanges;
+  int changeCapacity;
+  TextureStreamChange *changes;
+  SortItem *pending;
+  SortItem *pendingScratch;
+  int frameIndex;
+  TextureStreamStats stats;
+} TextureStreamer;
+
+void initTextureStreamer(TextureStreamer *streamer, int64_t budget);
+void destroyTextureStreamer(TextureStreamer *streamer);
+
+// Returns the entry of the texture, whose levels from coarseLevel on are
+// counted as resident right away. levelSizes holds numLevels sizes.
+int addStreamedTexture(TextureStreamer *streamer, void *source, int width,
+                       int height, int numLevels, const int *levelSizes);
+void removeStreamedTexture(TextureStreamer *streamer, int texture);
+
+// The finest level asked for since the last update is the one kept resident
+void requestTextureLevel(TextureStreamer *streamer, int texture, int level);
+
+// Turns the requests since the last update into changes, then starts
+// collecting the next ones
+void updateTextureStreamer(TextureStreamer *streamer);
+
+C_INTERFACE_END
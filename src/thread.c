@@ -0,0 +1,581 @@
+#include "thread.h"
+#include "app.h"
+#include "memory.h"
+#include "profiler.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#define THREAD_POOL_MAX_THREADS 64
+
+// Workload of logThreadPoolScaling
+#define THREAD_SCALING_ITEMS (1 << 16)
+#define THREAD_SCALING_ITEM_STEPS 256
+#define THREAD_SCALING_FINE_GRAIN 16
+#define THREAD_SCALING_RUNS 5
+
+#ifdef _WIN32
+typedef HANDLE ThreadHandle;
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE CondVar;
+#define THREAD_FUNC_RETURN DWORD WINAPI
+#else
+typedef pthread_t ThreadHandle;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+#define THREAD_FUNC_RETURN void *
+#endif
+
+// Chase-Lev deque: the owner pushes and pops at the bottom, other threads
+// steal from the top
+typedef struct _JobQueue {
+  _Alignas(64) int64_t top;
+  _Alignas(64) int64_t bottom;
+  Job *jobs[JOB_QUEUE_CAPACITY];
+} JobQueue;
+
+static struct {
+  int numThreads;
+  ThreadHandle threads[THREAD_POOL_MAX_THREADS];
+  // One per worker, then one per external thread in the order they first
+  // submit
+  JobQueue *queues;
+  int numExternalThreads;
+  // Bumped by initThreadPool so threads pick their queue again
+  int initCount;
+
+  Mutex mutex;
+  CondVar wakeCondVar;
+  // Jobs in any queue, and workers waiting for one to show up
+  int numQueuedJobs;
+  int numSleepingThreads;
+  bool quit;
+
+  int numJobs;
+  int numStolenJobs;
+} gThreadPool;
+
+static _Thread_local int tQueueIndex = -1;
+static _Thread_local int tQueueInitCount;
+static _Thread_local uint32_t tStealState;
+
+struct _Thread {
+  ThreadHandle handle;
+  ThreadFunc func;
+  void *data;
+};
+
+static void initMutex(Mutex *mutex) {
+#ifdef _WIN32
+  InitializeSRWLock(mutex);
+#else
+  pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static void destroyMutex(UNUSED Mutex *mutex) {
+#ifndef _WIN32
+  pthread_mutex_destroy(mutex);
+#endif
+}
+
+static void lockMutex(Mutex *mutex) {
+#ifdef _WIN32
+  AcquireSRWLockExclusive(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+static void unlockMutex(Mutex *mutex) {
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+static void initCondVar(CondVar *condVar) {
+#ifdef _WIN32
+  InitializeConditionVariable(condVar);
+#else
+  pthread_cond_init(condVar, NULL);
+#endif
+}
+
+static void destroyCondVar(UNUSED CondVar *condVar) {
+#ifndef _WIN32
+  pthread_cond_destroy(condVar);
+#endif
+}
+
+static void waitCondVar(CondVar *condVar, Mutex *mutex) {
+#ifdef _WIN32
+  SleepConditionVariableSRW(condVar, mutex, INFINITE, 0);
+#else
+  pthread_cond_wait(condVar, mutex);
+#endif
+}
+
+static void wakeAllCondVar(CondVar *condVar) {
+#ifdef _WIN32
+  WakeAllConditionVariable(condVar);
+#else
+  pthread_cond_broadcast(condVar);
+#endif
+}
+
+int getNumCpuCores(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  int result = (int)info.dwNumberOfProcessors;
+#else
+  int result = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return MAX(result, 1);
+}
+
+static void wakeOneCondVar(CondVar *condVar) {
+#ifdef _WIN32
+  WakeConditionVariable(condVar);
+#else
+  pthread_cond_signal(condVar);
+#endif
+}
+
+static bool pushJobQueue(JobQueue *queue, Job *job) {
+  int64_t bottom = __atomic_load_n(&queue->bottom, __ATOMIC_RELAXED);
+  int64_t top = __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+  if (bottom - top >= JOB_QUEUE_CAPACITY) {
+    return false;
+  }
+  __atomic_store_n(&queue->jobs[bottom & (JOB_QUEUE_CAPACITY - 1)], job,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&queue->bottom, bottom + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static Job *popJobQueue(JobQueue *queue) {
+  int64_t bottom = __atomic_load_n(&queue->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&queue->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t top = __atomic_load_n(&queue->top, __ATOMIC_RELAXED);
+  if (top > bottom) {
+    __atomic_store_n(&queue->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  Job *job = __atomic_load_n(&queue->jobs[bottom & (JOB_QUEUE_CAPACITY - 1)],
+                             __ATOMIC_RELAXED);
+  if (top == bottom) {
+    // The last job, which a thief may be taking as well
+    if (!__atomic_compare_exchange_n(&queue->top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      job = NULL;
+    }
+    __atomic_store_n(&queue->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+  return job;
+}
+
+static Job *stealJobQueue(JobQueue *queue) {
+  int64_t top = __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t bottom = __atomic_load_n(&queue->bottom, __ATOMIC_ACQUIRE);
+  if (top >= bottom) {
+    return NULL;
+  }
+  Job *job = __atomic_load_n(&queue->jobs[top & (JOB_QUEUE_CAPACITY - 1)],
+                             __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&queue->top, &top, top + 1, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  return job;
+}
+
+// Queue of the calling thread. External threads get one the first time.
+static int getQueueIndex(void) {
+  if (tQueueIndex < 0 || tQueueInitCount != gThreadPool.initCount) {
+    int index = __atomic_fetch_add(&gThreadPool.numExternalThreads, 1,
+                                   __ATOMIC_ACQ_REL);
+    ASSERT(index < JOB_MAX_EXTERNAL_THREADS);
+    tQueueIndex = gThreadPool.numThreads + index;
+    tQueueInitCount = gThreadPool.initCount;
+    tStealState = 0x9E3779B9u * (uint32_t)(tQueueIndex + 1);
+  }
+  return tQueueIndex;
+}
+
+static void runJob(Job *job);
+
+static void pushJob(Job *job) {
+  JobQueue *queue = &gThreadPool.queues[getQueueIndex()];
+  if (!pushJobQueue(queue, job)) {
+    runJob(job);
+    return;
+  }
+  __atomic_fetch_add(&gThreadPool.numQueuedJobs, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&gThreadPool.numSleepingThreads, __ATOMIC_SEQ_CST) > 0) {
+    lockMutex(&gThreadPool.mutex);
+    wakeOneCondVar(&gThreadPool.wakeCondVar);
+    unlockMutex(&gThreadPool.mutex);
+  }
+}
+
+static void releaseJob(Job *job) {
+  if (__atomic_sub_fetch(&job->numDependencies, 1, __ATOMIC_ACQ_REL) == 0) {
+    pushJob(job);
+  }
+}
+
+static void finishJob(Job *job) {
+  // Copied first, since whoever waits on the job can free it once it's
+  // finished
+  Job *parent = job->parent;
+  int numContinuations = job->numContinuations;
+  Job *continuations[JOB_MAX_CONTINUATIONS];
+  for (int i = 0; i < numContinuations; ++i) {
+    continuations[i] = job->continuations[i];
+  }
+  if (__atomic_sub_fetch(&job->numUnfinished, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+
+  for (int i = 0; i < numContinuations; ++i) {
+    releaseJob(continuations[i]);
+  }
+  if (parent) {
+    finishJob(parent);
+  }
+}
+
+static void runJob(Job *job) {
+  __atomic_fetch_add(&gThreadPool.numJobs, 1, __ATOMIC_RELAXED);
+  job->func(job->data);
+  finishJob(job);
+}
+
+// Runs a job of the calling thread's queue, or one stolen from another
+// queue, and returns false when there was none
+static bool tryRunJob(int queueIndex) {
+  Job *job = popJobQueue(&gThreadPool.queues[queueIndex]);
+  if (!job) {
+    int numQueues = gThreadPool.numThreads +
+                    MIN(__atomic_load_n(&gThreadPool.numExternalThreads,
+                                        __ATOMIC_ACQUIRE),
+                        JOB_MAX_EXTERNAL_THREADS);
+    // xorshift32, so that thieves spread over the queues
+    tStealState ^= tStealState << 13;
+    tStealState ^= tStealState >> 17;
+    tStealState ^= tStealState << 5;
+    int first = (int)(tStealState % (uint32_t)numQueues);
+    for (int i = 0; i < numQueues && !job; ++i) {
+      int victim = (first + i) % numQueues;
+      if (victim != queueIndex) {
+        job = stealJobQueue(&gThreadPool.queues[victim]);
+      }
+    }
+    if (!job) {
+      return false;
+    }
+    __atomic_fetch_add(&gThreadPool.numStolenJobs, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_sub(&gThreadPool.numQueuedJobs, 1, __ATOMIC_SEQ_CST);
+  runJob(job);
+  return true;
+}
+
+static THREAD_FUNC_RETURN threadPoolWorker(void *param) {
+  tQueueIndex = (int)(intptr_t)param;
+  tQueueInitCount = gThreadPool.initCount;
+  tStealState = 0x9E3779B9u * (uint32_t)(tQueueIndex + 1);
+  char name[PROFILER_MAX_THREAD_NAME];
+  snprintf(name, sizeof(name), "Worker %d", tQueueIndex);
+  setProfileThreadName(name);
+  while (!__atomic_load_n(&gThreadPool.quit, __ATOMIC_ACQUIRE)) {
+    if (tryRunJob(tQueueIndex)) {
+      continue;
+    }
+
+    // Pushes check for sleepers after queuing, so either they see this one
+    // or it sees their job
+    lockMutex(&gThreadPool.mutex);
+    __atomic_fetch_add(&gThreadPool.numSleepingThreads, 1, __ATOMIC_SEQ_CST);
+    while (!gThreadPool.quit &&
+           __atomic_load_n(&gThreadPool.numQueuedJobs, __ATOMIC_SEQ_CST) == 0) {
+      waitCondVar(&gThreadPool.wakeCondVar, &gThreadPool.mutex);
+    }
+    __atomic_fetch_sub(&gThreadPool.numSleepingThreads, 1, __ATOMIC_SEQ_CST);
+    unlockMutex(&gThreadPool.mutex);
+  }
+  return 0;
+}
+
+void initThreadPool(int numThreads) {
+  ASSERT(!gThreadPool.queues);
+  if (numThreads < 0) {
+    numThreads = getNumCpuCores() - 1;
+  }
+  numThreads = MIN(numThreads, THREAD_POOL_MAX_THREADS);
+
+  initMutex(&gThreadPool.mutex);
+  initCondVar(&gThreadPool.wakeCondVar);
+  gThreadPool.queues =
+      MMALLOC_ARRAY_ZEROES(JobQueue, numThreads + JOB_MAX_EXTERNAL_THREADS);
+  gThreadPool.numExternalThreads = 0;
+  gThreadPool.numQueuedJobs = 0;
+  gThreadPool.numSleepingThreads = 0;
+  gThreadPool.quit = false;
+  gThreadPool.numJobs = 0;
+  gThreadPool.numStolenJobs = 0;
+  gThreadPool.numThreads = numThreads;
+  ++gThreadPool.initCount;
+
+  for (int i = 0; i < numThreads; ++i) {
+    void *param = (void *)(intptr_t)i;
+#ifdef _WIN32
+    gThreadPool.threads[i] =
+        CreateThread(NULL, 0, threadPoolWorker, param, 0, NULL);
+    ASSERT(gThreadPool.threads[i]);
+#else
+    int result = pthread_create(&gThreadPool.threads[i], NULL,
+                                threadPoolWorker, param);
+    ASSERT(result == 0);
+#endif
+  }
+
+  LOG("Thread pool: %d worker threads", numThreads);
+}
+
+void destroyThreadPool(void) {
+  lockMutex(&gThreadPool.mutex);
+  __atomic_store_n(&gThreadPool.quit, true, __ATOMIC_RELEASE);
+  wakeAllCondVar(&gThreadPool.wakeCondVar);
+  unlockMutex(&gThreadPool.mutex);
+
+  for (int i = 0; i < gThreadPool.numThreads; ++i) {
+#ifdef _WIN32
+    WaitForSingleObject(gThreadPool.threads[i], INFINITE);
+    CloseHandle(gThreadPool.threads[i]);
+#else
+    pthread_join(gThreadPool.threads[i], NULL);
+#endif
+  }
+  ASSERT(gThreadPool.numQueuedJobs == 0);
+  LOG("Thread pool: %d jobs run, %d of them stolen", gThreadPool.numJobs,
+      gThreadPool.numStolenJobs);
+
+  MFREE(gThreadPool.queues);
+  gThreadPool.queues = NULL;
+  destroyCondVar(&gThreadPool.wakeCondVar);
+  destroyMutex(&gThreadPool.mutex);
+  gThreadPool.numThreads = 0;
+}
+
+int getNumThreadPoolThreads(void) { return gThreadPool.numThreads; }
+
+void initJob(Job *job, JobFunc func, void *data, Job *parent) {
+  ASSERT(func);
+  *job = (Job){
+      .func = func,
+      .data = data,
+      .parent = parent,
+      .numUnfinished = 1,
+      .numDependencies = 1,
+  };
+  if (parent) {
+    ASSERT(__atomic_load_n(&parent->numUnfinished, __ATOMIC_RELAXED) > 0);
+    __atomic_fetch_add(&parent->numUnfinished, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void addJobDependency(Job *job, Job *dependency) {
+  ASSERT(dependency->numContinuations < JOB_MAX_CONTINUATIONS);
+  dependency->continuations[dependency->numContinuations++] = job;
+  ++job->numDependencies;
+}
+
+void submitJob(Job *job) {
+  ASSERT(gThreadPool.queues);
+  releaseJob(job);
+}
+
+void waitForJob(Job *job) {
+  int queueIndex = getQueueIndex();
+  while (__atomic_load_n(&job->numUnfinished, __ATOMIC_ACQUIRE) > 0) {
+    if (!tryRunJob(queueIndex)) {
+      yieldThread();
+    }
+  }
+}
+
+typedef struct _ParallelFor {
+  ParallelForFunc func;
+  void *data;
+  int grainSize;
+  // Ranges split off so far, one per chunk at most
+  struct _ParallelForRange *ranges;
+  int numRanges;
+} ParallelFor;
+
+typedef struct _ParallelForRange {
+  Job job;
+  ParallelFor *parallelFor;
+  int begin;
+  int end;
+} ParallelForRange;
+
+// Pushes the upper half of the range for other threads to steal until one
+// chunk is left, then runs that
+static void runParallelForRange(void *data) {
+  ParallelForRange *range = data;
+  ParallelFor *pf = range->parallelFor;
+  int begin = range->begin;
+  int end = range->end;
+  while (end - begin > pf->grainSize) {
+    int numChunks = (end - begin + pf->grainSize - 1) / pf->grainSize;
+    int middle = begin + (numChunks / 2) * pf->grainSize;
+    int index = __atomic_fetch_add(&pf->numRanges, 1, __ATOMIC_RELAXED);
+    ParallelForRange *upper = &pf->ranges[index];
+    upper->parallelFor = pf;
+    upper->begin = middle;
+    upper->end = end;
+    initJob(&upper->job, runParallelForRange, upper, &range->job);
+    submitJob(&upper->job);
+    end = middle;
+  }
+  PROFILE_SCOPE("parallelFor");
+  pf->func(pf->data, begin, end);
+}
+
+void parallelFor(int count, int grainSize, ParallelForFunc func, void *data) {
+  if (grainSize <= 0) {
+    int numChunks =
+        PARALLEL_FOR_CHUNKS_PER_THREAD * (gThreadPool.numThreads + 1);
+    grainSize = (count + numChunks - 1) / numChunks;
+  }
+  grainSize = MAX(grainSize, 1);
+  if (gThreadPool.numThreads == 0 || count <= grainSize) {
+    if (count > 0) {
+      func(data, 0, count);
+    }
+    return;
+  }
+
+  ParallelFor pf = {
+      .func = func,
+      .data = data,
+      .grainSize = grainSize,
+      .ranges = MMALLOC_ARRAY(ParallelForRange,
+                              (count + grainSize - 1) / grainSize),
+      .numRanges = 1,
+  };
+  ParallelForRange *root = &pf.ranges[0];
+  root->parallelFor = &pf;
+  root->begin = 0;
+  root->end = count;
+  initJob(&root->job, runParallelForRange, root, NULL);
+  submitJob(&root->job);
+  waitForJob(&root->job);
+  MFREE(pf.ranges);
+}
+
+// Iterations of dependent float math per item, around a microsecond of work
+static void runScalingItems(void *data, int begin, int end) {
+  float *results = (float *)data;
+  for (int i = begin; i < end; ++i) {
+    float x = (float)i;
+    for (int k = 0; k < THREAD_SCALING_ITEM_STEPS; ++k) {
+      x = x * 0.999f + 1.f / (x + 1.f);
+    }
+    results[i] = x;
+  }
+}
+
+// Fastest of a few runs, in milliseconds
+static double timeScalingWorkload(float *results, int grainSize) {
+  double bestTime = 0;
+  for (int run = 0; run < THREAD_SCALING_RUNS; ++run) {
+    double startTime = getTime();
+    parallelFor(THREAD_SCALING_ITEMS, grainSize, runScalingItems, results);
+    double time = (getTime() - startTime) * 1000.0;
+    bestTime = run == 0 ? time : MIN(bestTime, time);
+  }
+  return bestTime;
+}
+
+void logThreadPoolScaling(int maxThreads) {
+  ASSERT(!gThreadPool.queues);
+  maxThreads = MAX(MIN(maxThreads, THREAD_POOL_MAX_THREADS + 1), 1);
+  float *results = MMALLOC_ARRAY(float, THREAD_SCALING_ITEMS);
+  double coarseTimes[THREAD_POOL_MAX_THREADS + 1];
+  double fineTimes[THREAD_POOL_MAX_THREADS + 1];
+  for (int numThreads = 1; numThreads <= maxThreads; ++numThreads) {
+    initThreadPool(numThreads - 1);
+    // Warms up the queues and the workers before timing
+    parallelFor(THREAD_SCALING_ITEMS, 0, runScalingItems, results);
+    coarseTimes[numThreads - 1] = timeScalingWorkload(results, 0);
+    fineTimes[numThreads - 1] =
+        timeScalingWorkload(results, THREAD_SCALING_FINE_GRAIN);
+    destroyThreadPool();
+  }
+  MFREE(results);
+
+  LOG("Thread pool scaling: %d items, fastest of %d runs, %d cores",
+      THREAD_SCALING_ITEMS, THREAD_SCALING_RUNS, getNumCpuCores());
+  LOG("  threads   coarse ms  speedup   fine ms  speedup");
+  for (int i = 0; i < maxThreads; ++i) {
+    LOG("  %7d %11.2f %7.2fx %9.2f %7.2fx", i + 1, coarseTimes[i],
+        coarseTimes[0] / coarseTimes[i], fineTimes[i],
+        fineTimes[0] / fineTimes[i]);
+  }
+}
+
+static THREAD_FUNC_RETURN threadMain(void *param) {
+  Thread *thread = (Thread *)param;
+  thread->func(thread->data);
+  return 0;
+}
+
+Thread *startThread(ThreadFunc func, void *data) {
+  Thread *thread = MMALLOC(Thread);
+  thread->func = func;
+  thread->data = data;
+#ifdef _WIN32
+  thread->handle = CreateThread(NULL, 0, threadMain, thread, 0, NULL);
+  ASSERT(thread->handle);
+#else
+  int result = pthread_create(&thread->handle, NULL, threadMain, thread);
+  ASSERT(result == 0);
+#endif
+  return thread;
+}
+
+void joinThread(Thread *thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#else
+  pthread_join(thread->handle, NULL);
+#endif
+  MFREE(thread);
+}
+
+void yieldThread(void) {
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
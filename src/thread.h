@@ -0,0 +1,79 @@
+#pragma once
+#include "util.h"
+
+C_INTERFACE_BEGIN
+
+// Jobs a thread can have queued before submitJob runs them inline
+#define JOB_QUEUE_CAPACITY 4096
+// Threads outside of the pool that can submit jobs, like the main and update
+// threads
+#define JOB_MAX_EXTERNAL_THREADS 8
+#define JOB_MAX_CONTINUATIONS 4
+// Chunks per thread parallelFor splits a range into for grainSize 0
+#define PARALLEL_FOR_CHUNKS_PER_THREAD 4
+
+int getNumCpuCores(void);
+
+// Persistent worker threads that run jobs. Each thread has a deque of jobs
+// it pushes to and pops from, and idle threads steal from the others. Threads
+// waiting on a job help running them, so numThreads is the number of extra
+// threads; pass -1 to use one per remaining core.
+void initThreadPool(int numThreads);
+void destroyThreadPool(void);
+int getNumThreadPoolThreads(void);
+
+typedef void (*JobFunc)(void *data);
+
+typedef struct _Job Job;
+struct _Job {
+  JobFunc func;
+  void *data;
+  // Finished along with its children
+  Job *parent;
+  // This job and its unfinished children, 0 once it's finished
+  int numUnfinished;
+  // Unfinished jobs it waits on to start, plus one until it's submitted
+  int numDependencies;
+  // Released once it's finished
+  int numContinuations;
+  Job *continuations[JOB_MAX_CONTINUATIONS];
+};
+
+// Jobs live in memory of the caller, which has to stay valid until waiting
+// on them or their parent returns. A parent has to be unfinished, like when
+// the children are created by the parent's func or before it's submitted.
+void initJob(Job *job, JobFunc func, void *data, Job *parent);
+// job starts once dependency is finished. Both have to be unsubmitted.
+void addJobDependency(Job *job, Job *dependency);
+// Queues the job on the calling thread, or runs it right away when the queue
+// is full. The pool has to be initialized.
+void submitJob(Job *job);
+// Runs queued jobs until job and its children are finished
+void waitForJob(Job *job);
+
+typedef void (*ParallelForFunc)(void *data, int begin, int end);
+
+// Calls func over [0, count) in chunks of at most grainSize and returns once
+// every chunk has run. The range is split in halves that idle threads steal,
+// down to grainSize, or a size picked for the number of threads when it's 0.
+// Runs inline when the pool has no threads or the range fits in one chunk.
+// Can be called from jobs, including the chunks of another parallelFor.
+void parallelFor(int count, int grainSize, ParallelForFunc func, void *data);
+
+// Times a synthetic parallelFor workload with pools of 1 to maxThreads
+// threads, the calling one included, and logs the speedup of each. Chunks
+// are coarse, a few per thread, and then a few items each to show the
+// overhead of the jobs. The pool has to be uninitialized.
+void logThreadPoolScaling(int maxThreads);
+
+typedef struct _Thread Thread;
+typedef void (*ThreadFunc)(void *data);
+
+// A thread of its own, outside of the pool, running func until it returns
+Thread *startThread(ThreadFunc func, void *data);
+// Waits for func to return and frees the thread
+void joinThread(Thread *thread);
+// Gives the rest of the time slice of the calling thread to another one
+void yieldThread(void);
+
+C_INTERFACE_END
@@ -0,0 +1,35 @@
+#include "triplebuffer.h"
+
+void initTripleBuffer(TripleBuffer *buffer) {
+  *buffer = (TripleBuffer){
+      .writeSlot = 0,
+      .readSlot = 1,
+      .middle = 2,
+  };
+}
+
+void publishTripleBuffer(TripleBuffer *buffer) {
+  // Release the writes to the slot, acquire those of the consumer to the one
+  // coming back
+  uint32_t middle =
+      __atomic_exchange_n(&buffer->middle,
+                          (uint32_t)buffer->writeSlot | TRIPLE_BUFFER_NEW_BIT,
+                          __ATOMIC_ACQ_REL);
+  buffer->writeSlot = (int)(middle & ~TRIPLE_BUFFER_NEW_BIT);
+}
+
+bool isTripleBufferPending(const TripleBuffer *buffer) {
+  return (__atomic_load_n(&buffer->middle, __ATOMIC_ACQUIRE) &
+          TRIPLE_BUFFER_NEW_BIT) != 0;
+}
+
+bool acquireTripleBuffer(TripleBuffer *buffer) {
+  if (!isTripleBufferPending(buffer)) {
+    return false;
+  }
+  // Only the consumer clears the bit, so the middle slot is still new here
+  uint32_t middle = __atomic_exchange_n(
+      &buffer->middle, (uint32_t)buffer->readSlot, __ATOMIC_ACQ_REL);
+  buffer->readSlot = (int)(middle & ~TRIPLE_BUFFER_NEW_BIT);
+  return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+// Slots 0 to 2 of something the caller stores, handed from one producer
+// thread to one consumer thread without locks. The producer fills its write
+// slot and publishes it, the consumer acquires the latest published slot as
+// its read slot. Neither side ever waits, a slot published before the
+// consumer got to it is dropped.
+typedef struct _TripleBuffer {
+  // Only touched by the producer and the consumer respectively
+  int writeSlot;
+  int readSlot;
+  // Slot in between, with TRIPLE_BUFFER_NEW_BIT set while it holds a
+  // publish the consumer hasn't acquired yet
+  uint32_t middle;
+} TripleBuffer;
+
+#define TRIPLE_BUFFER_NEW_BIT 4u
+
+void initTripleBuffer(TripleBuffer *buffer);
+
+// Producer side. The write slot is handed over, the producer gets the old
+// middle slot to fill next.
+void publishTripleBuffer(TripleBuffer *buffer);
+// Whether the last publish is still waiting for the consumer
+bool isTripleBufferPending(const TripleBuffer *buffer);
+
+// Consumer side. Returns false and keeps the read slot when nothing was
+// published since the last acquire.
+bool acquireTripleBuffer(TripleBuffer *buffer);
+
+C_INTERFACE_END
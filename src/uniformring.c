@@ -0,0 +1,99 @@
+#include "uniformring.h"
+#include <string.h>
+
+void initUniformRing(UniformRing *ring, void *mapped, int frameSize,
+                     int numFrames, int alignment) {
+  ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+  *ring = (UniformRing){
+      .mapped = (uint8_t *)mapped,
+      .frameSize = frameSize & ~(alignment - 1),
+      .numFrames = numFrames,
+      .alignment = alignment,
+  };
+}
+
+void advanceUniformRing(UniformRing *ring) {
+  ring->highWaterMark = MAX(ring->highWaterMark, ring->requested);
+  ring->frameIndex = (ring->frameIndex + 1) % ring->numFrames;
+  ring->frameOffset = ring->frameIndex * ring->frameSize;
+  ring->used = 0;
+  ring->requested = 0;
+}
+
+int allocateUniforms(UniformRing *ring, int size, void **outData) {
+  int alignedSize = (size + ring->alignment - 1) & ~(ring->alignment - 1);
+  ring->requested += alignedSize;
+  if (ring->used + alignedSize > ring->frameSize) {
+    return -1;
+  }
+
+  int offset = ring->frameOffset + ring->used;
+  ring->used += alignedSize;
+  if (outData) {
+    *outData = ring->mapped ? ring->mapped + offset : NULL;
+  }
+  return offset;
+}
+
+int pushUniforms(UniformRing *ring, const void *data, int size) {
+  void *dst;
+  int offset = allocateUniforms(ring, size, &dst);
+  if (offset >= 0 && dst) {
+    memcpy(dst, data, size);
+  }
+  return offset;
+}
+
+int getUniformRingGrowSize(const UniformRing *ring, int size) {
+  int frameSize = MAX(ring->frameSize, ring->alignment);
+  while (frameSize < size) {
+    frameSize *= 2;
+  }
+  return frameSize;
+}
+
+bool checkUniformRing(void) {
+  bool passed = true;
+  uint8_t memory[3 * 96];
+  UniformRing ring;
+  // Rounded down to 96 bytes per frame
+  initUniformRing(&ring, memory, 100, 3, 16);
+  CHECK(passed, ring.frameSize == 96);
+
+  void *data;
+  CHECK(passed, allocateUniforms(&ring, 1, &data) == 0 && data == memory);
+  CHECK(passed, allocateUniforms(&ring, 20, &data) == 16 &&
+                    data == memory + 16);
+  const uint8_t bytes[4] = {1, 2, 3, 4};
+  int offset = pushUniforms(&ring, bytes, sizeof(bytes));
+  CHECK(passed, offset == 48 && memcmp(memory + 48, bytes, 4) == 0);
+
+  // 64 more don't fit in the 32 left, but still count as asked for
+  CHECK(passed, allocateUniforms(&ring, 64, &data) == -1);
+  CHECK(passed, pushUniforms(&ring, bytes, sizeof(bytes)) == 64);
+  CHECK(passed, ring.used == 80 && ring.requested == 144);
+
+  advanceUniformRing(&ring);
+  CHECK(passed, ring.highWaterMark == 144 && ring.requested == 0);
+  CHECK(passed, allocateUniforms(&ring, 16, NULL) == 96);
+  advanceUniformRing(&ring);
+  CHECK(passed, allocateUniforms(&ring, 96, NULL) == 192);
+  CHECK(passed, allocateUniforms(&ring, 1, NULL) == -1);
+  advanceUniformRing(&ring);
+  CHECK(passed, ring.frameIndex == 0 && allocateUniforms(&ring, 1, NULL) == 0);
+  CHECK(passed, ring.highWaterMark == 144);
+
+  CHECK(passed, getUniformRingGrowSize(&ring, 0) == 96);
+  CHECK(passed, getUniformRingGrowSize(&ring, 96) == 96);
+  CHECK(passed, getUniformRingGrowSize(&ring, ring.highWaterMark) == 192);
+  CHECK(passed, getUniformRingGrowSize(&ring, 1000) == 1536);
+
+  // Without a mapping only offsets are handed out
+  initUniformRing(&ring, NULL, 64, 2, 16);
+  data = memory;
+  CHECK(passed, allocateUniforms(&ring, 8, &data) == 0 && data == NULL);
+  CHECK(passed, pushUniforms(&ring, bytes, sizeof(bytes)) == 16);
+
+  LOG("Uniform ring: checks %s", passed ? "passed" : "failed");
+  return passed;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+C_INTERFACE_BEGIN
+
+// Linear allocator over a buffer split into numFrames equal regions, one per
+// frame in flight. The backend owns the buffer and the fences; the ring only
+// hands out aligned offsets inside the region of the current frame, so it
+// can run against plain CPU memory as well.
+typedef struct _UniformRing {
+  uint8_t *mapped;
+  int frameSize;
+  int numFrames;
+  int alignment;
+
+  int frameIndex;
+  int frameOffset;
+  int used;
+  // Asked for by the current frame, including allocations that didn't fit
+  int requested;
+  // Largest amount asked for by a single frame so far
+  int highWaterMark;
+} UniformRing;
+
+// frameSize is rounded down to a multiple of alignment. mapped may be NULL
+// while the buffer is not mapped, in which case only offsets are handed out.
+void initUniformRing(UniformRing *ring, void *mapped, int frameSize,
+                     int numFrames, int alignment);
+
+// Moves to the next region. The caller must have waited for the GPU to be
+// done with it.
+void advanceUniformRing(UniformRing *ring);
+
+// Returns the offset from the start of the buffer, or -1 when the frame
+// region is full. *outData points at the allocation when mapped is set.
+int allocateUniforms(UniformRing *ring, int size, void **outData);
+// allocateUniforms followed by a copy of size bytes from data
+int pushUniforms(UniformRing *ring, const void *data, int size);
+
+// Frame size, doubled from the current one, that a frame asking for size
+// bytes fits in. The backend recreates its buffer between frames when it
+// differs from frameSize.
+int getUniformRingGrowSize(const UniformRing *ring, int size);
+
+// Runs the ring over a small CPU buffer: alignment, running out of a region,
+// the high water mark, wrapping around the regions and the grow size. Logs
+// every check that fails.
+bool checkUniformRing(void);
+
+C_INTERFACE_END
@@ -0,0 +1,125 @@
+#include "updatethread.h"
+#include "triplebuffer.h"
+#include "spscqueue.h"
+#include "thread.h"
+#include "profiler.h"
+
+static struct {
+  Thread *thread;
+  OnUpdate update;
+  OnBeginFrame beginFrame;
+  int numFrames;
+  float timeStep;
+
+  TripleBuffer slots;
+  UpdatedFrame frames[3];
+  SpscQueue events;
+} gUpdateThread;
+
+// Events can be pushed before the thread starts, like the resizes of a window
+// being shown
+static void initAppEvents(void) {
+  if (!gUpdateThread.events.elements) {
+    initSpscQueue(&gUpdateThread.events, sizeof(AppEvent),
+                  UPDATE_THREAD_EVENT_CAPACITY);
+  }
+}
+
+// Returns true once AppEventType_Quit is received
+static bool handleAppEvents(void) {
+  App *app = getApp();
+  AppEvent event;
+  while (popSpscQueue(&gUpdateThread.events, &event)) {
+    switch (event.type) {
+    case AppEventType_Resize:
+      app->width = event.width;
+      app->height = event.height;
+      break;
+    case AppEventType_Quit:
+      return true;
+    }
+  }
+  return false;
+}
+
+static void runUpdateThread(UNUSED void *data) {
+  setProfileThreadName("Update");
+  double prevTime = getTime();
+  for (int frame = 0;
+       gUpdateThread.numFrames == 0 || frame < gUpdateThread.numFrames;
+       ++frame) {
+    // The previous frame has to be picked up first. Events are handled after
+    // seeing that, so those pushed before picking it up apply to this frame.
+    bool quit;
+    for (;;) {
+      bool pending = isTripleBufferPending(&gUpdateThread.slots);
+      quit = handleAppEvents();
+      if (quit || !pending) {
+        break;
+      }
+      yieldThread();
+    }
+    if (quit) {
+      break;
+    }
+
+    double time = getTime();
+    float dt = gUpdateThread.timeStep;
+    if (dt <= 0) {
+      dt = MIN((float)(time - prevTime), 1 / 60.f);
+    }
+    prevTime = time;
+
+    int slot = gUpdateThread.slots.writeSlot;
+    UpdatedFrame *updated = &gUpdateThread.frames[slot];
+    gUpdateThread.beginFrame(slot);
+    gUpdateThread.update(dt);
+    updated->slot = slot;
+    updated->dt = dt;
+    copyString(&updated->title, &getApp()->title);
+    publishTripleBuffer(&gUpdateThread.slots);
+  }
+}
+
+void startUpdateThread(OnUpdate update, OnBeginFrame beginFrame,
+                       int numFrames, float timeStep) {
+  ASSERT(!gUpdateThread.thread && update && beginFrame && numFrames >= 0);
+  gUpdateThread.update = update;
+  gUpdateThread.beginFrame = beginFrame;
+  gUpdateThread.numFrames = numFrames;
+  gUpdateThread.timeStep = timeStep;
+  initTripleBuffer(&gUpdateThread.slots);
+  initAppEvents();
+  gUpdateThread.thread = startThread(runUpdateThread, NULL);
+}
+
+void stopUpdateThread(void) {
+  // The update thread keeps draining the queue, so it frees up
+  AppEvent quit = {.type = AppEventType_Quit};
+  while (!pushSpscQueue(&gUpdateThread.events, &quit)) {
+    yieldThread();
+  }
+  joinThread(gUpdateThread.thread);
+  gUpdateThread.thread = NULL;
+
+  for (int i = 0; i < 3; ++i) {
+    destroyString(&gUpdateThread.frames[i].title);
+  }
+  destroySpscQueue(&gUpdateThread.events);
+}
+
+bool pushAppEvent(const AppEvent *event) {
+  initAppEvents();
+  if (!pushSpscQueue(&gUpdateThread.events, event)) {
+    LOG("App event queue is full, dropping event %d", event->type);
+    return false;
+  }
+  return true;
+}
+
+const UpdatedFrame *acquireUpdatedFrame(void) {
+  if (!acquireTripleBuffer(&gUpdateThread.slots)) {
+    return NULL;
+  }
+  return &gUpdateThread.frames[gUpdateThread.slots.readSlot];
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "app.h"
+#include <stdbool.h>
+
+C_INTERFACE_BEGIN
+
+#define UPDATE_THREAD_EVENT_CAPACITY 64
+
+typedef void (*OnBeginFrame)(int slot);
+
+// What one update left for the render thread
+typedef struct _UpdatedFrame {
+  // Slot 0 to 2 of the triple buffer, which the renderer recorded the frame
+  // into
+  int slot;
+  float dt;
+  // Copy of App.title as update left it
+  String title;
+} UpdatedFrame;
+
+// Runs update on a thread of its own, so that the next frame is updated while
+// the calling thread renders the current one. beginFrame is called with the
+// slot of each frame before update records into it, and the update thread
+// stays at most one published frame ahead of acquireUpdatedFrame, so none
+// are dropped. With numFrames 0 it runs until AppEventType_Quit, with
+// timeStep 0 dt is measured on the clock. The update thread owns App.width,
+// App.height and App.title until it stops.
+void startUpdateThread(OnUpdate update, OnBeginFrame beginFrame,
+                       int numFrames, float timeStep);
+// Sends AppEventType_Quit and waits for the thread
+void stopUpdateThread(void);
+
+// Render thread side. Events are handled before the next update starts.
+// Returns false when the queue is full and the event is dropped.
+bool pushAppEvent(const AppEvent *event);
+// Latest frame published by the update thread, or null when there's no new
+// one since the last call
+const UpdatedFrame *acquireUpdatedFrame(void);
+
+C_INTERFACE_END
@@ -28,10 +28,24 @@
 #define LOG(...)
 #endif
 
+// For the --self-check run, clears passed and logs the condition when it
+// doesn't hold, also in builds without asserts
+#define CHECK(passed, condition)                                               \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      LOG("%s:%d: check failed: %s", __FILE__, __LINE__, #condition);         \
+      (passed) = false;                                                        \
+    }                                                                          \
+  } while (0)
+
 #ifndef MAX
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #endif
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 #define ARRAY_COUNT(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #define UNUSED __attribute__((unused))
\ No newline at end of file
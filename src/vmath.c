@@ -69,6 +69,11 @@ float float4Dot(const Float4 a, const Float4 b) {
   return result;
 }
 
+Float4 float4Select(const Int4 mask, const Float4 a, const Float4 b) {
+  Float4 result = (Float4)((mask & (Int4)a) | (~mask & (Int4)b));
+  return result;
+}
+
 Float4 mat4Row(const Mat4 mat, int n) {
   Float4 row = {mat.cols[0][n], mat.cols[1][n], mat.cols[2][n], mat.cols[3][n]};
   return row;
@@ -92,6 +97,12 @@ Mat4 mat4Multiply(const Mat4 a, const Mat4 b) {
   return result;
 }
 
+Float4 mat4MultiplyFloat4(const Mat4 m, const Float4 v) {
+  Float4 result =
+      m.cols[0] * v.x + m.cols[1] * v.y + m.cols[2] * v.z + m.cols[3] * v.w;
+  return result;
+}
+
 Mat4 mat4Adjugate(Mat4 m) {
   Mat4 adjugate = {{{m.cols[1].y * m.cols[2].z * m.cols[3].w +
                          m.cols[3].y * m.cols[1].z * m.cols[2].w +
@@ -313,7 +324,7 @@ Mat4 mat4LookAt(const Float3 eye, const Float3 target, const Float3 upAxis) {
 Mat4 mat4Perspective(float fov, float aspectRatio, float nearZ, float farZ) {
   float yScale = 1.f / tanf(fov * 0.5f);
   float xScale = yScale / aspectRatio;
-#ifdef RENDERER_GL33
+#if defined(RENDERER_GL33) || defined(RENDERER_NULL) || defined(RENDERER_SOFT)
   float zRange = 1.f / (farZ - nearZ);
   float zScale = (farZ + nearZ) * zRange;
   float wzScale = 2.f * farZ * nearZ * zRange;
@@ -357,4 +368,61 @@ Float4 quatRotateAroundAxis(Float3 axis, float angleRad) {
   return quat;
 }
 
+static Float4 normalizePlane(Float4 plane) {
+  float len = float3Length(plane.xyz);
+  if (len > 0) {
+    plane /= len;
+  }
+  return plane;
+}
+
+Frustum frustumFromMatrix(const Mat4 m) {
+  Float4 rows[4] = {
+      mat4Row(m, 0),
+      mat4Row(m, 1),
+      mat4Row(m, 2),
+      mat4Row(m, 3),
+  };
+
+  // The near/far pair covers both the [-w, w] and [0, w] clip depth ranges,
+  // which keeps the planes conservative for every backend.
+  Frustum frustum = {{
+      normalizePlane(rows[3] + rows[0]),
+      normalizePlane(rows[3] - rows[0]),
+      normalizePlane(rows[3] + rows[1]),
+      normalizePlane(rows[3] - rows[1]),
+      normalizePlane(rows[3] + rows[2]),
+      normalizePlane(rows[3] - rows[2]),
+  }};
+
+  return frustum;
+}
+
+bool frustumIntersectsSphere(const Frustum *frustum, Float3 center,
+                             float radius) {
+  for (int i = 0; i < 6; ++i) {
+    Float4 plane = frustum->planes[i];
+    if (float3Dot(plane.xyz, center) + plane.w < -radius) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool frustumIntersectsAABB(const Frustum *frustum, Float3 aabbMin,
+                           Float3 aabbMax) {
+  for (int i = 0; i < 6; ++i) {
+    Float4 plane = frustum->planes[i];
+    Float3 positive = {
+        plane.x >= 0 ? aabbMax.x : aabbMin.x,
+        plane.y >= 0 ? aabbMax.y : aabbMin.y,
+        plane.z >= 0 ? aabbMax.z : aabbMin.z,
+    };
+    if (float3Dot(plane.xyz, positive) + plane.w < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
 C_INTERFACE_END
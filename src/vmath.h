@@ -1,6 +1,8 @@
 #ifndef vmath_h
 #define vmath_h
 #include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 #define MATH_PI 3.141592f
 
@@ -12,6 +14,8 @@ float radToDeg(float rad);
 typedef float Float2 __attribute__((ext_vector_type(2)));
 typedef float Float3 __attribute__((ext_vector_type(3)));
 typedef float Float4 __attribute__((ext_vector_type(4)));
+// Lane masks of Float4 comparisons, all bits set where they hold
+typedef int32_t Int4 __attribute__((ext_vector_type(4)));
 
 float float2Dot(const Float2 a, const Float2 b);
 
@@ -23,6 +27,8 @@ Float3 float3Normalize(const Float3 v);
 Float3 sphericalToCartesian(float r, float theta, float phi);
 
 float float4Dot(const Float4 a, const Float4 b);
+// a in the lanes where mask is set, b elsewhere
+Float4 float4Select(const Int4 mask, const Float4 a, const Float4 b);
 
 typedef struct _Mat4 {
   Float4 cols[4];
@@ -30,6 +36,7 @@ typedef struct _Mat4 {
 
 Float4 mat4Row(const Mat4 mat, int n);
 Mat4 mat4Multiply(const Mat4 a, const Mat4 b);
+Float4 mat4MultiplyFloat4(const Mat4 m, const Float4 v);
 Mat4 mat4Inverse(Mat4 m);
 Mat4 mat4Transpose(Mat4 m);
 Mat4 mat4Identity(void);
@@ -42,6 +49,17 @@ Mat4 mat4Perspective(float fov, float aspectRatio, float nearZ, float farZ);
 Mat4 quatToMat4(Float4 q);
 Float4 quatRotateAroundAxis(Float3 axis, float angleRad);
 
+// Planes are stored as (normal, distance) and point inwards
+typedef struct _Frustum {
+  Float4 planes[6];
+} Frustum;
+
+Frustum frustumFromMatrix(const Mat4 m);
+bool frustumIntersectsSphere(const Frustum *frustum, Float3 center,
+                             float radius);
+bool frustumIntersectsAABB(const Frustum *frustum, Float3 aabbMin,
+                           Float3 aabbMax);
+
 C_INTERFACE_END
 
 #endif /* vmath_h */